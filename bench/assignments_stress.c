@@ -0,0 +1,287 @@
+/**
+ * @file assignments_stress.c
+ * @brief Consistency of the shared assignment table under concurrent publications
+ *
+ * A writer publishes a flow table of --flows flows as fast as it can (or every --period-us), the way the
+ * daemon does each cycle, while --readers threads map the file on their own and look random flows up. The
+ * flow table at each cycle is a function of the cycle: which flows are in it, the core of each flow (so which
+ * ones migrated since the previous cycle) and the target load of each core. Every read is checked against
+ * the cycle it returned; a read mixing two publications is reported as inconsistent.
+ *
+ * Reports the publications per second, the lookups per second and their mean time, the reads retried
+ * because a publication overlapped them and the inconsistent reads. Exits with status 1 if there are any.
+ *
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "bench.h"
+#include "assignments.h"
+
+#define STRESS_CORES 8
+
+struct StressState {
+    const char *path;
+    int nb_flows;
+    atomic_int running;
+};
+
+struct StressReader {
+    pthread_t thread;
+    struct StressState *state;
+    uint32_t seed;
+    uint64_t lookups;
+    uint64_t pending_reads;
+    uint64_t core_reads;
+    uint64_t retries;
+    uint64_t busy;
+    uint64_t inconsistent;
+    uint64_t elapsed_ns;
+};
+
+struct FiveTuple stress_key(uint32_t i){
+    struct FiveTuple key = {0};
+    key.src_ip = 0x0A000000 | (i >> 16);
+    key.dst_ip = 0x0A010001;
+    key.src_port = i & 0xFFFF;
+    key.dst_port = 443;
+    key.proto = 6;
+    return key;
+}
+
+/*
+    The flow table at each cycle: a fifth of the flows leave it every 4 cycles, the cores are shuffled
+    every 2 cycles
+*/
+uint8_t stress_present(uint32_t flow, uint64_t cycle){
+    return (flow + cycle / 4) % 5 != 0;
+}
+
+uint8_t stress_core(uint32_t flow, uint64_t cycle){
+    return ((flow + (cycle / 2) * 7919) * 2654435761u >> 16) % STRESS_CORES;
+}
+
+uint64_t stress_load(int core, uint64_t cycle){
+    return cycle * 1000 + core;
+}
+
+/*
+    Whether the flow was published at `cycle` by a migration: it stayed in the table and changed core
+*/
+uint8_t stress_pending(uint32_t flow, uint64_t cycle){
+    return cycle > 1 && stress_present(flow, cycle) && stress_present(flow, cycle - 1) &&
+        stress_core(flow, cycle) != stress_core(flow, cycle - 1);
+}
+
+uint8_t stress_check_lookup(uint32_t flow, int found, struct Assignment *assignment){
+    uint64_t cycle = assignment->cycle;
+    if (cycle == 0){
+        // Nothing published yet
+        return !found;
+    }
+    if (found != stress_present(flow, cycle)){
+        return 0;
+    }
+    if (!found){
+        return 1;
+    }
+    if (assignment->core != stress_core(flow, cycle) || assignment->pending != stress_pending(flow, cycle)){
+        return 0;
+    }
+    return !assignment->pending || (assignment->previous_core == stress_core(flow, cycle - 1) && assignment->migration_cycle == cycle);
+}
+
+uint8_t stress_check_pending(struct AssignmentMigration *migrations, int nb_migrations, uint64_t cycle, int nb_flows){
+    int expected = 0;
+    for (uint32_t flow = 0; flow < (uint32_t)nb_flows && cycle; flow++){
+        expected += stress_pending(flow, cycle);
+    }
+    if (nb_migrations != expected){
+        return 0;
+    }
+    for (int i = 0; i < nb_migrations; i++){
+        uint32_t flow = (migrations[i].key.src_ip & 0xFFFF) << 16 | migrations[i].key.src_port;
+        if (!stress_pending(flow, cycle) || migrations[i].source_core != stress_core(flow, cycle - 1) ||
+            migrations[i].destination_core != stress_core(flow, cycle)){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+uint8_t stress_check_cores(struct AssignmentCores *cores){
+    if (cores->nb_cores != STRESS_CORES){
+        return 0;
+    }
+    for (int core = 0; core < STRESS_CORES && cores->cycle; core++){
+        if (cores->target_load[core] != stress_load(core, cores->cycle) || cores->active[core] != (core <= (int)(cores->cycle % STRESS_CORES))){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void *stress_read(void *arg){
+    struct StressReader *stress = arg;
+    struct StressState *state = stress->state;
+    struct AssignmentReader reader;
+    if (assignments_attach(&reader, state->path)){
+        stress->inconsistent++;
+        return NULL;
+    }
+    struct AssignmentMigration *migrations = calloc(state->nb_flows, sizeof(struct AssignmentMigration));
+    uint64_t batches = 0;
+    uint64_t start = bench_now_ns();
+    while (atomic_load_explicit(&state->running, memory_order_relaxed)){
+        // Mostly lookups, like a dispatcher, the migrations and loads every 16k lookups
+        for (int i = 0; i < 1024; i++){
+            uint32_t flow = (stress->seed = stress->seed * 1103515245 + 12345) % state->nb_flows;
+            struct FiveTuple key = stress_key(flow);
+            struct Assignment assignment;
+            int found = assignments_lookup(&reader, &key, &assignment);
+            if (found < 0){
+                stress->busy++;
+                continue;
+            }
+            stress->lookups++;
+            stress->inconsistent += !stress_check_lookup(flow, found, &assignment);
+        }
+        if (++batches % 16){
+            continue;
+        }
+        uint64_t cycle;
+        int nb_migrations = assignments_pending(&reader, migrations, state->nb_flows, &cycle);
+        if (nb_migrations >= 0){
+            stress->pending_reads++;
+            stress->inconsistent += !stress_check_pending(migrations, nb_migrations, cycle, state->nb_flows);
+        }
+        struct AssignmentCores cores;
+        if (!assignments_cores(&reader, &cores)){
+            stress->core_reads++;
+            stress->inconsistent += !stress_check_cores(&cores);
+        }
+    }
+    stress->elapsed_ns = bench_now_ns() - start;
+    stress->retries = reader.retries;
+    free(migrations);
+    assignments_detach(&reader);
+    return NULL;
+}
+
+/*
+    Brings the flow table to its state at `cycle`
+*/
+void stress_update(struct HashMap *map, int nb_flows, uint64_t cycle){
+    for (uint32_t flow = 0; flow < (uint32_t)nb_flows; flow++){
+        struct FiveTuple key = stress_key(flow);
+        struct RingBuffer *ring_buffer = hashmap_get(map, &key);
+        if (!stress_present(flow, cycle)){
+            if (ring_buffer){
+                hashmap_remove(map, &key);
+            }
+            continue;
+        }
+        if (!ring_buffer){
+            ring_buffer = hashmap_new(map, &key);
+        }
+        ring_buffer->assigned_core = stress_core(flow, cycle);
+    }
+}
+
+void usage(const char *prog){
+    fprintf(stderr, "Usage: %s [options]\n"
+        "  --readers N           reader threads (default 4)\n"
+        "  --flows N             flows of the table (default 65536)\n"
+        "  --seconds S           duration (default 5)\n"
+        "  --period-us US        time between two publications, 0 to publish back to back (default 0)\n"
+        "  --path FILE           assignment table (default /tmp/orss-assignments-stress)\n",
+        prog);
+}
+
+int main(int argc, char *argv[]){
+    struct StressState state = {.path = "/tmp/orss-assignments-stress", .nb_flows = 65536, .running = 1};
+    int nb_readers = 4;
+    double seconds = 5;
+    int period_us = 0;
+    static struct option options[] = {
+        {"readers", required_argument, 0, 'r'},
+        {"flows", required_argument, 0, 'f'},
+        {"seconds", required_argument, 0, 's'},
+        {"period-us", required_argument, 0, 'p'},
+        {"path", required_argument, 0, 'P'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1){
+        switch (opt){
+        case 'r': nb_readers = atoi(optarg); break;
+        case 'f': state.nb_flows = atoi(optarg); break;
+        case 's': seconds = atof(optarg); break;
+        case 'p': period_us = atoi(optarg); break;
+        case 'P': state.path = optarg; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (nb_readers < 1 || state.nb_flows < 1){
+        usage(argv[0]);
+        return 1;
+    }
+    struct HashMap *map = hashmap_init(state.nb_flows, 1);
+    struct AssignmentTable table;
+    if (assignments_open(&table, state.path, state.nb_flows, STRESS_CORES)){
+        return 1;
+    }
+    struct StressReader *readers = calloc(nb_readers, sizeof(struct StressReader));
+    for (int i = 0; i < nb_readers; i++){
+        readers[i].state = &state;
+        readers[i].seed = i + 1;
+        pthread_create(&readers[i].thread, NULL, stress_read, &readers[i]);
+    }
+    uint64_t start = bench_now_ns();
+    uint64_t end = start + seconds * 1e9;
+    uint64_t cycle = 0;
+    uint64_t publish_ns = 0;
+    while (bench_now_ns() < end){
+        cycle++;
+        stress_update(map, state.nb_flows, cycle);
+        uint64_t target_load[STRESS_CORES];
+        uint8_t active[STRESS_CORES];
+        for (int core = 0; core < STRESS_CORES; core++){
+            target_load[core] = stress_load(core, cycle);
+            active[core] = core <= (int)(cycle % STRESS_CORES);
+        }
+        uint64_t publish_start = bench_now_ns();
+        assignments_publish(&table, map, target_load, active, publish_start);
+        publish_ns += bench_now_ns() - publish_start;
+        if (period_us){
+            usleep(period_us);
+        }
+    }
+    atomic_store(&state.running, 0);
+    uint64_t elapsed_ns = bench_now_ns() - start;
+    uint64_t lookups = 0, lookup_ns = 0, pending_reads = 0, core_reads = 0, retries = 0, busy = 0, inconsistent = 0;
+    for (int i = 0; i < nb_readers; i++){
+        pthread_join(readers[i].thread, NULL);
+        lookups += readers[i].lookups;
+        lookup_ns += readers[i].elapsed_ns;
+        pending_reads += readers[i].pending_reads;
+        core_reads += readers[i].core_reads;
+        retries += readers[i].retries;
+        busy += readers[i].busy;
+        inconsistent += readers[i].inconsistent;
+    }
+    printf("Assignment table: %d flows, %d readers, %.1f s\n", state.nb_flows, nb_readers, elapsed_ns / 1e9);
+    printf("  publications: %lu, %.0f/s, %.1f us each\n", cycle, cycle * 1e9 / elapsed_ns, publish_ns / 1e3 / cycle);
+    printf("  lookups: %lu, %.0f/s per reader, %.0f ns each (checks included)\n", lookups,
+        lookups * 1e9 / lookup_ns, lookups ? (double)lookup_ns / lookups : 0);
+    printf("  migration lists read: %lu, core loads read: %lu\n", pending_reads, core_reads);
+    printf("  reads retried: %lu, busy: %lu\n", retries, busy);
+    printf("  inconsistent reads: %lu\n", inconsistent);
+    free(readers);
+    assignments_close(&table);
+    hashmap_destroy(map);
+    return inconsistent ? 1 : 0;
+}
@@ -0,0 +1,341 @@
+/**
+ * @file balancer_sim.c
+ * @brief Offline balancer simulator replaying per-flow rate traces
+ *
+ * Every cycle, the flows of the trace are reported to the flow table like OVS flow stats would be:
+ * cumulative packet counters, for as long as the flow sent a packet less than `--idle-cycles` ago.
+ * The balancer then runs and its migrations are applied immediately. The load of each core is
+ * computed from the packets of the cycle and the assignment decided at the previous cycles, and
+ * compared to its share of the total load (`--core-capacity`).
+ * With `--consolidation`, the balancer packs the flows onto the fewest cores staying under the ceiling: the
+ * shares are then those of the active cores, and the simulator reports the active cores over time and the
+ * cycles where a core went over the ceiling.
+ *
+ * Thresholds (`--max-imbalance`, `--max-migrations`, `--max-flow-moves`, `--max-cpu-us`) make the simulator
+ * exit with status 2 when they are exceeded, so CI can catch regressions of the balancer.
+ *
+ */
+
+#include <getopt.h>
+#include "bench.h"
+#include "trace.h"
+#include "balancer.h"
+
+struct SimFlow {
+    uint64_t packet_count; /** Cumulative, as reported by the switch */
+    int first_active; /** First cycle the flow sent packets, its rule was created then */
+    int last_active; /** Last cycle the flow sent packets, -1 if never */
+    int moves; /** Migrations of the flow */
+    uint8_t tracked; /** Entered the flow table at least once */
+};
+
+struct SimCycle {
+    double imbalance; /** Most loaded core / average core load, 0 if there was no packet */
+    int migrations;
+    int table_size;
+    uint64_t balance_cpu_ns;
+    uint64_t update_cpu_ns;
+    int active_cores; /** Cores active during the cycle, decided by the previous balancing */
+    double peak_load; /** Packets per second of the most loaded core */
+};
+
+struct SimOptions {
+    uint64_t cycle_ns;
+    int nb_cores;
+    int idle_cycles;
+    const char *csv_path;
+    int verbose;
+    double max_imbalance;
+    long max_migrations;
+    int max_flow_moves;
+    double max_cpu_us;
+    double core_capacity[MAX_CORES];
+    double consolidation_ceiling;
+};
+
+void usage(const char *prog){
+    fprintf(stderr, "Usage: %s [options] TRACE(.csv|.pcap)\n"
+        "  --cycle-ms MS         duration of a balancing cycle (default 1000)\n"
+        "  --cores N             cores to balance, at most %d (default %d)\n"
+        "  --idle-cycles N       cycles a silent flow is still reported (default 10)\n"
+        "  --core-capacity LIST  relative capacity of the first cores, comma separated, 0 drains a core\n"
+        "  --consolidation PPS   pack the flows onto the fewest cores staying under PPS packets per second\n"
+        "  --csv FILE            write one line per cycle to FILE\n"
+        "  --max-imbalance F     fail if the mean imbalance (load over capacity share) exceeds F\n"
+        "  --max-migrations N    fail if there are more than N migrations\n"
+        "  --max-flow-moves N    fail if a flow migrates more than N times, e.g. back and forth between two cores\n"
+        "  --max-cpu-us US       fail if the p99 balancer CPU time per cycle exceeds US\n"
+        "  --verbose             keep the balancer's per-cycle output\n",
+        prog, MAX_CORES, NB_CORES);
+}
+
+/**
+ * @brief Reports the flows that are still known by the switch to the flow table
+ */
+void sim_update_table(struct TraceSet *trace, struct SimFlow *flows, int cycle, uint64_t cycle_ns, int idle_cycles,
+    struct HashMap *map, uint64_t *dropped){
+    for (int i = 0; i < trace->nb_flows; i++){
+        if (flows[i].last_active < 0 || cycle - flows[i].last_active > idle_cycles){
+            continue;
+        }
+        // Sampled at the end of the cycle, with the age of the rule like OVS reports it
+        struct FlowSample sample = {
+            .packets = flows[i].packet_count,
+            .time_ns = (cycle + 1) * cycle_ns,
+            .age_ns = (cycle + 1 - flows[i].first_active) * cycle_ns,
+        };
+        struct RingBuffer *ring_buffer = hashmap_get(map, &trace->flows[i].key);
+        if (!ring_buffer){
+            // Like the daemon, a full table evicts its flow of lowest rate if the new one is larger by the margin
+            struct Eviction eviction;
+            ring_buffer = hashmap_admit(map, &trace->flows[i].key, sample.packets * 1e9 / sample.age_ns, &eviction);
+            if (!ring_buffer){
+                (*dropped)++;
+                continue;
+            }
+            flows[i].tracked = 1;
+        }
+        ringbuffer_add_sample(ring_buffer, &sample);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct SimOptions options = {
+        .cycle_ns = 1000000000ULL,
+        .nb_cores = NB_CORES,
+        .idle_cycles = 10,
+        .csv_path = NULL,
+        .verbose = 0,
+        .max_imbalance = 0,
+        .max_migrations = -1,
+        .max_flow_moves = -1,
+        .max_cpu_us = 0,
+        .consolidation_ceiling = 0,
+    };
+    static struct option long_options[] = {
+        {"cycle-ms", required_argument, 0, 'c'},
+        {"cores", required_argument, 0, 'n'},
+        {"idle-cycles", required_argument, 0, 'i'},
+        {"core-capacity", required_argument, 0, 'w'},
+        {"consolidation", required_argument, 0, 'C'},
+        {"csv", required_argument, 0, 'o'},
+        {"max-imbalance", required_argument, 0, 'b'},
+        {"max-migrations", required_argument, 0, 'm'},
+        {"max-flow-moves", required_argument, 0, 'M'},
+        {"max-cpu-us", required_argument, 0, 'u'},
+        {"verbose", no_argument, 0, 'v'},
+        {0, 0, 0, 0}
+    };
+    for (int core = 0; core < MAX_CORES; core++){
+        options.core_capacity[core] = 1;
+    }
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1){
+        switch (opt){
+        case 'c': options.cycle_ns = (uint64_t)(atof(optarg) * 1e6); break;
+        case 'n': options.nb_cores = atoi(optarg); break;
+        case 'i': options.idle_cycles = atoi(optarg); break;
+        case 'w': {
+            char *item = optarg;
+            for (int core = 0; core < MAX_CORES && *item; core++){
+                options.core_capacity[core] = strtod(item, &item);
+                item += *item == ',';
+            }
+            break;
+        }
+        case 'C': options.consolidation_ceiling = atof(optarg); break;
+        case 'o': options.csv_path = optarg; break;
+        case 'b': options.max_imbalance = atof(optarg); break;
+        case 'm': options.max_migrations = atol(optarg); break;
+        case 'M': options.max_flow_moves = atoi(optarg); break;
+        case 'u': options.max_cpu_us = atof(optarg); break;
+        case 'v': options.verbose = 1; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || options.cycle_ns == 0 || options.nb_cores <= 0 || options.nb_cores > MAX_CORES){
+        usage(argv[0]);
+        return 1;
+    }
+    struct TraceSet trace;
+    trace_init(&trace, options.cycle_ns);
+    if (trace_load(&trace, argv[optind]) || trace.nb_cycles == 0){
+        printf("Could not load a trace from %s\n", argv[optind]);
+        trace_destroy(&trace);
+        return 1;
+    }
+    FILE *out = bench_report_stream(options.verbose);
+
+    struct SimFlow *flows = calloc(trace.nb_flows, sizeof(struct SimFlow));
+    for (int i = 0; i < trace.nb_flows; i++){
+        flows[i].last_active = -1;
+    }
+    struct SimCycle *cycles = calloc(trace.nb_cycles, sizeof(struct SimCycle));
+    struct HashMap *map = hashmap_init(HASHMAP_SIZE, RING_SIZE);
+    for (int core = 0; core < options.nb_cores; core++){
+        balancer_set_capacity(core, options.core_capacity[core]);
+    }
+    balancer_set_consolidation(options.consolidation_ceiling);
+    int transitions = 0;
+    uint8_t active[MAX_CORES];
+    for (int core = 0; core < options.nb_cores; core++){
+        active[core] = balancer_core_active(core);
+    }
+    uint64_t dropped = 0;
+    uint64_t core_load[MAX_CORES];
+    for (int c = 0; c < trace.nb_cycles; c++){
+        struct TraceCycle *trace_cycle = &trace.cycles[c];
+        struct SimCycle *cycle = &cycles[c];
+        // Real load, with the assignments decided so far. Untracked flows stay on the default core.
+        memset(core_load, 0, sizeof(core_load));
+        for (int s = 0; s < trace_cycle->nb_samples; s++){
+            struct TraceSample *sample = &trace_cycle->samples[s];
+            flows[sample->flow].packet_count += sample->packets;
+            if (flows[sample->flow].last_active < 0){
+                flows[sample->flow].first_active = c;
+            }
+            flows[sample->flow].last_active = c;
+            struct RingBuffer *ring_buffer = hashmap_get(map, &trace.flows[sample->flow].key);
+            core_load[ring_buffer ? ring_buffer->assigned_core % options.nb_cores : 0] += sample->packets;
+        }
+        // Imbalance against the capacity share of each core, a drained or parked core only counts while it
+        // still has load
+        uint64_t total_load = 0;
+        double total_capacity = 0;
+        cycle->active_cores = 0;
+        cycle->peak_load = 0;
+        for (int core = 0; core < options.nb_cores; core++){
+            total_load += core_load[core];
+            total_capacity += active[core] ? options.core_capacity[core] : 0;
+            cycle->active_cores += active[core];
+            if (core_load[core] * 1e9 / options.cycle_ns > cycle->peak_load){
+                cycle->peak_load = core_load[core] * 1e9 / options.cycle_ns;
+            }
+        }
+        cycle->imbalance = 0;
+        for (int core = 0; core < options.nb_cores && total_load; core++){
+            double share = active[core] ? total_load * options.core_capacity[core] / total_capacity : 0;
+            double imbalance = share > 0 ? core_load[core] / share : (core_load[core] ? options.nb_cores : 0);
+            if (imbalance > cycle->imbalance){
+                cycle->imbalance = imbalance;
+            }
+        }
+        // Control loop
+        uint64_t start = bench_cpu_ns();
+        sim_update_table(&trace, flows, c, options.cycle_ns, options.idle_cycles, map, &dropped);
+        cycle->update_cpu_ns = bench_cpu_ns() - start;
+        struct Migrations migrations = {0};
+        start = bench_cpu_ns();
+        balancer_balance(map, options.nb_cores, &migrations);
+        cycle->balance_cpu_ns = bench_cpu_ns() - start;
+        for (int core = 0; core < options.nb_cores; core++){
+            transitions += active[core] != balancer_core_active(core);
+            active[core] = balancer_core_active(core);
+        }
+        for (int i = 0; i < migrations.nb_migrations; i++){
+            flows[trace_flow(&trace, &migrations.migrations[i].key)].moves++;
+        }
+        hashmap_cleanup_inactive_flows(map);
+        cycle->migrations = migrations.nb_migrations;
+        cycle->table_size = map->size;
+    }
+
+    // Per-cycle series
+    if (options.csv_path){
+        FILE *csv = fopen(options.csv_path, "w");
+        if (!csv){
+            fprintf(out, "Could not open %s\n", options.csv_path);
+        } else {
+            fprintf(csv, "cycle,imbalance,migrations,table_size,balance_cpu_us,update_cpu_us,active_cores\n");
+            for (int c = 0; c < trace.nb_cycles; c++){
+                fprintf(csv, "%d,%.4f,%d,%d,%.2f,%.2f,%d\n", c, cycles[c].imbalance, cycles[c].migrations,
+                    cycles[c].table_size, cycles[c].balance_cpu_ns / 1e3, cycles[c].update_cpu_ns / 1e3,
+                    cycles[c].active_cores);
+            }
+            fclose(csv);
+        }
+    }
+    // Summary
+    double mean_imbalance = 0;
+    double max_imbalance = 0;
+    int loaded_cycles = 0;
+    long total_migrations = 0;
+    uint64_t *balance_cpu = calloc(trace.nb_cycles, sizeof(uint64_t));
+    uint64_t update_cpu = 0;
+    for (int c = 0; c < trace.nb_cycles; c++){
+        if (cycles[c].imbalance > 0){
+            mean_imbalance += cycles[c].imbalance;
+            loaded_cycles++;
+        }
+        if (cycles[c].imbalance > max_imbalance){
+            max_imbalance = cycles[c].imbalance;
+        }
+        total_migrations += cycles[c].migrations;
+        balance_cpu[c] = cycles[c].balance_cpu_ns;
+        update_cpu += cycles[c].update_cpu_ns;
+    }
+    mean_imbalance = loaded_cycles ? mean_imbalance / loaded_cycles : 0;
+    int tracked_flows = 0;
+    int max_moves = 0;
+    for (int i = 0; i < trace.nb_flows; i++){
+        tracked_flows += flows[i].tracked;
+        if (flows[i].moves > max_moves){
+            max_moves = flows[i].moves;
+        }
+    }
+    double balance_p50_us = bench_percentile(balance_cpu, trace.nb_cycles, 50) / 1e3;
+    double balance_p99_us = bench_percentile(balance_cpu, trace.nb_cycles, 99) / 1e3;
+    fprintf(out, "Balancer simulation: %s, %d cycles of %.0f ms, %d flows, %d cores\n", argv[optind],
+        trace.nb_cycles, options.cycle_ns / 1e6, trace.nb_flows, options.nb_cores);
+    fprintf(out, "  imbalance (load/capacity share): mean %.3f, max %.3f\n", mean_imbalance, max_imbalance);
+    fprintf(out, "  migrations: %ld, %.2f per cycle\n", total_migrations, (double)total_migrations / trace.nb_cycles);
+    fprintf(out, "  flow moves per tracked flow: mean %.3f, max %d\n",
+        tracked_flows ? (double)total_migrations / tracked_flows : 0, max_moves);
+    fprintf(out, "  balancer CPU time per cycle (us): p50 %.1f, p99 %.1f, max %.1f\n", balance_p50_us, balance_p99_us,
+        bench_percentile(balance_cpu, trace.nb_cycles, 100) / 1e3);
+    fprintf(out, "  flow table update CPU time per cycle (us): mean %.1f\n", update_cpu / 1e3 / trace.nb_cycles);
+    if (options.consolidation_ceiling > 0){
+        double mean_active = 0;
+        int min_active = options.nb_cores;
+        int over_ceiling = 0;
+        for (int c = 0; c < trace.nb_cycles; c++){
+            mean_active += (double)cycles[c].active_cores / trace.nb_cycles;
+            min_active = cycles[c].active_cores < min_active ? cycles[c].active_cores : min_active;
+            over_ceiling += cycles[c].peak_load > options.consolidation_ceiling;
+        }
+        fprintf(out, "  consolidation under %.0f pps: %.2f active cores on average, %d at least, %d transitions, "
+            "%d cycles with a core over the ceiling\n", options.consolidation_ceiling, mean_active, min_active, transitions,
+            over_ceiling);
+    }
+    if (dropped){
+        fprintf(out, "  %lu flow reports left out of the full flow table\n", dropped);
+    }
+    // Regression checks
+    int status = 0;
+    if (options.max_imbalance > 0 && mean_imbalance > options.max_imbalance){
+        fprintf(out, "FAIL: mean imbalance %.3f > %.3f\n", mean_imbalance, options.max_imbalance);
+        status = 2;
+    }
+    if (options.max_migrations >= 0 && total_migrations > options.max_migrations){
+        fprintf(out, "FAIL: %ld migrations > %ld\n", total_migrations, options.max_migrations);
+        status = 2;
+    }
+    if (options.max_flow_moves >= 0 && max_moves > options.max_flow_moves){
+        fprintf(out, "FAIL: a flow migrated %d times > %d\n", max_moves, options.max_flow_moves);
+        status = 2;
+    }
+    if (options.max_cpu_us > 0 && balance_p99_us > options.max_cpu_us){
+        fprintf(out, "FAIL: p99 balancer CPU time %.1f us > %.1f us\n", balance_p99_us, options.max_cpu_us);
+        status = 2;
+    }
+    fclose(out);
+    free(balance_cpu);
+    free(cycles);
+    free(flows);
+    hashmap_destroy(map);
+    trace_destroy(&trace);
+    return status;
+}
@@ -0,0 +1,40 @@
+#include "bench.h"
+
+uint64_t bench_now_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+uint64_t bench_cpu_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+int compare_u64(const void *a, const void *b){
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+uint64_t bench_percentile(uint64_t *samples, int nb_samples, int percentile){
+    if (nb_samples <= 0){
+        return 0;
+    }
+    qsort(samples, nb_samples, sizeof(uint64_t), compare_u64);
+    int idx = (int)((int64_t)nb_samples * percentile / 100);
+    if (idx >= nb_samples){
+        idx = nb_samples - 1;
+    }
+    return samples[idx];
+}
+
+FILE *bench_report_stream(int verbose){
+    fflush(stdout);
+    FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+    if (!verbose){
+        freopen("/dev/null", "w", stdout);
+    }
+    return report;
+}
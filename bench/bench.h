@@ -0,0 +1,49 @@
+/**
+ * @file bench.h
+ * @brief Helpers shared by the benchmarks: clocks, percentiles and output
+ *
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Monotonic wall-clock time
+ *
+ * @return uint64_t : time in nanoseconds
+ */
+uint64_t bench_now_ns();
+
+/**
+ * @brief CPU time consumed by the calling thread
+ *
+ * @return uint64_t : time in nanoseconds
+ */
+uint64_t bench_cpu_ns();
+
+/**
+ * @brief Sorts the samples and returns the requested percentile
+ *
+ * @param samples : the samples, sorted in place
+ * @param nb_samples
+ * @param percentile : between 0 and 100
+ * @return uint64_t : the percentile, 0 if there are no samples
+ */
+uint64_t bench_percentile(uint64_t *samples, int nb_samples, int percentile);
+
+/**
+ * @brief The daemon code prints a dump every cycle. Returns a stream to the original stdout
+ * for the report, and discards everything printed on stdout afterwards unless `verbose` is set.
+ *
+ * @param verbose : keep stdout
+ * @return FILE* : the report stream
+ */
+FILE *bench_report_stream(int verbose);
+
+#endif
@@ -0,0 +1,460 @@
+/**
+ * @file control_loop_bench.c
+ * @brief End-to-end benchmark of the OpenFlow control loop against the mock switch
+ *
+ * Runs the cycle of the daemon (openflow_control, openflow_get_flows, flow table update,
+ * balancing and FLOW_MODs) back to back, without the 1s sleep, against a local mock switch.
+ * Reports the cycle latency, the stats round-trip and parse throughput, the migrations per second
+ * and the real imbalance of the cores over time, as computed by the switch from the flow rates.
+ * With --of-version 1.3 or 1.4, the migrations of a cycle are sent as a bundle, like in the daemon.
+ * With --buckets, the switch hashes the flows over the buckets of a SELECT group and the balancer
+ * moves buckets (STEERING_BUCKETS mode), a cycle then sends at most one GROUP_MOD.
+ * New flows are placed by the policy of --placement and moved by a FLOW_MOD sent with the migrations.
+ * FLOW_MODs stamp the rules with the cookie of their flow table slot and the flow stats are matched to the
+ * table by cookie, like in the daemon; --no-cookies matches every entry by its 5-tuple instead.
+ * With --restart N, the daemon restarts before cycle N: its flow table is checkpointed and restored, like
+ * at a warm restart, or lost with --cold. Reports the time to checkpoint and restore the table and the
+ * placements and migrations of the cycles that follow.
+ *
+ * The daemon's per-cycle dumps are discarded unless --verbose is given.
+ *
+ */
+
+#include <getopt.h>
+#include "bench.h"
+#include "mock_switch.h"
+#include "balancer.h"
+#include "bucket_steering.h"
+#include "checkpoint.h"
+
+// Cycles after a restart whose placements and migrations are reported
+#define CONTROL_LOOP_RESTART_WINDOW 5
+
+struct CycleResult {
+    uint64_t latency_ns;
+    uint64_t stats_ns; /** Time spent in openflow_get_flows */
+    int nb_flows;
+    int nb_migrations;
+    double imbalance; /** Real imbalance at the start of the cycle */
+};
+
+struct BenchReport {
+    uint64_t dropped_new_flows; /** New flows left out of the full flow table */
+    uint64_t evictions; /** Flows evicted from the full flow table for a new flow */
+    uint64_t placed_flows; /** New flows moved off the default core at discovery */
+    uint64_t cookie_hits; /** Stats entries matched to the flow table by cookie */
+    uint64_t key_lookups; /** Stats entries matched by 5-tuple */
+    uint64_t track_ns; /** Time spent updating the flow table from the stats */
+    uint64_t reconciled_flows; /** Restored flows whose rule steers them to another core */
+    int restored_flows; /** Flows restored at the restart, -1 without checkpoint */
+    uint64_t checkpoint_ns; /** Time to write the checkpoint */
+    uint64_t restore_ns; /** Time to restore it */
+    uint64_t restart_placements; /** Placements in the cycles following the restart */
+    uint64_t restart_migrations;
+};
+
+// Stamp the rules with the cookie of their slot and resolve the stats by cookie
+uint8_t use_cookies = 1;
+// Set until the first flow stats after a warm restart, like in the daemon
+uint8_t reconciling = 0;
+
+/**
+ * @brief Same cookie as the daemon's flow_cookie, 0 with --no-cookies
+ */
+uint64_t bench_cookie(struct HashMap *map, struct FiveTuple *key){
+    int slot = use_cookies ? hashmap_slot(map, key) : -1;
+    return slot < 0 ? 0 : openflow_flow_cookie(slot, hashmap_generation(map, slot));
+}
+
+/**
+ * @brief Same reconciliation of a flow with its rule as the daemon after a restore
+ */
+void bench_reconcile_flow(struct RingBuffer *ring_buffer, uint16_t vlan, struct BenchReport *report){
+    if (reconciling && ring_buffer->assigned_core != vlan % NB_CORES){
+        ring_buffer->assigned_core = vlan % NB_CORES;
+        report->reconciled_flows++;
+    }
+}
+
+/**
+ * @brief Same flow table update, admission to a full table and placement as the daemon
+ */
+void bench_track_flows(openflow_flows *flows, struct HashMap *map, struct BenchReport *report, struct Migrations *placements){
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < flows->nb_flows; i++){
+        struct FlowSample sample = {
+            .packets = openflow_ovsbe64_to_uint64(flows->flow_stats[i].packet_count),
+            .bytes = openflow_ovsbe64_to_uint64(flows->flow_stats[i].byte_count),
+            .time_ns = start,
+            .age_ns = flows->flow_stats[i].duration_sec * 1000000000ULL + flows->flow_stats[i].duration_nsec,
+        };
+        uint16_t vlan = openflow_get_vlan(flows, i);
+        struct FiveTuple key = {0};
+        key.src_ip = flows->flow_stats[i].match.nw_src;
+        key.dst_ip = flows->flow_stats[i].match.nw_dst;
+        key.src_port = flows->flow_stats[i].match.tp_src;
+        key.dst_port = flows->flow_stats[i].match.tp_dst;
+        key.proto = flows->flow_stats[i].match.nw_proto;
+        int slot;
+        uint16_t generation;
+        if (use_cookies && !openflow_cookie_slot(openflow_get_cookie(flows, i), &slot, &generation)){
+            struct RingBuffer *ring_buffer = hashmap_get_slot(map, slot, generation, &key);
+            if (ring_buffer){
+                report->cookie_hits++;
+                bench_reconcile_flow(ring_buffer, vlan, report);
+                ringbuffer_add_sample(ring_buffer, &sample);
+                continue;
+            }
+        }
+        report->key_lookups++;
+        struct RingBuffer *ring_buffer = hashmap_get(map, &key);
+        if (!ring_buffer){
+            struct Eviction eviction;
+            ring_buffer = hashmap_admit(map, &key, sample.age_ns ? sample.packets * 1e9 / sample.age_ns : 0, &eviction);
+            report->evictions += eviction.evicted;
+            if (!ring_buffer){
+                report->dropped_new_flows++;
+                continue;
+            }
+            if (vlan % NB_CORES != 0){
+                // Already steered by a previous run, its rule stays as it is
+                ring_buffer->assigned_core = vlan % NB_CORES;
+            } else if (placements->nb_migrations < MAX_MIGRATIONS){
+                ring_buffer->assigned_core = balancer_place(&key, NB_CORES);
+                if (ring_buffer->assigned_core != 0){
+                    placements->migrations[placements->nb_migrations].key = key;
+                    placements->migrations[placements->nb_migrations].destination_core = ring_buffer->assigned_core;
+                    placements->nb_migrations++;
+                }
+            }
+        } else {
+            bench_reconcile_flow(ring_buffer, vlan, report);
+        }
+        ringbuffer_add_sample(ring_buffer, &sample);
+    }
+    report->track_ns += bench_now_ns() - start;
+}
+
+/**
+ * @brief Same bucket accounting as the daemon in STEERING_BUCKETS mode
+ */
+void bench_track_buckets(struct BucketSteering *steering, struct HashMap *map, struct BenchReport *report){
+    if (bucket_steering_collect(steering)){
+        return;
+    }
+    uint64_t time_ns = bench_now_ns();
+    for (int bucket = 0; bucket < NB_BUCKETS; bucket++){
+        struct FiveTuple key = bucket_steering_key(bucket);
+        struct RingBuffer *ring_buffer = hashmap_get(map, &key);
+        if (!ring_buffer){
+            struct Eviction eviction;
+            ring_buffer = hashmap_admit(map, &key, UINT64_MAX, &eviction);
+            report->evictions += eviction.evicted;
+            if (!ring_buffer){
+                report->dropped_new_flows++;
+                continue;
+            }
+        }
+        ring_buffer->assigned_core = steering->bucket_core[bucket];
+        struct FlowSample sample = {.packets = steering->packets[bucket], .time_ns = time_ns};
+        ringbuffer_add_sample(ring_buffer, &sample);
+    }
+}
+
+void usage(const char *prog){
+    fprintf(stderr, "Usage: %s [options]\n"
+        "  --cycles N            control loop cycles to run (default 100)\n"
+        "  --flows N             active flows, at most %d (default 1000)\n"
+        "  --distribution D      uniform, zipf or elephants (default zipf)\n"
+        "  --zipf-exponent S     exponent of the Zipf distribution (default 1.1)\n"
+        "  --elephant-share F    share of elephants (default 0.05)\n"
+        "  --elephant-ratio R    elephant rate / mouse rate (default 100)\n"
+        "  --rate P              packets per cycle over all flows (default 10000000)\n"
+        "  --churn F             share of the flows replaced each cycle (default 0)\n"
+        "  --seed N              random seed (default 42)\n"
+        "  --of-version V        highest OpenFlow version of the switch: 1.0, 1.3 or 1.4 (default 1.0)\n"
+        "  --core-rate-limit P   install per-core meters of P packets per second (OpenFlow 1.3+)\n"
+        "  --placement P         core of the new flows: default, least-loaded, two-choices or weighted-hash\n"
+        "                        (default least-loaded)\n"
+        "  --buckets             steer %d hash buckets through a SELECT group instead of the flows (OpenFlow 1.3+)\n"
+        "  --no-cookies          match the flow stats to the flow table by 5-tuple only\n"
+        "  --table-size N        flows in the flow table, fewer than --flows to overload it (default %d)\n"
+        "  --restart N           restart the daemon before cycle N, its flow table restored from a checkpoint\n"
+        "  --cold                restart with an empty flow table instead\n"
+        "  --csv FILE            write one line per cycle to FILE\n"
+        "  --verbose             keep the daemon's per-cycle output\n",
+        prog, MAX_HANDLED_FLOWS, NB_BUCKETS, HASHMAP_SIZE);
+}
+
+int main(int argc, char *argv[])
+{
+    struct MockSwitchConfig config;
+    mock_switch_default_config(&config);
+    int nb_cycles = 100;
+    const char *csv_path = NULL;
+    int verbose = 0;
+    uint32_t core_rate_limit = 0;
+    int buckets = 0;
+    int table_size = HASHMAP_SIZE;
+    int restart_cycle = -1;
+    int cold = 0;
+    static struct option options[] = {
+        {"cycles", required_argument, 0, 'c'},
+        {"flows", required_argument, 0, 'f'},
+        {"distribution", required_argument, 0, 'd'},
+        {"zipf-exponent", required_argument, 0, 'z'},
+        {"elephant-share", required_argument, 0, 'e'},
+        {"elephant-ratio", required_argument, 0, 'r'},
+        {"rate", required_argument, 0, 'p'},
+        {"churn", required_argument, 0, 'n'},
+        {"seed", required_argument, 0, 's'},
+        {"of-version", required_argument, 0, 'V'},
+        {"core-rate-limit", required_argument, 0, 'm'},
+        {"buckets", no_argument, 0, 'b'},
+        {"no-cookies", no_argument, 0, 'k'},
+        {"table-size", required_argument, 0, 't'},
+        {"restart", required_argument, 0, 'R'},
+        {"cold", no_argument, 0, 'C'},
+        {"placement", required_argument, 0, 'P'},
+        {"csv", required_argument, 0, 'o'},
+        {"verbose", no_argument, 0, 'v'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1){
+        switch (opt){
+        case 'c': nb_cycles = atoi(optarg); break;
+        case 'f': config.nb_flows = atoi(optarg); break;
+        case 'd':
+            if (!strcmp(optarg, "uniform")){
+                config.distribution = MOCK_RATES_UNIFORM;
+            } else if (!strcmp(optarg, "zipf")){
+                config.distribution = MOCK_RATES_ZIPF;
+            } else if (!strcmp(optarg, "elephants")){
+                config.distribution = MOCK_RATES_ELEPHANTS;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'z': config.zipf_exponent = atof(optarg); break;
+        case 'e': config.elephant_share = atof(optarg); break;
+        case 'r': config.elephant_ratio = atof(optarg); break;
+        case 'p': config.total_rate = strtoull(optarg, NULL, 10); break;
+        case 'n': config.churn = atof(optarg); break;
+        case 's': config.seed = atoi(optarg); break;
+        case 'V':
+            if (!strcmp(optarg, "1.0")){
+                config.of_version = OFP_VERSION;
+            } else if (!strcmp(optarg, "1.3")){
+                config.of_version = OFP13_VERSION;
+            } else if (!strcmp(optarg, "1.4")){
+                config.of_version = OFP14_VERSION;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'm': core_rate_limit = strtoul(optarg, NULL, 10); break;
+        case 'b': buckets = 1; break;
+        case 'k': use_cookies = 0; break;
+        case 't': table_size = atoi(optarg); break;
+        case 'R': restart_cycle = atoi(optarg); break;
+        case 'C': cold = 1; break;
+        case 'P':
+            if (!strcmp(optarg, "default")){
+                balancer_set_placement(PLACEMENT_DEFAULT);
+            } else if (!strcmp(optarg, "least-loaded")){
+                balancer_set_placement(PLACEMENT_LEAST_LOADED);
+            } else if (!strcmp(optarg, "two-choices")){
+                balancer_set_placement(PLACEMENT_TWO_CHOICES);
+            } else if (!strcmp(optarg, "weighted-hash")){
+                balancer_set_placement(PLACEMENT_WEIGHTED_HASH);
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'o': csv_path = optarg; break;
+        case 'v': verbose = 1; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (nb_cycles <= 0 || table_size <= 0 || restart_cycle == 0 || restart_cycle >= nb_cycles){
+        usage(argv[0]);
+        return 1;
+    }
+    struct MockSwitch sw;
+    if (mock_switch_init(&sw, &config) || mock_switch_start(&sw)){
+        return 1;
+    }
+    FILE *out = bench_report_stream(verbose);
+    openflow_connection ofp_connection = {0};
+    openflow_create_connection(&ofp_connection, OF_PORT);
+    if (core_rate_limit && openflow_add_core_meters(&ofp_connection, NB_CORES, core_rate_limit)){
+        return 1;
+    }
+    struct BucketSteering steering;
+    if (buckets && bucket_steering_init(&steering, &ofp_connection, NB_CORES)){
+        return 1;
+    }
+
+    struct HashMap *map = hashmap_init(table_size, RING_SIZE);
+    static openflow_flows flows;
+    struct CycleResult *results = calloc(nb_cycles, sizeof(struct CycleResult));
+    struct BenchReport report = {.restored_flows = -1};
+    uint64_t core_load[NB_CORES];
+    uint64_t bench_start = bench_now_ns();
+    for (int cycle = 0; cycle < nb_cycles; cycle++){
+        struct CycleResult *result = &results[cycle];
+        if (cycle == restart_cycle){
+            // The daemon stops after its last checkpoint, the rules stay on the switch
+            char checkpoint_path[] = "/tmp/orss-bench-XXXXXX";
+            int fd = cold ? -1 : mkstemp(checkpoint_path);
+            struct Checkpoint checkpoint;
+            uint8_t warm = fd >= 0 && !checkpoint_open(&checkpoint, checkpoint_path, table_size, RING_SIZE);
+            if (warm){
+                uint64_t checkpoint_start = bench_now_ns();
+                checkpoint_write(&checkpoint, map);
+                report.checkpoint_ns = bench_now_ns() - checkpoint_start;
+            }
+            hashmap_destroy(map);
+            map = hashmap_init(table_size, RING_SIZE);
+            if (warm){
+                uint64_t restore_start = bench_now_ns();
+                report.restored_flows = checkpoint_restore(&checkpoint, map, NB_CORES);
+                report.restore_ns = bench_now_ns() - restore_start;
+                checkpoint_close(&checkpoint);
+                reconciling = report.restored_flows > 0;
+            }
+            if (fd >= 0){
+                close(fd);
+                unlink(checkpoint_path);
+            }
+        }
+        // Migrations of the previous cycle are applied by the switch at this point
+        result->imbalance = mock_switch_core_load(&sw, core_load);
+        uint64_t start = bench_now_ns();
+        openflow_control(&ofp_connection);
+        uint64_t stats_start = bench_now_ns();
+        openflow_get_flows(&ofp_connection, &flows);
+        result->stats_ns = bench_now_ns() - stats_start;
+        result->nb_flows = flows.nb_flows;
+        struct Migrations placements = {0};
+        bench_track_flows(&flows, map, &report, &placements);
+        report.placed_flows += placements.nb_migrations;
+        if (flows.nb_flows){
+            reconciling = 0;
+        }
+        openflow_free_flows(&flows);
+        if (buckets){
+            bench_track_buckets(&steering, map, &report);
+        }
+        struct Migrations migrations = {0};
+        balancer_balance(map, NB_CORES, &migrations);
+        openflow_bundle_begin(&ofp_connection);
+        for (int i = 0; i < placements.nb_migrations; i++){
+            openflow_mod_vlan(&ofp_connection, &placements.migrations[i].key, placements.migrations[i].destination_core,
+                bench_cookie(map, &placements.migrations[i].key));
+        }
+        for (int i = 0; i < migrations.nb_migrations; i++){
+            struct Migration *migration = &migrations.migrations[i];
+            int bucket = buckets ? bucket_steering_bucket(&migration->key) : -1;
+            if (bucket >= 0){
+                bucket_steering_assign(&steering, bucket, migration->destination_core);
+            } else {
+                openflow_mod_vlan(&ofp_connection, &migration->key, migration->destination_core, bench_cookie(map, &migration->key));
+            }
+        }
+        if (buckets){
+            bucket_steering_commit(&steering);
+        }
+        if (openflow_bundle_commit(&ofp_connection)){
+            fprintf(out, "Cycle %d: the migration bundle was rejected\n", cycle);
+        }
+        hashmap_cleanup_inactive_flows(map);
+        result->nb_migrations = migrations.nb_migrations;
+        if (restart_cycle >= 0 && cycle >= restart_cycle && cycle < restart_cycle + CONTROL_LOOP_RESTART_WINDOW){
+            report.restart_placements += placements.nb_migrations;
+            report.restart_migrations += migrations.nb_migrations;
+        }
+        result->latency_ns = bench_now_ns() - start;
+    }
+    uint64_t bench_ns = bench_now_ns() - bench_start;
+    // Closing with unread messages would reset the connection before the last FLOW_MODs are read
+    usleep(10000);
+    openflow_control(&ofp_connection);
+    openflow_terminate_connection(&ofp_connection);
+    mock_switch_wait(&sw);
+
+    // Per-cycle series
+    if (csv_path){
+        FILE *csv = fopen(csv_path, "w");
+        if (!csv){
+            fprintf(out, "Could not open %s\n", csv_path);
+        } else {
+            fprintf(csv, "cycle,latency_us,stats_us,flows,migrations,imbalance\n");
+            for (int cycle = 0; cycle < nb_cycles; cycle++){
+                fprintf(csv, "%d,%.1f,%.1f,%d,%d,%.4f\n", cycle, results[cycle].latency_ns / 1e3,
+                    results[cycle].stats_ns / 1e3, results[cycle].nb_flows, results[cycle].nb_migrations,
+                    results[cycle].imbalance);
+            }
+            fclose(csv);
+        }
+    }
+    // Summary
+    uint64_t *latencies = calloc(nb_cycles, sizeof(uint64_t));
+    uint64_t total_flows = 0;
+    uint64_t total_stats_ns = 0;
+    uint64_t total_migrations = 0;
+    double mean_imbalance = 0;
+    for (int cycle = 0; cycle < nb_cycles; cycle++){
+        latencies[cycle] = results[cycle].latency_ns;
+        total_flows += results[cycle].nb_flows;
+        total_stats_ns += results[cycle].stats_ns;
+        total_migrations += results[cycle].nb_migrations;
+        mean_imbalance += results[cycle].imbalance / nb_cycles;
+    }
+    double final_imbalance = mock_switch_core_load(&sw, core_load);
+    fprintf(out, "Control loop: %d cycles, %d flows, churn %.3f, OpenFlow %s%s\n", nb_cycles, config.nb_flows, config.churn,
+        sw.version == OFP14_VERSION ? "1.4" : sw.version == OFP13_VERSION ? "1.3" : "1.0", buckets ? ", bucket steering" : "");
+    fprintf(out, "  cycle latency (us): p50 %.1f, p99 %.1f, max %.1f\n", bench_percentile(latencies, nb_cycles, 50) / 1e3,
+        bench_percentile(latencies, nb_cycles, 99) / 1e3, bench_percentile(latencies, nb_cycles, 100) / 1e3);
+    fprintf(out, "  stats round-trip and parse: %.0f flows/s\n", total_flows / (total_stats_ns / 1e9));
+    fprintf(out, "  migrations: %lu, %.1f/s\n", total_migrations, total_migrations / (bench_ns / 1e9));
+    fprintf(out, "  imbalance (max/avg load): first %.3f, mean %.3f, final %.3f\n", results[0].imbalance, mean_imbalance, final_imbalance);
+    fprintf(out, "  switch: %lu flow mods (%lu on unknown flows), %lu echo replies, %lu churned flows\n",
+        sw.flow_mods, sw.unknown_flow_mods, sw.echo_replies, sw.churned_flows);
+    if (sw.version >= OFP13_VERSION){
+        fprintf(out, "  switch: %lu bundles committed, %lu meter mods, %lu group mods\n", sw.bundles, sw.meter_mods, sw.group_mods);
+    }
+    fprintf(out, "  placement: %lu new flows moved off the default core\n", report.placed_flows);
+    fprintf(out, "  flow table update: %.1f ns per stats entry, %lu entries matched by cookie, %lu by 5-tuple\n",
+        total_flows ? (double)report.track_ns / total_flows : 0, report.cookie_hits, report.key_lookups);
+    if (report.dropped_new_flows || report.evictions){
+        fprintf(out, "  full flow table: %lu flows evicted, %lu new flows left out\n", report.evictions, report.dropped_new_flows);
+    }
+    if (restart_cycle >= 0){
+        if (report.restored_flows >= 0){
+            fprintf(out, "  restart before cycle %d: %d flows checkpointed in %.1f us, restored in %.1f us, %lu reconciled with their rule\n",
+                restart_cycle, report.restored_flows, report.checkpoint_ns / 1e3, report.restore_ns / 1e3, report.reconciled_flows);
+        } else {
+            fprintf(out, "  restart before cycle %d: empty flow table\n", restart_cycle);
+        }
+        double restart_imbalance = 0;
+        for (int cycle = restart_cycle; cycle < nb_cycles && cycle < restart_cycle + CONTROL_LOOP_RESTART_WINDOW; cycle++){
+            restart_imbalance = results[cycle].imbalance > restart_imbalance ? results[cycle].imbalance : restart_imbalance;
+        }
+        fprintf(out, "  %d cycles after the restart: %lu placements, %lu migrations, imbalance before %.3f, at most %.3f\n",
+            CONTROL_LOOP_RESTART_WINDOW, report.restart_placements, report.restart_migrations,
+            results[restart_cycle - 1].imbalance, restart_imbalance);
+    }
+    fclose(out);
+    mock_switch_destroy(&sw);
+    free(latencies);
+    free(results);
+    hashmap_destroy(map);
+    return 0;
+}
@@ -0,0 +1,185 @@
+/**
+ * @file flow_setup_bench.c
+ * @brief Connection setup rate of the native PACKET_IN handling against the mock switch
+ *
+ * The mock switch sends the PACKET_IN of the first packet of --setups new connections, keeping at most
+ * --window of them waiting for the controller, and openflow_control sets them up like in the daemon:
+ * 5-tuple read from the packet, core picked by the placement policy and recorded in the flow table, FLOW_MOD
+ * releasing the buffered packet (or FLOW_MOD and PACKET_OUT with --unbuffered). The FLOW_MODs of --batch
+ * setups are written at once, --batch 1 writes each of them on its own.
+ *
+ * Reports the setups per second and the first-packet latency, from the PACKET_IN being written by the
+ * switch to its packet leaving the switch with the VLAN of its core.
+ *
+ */
+
+#include <getopt.h>
+#include "bench.h"
+#include "mock_switch.h"
+#include "balancer.h"
+
+// Seconds without any setup completed before giving up
+#define FLOW_SETUP_BENCH_TIMEOUT 5
+
+struct SetupTable {
+    struct HashMap *map;
+    uint64_t untracked; /** Flows placed without entering the full flow table */
+    uint64_t evictions; /** Flows evicted from the full flow table for a new one */
+};
+
+/**
+ * @brief Same placement as the daemon's setup_flow
+ */
+uint16_t bench_setup_flow(struct FiveTuple *key, void *arg, uint64_t *cookie){
+    struct SetupTable *table = arg;
+    struct RingBuffer *ring_buffer = hashmap_get(table->map, key);
+    if (!ring_buffer){
+        struct Eviction eviction;
+        ring_buffer = hashmap_admit(table->map, key, 0, &eviction);
+        table->evictions += eviction.evicted;
+        if (!ring_buffer){
+            table->untracked++;
+            return balancer_place(key, NB_CORES);
+        }
+        ring_buffer->assigned_core = balancer_place(key, NB_CORES);
+    }
+    int slot = hashmap_slot(table->map, key);
+    *cookie = openflow_flow_cookie(slot, hashmap_generation(table->map, slot));
+    return ring_buffer->assigned_core;
+}
+
+void usage(const char *prog){
+    fprintf(stderr, "Usage: %s [options]\n"
+        "  --setups N            new connections to set up (default 20000)\n"
+        "  --window N            connections waiting for their FLOW_MOD at most (default 256)\n"
+        "  --batch N             setups whose FLOW_MODs are written at once (default %d)\n"
+        "  --table-size N        flows in the flow table (default %d)\n"
+        "  --of-version V        highest OpenFlow version of the switch: 1.0, 1.3 or 1.4 (default 1.0)\n"
+        "  --unbuffered          send whole packets in the PACKET_INs, returned in PACKET_OUTs\n"
+        "  --verbose             keep the daemon's output\n",
+        prog, FLOW_SETUP_BATCH, HASHMAP_SIZE);
+}
+
+int main(int argc, char *argv[])
+{
+    struct MockSwitchConfig config;
+    mock_switch_default_config(&config);
+    // The synthetic flows and their keep-alives are not used
+    config.nb_flows = 1;
+    config.echo_interval = 0;
+    int nb_setups = 20000;
+    int window = 256;
+    int batch = FLOW_SETUP_BATCH;
+    int table_size = HASHMAP_SIZE;
+    int buffered = 1;
+    int verbose = 0;
+    static struct option options[] = {
+        {"setups", required_argument, 0, 'n'},
+        {"window", required_argument, 0, 'w'},
+        {"batch", required_argument, 0, 'b'},
+        {"table-size", required_argument, 0, 't'},
+        {"of-version", required_argument, 0, 'V'},
+        {"unbuffered", no_argument, 0, 'u'},
+        {"verbose", no_argument, 0, 'v'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1){
+        switch (opt){
+        case 'n': nb_setups = atoi(optarg); break;
+        case 'w': window = atoi(optarg); break;
+        case 'b': batch = atoi(optarg); break;
+        case 't': table_size = atoi(optarg); break;
+        case 'V':
+            if (!strcmp(optarg, "1.0")){
+                config.of_version = OFP_VERSION;
+            } else if (!strcmp(optarg, "1.3")){
+                config.of_version = OFP13_VERSION;
+            } else if (!strcmp(optarg, "1.4")){
+                config.of_version = OFP14_VERSION;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'u': buffered = 0; break;
+        case 'v': verbose = 1; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (nb_setups <= 0 || window <= 0 || batch <= 0 || batch > 0xffff || table_size <= 0){
+        usage(argv[0]);
+        return 1;
+    }
+    struct MockSwitch sw;
+    if (mock_switch_init(&sw, &config) || mock_switch_start(&sw)){
+        return 1;
+    }
+    FILE *out = bench_report_stream(verbose);
+    openflow_connection ofp_connection = {0};
+    openflow_create_connection(&ofp_connection, OF_PORT);
+    struct SetupTable table = {.map = hashmap_init(table_size, RING_SIZE)};
+    if (openflow_enable_flow_setup(&ofp_connection, bench_setup_flow, &table, batch)){
+        return 1;
+    }
+
+    int sent = 0;
+    uint32_t completed = 0;
+    uint64_t bench_start = bench_now_ns();
+    uint64_t last_progress = bench_start;
+    while (completed < (uint32_t)nb_setups){
+        if (sent - (int)completed < window && sent < nb_setups){
+            int burst = window - (sent - completed);
+            if (burst > nb_setups - sent){
+                burst = nb_setups - sent;
+            }
+            if (mock_switch_packet_in(&sw, burst, buffered)){
+                break;
+            }
+            sent += burst;
+        }
+        openflow_control(&ofp_connection);
+        uint32_t now_completed = mock_switch_setups_completed(&sw);
+        if (now_completed != completed){
+            completed = now_completed;
+            last_progress = bench_now_ns();
+        } else if (bench_now_ns() - last_progress > FLOW_SETUP_BENCH_TIMEOUT * 1000000000ULL){
+            fprintf(out, "No setup completed for %d s, giving up\n", FLOW_SETUP_BENCH_TIMEOUT);
+            break;
+        }
+    }
+    uint64_t bench_ns = bench_now_ns() - bench_start;
+    openflow_terminate_connection(&ofp_connection);
+    mock_switch_wait(&sw);
+
+    // First-packet latency of the completed setups
+    uint64_t *latencies = calloc(sw.nb_setups, sizeof(uint64_t));
+    int nb_latencies = 0;
+    uint32_t core_flows[NB_CORES] = {0};
+    for (uint32_t i = 0; i < sw.nb_setups; i++){
+        if (sw.setups[i].installed_ns && sw.setups[i].released_ns){
+            latencies[nb_latencies++] = sw.setups[i].released_ns - sw.setups[i].sent_ns;
+            core_flows[sw.setups[i].vlan % NB_CORES]++;
+        }
+    }
+    fprintf(out, "Flow setup: %d connections, window %d, batch %d, OpenFlow %s, %s packets\n", nb_setups, window, batch,
+        sw.version == OFP14_VERSION ? "1.4" : sw.version == OFP13_VERSION ? "1.3" : "1.0", buffered ? "buffered" : "unbuffered");
+    fprintf(out, "  rate: %.0f setups/s (%u completed in %.3f s)\n", completed / (bench_ns / 1e9), completed, bench_ns / 1e9);
+    fprintf(out, "  first packet latency (us): p50 %.1f, p99 %.1f, max %.1f\n",
+        bench_percentile(latencies, nb_latencies, 50) / 1e3, bench_percentile(latencies, nb_latencies, 99) / 1e3,
+        bench_percentile(latencies, nb_latencies, 100) / 1e3);
+    fprintf(out, "  flows per core:");
+    for (int core = 0; core < NB_CORES; core++){
+        fprintf(out, " %u", core_flows[core]);
+    }
+    fprintf(out, "\n  switch: %lu flow mods, %lu packet outs%s\n",
+        sw.flow_mods, sw.packet_outs, sw.table_miss ? ", table-miss rule installed" : "");
+    fprintf(out, "  full flow table: %lu flows evicted, %lu flows placed outside of it\n", table.evictions, table.untracked);
+    fclose(out);
+    free(latencies);
+    mock_switch_destroy(&sw);
+    hashmap_destroy(table.map);
+    return completed == (uint32_t)nb_setups ? 0 : 1;
+}
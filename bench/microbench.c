@@ -0,0 +1,681 @@
+/**
+ * @file microbench.c
+ * @brief Microbenchmarks of the hot paths of the daemon
+ *
+ * Covers the flow table (insert, get, get by slot, remove, get_next), the flow hashes (CRC32C of each backend,
+ * Toeplitz), the ring buffers, `balancer_balance()` and the parsing of multipart flow stats replies by `openflow_get_flows()`. Each benchmark runs with
+ * an increasing number of iterations until it lasts `--min-time` seconds. The console output and
+ * the `--json` file follow the format of Google Benchmark, so results can be compared across
+ * commits with its tools (e.g. `compare.py`).
+ *
+ * The flow table is sized for each benchmark, so it can be measured with up to 1M flows. Sizes
+ * above `--max-flows` are reported as skipped.
+ *
+ */
+
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+#include "bench.h"
+#include "mock_switch.h"
+#include "balancer.h"
+#include "flowhash.h"
+
+// Transaction ID of the next OpenFlow request, fixed to replay canned replies
+extern uint32_t transaction_id;
+
+struct MicroState {
+    uint64_t iterations;
+    int64_t range; /** First argument of the benchmark, e.g. the number of flows */
+    int64_t range2; /** Second argument, 0 if unused */
+    uint64_t items; /** Items processed by one iteration, for items_per_second */
+    const char *label;
+    const char *error; /** Set by the setup when the benchmark can't run */
+    void *ctx;
+};
+
+typedef void (*micro_fn)(struct MicroState *state);
+
+struct MicroBenchmark {
+    const char *family;
+    micro_fn setup;
+    micro_fn run;
+    micro_fn teardown;
+    int64_t range;
+    int64_t range2;
+};
+
+struct MicroResult {
+    char name[128];
+    uint64_t iterations;
+    double real_ns; /** Per iteration */
+    double cpu_ns; /** Per iteration */
+    double items_per_second;
+    const char *label;
+    const char *error;
+};
+
+int64_t max_flows = 1048576;
+
+/**
+ * @brief Returns the key of the i-th synthetic flow
+ */
+struct FiveTuple micro_key(uint32_t i){
+    struct FiveTuple key = {0};
+    key.src_ip = 0x0A000000 | (i >> 16);
+    key.dst_ip = 0x0A010001;
+    key.src_port = i & 0xFFFF;
+    key.dst_port = 80;
+    key.proto = 6;
+    return key;
+}
+
+// Flow table
+
+struct HashMapContext {
+    struct HashMap *map;
+    struct FiveTuple *keys;
+    uint32_t next;
+};
+
+void hashmap_setup(struct MicroState *state){
+    if (state->range > max_flows){
+        state->error = "skipped: above --max-flows";
+        return;
+    }
+    struct HashMapContext *ctx = calloc(1, sizeof(struct HashMapContext));
+    ctx->map = hashmap_init(state->range, RING_SIZE);
+    ctx->keys = calloc(state->range, sizeof(struct FiveTuple));
+    for (int64_t i = 0; i < state->range; i++){
+        ctx->keys[i] = micro_key(i);
+    }
+    state->ctx = ctx;
+}
+
+void hashmap_fill_setup(struct MicroState *state){
+    hashmap_setup(state);
+    if (state->error){
+        return;
+    }
+    struct HashMapContext *ctx = state->ctx;
+    for (int64_t i = 0; i < state->range; i++){
+        hashmap_new(ctx->map, &ctx->keys[i]);
+    }
+}
+
+void hashmap_teardown(struct MicroState *state){
+    struct HashMapContext *ctx = state->ctx;
+    if (!ctx){
+        return;
+    }
+    hashmap_destroy(ctx->map);
+    free(ctx->keys);
+    free(ctx);
+}
+
+void bm_hashmap_insert(struct MicroState *state){
+    struct HashMapContext *ctx = state->ctx;
+    state->items = state->range;
+    state->label = "fill an empty table";
+    for (uint64_t it = 0; it < state->iterations; it++){
+        struct HashMap *map = hashmap_init(state->range, RING_SIZE);
+        for (int64_t i = 0; i < state->range; i++){
+            hashmap_new(map, &ctx->keys[i]);
+        }
+        hashmap_destroy(map);
+    }
+}
+
+void bm_hashmap_get(struct MicroState *state){
+    struct HashMapContext *ctx = state->ctx;
+    state->items = 1;
+    uint64_t found = 0;
+    for (uint64_t it = 0; it < state->iterations; it++){
+        found += hashmap_get(ctx->map, &ctx->keys[ctx->next]) != NULL;
+        // Stride over the table so consecutive lookups don't hit the same entries
+        ctx->next = (ctx->next + 7919) % state->range;
+    }
+    if (found != state->iterations){
+        state->error = "lookup failed";
+    }
+}
+
+void bm_hashmap_get_slot(struct MicroState *state){
+    struct HashMapContext *ctx = state->ctx;
+    state->items = 1;
+    state->label = "lookup by flow cookie";
+    uint64_t found = 0;
+    for (uint64_t it = 0; it < state->iterations; it++){
+        // The keys were inserted in order, the i-th one is in slot i
+        uint64_t cookie = openflow_flow_cookie(ctx->next, hashmap_generation(ctx->map, ctx->next));
+        int slot;
+        uint16_t generation;
+        if (!openflow_cookie_slot(cookie, &slot, &generation)){
+            found += hashmap_get_slot(ctx->map, slot, generation, &ctx->keys[ctx->next]) != NULL;
+        }
+        ctx->next = (ctx->next + 7919) % state->range;
+    }
+    if (found != state->iterations){
+        state->error = "lookup failed";
+    }
+}
+
+void bm_hashmap_remove(struct MicroState *state){
+    struct HashMapContext *ctx = state->ctx;
+    state->items = 1;
+    state->label = "remove then insert back";
+    for (uint64_t it = 0; it < state->iterations; it++){
+        hashmap_remove(ctx->map, &ctx->keys[ctx->next]);
+        hashmap_new(ctx->map, &ctx->keys[ctx->next]);
+        ctx->next = (ctx->next + 7919) % state->range;
+    }
+}
+
+void bm_hashmap_get_next(struct MicroState *state){
+    struct HashMapContext *ctx = state->ctx;
+    state->items = state->range;
+    state->label = "full iteration";
+    for (uint64_t it = 0; it < state->iterations; it++){
+        struct FiveTuple previous_key = {0};
+        struct FiveTuple current_key;
+        struct RingBuffer *value;
+        // Same iteration as balancer_compute_repartition
+        while (hashmap_get_next(ctx->map, &previous_key, &current_key, &value)){
+            previous_key = current_key;
+        }
+    }
+}
+
+// Sum of the results of a benchmark, so the compiler keeps computing them
+volatile uint64_t sink;
+
+// Flow hashes
+
+struct FlowHashContext {
+    struct FiveTuple *keys;
+    flowhash_function crc32c;
+    struct ToeplitzTable toeplitz;
+    uint8_t rss_key[40];
+};
+
+// Verification vectors of the RSS specification (IPv4 with TCP), for FLOWHASH_RSS_KEY
+static const struct {
+    uint8_t src[4];
+    uint8_t dst[4];
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint32_t hash;
+} rss_vectors[] = {
+    {{66, 9, 149, 187}, {161, 142, 100, 80}, 2794, 1766, 0x51ccc178},
+    {{199, 92, 111, 2}, {65, 69, 140, 83}, 14230, 4739, 0xc626b0ea},
+    {{24, 19, 198, 95}, {12, 22, 207, 184}, 12898, 38024, 0x5c2b394a},
+    {{38, 27, 205, 30}, {209, 142, 163, 6}, 48228, 2217, 0xafc7327f},
+    {{153, 39, 163, 191}, {202, 188, 127, 2}, 44251, 1303, 0x10e828a2},
+};
+
+void flowhash_setup(struct MicroState *state, int backend){
+    struct FlowHashContext *ctx = calloc(1, sizeof(struct FlowHashContext));
+    state->ctx = ctx;
+    ctx->keys = calloc(state->range, sizeof(struct FiveTuple));
+    for (int64_t i = 0; i < state->range; i++){
+        ctx->keys[i] = micro_key(i * 2654435761U);
+    }
+    const uint8_t rss_key[] = FLOWHASH_RSS_KEY;
+    memcpy(ctx->rss_key, rss_key, sizeof(ctx->rss_key));
+    flowhash_toeplitz_init(&ctx->toeplitz, ctx->rss_key, sizeof(ctx->rss_key));
+    if (backend < 0){
+        // Toeplitz: the table must give the hashes of the specification
+        for (size_t i = 0; i < sizeof(rss_vectors) / sizeof(rss_vectors[0]); i++){
+            struct FiveTuple key = {0};
+            key.src_ip = (uint32_t)rss_vectors[i].src[0] << 24 | rss_vectors[i].src[1] << 16 | rss_vectors[i].src[2] << 8 | rss_vectors[i].src[3];
+            key.dst_ip = (uint32_t)rss_vectors[i].dst[0] << 24 | rss_vectors[i].dst[1] << 16 | rss_vectors[i].dst[2] << 8 | rss_vectors[i].dst[3];
+            key.src_port = rss_vectors[i].src_port;
+            key.dst_port = rss_vectors[i].dst_port;
+            key.proto = 6;
+            if (flowhash_toeplitz(&ctx->toeplitz, &key) != rss_vectors[i].hash ||
+                flowhash_toeplitz_reference(ctx->rss_key, &key) != rss_vectors[i].hash){
+                state->error = "Toeplitz hash differs from the RSS verification vectors";
+            }
+        }
+        return;
+    }
+    flowhash_init();
+    ctx->crc32c = flowhash_crc32c_backend(backend);
+    if (!ctx->crc32c){
+        state->error = "skipped: backend not supported by this CPU";
+        return;
+    }
+    flowhash_function portable = flowhash_crc32c_backend(FLOWHASH_PORTABLE);
+    for (int64_t i = 0; i < state->range; i++){
+        if (ctx->crc32c(&ctx->keys[i], 0) != portable(&ctx->keys[i], 0)){
+            state->error = "hash differs from the portable backend";
+            return;
+        }
+    }
+}
+
+void flowhash_portable_setup(struct MicroState *state){
+    flowhash_setup(state, FLOWHASH_PORTABLE);
+}
+
+void flowhash_armv8_setup(struct MicroState *state){
+    flowhash_setup(state, FLOWHASH_ARMV8_CRC);
+}
+
+void flowhash_sse42_setup(struct MicroState *state){
+    flowhash_setup(state, FLOWHASH_SSE42);
+}
+
+void flowhash_toeplitz_setup(struct MicroState *state){
+    flowhash_setup(state, -1);
+}
+
+void flowhash_teardown(struct MicroState *state){
+    struct FlowHashContext *ctx = state->ctx;
+    free(ctx->keys);
+    free(ctx);
+}
+
+void bm_flowhash_crc32c(struct MicroState *state){
+    struct FlowHashContext *ctx = state->ctx;
+    state->items = state->range;
+    uint32_t sum = 0;
+    for (uint64_t it = 0; it < state->iterations; it++){
+        for (int64_t i = 0; i < state->range; i++){
+            sum += ctx->crc32c(&ctx->keys[i], 0);
+        }
+    }
+    sink = sum;
+}
+
+void bm_flowhash_toeplitz(struct MicroState *state){
+    struct FlowHashContext *ctx = state->ctx;
+    state->items = state->range;
+    uint32_t sum = 0;
+    for (uint64_t it = 0; it < state->iterations; it++){
+        for (int64_t i = 0; i < state->range; i++){
+            sum += flowhash_toeplitz(&ctx->toeplitz, &ctx->keys[i]);
+        }
+    }
+    sink = sum;
+}
+
+void bm_flowhash_toeplitz_reference(struct MicroState *state){
+    struct FlowHashContext *ctx = state->ctx;
+    state->items = state->range;
+    uint32_t sum = 0;
+    for (uint64_t it = 0; it < state->iterations; it++){
+        for (int64_t i = 0; i < state->range; i++){
+            sum += flowhash_toeplitz_reference(ctx->rss_key, &ctx->keys[i]);
+        }
+    }
+    sink = sum;
+}
+
+// Ring buffers
+
+void ringbuffer_setup(struct MicroState *state){
+    struct RingBuffer *rb = ringbuffer_init(RING_SIZE);
+    for (int i = 0; i < RING_SIZE; i++){
+        ringbuffer_add(rb, i * 1000);
+    }
+    state->ctx = rb;
+}
+
+void ringbuffer_teardown(struct MicroState *state){
+    ringbuffer_destroy(state->ctx);
+}
+
+void bm_ringbuffer_add(struct MicroState *state){
+    struct RingBuffer *rb = state->ctx;
+    state->items = 1;
+    for (uint64_t it = 0; it < state->iterations; it++){
+        ringbuffer_add(rb, it * 1000);
+    }
+}
+
+void bm_ringbuffer_add_sample(struct MicroState *state){
+    struct RingBuffer *rb = state->ctx;
+    state->items = 1;
+    // A flow polled every second, re-created every 1024 samples
+    struct FlowSample sample = {0};
+    for (uint64_t it = 0; it < state->iterations; it++){
+        uint64_t age = it % 1024 + 1;
+        sample.packets = age * 1000;
+        sample.bytes = age * 64000;
+        sample.time_ns = (it + 1) * 1000000000ULL;
+        sample.age_ns = age * 1000000000ULL;
+        ringbuffer_add_sample(rb, &sample);
+    }
+}
+
+void bm_ringbuffer_get_average(struct MicroState *state){
+    struct RingBuffer *rb = state->ctx;
+    state->items = 1;
+    uint64_t sum = 0;
+    for (uint64_t it = 0; it < state->iterations; it++){
+        sum += ringbuffer_get_average(rb, state->range);
+    }
+    sink = sum;
+}
+
+// Balancer
+
+void balancer_setup(struct MicroState *state){
+    hashmap_fill_setup(state);
+    if (state->error){
+        return;
+    }
+    struct HashMapContext *ctx = state->ctx;
+    // Zipf-like loads, every flow starts on core 0 like new flows do
+    for (int64_t i = 0; i < state->range; i++){
+        struct RingBuffer *rb = hashmap_get(ctx->map, &ctx->keys[i]);
+        ringbuffer_add(rb, 1000000 / (i + 1));
+    }
+}
+
+void bm_balancer_balance(struct MicroState *state){
+    struct HashMapContext *ctx = state->ctx;
+    state->items = state->range;
+    for (uint64_t it = 0; it < state->iterations; it++){
+        struct Migrations migrations = {0};
+        balancer_balance(ctx->map, state->range2, &migrations);
+    }
+}
+
+// OpenFlow parsing
+
+struct OpenFlowContext {
+    int sockets[2];
+    openflow_connection connection;
+    openflow_flows *flows;
+    uint8_t *reply;
+    size_t reply_len;
+    uint8_t *request;
+};
+
+#define MICRO_XID 0x1234
+
+void openflow_setup(struct MicroState *state){
+    struct OpenFlowContext *ctx = calloc(1, sizeof(struct OpenFlowContext));
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, ctx->sockets)){
+        state->error = "socketpair failed";
+        free(ctx);
+        return;
+    }
+    // The whole reply is written before openflow_get_flows reads it
+    int buffer_size = 4 << 20;
+    for (int i = 0; i < 2; i++){
+        setsockopt(ctx->sockets[i], SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+        setsockopt(ctx->sockets[i], SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    }
+    state->ctx = ctx;
+    ctx->connection.fd = ctx->sockets[0];
+    ctx->flows = calloc(1, sizeof(openflow_flows));
+    ctx->request = malloc(sizeof(openflow_stats_request_message));
+    // Canned multipart reply
+    struct MockSwitchConfig config;
+    mock_switch_default_config(&config);
+    config.nb_flows = state->range;
+    struct MockSwitch sw;
+    if (mock_switch_init(&sw, &config)){
+        state->error = "invalid number of flows";
+        return;
+    }
+    ctx->reply = mock_switch_flow_stats_reply(&sw, MICRO_XID, 0, 0, &ctx->reply_len);
+    mock_switch_destroy(&sw);
+}
+
+void openflow_teardown(struct MicroState *state){
+    struct OpenFlowContext *ctx = state->ctx;
+    if (!ctx){
+        return;
+    }
+    close(ctx->sockets[0]);
+    close(ctx->sockets[1]);
+    free(ctx->flows);
+    free(ctx->reply);
+    free(ctx->request);
+    free(ctx);
+}
+
+void bm_openflow_get_flows(struct MicroState *state){
+    struct OpenFlowContext *ctx = state->ctx;
+    state->items = state->range;
+    state->label = "canned multipart reply over a socketpair";
+    for (uint64_t it = 0; it < state->iterations; it++){
+        if (write(ctx->sockets[1], ctx->reply, ctx->reply_len) != (ssize_t)ctx->reply_len){
+            state->error = "could not write the canned reply";
+            return;
+        }
+        transaction_id = MICRO_XID;
+        openflow_get_flows(&ctx->connection, ctx->flows);
+        openflow_free_flows(ctx->flows);
+        // Drop the request sent by openflow_get_flows
+        if (read(ctx->sockets[1], ctx->request, sizeof(openflow_stats_request_message)) < 0){
+            state->error = "could not read the request";
+            return;
+        }
+    }
+}
+
+struct MicroBenchmark benchmarks[] = {
+    {"hashmap_insert", hashmap_setup, bm_hashmap_insert, hashmap_teardown, 1024, 0},
+    {"hashmap_insert", hashmap_setup, bm_hashmap_insert, hashmap_teardown, 8192, 0},
+    {"hashmap_insert", hashmap_setup, bm_hashmap_insert, hashmap_teardown, 65536, 0},
+    {"hashmap_insert", hashmap_setup, bm_hashmap_insert, hashmap_teardown, 1048576, 0},
+    {"hashmap_get", hashmap_fill_setup, bm_hashmap_get, hashmap_teardown, 1024, 0},
+    {"hashmap_get", hashmap_fill_setup, bm_hashmap_get, hashmap_teardown, 8192, 0},
+    {"hashmap_get", hashmap_fill_setup, bm_hashmap_get, hashmap_teardown, 65536, 0},
+    {"hashmap_get", hashmap_fill_setup, bm_hashmap_get, hashmap_teardown, 1048576, 0},
+    {"hashmap_get_slot", hashmap_fill_setup, bm_hashmap_get_slot, hashmap_teardown, 1024, 0},
+    {"hashmap_get_slot", hashmap_fill_setup, bm_hashmap_get_slot, hashmap_teardown, 65536, 0},
+    {"hashmap_get_slot", hashmap_fill_setup, bm_hashmap_get_slot, hashmap_teardown, 1048576, 0},
+    {"hashmap_remove", hashmap_fill_setup, bm_hashmap_remove, hashmap_teardown, 1024, 0},
+    {"hashmap_remove", hashmap_fill_setup, bm_hashmap_remove, hashmap_teardown, 8192, 0},
+    {"hashmap_remove", hashmap_fill_setup, bm_hashmap_remove, hashmap_teardown, 65536, 0},
+    {"hashmap_remove", hashmap_fill_setup, bm_hashmap_remove, hashmap_teardown, 1048576, 0},
+    {"hashmap_get_next", hashmap_fill_setup, bm_hashmap_get_next, hashmap_teardown, 1024, 0},
+    {"hashmap_get_next", hashmap_fill_setup, bm_hashmap_get_next, hashmap_teardown, 8192, 0},
+    {"hashmap_get_next", hashmap_fill_setup, bm_hashmap_get_next, hashmap_teardown, 65536, 0},
+    {"hashmap_get_next", hashmap_fill_setup, bm_hashmap_get_next, hashmap_teardown, 1048576, 0},
+    {"flowhash_crc32c_portable", flowhash_portable_setup, bm_flowhash_crc32c, flowhash_teardown, 1024, 0},
+    {"flowhash_crc32c_armv8", flowhash_armv8_setup, bm_flowhash_crc32c, flowhash_teardown, 1024, 0},
+    {"flowhash_crc32c_sse42", flowhash_sse42_setup, bm_flowhash_crc32c, flowhash_teardown, 1024, 0},
+    {"flowhash_toeplitz", flowhash_toeplitz_setup, bm_flowhash_toeplitz, flowhash_teardown, 1024, 0},
+    {"flowhash_toeplitz_reference", flowhash_toeplitz_setup, bm_flowhash_toeplitz_reference, flowhash_teardown, 1024, 0},
+    {"ringbuffer_add", ringbuffer_setup, bm_ringbuffer_add, ringbuffer_teardown, 0, 0},
+    {"ringbuffer_add_sample", ringbuffer_setup, bm_ringbuffer_add_sample, ringbuffer_teardown, 0, 0},
+    {"ringbuffer_get_average", ringbuffer_setup, bm_ringbuffer_get_average, ringbuffer_teardown, 4, 0},
+    {"ringbuffer_get_average", ringbuffer_setup, bm_ringbuffer_get_average, ringbuffer_teardown, RING_SIZE, 0},
+    {"balancer_balance", balancer_setup, bm_balancer_balance, hashmap_teardown, 1024, 2},
+    {"balancer_balance", balancer_setup, bm_balancer_balance, hashmap_teardown, 1024, NB_CORES},
+    {"balancer_balance", balancer_setup, bm_balancer_balance, hashmap_teardown, 8192, 2},
+    {"balancer_balance", balancer_setup, bm_balancer_balance, hashmap_teardown, 8192, NB_CORES},
+    {"balancer_balance", balancer_setup, bm_balancer_balance, hashmap_teardown, 65536, 2},
+    {"balancer_balance", balancer_setup, bm_balancer_balance, hashmap_teardown, 65536, NB_CORES},
+    {"balancer_balance", balancer_setup, bm_balancer_balance, hashmap_teardown, 65536, 64},
+    {"openflow_get_flows", openflow_setup, bm_openflow_get_flows, openflow_teardown, 64, 0},
+    {"openflow_get_flows", openflow_setup, bm_openflow_get_flows, openflow_teardown, 256, 0},
+    {"openflow_get_flows", openflow_setup, bm_openflow_get_flows, openflow_teardown, MAX_HANDLED_FLOWS, 0},
+};
+
+/**
+ * @brief Names a benchmark instance like Google Benchmark: family/range/range2
+ */
+void micro_name(struct MicroBenchmark *bm, char *name, size_t len){
+    if (bm->range2){
+        snprintf(name, len, "%s/%ld/%ld", bm->family, bm->range, bm->range2);
+    } else if (bm->range){
+        snprintf(name, len, "%s/%ld", bm->family, bm->range);
+    } else {
+        snprintf(name, len, "%s", bm->family);
+    }
+}
+
+/**
+ * @brief Runs a benchmark with more and more iterations until it lasts `min_time_ns`
+ */
+void micro_run(struct MicroBenchmark *bm, uint64_t min_time_ns, struct MicroResult *result){
+    memset(result, 0, sizeof(*result));
+    micro_name(bm, result->name, sizeof(result->name));
+    struct MicroState state = {0};
+    state.range = bm->range;
+    state.range2 = bm->range2;
+    bm->setup(&state);
+    uint64_t iterations = 1;
+    while (!state.error){
+        state.iterations = iterations;
+        uint64_t real_start = bench_now_ns();
+        uint64_t cpu_start = bench_cpu_ns();
+        bm->run(&state);
+        uint64_t cpu_ns = bench_cpu_ns() - cpu_start;
+        uint64_t real_ns = bench_now_ns() - real_start;
+        if (real_ns >= min_time_ns || iterations >= (1ULL << 40)){
+            result->iterations = iterations;
+            result->real_ns = (double)real_ns / iterations;
+            result->cpu_ns = (double)cpu_ns / iterations;
+            result->items_per_second = cpu_ns ? state.items * iterations * 1e9 / cpu_ns : 0;
+            break;
+        }
+        // Aim at 1.4x the minimum time, like Google Benchmark
+        uint64_t next = real_ns ? (uint64_t)(iterations * 1.4 * min_time_ns / real_ns) : iterations * 10;
+        if (next > iterations * 10){
+            next = iterations * 10;
+        }
+        iterations = next > iterations ? next : iterations + 1;
+    }
+    result->label = state.label;
+    result->error = state.error;
+    bm->teardown(&state);
+}
+
+void micro_print(FILE *out, struct MicroResult *result){
+    if (result->error){
+        fprintf(out, "%-40s ERROR OCCURRED: '%s'\n", result->name, result->error);
+        return;
+    }
+    fprintf(out, "%-40s %13.0f ns %13.0f ns %12lu", result->name, result->real_ns, result->cpu_ns, result->iterations);
+    if (result->items_per_second > 0){
+        fprintf(out, " items_per_second=%.4g/s", result->items_per_second);
+    }
+    if (result->label){
+        fprintf(out, " %s", result->label);
+    }
+    fprintf(out, "\n");
+}
+
+void micro_write_json(const char *path, struct MicroResult *results, int nb_results, const char *executable){
+    FILE *json = fopen(path, "w");
+    if (!json){
+        printf("Could not open %s\n", path);
+        return;
+    }
+    char date[64];
+    time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    struct utsname host;
+    uname(&host);
+    fprintf(json, "{\n  \"context\": {\n");
+    fprintf(json, "    \"date\": \"%s\",\n", date);
+    fprintf(json, "    \"host_name\": \"%s\",\n", host.nodename);
+    fprintf(json, "    \"executable\": \"%s\",\n", executable);
+    fprintf(json, "    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+#ifdef NDEBUG
+    fprintf(json, "    \"library_build_type\": \"release\"\n");
+#else
+    fprintf(json, "    \"library_build_type\": \"debug\"\n");
+#endif
+    fprintf(json, "  },\n  \"benchmarks\": [\n");
+    for (int i = 0; i < nb_results; i++){
+        struct MicroResult *result = &results[i];
+        fprintf(json, "    {\n");
+        fprintf(json, "      \"name\": \"%s\",\n", result->name);
+        fprintf(json, "      \"run_name\": \"%s\",\n", result->name);
+        fprintf(json, "      \"run_type\": \"iteration\",\n");
+        fprintf(json, "      \"repetitions\": 1,\n");
+        fprintf(json, "      \"repetition_index\": 0,\n");
+        fprintf(json, "      \"threads\": 1,\n");
+        if (result->error){
+            fprintf(json, "      \"error_occurred\": true,\n");
+            fprintf(json, "      \"error_message\": \"%s\"\n", result->error);
+        } else {
+            fprintf(json, "      \"iterations\": %lu,\n", result->iterations);
+            fprintf(json, "      \"real_time\": %.6e,\n", result->real_ns);
+            fprintf(json, "      \"cpu_time\": %.6e,\n", result->cpu_ns);
+            fprintf(json, "      \"time_unit\": \"ns\"");
+            if (result->items_per_second > 0){
+                fprintf(json, ",\n      \"items_per_second\": %.6e", result->items_per_second);
+            }
+            if (result->label){
+                fprintf(json, ",\n      \"label\": \"%s\"", result->label);
+            }
+            fprintf(json, "\n");
+        }
+        fprintf(json, "    }%s\n", i + 1 < nb_results ? "," : "");
+    }
+    fprintf(json, "  ]\n}\n");
+    fclose(json);
+}
+
+void usage(const char *prog){
+    fprintf(stderr, "Usage: %s [options]\n"
+        "  --filter SUBSTRING    only run the benchmarks whose name contains SUBSTRING\n"
+        "  --min-time S          minimum duration of each benchmark (default 0.5)\n"
+        "  --max-flows N         skip the flow table sizes above N (default 1048576)\n"
+        "  --json FILE           write the results to FILE in Google Benchmark JSON format\n"
+        "  --verbose             keep the output of the daemon code\n",
+        prog);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *filter = NULL;
+    const char *json_path = NULL;
+    double min_time = 0.5;
+    int verbose = 0;
+    static struct option options[] = {
+        {"filter", required_argument, 0, 'f'},
+        {"min-time", required_argument, 0, 't'},
+        {"max-flows", required_argument, 0, 'm'},
+        {"json", required_argument, 0, 'j'},
+        {"verbose", no_argument, 0, 'v'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1){
+        switch (opt){
+        case 'f': filter = optarg; break;
+        case 't': min_time = atof(optarg); break;
+        case 'm': max_flows = atol(optarg); break;
+        case 'j': json_path = optarg; break;
+        case 'v': verbose = 1; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    FILE *out = bench_report_stream(verbose);
+    int nb_benchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    struct MicroResult *results = calloc(nb_benchmarks, sizeof(struct MicroResult));
+    int nb_results = 0;
+    fprintf(out, "%-40s %16s %16s %12s\n", "Benchmark", "Time", "CPU", "Iterations");
+    fprintf(out, "-------------------------------------------------------------------------------------------\n");
+    for (int i = 0; i < nb_benchmarks; i++){
+        struct MicroResult *result = &results[nb_results];
+        micro_name(&benchmarks[i], result->name, sizeof(result->name));
+        if (filter && !strstr(result->name, filter)){
+            continue;
+        }
+        micro_run(&benchmarks[i], (uint64_t)(min_time * 1e9), result);
+        micro_print(out, result);
+        fflush(out);
+        nb_results++;
+    }
+    if (json_path){
+        micro_write_json(json_path, results, nb_results, argv[0]);
+    }
+    fclose(out);
+    free(results);
+    return 0;
+}
@@ -0,0 +1,1065 @@
+#include "mock_switch.h"
+#include <math.h>
+
+// Largest number of flow entries fitting in a single STATS_REPLY
+#define MOCK_ENTRY_LEN (sizeof(openflow_flow_stats) + sizeof(openflow_action_vlan_vid) + sizeof(openflow_action_output))
+#define MOCK_FLOWS_PER_REPLY ((0xFFFF - OFP_HEADER_LEN - sizeof(openflow_flow_stats_reply_header)) / MOCK_ENTRY_LEN)
+// Upper bound of an OFPMP_FLOW entry: stats, 5-tuple match and VLAN instructions
+#define MOCK13_ENTRY_MAX_LEN 160
+#define MOCK13_FLOWS_PER_REPLY ((0xFFFF - OFP_HEADER_LEN - sizeof(openflow13_multipart_header)) / MOCK13_ENTRY_MAX_LEN)
+// Connections of mock_switch_packet_in: from 10.2.0.1 and up to 10.1.0.1:443, apart from the synthetic flows
+#define MOCK_SETUP_SRC_IP 0x0A020001
+#define MOCK_SETUP_DST_PORT 443
+#define MOCK_SETUP_PORTS 60000
+// Ethernet, IPv4 and TCP headers of the first packet of a connection, the frame is padded to 64 bytes
+#define MOCK_SETUP_HEADERS_LEN 54
+#define MOCK_SETUP_FRAME_LEN 64
+// Upper bound of a PACKET_IN: OpenFlow 1.3 body, match on the ingress port, padding and the whole frame
+#define MOCK_PACKET_IN_MAX_LEN (OFP_HEADER_LEN + sizeof(openflow13_packet_in) + 16 + 2 + MOCK_SETUP_FRAME_LEN)
+
+void mock_switch_default_config(struct MockSwitchConfig *config){
+    config->nb_flows = 1000;
+    config->distribution = MOCK_RATES_ZIPF;
+    config->zipf_exponent = 1.1;
+    config->elephant_share = 0.05;
+    config->elephant_ratio = 100;
+    config->total_rate = 10000000;
+    config->churn = 0;
+    config->echo_interval = 5;
+    config->of_version = OFP_VERSION;
+    config->seed = 42;
+}
+
+/**
+ * @brief Gives a new key to the flow in slot `idx`, its rate is kept
+ */
+void mock_switch_new_flow(struct MockSwitch *sw, int idx){
+    struct MockFlow *flow = &sw->flows[idx];
+    uint32_t id = sw->next_port++;
+    flow->key.src_ip = 0x0A000001 + id / 60000; // 10.0.0.1 and up
+    flow->key.dst_ip = 0x0A010001; // 10.1.0.1
+    flow->key.src_port = 1024 + id % 60000;
+    flow->key.dst_port = 80;
+    flow->key.proto = TCP_PROTO;
+    flow->packet_count = 0;
+    flow->created_tick = sw->tick;
+    // New flows are not steered yet, they are on the default core like in the flow table
+    flow->vlan = 0;
+    flow->pinned = 0;
+    flow->cookie = 0;
+}
+
+/**
+ * @brief Gives the bucket of the group a flow hashes to
+ */
+int mock_flow_bucket(struct MockSwitch *sw, struct MockFlow *flow){
+    uint32_t hash = flow->key.src_ip * 2654435761U;
+    hash ^= (flow->key.dst_ip + flow->key.src_port * 40503U + flow->key.dst_port + flow->key.proto) * 2246822519U;
+    hash ^= hash >> 15;
+    return hash % sw->nb_buckets;
+}
+
+/**
+ * @brief Tells whether the group steers a flow
+ */
+uint8_t mock_flow_in_group(struct MockSwitch *sw, struct MockFlow *flow){
+    return sw->group_rule && sw->nb_buckets > 0 && !flow->pinned;
+}
+
+/**
+ * @brief Gives the VLAN the packets of a flow leave with
+ */
+uint16_t mock_flow_vlan(struct MockSwitch *sw, struct MockFlow *flow){
+    return mock_flow_in_group(sw, flow) ? sw->group_vlans[mock_flow_bucket(sw, flow)] : flow->vlan;
+}
+
+int mock_switch_init(struct MockSwitch *sw, struct MockSwitchConfig *config){
+    memset(sw, 0, sizeof(*sw));
+    sw->config = *config;
+    sw->fd = -1;
+    if (config->nb_flows <= 0 || config->nb_flows > MAX_HANDLED_FLOWS){
+        printf("The mock switch handles between 1 and %d flows\n", MAX_HANDLED_FLOWS);
+        return -1;
+    }
+    if (config->of_version != OFP_VERSION && config->of_version != OFP13_VERSION && config->of_version != OFP14_VERSION){
+        printf("The mock switch speaks OpenFlow 1.0, 1.3 and 1.4\n");
+        return -1;
+    }
+    srand(config->seed);
+    sw->flows = calloc(config->nb_flows, sizeof(struct MockFlow));
+    double *weights = calloc(config->nb_flows, sizeof(double));
+    double total_weight = 0;
+    int nb_elephants = (int)(config->elephant_share * config->nb_flows + 0.5);
+    for (int i = 0; i < config->nb_flows; i++){
+        switch (config->distribution){
+        case MOCK_RATES_ZIPF:
+            weights[i] = 1.0 / pow(i + 1, config->zipf_exponent);
+            break;
+        case MOCK_RATES_ELEPHANTS:
+            weights[i] = i < nb_elephants ? config->elephant_ratio : 1.0;
+            break;
+        default:
+            weights[i] = 1.0;
+            break;
+        }
+        total_weight += weights[i];
+    }
+    for (int i = 0; i < config->nb_flows; i++){
+        mock_switch_new_flow(sw, i);
+        sw->flows[i].rate = (uint64_t)(config->total_rate * weights[i] / total_weight);
+        if (sw->flows[i].rate == 0){
+            sw->flows[i].rate = 1;
+        }
+    }
+    free(weights);
+    pthread_mutex_init(&sw->lock, NULL);
+    return 0;
+}
+
+/**
+ * @brief Reads exactly `count` bytes, returns -1 if the connection was closed
+ */
+int mock_read_full(int fd, void *buf, size_t count){
+    size_t bytes_read = 0;
+    while (bytes_read < count){
+        ssize_t valread = read(fd, (uint8_t *)buf + bytes_read, count - bytes_read);
+        if (valread <= 0){
+            return -1;
+        }
+        bytes_read += valread;
+    }
+    return 0;
+}
+
+/**
+ * @brief Sends a message made of a header and an optional body
+ */
+void mock_send(struct MockSwitch *sw, uint8_t type, uint32_t xid, void *body, uint16_t body_len){
+    // A single write, the controller reads headers without waiting for the rest of them
+    uint8_t *message = malloc(OFP_HEADER_LEN + body_len);
+    openflow_header *header = (openflow_header *)message;
+    header->version = sw->version ? sw->version : OFP_VERSION;
+    header->type = type;
+    header->length = htons(OFP_HEADER_LEN + body_len);
+    header->xid = htonl(xid);
+    if (body_len > 0){
+        memcpy(message + OFP_HEADER_LEN, body, body_len);
+    }
+    if (write(sw->fd, message, OFP_HEADER_LEN + body_len) < 0){
+        printf("Mock switch: could not send message type %u\n", type);
+    }
+    free(message);
+}
+
+void mock_send_features_reply(struct MockSwitch *sw, uint32_t xid){
+    struct {
+        openflow_features features;
+        openflow_port_data ports[2];
+    } reply = {0};
+    reply.features.datapath_id = htonll(0x0000cafecafecafeULL);
+    reply.features.n_buffers = htonl(256);
+    reply.features.n_tables = 1;
+    reply.ports[0].port_no = htons(OVS_NETWORK_IFINDEX);
+    strcpy(reply.ports[0].name, "p0");
+    reply.ports[1].port_no = htons(OVS_HOST_IFINDEX);
+    strcpy(reply.ports[1].name, "pf0hpf");
+    // OpenFlow 1.3 describes ports in a separate multipart request
+    uint16_t len = sw->version >= OFP13_VERSION ? sizeof(reply.features) : sizeof(reply);
+    mock_send(sw, OFP_FEATURES_REPLY, xid, &reply, len);
+}
+
+/**
+ * @brief Gives the versions the switch offers, as a HELLO version bitmap
+ */
+uint32_t mock_version_bitmap(struct MockSwitch *sw){
+    uint32_t bitmap = 1U << OFP_VERSION;
+    if (sw->config.of_version >= OFP13_VERSION){
+        bitmap |= 1U << OFP13_VERSION;
+    }
+    if (sw->config.of_version >= OFP14_VERSION){
+        bitmap |= 1U << OFP14_VERSION;
+    }
+    return bitmap;
+}
+
+void mock_send_hello(struct MockSwitch *sw){
+    // Offered before the negotiation
+    sw->version = sw->config.of_version;
+    if (sw->version == OFP_VERSION){
+        mock_send(sw, OFP_HELLO, 0, NULL, 0);
+        return;
+    }
+    uint8_t element[8];
+    uint16_t element_header[2] = {htons(OFPHET_VERSIONBITMAP), htons(sizeof(element))};
+    uint32_t bitmap = htonl(mock_version_bitmap(sw));
+    memcpy(element, element_header, sizeof(element_header));
+    memcpy(element + sizeof(element_header), &bitmap, sizeof(bitmap));
+    mock_send(sw, OFP_HELLO, 0, element, sizeof(element));
+}
+
+/**
+ * @brief Picks the version from the HELLO of the controller, like openflow_create_connection
+ */
+void mock_negotiate_version(struct MockSwitch *sw, openflow_header *header, uint8_t *body, uint16_t body_len){
+    uint32_t common = 0;
+    uint8_t *element = body;
+    while (element + 8 <= body + body_len){
+        uint16_t type = ntohs(*(uint16_t *)element);
+        uint16_t len = ntohs(*(uint16_t *)(element + 2));
+        if (len < 4){
+            break;
+        }
+        if (type == OFPHET_VERSIONBITMAP){
+            uint32_t bitmap;
+            memcpy(&bitmap, element + 4, sizeof(bitmap));
+            common = ntohl(bitmap) & mock_version_bitmap(sw);
+        }
+        element += (len + 7) & ~7;
+    }
+    if (common){
+        sw->version = 31;
+        while (!(common & (1U << sw->version))){
+            sw->version--;
+        }
+    } else {
+        sw->version = header->version < sw->config.of_version ? header->version : sw->config.of_version;
+        if (sw->version != OFP14_VERSION && sw->version != OFP13_VERSION){
+            sw->version = OFP_VERSION;
+        }
+    }
+}
+
+/**
+ * @brief Advances the emulated time by one tick: counters grow and some flows are replaced
+ */
+void mock_switch_tick(struct MockSwitch *sw){
+    for (int i = 0; i < sw->config.nb_flows; i++){
+        sw->flows[i].packet_count += sw->flows[i].rate;
+        if (mock_flow_in_group(sw, &sw->flows[i])){
+            sw->bucket_packets[mock_flow_bucket(sw, &sw->flows[i])] += sw->flows[i].rate;
+        }
+    }
+    sw->churn_carry += sw->config.churn * sw->config.nb_flows;
+    while (sw->churn_carry >= 1){
+        mock_switch_new_flow(sw, rand() % sw->config.nb_flows);
+        sw->churned_flows++;
+        sw->churn_carry -= 1;
+    }
+    sw->tick++;
+}
+
+/**
+ * @brief Writes the stats entry of a flow, with its SET_VLAN_VID and OUTPUT actions
+ */
+void mock_fill_entry(struct MockSwitch *sw, struct MockFlow *flow, uint8_t *entry){
+    openflow_flow_stats *stats = (openflow_flow_stats *)entry;
+    memset(stats, 0, sizeof(*stats));
+    stats->length = htons(MOCK_ENTRY_LEN);
+    stats->match.wildcards = htonl(OFPW_MATCH_FIVE_TUPLE);
+    stats->match.in_port = htons(OVS_NETWORK_IFINDEX);
+    stats->match.dl_type = htons(IPV4_ETH_TYPE);
+    stats->match.nw_proto = flow->key.proto;
+    stats->match.nw_src = htonl(flow->key.src_ip);
+    stats->match.nw_dst = htonl(flow->key.dst_ip);
+    stats->match.tp_src = htons(flow->key.src_port);
+    stats->match.tp_dst = htons(flow->key.dst_port);
+    stats->duration_sec = htonl(sw->tick - flow->created_tick);
+    stats->cookie.hi = htonl(flow->cookie >> 32);
+    stats->cookie.lo = htonl(flow->cookie & 0xFFFFFFFF);
+    stats->packet_count.hi = htonl(flow->packet_count >> 32);
+    stats->packet_count.lo = htonl(flow->packet_count & 0xFFFFFFFF);
+    stats->byte_count.hi = htonl((flow->packet_count * 64) >> 32);
+    stats->byte_count.lo = htonl((flow->packet_count * 64) & 0xFFFFFFFF);
+    openflow_action_vlan_vid *vlan_vid = (openflow_action_vlan_vid *)(entry + sizeof(openflow_flow_stats));
+    vlan_vid->type = htons(OFPAT_SET_VLAN_VID);
+    vlan_vid->len = htons(sizeof(openflow_action_vlan_vid));
+    vlan_vid->vlan_vid = htons(flow->vlan);
+    vlan_vid->pad[0] = vlan_vid->pad[1] = 0;
+    openflow_action_output *output = (openflow_action_output *)(vlan_vid + 1);
+    output->type = htons(OFPAT_OUTPUT);
+    output->len = htons(sizeof(openflow_action_output));
+    output->port = htons(OVS_HOST_IFINDEX);
+    output->max_len = 0;
+}
+
+/**
+ * @brief Writes the OFPMP_FLOW entry of a flow, with its OXM match and VLAN instructions
+ */
+uint16_t mock_fill_entry13(struct MockSwitch *sw, struct MockFlow *flow, uint8_t *entry){
+    openflow13_flow_stats *stats = (openflow13_flow_stats *)entry;
+    memset(stats, 0, sizeof(*stats));
+    stats->duration_sec = htonl(sw->tick - flow->created_tick);
+    stats->cookie = htonll(flow->cookie);
+    stats->packet_count = htonll(flow->packet_count);
+    stats->byte_count = htonll(flow->packet_count * 64);
+    uint8_t *body = entry + sizeof(*stats);
+    body += openflow13_put_match(body, OVS_NETWORK_IFINDEX, &flow->key);
+    body += openflow13_put_vlan_instructions(body, flow->vlan, OVS_HOST_IFINDEX, 0);
+    stats->length = htons(body - entry);
+    return body - entry;
+}
+
+/**
+ * @brief Gives the flows having their own rule, all of them until the group rule is added, whose cookie matches
+ */
+struct MockFlow **mock_listed_flows(struct MockSwitch *sw, uint64_t cookie, uint64_t cookie_mask, int *nb_listed){
+    struct MockFlow **listed = malloc(sw->config.nb_flows * sizeof(struct MockFlow *));
+    *nb_listed = 0;
+    for (int i = 0; i < sw->config.nb_flows; i++){
+        if ((!sw->group_rule || sw->flows[i].pinned) && !((sw->flows[i].cookie ^ cookie) & cookie_mask)){
+            listed[(*nb_listed)++] = &sw->flows[i];
+        }
+    }
+    return listed;
+}
+
+/**
+ * @brief mock_switch_flow_stats_reply in OpenFlow 1.3 and later
+ */
+uint8_t *mock_flow_stats_multipart_reply(struct MockSwitch *sw, uint32_t xid, uint64_t cookie, uint64_t cookie_mask, size_t *len){
+    int nb_listed;
+    struct MockFlow **listed = mock_listed_flows(sw, cookie, cookie_mask, &nb_listed);
+    int nb_messages = (nb_listed + MOCK13_FLOWS_PER_REPLY - 1) / MOCK13_FLOWS_PER_REPLY + 1;
+    size_t max_len = nb_messages * (OFP_HEADER_LEN + sizeof(openflow13_multipart_header)) + nb_listed * MOCK13_ENTRY_MAX_LEN;
+    uint8_t *stream = malloc(max_len);
+    uint8_t *message = stream;
+    int sent = 0;
+    do {
+        int nb_entries = nb_listed - sent;
+        if (nb_entries > (int)MOCK13_FLOWS_PER_REPLY){
+            nb_entries = MOCK13_FLOWS_PER_REPLY;
+        }
+        openflow_header *header = (openflow_header *)message;
+        openflow13_multipart_header *reply_header = (openflow13_multipart_header *)(message + OFP_HEADER_LEN);
+        memset(reply_header, 0, sizeof(*reply_header));
+        reply_header->type = htons(OFPMP_FLOW);
+        reply_header->flags = htons(sent + nb_entries < nb_listed ? OFPMPF_REPLY_MORE : 0);
+        uint8_t *entry = (uint8_t *)(reply_header + 1);
+        for (int i = 0; i < nb_entries; i++){
+            entry += mock_fill_entry13(sw, listed[sent + i], entry);
+        }
+        header->version = sw->version;
+        header->type = OFPT13_MULTIPART_REPLY;
+        header->length = htons(entry - message);
+        header->xid = htonl(xid);
+        message = entry;
+        sent += nb_entries;
+    } while (sent < nb_listed);
+    free(listed);
+    *len = message - stream;
+    return stream;
+}
+
+uint8_t *mock_switch_flow_stats_reply(struct MockSwitch *sw, uint32_t xid, uint64_t cookie, uint64_t cookie_mask, size_t *len){
+    if (sw->version >= OFP13_VERSION){
+        return mock_flow_stats_multipart_reply(sw, xid, cookie, cookie_mask, len);
+    }
+    int nb_messages = (sw->config.nb_flows + MOCK_FLOWS_PER_REPLY - 1) / MOCK_FLOWS_PER_REPLY;
+    size_t max_len = nb_messages * (OFP_HEADER_LEN + sizeof(openflow_flow_stats_reply_header)) + sw->config.nb_flows * MOCK_ENTRY_LEN;
+    uint8_t *stream = malloc(max_len);
+    uint8_t *message = stream;
+    int sent = 0;
+    do {
+        int nb_entries = sw->config.nb_flows - sent;
+        if (nb_entries > (int)MOCK_FLOWS_PER_REPLY){
+            nb_entries = MOCK_FLOWS_PER_REPLY;
+        }
+        openflow_header *header = (openflow_header *)message;
+        openflow_flow_stats_reply_header *reply_header = (openflow_flow_stats_reply_header *)(message + OFP_HEADER_LEN);
+        reply_header->type = htons(OFPST_FLOW);
+        reply_header->flags = htons(sent + nb_entries < sw->config.nb_flows ? OFPSF_REPLY_MORE : 0);
+        uint8_t *entry = (uint8_t *)(reply_header + 1);
+        for (int i = 0; i < nb_entries; i++){
+            mock_fill_entry(sw, &sw->flows[sent + i], entry);
+            entry += MOCK_ENTRY_LEN;
+        }
+        header->version = OFP_VERSION;
+        header->type = OFP_STATS_REPLY;
+        header->length = htons(entry - message);
+        header->xid = htonl(xid);
+        message = entry;
+        sent += nb_entries;
+    } while (sent < sw->config.nb_flows);
+    *len = message - stream;
+    return stream;
+}
+
+void mock_send_flow_stats(struct MockSwitch *sw, uint32_t xid, uint64_t cookie, uint64_t cookie_mask){
+    pthread_mutex_lock(&sw->lock);
+    mock_switch_tick(sw);
+    sw->stats_requests++;
+    size_t len;
+    uint8_t *stream = mock_switch_flow_stats_reply(sw, xid, cookie, cookie_mask, &len);
+    pthread_mutex_unlock(&sw->lock);
+    if (write(sw->fd, stream, len) < 0){
+        printf("Mock switch: could not send flow stats\n");
+    }
+    free(stream);
+}
+
+/**
+ * @brief Replies to an OFPMP_GROUP request with the counters of the buckets, without advancing the time
+ */
+void mock_send_group_stats(struct MockSwitch *sw, uint32_t xid){
+    pthread_mutex_lock(&sw->lock);
+    int nb_buckets = sw->nb_buckets;
+    size_t entry_len = sizeof(openflow13_group_stats) + nb_buckets * sizeof(openflow13_bucket_counter);
+    size_t len = OFP_HEADER_LEN + sizeof(openflow13_multipart_header) + (nb_buckets ? entry_len : 0);
+    uint8_t *message = calloc(1, len);
+    openflow_header *header = (openflow_header *)message;
+    header->version = sw->version;
+    header->type = OFPT13_MULTIPART_REPLY;
+    header->length = htons(len);
+    header->xid = htonl(xid);
+    openflow13_multipart_header *reply_header = (openflow13_multipart_header *)(message + OFP_HEADER_LEN);
+    reply_header->type = htons(OFPMP_GROUP);
+    if (nb_buckets){
+        openflow13_group_stats *group_stats = (openflow13_group_stats *)(reply_header + 1);
+        group_stats->length = htons(entry_len);
+        group_stats->group_id = htonl(BUCKET_GROUP_ID);
+        group_stats->ref_count = htonl(sw->group_rule);
+        openflow13_bucket_counter *counters = (openflow13_bucket_counter *)(group_stats + 1);
+        uint64_t total = 0;
+        for (int i = 0; i < nb_buckets; i++){
+            counters[i].packet_count = htonll(sw->bucket_packets[i]);
+            counters[i].byte_count = htonll(sw->bucket_packets[i] * 64);
+            total += sw->bucket_packets[i];
+        }
+        group_stats->packet_count = htonll(total);
+        group_stats->byte_count = htonll(total * 64);
+    }
+    pthread_mutex_unlock(&sw->lock);
+    if (write(sw->fd, message, len) < 0){
+        printf("Mock switch: could not send group stats\n");
+    }
+    free(message);
+}
+
+/**
+ * @brief Applies a GROUP_MOD: only the single group of the bucket steering is emulated
+ */
+void mock_apply_group_mod(struct MockSwitch *sw, uint8_t *body, uint16_t body_len){
+    if (body_len < sizeof(openflow13_group_mod)){
+        return;
+    }
+    openflow13_group_mod *group_mod = (openflow13_group_mod *)body;
+    pthread_mutex_lock(&sw->lock);
+    sw->group_mods++;
+    if (ntohs(group_mod->command) == OFPGC_DELETE){
+        // The rules forwarding to the group go with it
+        sw->nb_buckets = 0;
+        sw->group_rule = 0;
+        memset(sw->bucket_packets, 0, sizeof(sw->bucket_packets));
+        pthread_mutex_unlock(&sw->lock);
+        return;
+    }
+    int nb_buckets = 0;
+    uint8_t *bucket = body + sizeof(*group_mod);
+    uint8_t *end = body + body_len;
+    while (bucket + sizeof(openflow13_bucket) <= end && nb_buckets < OPENFLOW13_MAX_BUCKETS){
+        uint16_t len = ntohs(((openflow13_bucket *)bucket)->len);
+        if (len < sizeof(openflow13_bucket) || bucket + len > end){
+            break;
+        }
+        action_descriptor actions[MAX_ACTIONS];
+        uint8_t nb_actions = 0;
+        openflow13_parse_actions(bucket + sizeof(openflow13_bucket), bucket + len, actions, &nb_actions);
+        sw->group_vlans[nb_buckets] = 0;
+        for (uint8_t i = 0; i < nb_actions; i++){
+            if (actions[i].type == OFPAT_SET_VLAN_VID){
+                sw->group_vlans[nb_buckets] = ((openflow_action_vlan_vid *)actions[i].data)->vlan_vid;
+            }
+            free(actions[i].data);
+        }
+        nb_buckets++;
+        bucket += len;
+    }
+    sw->nb_buckets = nb_buckets;
+    pthread_mutex_unlock(&sw->lock);
+}
+
+uint64_t mock_now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Gives the 5-tuple of the `idx`-th connection of mock_switch_packet_in
+ */
+void mock_setup_key(uint32_t idx, struct FiveTuple *key){
+    memset(key, 0, sizeof(*key));
+    key->src_ip = MOCK_SETUP_SRC_IP + idx / MOCK_SETUP_PORTS;
+    key->dst_ip = 0x0A010001;
+    key->src_port = 1024 + idx % MOCK_SETUP_PORTS;
+    key->dst_port = MOCK_SETUP_DST_PORT;
+    key->proto = TCP_PROTO;
+}
+
+/**
+ * @brief Gives the index of the connection of mock_switch_packet_in with this 5-tuple, -1 if there is none
+ */
+int64_t mock_setup_index(struct MockSwitch *sw, struct FiveTuple *key){
+    if (key->proto != TCP_PROTO || key->dst_port != MOCK_SETUP_DST_PORT || key->src_ip < MOCK_SETUP_SRC_IP ||
+        key->src_port < 1024 || key->src_port >= 1024 + MOCK_SETUP_PORTS){
+        return -1;
+    }
+    uint64_t idx = (uint64_t)(key->src_ip - MOCK_SETUP_SRC_IP) * MOCK_SETUP_PORTS + key->src_port - 1024;
+    return idx < sw->nb_setups ? (int64_t)idx : -1;
+}
+
+/**
+ * @brief Writes the first packet of a connection: Ethernet, IPv4 and a TCP SYN, padded to MOCK_SETUP_FRAME_LEN
+ */
+void mock_setup_frame(struct FiveTuple *key, uint8_t *frame){
+    memset(frame, 0, MOCK_SETUP_FRAME_LEN);
+    uint8_t macs[12] = {0x02, 0, 0, 0, 0, 0x02, 0x02, 0, 0, 0, 0, 0x01};
+    memcpy(frame, macs, sizeof(macs));
+    frame[12] = IPV4_ETH_TYPE >> 8;
+    frame[13] = IPV4_ETH_TYPE & 0xff;
+    uint8_t *ip = frame + 14;
+    ip[0] = 0x45;
+    ip[3] = 40;
+    ip[8] = 64;
+    ip[9] = key->proto;
+    uint32_t src_ip = htonl(key->src_ip);
+    uint32_t dst_ip = htonl(key->dst_ip);
+    memcpy(ip + 12, &src_ip, sizeof(src_ip));
+    memcpy(ip + 16, &dst_ip, sizeof(dst_ip));
+    uint8_t *tcp = ip + 20;
+    uint16_t ports[2] = {htons(key->src_port), htons(key->dst_port)};
+    memcpy(tcp, ports, sizeof(ports));
+    tcp[12] = 0x50;
+    tcp[13] = 0x02; // SYN
+}
+
+/**
+ * @brief Records the FLOW_MOD (`install`) or the PACKET_OUT of a connection of mock_switch_packet_in
+ *
+ * @return int : 1 if the 5-tuple is one of these connections, 0 otherwise
+ */
+int mock_setup_event(struct MockSwitch *sw, struct FiveTuple *key, int32_t vlan, uint32_t buffer_id, uint8_t install){
+    pthread_mutex_lock(&sw->lock);
+    int64_t idx = mock_setup_index(sw, key);
+    if (idx < 0){
+        pthread_mutex_unlock(&sw->lock);
+        return 0;
+    }
+    struct MockSetup *setup = &sw->setups[idx];
+    uint64_t now = mock_now_ns();
+    uint8_t completed = setup->installed_ns && setup->released_ns;
+    if (install){
+        sw->flow_mods++;
+        if (!setup->installed_ns){
+            setup->installed_ns = now;
+            setup->vlan = vlan >= 0 ? vlan : 0;
+            sw->setups_installed++;
+        }
+    } else {
+        sw->packet_outs++;
+    }
+    // A FLOW_MOD without buffer leaves the packet in the controller
+    if ((!install || buffer_id != OPENFLOW_NO_BUFFER) && !setup->released_ns){
+        setup->released_ns = now;
+    }
+    if (!completed && setup->installed_ns && setup->released_ns){
+        sw->setups_completed++;
+    }
+    pthread_mutex_unlock(&sw->lock);
+    return 1;
+}
+
+int mock_switch_packet_in(struct MockSwitch *sw, int nb_packets, uint8_t buffered){
+    if (nb_packets <= 0){
+        return 0;
+    }
+    uint8_t *messages = malloc(nb_packets * MOCK_PACKET_IN_MAX_LEN);
+    if (messages == NULL){
+        return -1;
+    }
+    // Only this thread adds connections
+    uint32_t first = sw->nb_setups;
+    size_t len = 0;
+    for (int i = 0; i < nb_packets; i++){
+        uint32_t idx = first + i;
+        struct FiveTuple key;
+        mock_setup_key(idx, &key);
+        uint8_t frame[MOCK_SETUP_FRAME_LEN];
+        mock_setup_frame(&key, frame);
+        // The switch sends the headers of a buffered packet, the whole frame otherwise
+        uint16_t data_len = buffered ? MOCK_SETUP_HEADERS_LEN : MOCK_SETUP_FRAME_LEN;
+        uint32_t buffer_id = buffered ? idx : OPENFLOW_NO_BUFFER;
+        uint8_t message[MOCK_PACKET_IN_MAX_LEN];
+        uint8_t *body = message + OFP_HEADER_LEN;
+        if (sw->version >= OFP13_VERSION){
+            openflow13_packet_in *packet_in = (openflow13_packet_in *)body;
+            memset(packet_in, 0, sizeof(*packet_in));
+            packet_in->buffer_id = htonl(buffer_id);
+            packet_in->total_len = htons(MOCK_SETUP_FRAME_LEN);
+            body += sizeof(*packet_in);
+            body += openflow13_put_match(body, OVS_NETWORK_IFINDEX, NULL);
+            memset(body, 0, 2);
+            body += 2;
+        } else {
+            openflow_packet_in packet_in = {0};
+            packet_in.buffer_id = htonl(buffer_id);
+            packet_in.total_len = htons(MOCK_SETUP_FRAME_LEN);
+            packet_in.in_port = htons(OVS_NETWORK_IFINDEX);
+            memcpy(body, &packet_in, sizeof(packet_in));
+            body += sizeof(packet_in);
+        }
+        memcpy(body, frame, data_len);
+        body += data_len;
+        openflow_header *header = (openflow_header *)message;
+        header->version = sw->version ? sw->version : OFP_VERSION;
+        header->type = OFP_PACKET_IN;
+        header->length = htons(body - message);
+        header->xid = 0;
+        memcpy(messages + len, message, body - message);
+        len += body - message;
+    }
+    pthread_mutex_lock(&sw->lock);
+    if (sw->nb_setups + nb_packets > sw->setups_capacity){
+        uint32_t capacity = sw->setups_capacity ? sw->setups_capacity : 1024;
+        while (capacity < sw->nb_setups + nb_packets){
+            capacity *= 2;
+        }
+        struct MockSetup *setups = realloc(sw->setups, capacity * sizeof(struct MockSetup));
+        if (setups == NULL){
+            pthread_mutex_unlock(&sw->lock);
+            free(messages);
+            return -1;
+        }
+        sw->setups = setups;
+        sw->setups_capacity = capacity;
+    }
+    uint64_t now = mock_now_ns();
+    for (int i = 0; i < nb_packets; i++){
+        memset(&sw->setups[first + i], 0, sizeof(struct MockSetup));
+        sw->setups[first + i].sent_ns = now;
+    }
+    sw->nb_setups += nb_packets;
+    pthread_mutex_unlock(&sw->lock);
+    int status = write(sw->fd, messages, len) == (ssize_t)len ? 0 : -1;
+    if (status){
+        printf("Mock switch: could not send PACKET_INs\n");
+    }
+    free(messages);
+    return status;
+}
+
+uint32_t mock_switch_setups_completed(struct MockSwitch *sw){
+    pthread_mutex_lock(&sw->lock);
+    uint32_t completed = sw->setups_completed;
+    pthread_mutex_unlock(&sw->lock);
+    return completed;
+}
+
+/**
+ * @brief Releases the packet of a PACKET_OUT, from its buffer or from the packet it carries
+ */
+void mock_handle_packet_out(struct MockSwitch *sw, uint8_t *body, uint16_t body_len){
+    uint32_t buffer_id;
+    uint8_t *actions;
+    uint16_t actions_len;
+    if (sw->version >= OFP13_VERSION){
+        if (body_len < sizeof(openflow13_packet_out)){
+            return;
+        }
+        openflow13_packet_out *packet_out = (openflow13_packet_out *)body;
+        buffer_id = ntohl(packet_out->buffer_id);
+        actions_len = ntohs(packet_out->actions_len);
+        actions = body + sizeof(openflow13_packet_out);
+    } else {
+        if (body_len < sizeof(openflow_packet_out)){
+            return;
+        }
+        openflow_packet_out *packet_out = (openflow_packet_out *)body;
+        buffer_id = ntohl(packet_out->buffer_id);
+        actions_len = ntohs(packet_out->actions_len);
+        actions = body + sizeof(openflow_packet_out);
+    }
+    if (actions + actions_len > body + body_len){
+        return;
+    }
+    struct FiveTuple key;
+    if (buffer_id != OPENFLOW_NO_BUFFER){
+        mock_setup_key(buffer_id, &key);
+    } else if (openflow_parse_packet(actions + actions_len, body + body_len - actions - actions_len, &key)){
+        return;
+    }
+    mock_setup_event(sw, &key, -1, buffer_id, 0);
+}
+
+/**
+ * @brief Pins a flow with its own rule, it leaves the group with fresh counters
+ */
+void mock_pin_flow(struct MockSwitch *sw, struct FiveTuple *key, int32_t vlan, uint64_t cookie){
+    pthread_mutex_lock(&sw->lock);
+    sw->flow_mods++;
+    uint8_t found = 0;
+    for (int i = 0; i < sw->config.nb_flows && !found; i++){
+        if (five_tuple_equals(&sw->flows[i].key, key)){
+            sw->flows[i].pinned = 1;
+            sw->flows[i].packet_count = 0;
+            sw->flows[i].vlan = vlan >= 0 ? vlan : 0;
+            sw->flows[i].cookie = cookie;
+            sw->pinned_flows++;
+            found = 1;
+        }
+    }
+    if (!found){
+        sw->unknown_flow_mods++;
+    }
+    pthread_mutex_unlock(&sw->lock);
+}
+
+/**
+ * @brief Moves the flow to `vlan`, -1 leaves it where it is, and gives it `cookie` unless it is NULL
+ */
+void mock_apply_vlan(struct MockSwitch *sw, struct FiveTuple *key, int32_t vlan, uint64_t *cookie){
+    pthread_mutex_lock(&sw->lock);
+    sw->flow_mods++;
+    uint8_t found = 0;
+    for (int i = 0; i < sw->config.nb_flows && !found; i++){
+        if (five_tuple_equals(&sw->flows[i].key, key)){
+            if (vlan >= 0){
+                sw->flows[i].vlan = vlan;
+            }
+            if (cookie){
+                sw->flows[i].cookie = *cookie;
+            }
+            found = 1;
+        }
+    }
+    if (!found){
+        sw->unknown_flow_mods++;
+    }
+    pthread_mutex_unlock(&sw->lock);
+}
+
+/**
+ * @brief Decodes an OpenFlow 1.3 FLOW_MOD body, returns -1 if it is malformed
+ */
+int mock_parse_flow_mod13(uint8_t *body, uint16_t body_len, struct MockFlowMod *flow_mod){
+    openflow_match match;
+    if (body_len < sizeof(openflow13_flow_mod)){
+        return -1;
+    }
+    uint8_t *end = body + body_len;
+    uint8_t *match_start = body + sizeof(openflow13_flow_mod);
+    int match_len = openflow13_parse_match(match_start, end, &match);
+    if (match_len < 0){
+        return -1;
+    }
+    flow_mod->command = ((openflow13_flow_mod *)body)->command;
+    flow_mod->priority = ntohs(((openflow13_flow_mod *)body)->priority);
+    flow_mod->buffer_id = ntohl(((openflow13_flow_mod *)body)->buffer_id);
+    flow_mod->cookie = ntohll(((openflow13_flow_mod *)body)->cookie);
+    memset(&flow_mod->key, 0, sizeof(flow_mod->key));
+    flow_mod->key.src_ip = match.nw_src;
+    flow_mod->key.dst_ip = match.nw_dst;
+    flow_mod->key.src_port = match.tp_src;
+    flow_mod->key.dst_port = match.tp_dst;
+    flow_mod->key.proto = match.nw_proto;
+    flow_mod->vlan = -1;
+    action_descriptor actions[MAX_ACTIONS];
+    uint8_t nb_actions;
+    openflow13_parse_instructions(match_start + match_len, end, actions, &nb_actions);
+    for (uint8_t i = 0; i < nb_actions; i++){
+        if (actions[i].type == OFPAT_SET_VLAN_VID){
+            flow_mod->vlan = ((openflow_action_vlan_vid *)actions[i].data)->vlan_vid;
+        }
+        free(actions[i].data);
+    }
+    return 0;
+}
+
+void mock_apply_flow_mod13(struct MockSwitch *sw, uint8_t *body, uint16_t body_len){
+    struct MockFlowMod flow_mod;
+    if (mock_parse_flow_mod13(body, body_len, &flow_mod)){
+        return;
+    }
+    if (flow_mod.command != OFPFC_ADD){
+        // The cookie of a MODIFY selects the rules, it doesn't replace theirs
+        mock_apply_vlan(sw, &flow_mod.key, flow_mod.vlan, NULL);
+    } else if (flow_mod.key.proto){
+        if (!mock_setup_event(sw, &flow_mod.key, flow_mod.vlan, flow_mod.buffer_id, 1)){
+            mock_pin_flow(sw, &flow_mod.key, flow_mod.vlan, flow_mod.cookie);
+        }
+    } else {
+        // No 5-tuple: the table-miss rule, or the rule sending the traffic to the group
+        pthread_mutex_lock(&sw->lock);
+        if (flow_mod.priority == 0){
+            sw->table_miss = 1;
+        } else {
+            sw->group_rule = 1;
+        }
+        pthread_mutex_unlock(&sw->lock);
+    }
+}
+
+void mock_handle_message13(struct MockSwitch *sw, openflow_header *header, uint8_t *body, uint16_t body_len);
+
+/**
+ * @brief Handles a bundle control or add, given the body that follows the experimenter header in OpenFlow 1.3
+ */
+void mock_handle_bundle(struct MockSwitch *sw, uint32_t xid, uint8_t add, uint8_t *body, uint16_t body_len){
+    if (add){
+        if (body_len < sizeof(openflow13_bundle_add) + OFP_HEADER_LEN){
+            return;
+        }
+        openflow_header *inner = (openflow_header *)(body + sizeof(openflow13_bundle_add));
+        uint16_t inner_len = ntohs(inner->length);
+        if ((inner->type != OFP_FLOW_MOD && inner->type != OFPT13_GROUP_MOD) || inner_len < OFP_HEADER_LEN ||
+            inner_len > body_len - sizeof(openflow13_bundle_add)){
+            return;
+        }
+        if (sw->bundle_len == sw->bundle_capacity){
+            sw->bundle_capacity = sw->bundle_capacity ? 2 * sw->bundle_capacity : 64;
+            sw->bundle = realloc(sw->bundle, sw->bundle_capacity * sizeof(uint8_t *));
+        }
+        sw->bundle[sw->bundle_len] = malloc(inner_len);
+        memcpy(sw->bundle[sw->bundle_len++], inner, inner_len);
+        return;
+    }
+    if (body_len < sizeof(openflow13_bundle_ctrl)){
+        return;
+    }
+    openflow13_bundle_ctrl *ctrl = (openflow13_bundle_ctrl *)body;
+    uint16_t type = ntohs(ctrl->type);
+    if (type == OFPBCT_OPEN_REQUEST || type == OFPBCT_COMMIT_REQUEST){
+        for (uint32_t i = 0; i < sw->bundle_len; i++){
+            if (type == OFPBCT_COMMIT_REQUEST){
+                openflow_header *inner = (openflow_header *)sw->bundle[i];
+                mock_handle_message13(sw, inner, (uint8_t *)(inner + 1), ntohs(inner->length) - OFP_HEADER_LEN);
+            }
+            free(sw->bundle[i]);
+        }
+        sw->bundle_len = 0;
+    }
+    if (type == OFPBCT_COMMIT_REQUEST){
+        sw->bundles++;
+    } else if (type != OFPBCT_OPEN_REQUEST){
+        return;
+    }
+    // Requests and replies differ by one
+    uint8_t reply[OPENFLOW13_MAX_MESSAGE_LEN];
+    uint16_t len = openflow13_bundle_ctrl_message(reply, sw->version, xid, ntohl(ctrl->bundle_id), type + 1, ntohs(ctrl->flags));
+    if (write(sw->fd, reply, len) < 0){
+        printf("Mock switch: could not send bundle reply\n");
+    }
+}
+
+/**
+ * @brief Handles the messages of OpenFlow 1.3 and later, some types mean something else in 1.0
+ */
+void mock_handle_message13(struct MockSwitch *sw, openflow_header *header, uint8_t *body, uint16_t body_len){
+    uint32_t xid = ntohl(header->xid);
+    switch (header->type){
+    case OFPT13_MULTIPART_REQUEST:
+        if (body_len >= sizeof(openflow13_multipart_header) + sizeof(openflow13_flow_stats_request) &&
+            ntohs(*(uint16_t *)body) == OFPMP_FLOW){
+            openflow13_flow_stats_request *request = (openflow13_flow_stats_request *)(body + sizeof(openflow13_multipart_header));
+            mock_send_flow_stats(sw, xid, ntohll(request->cookie), ntohll(request->cookie_mask));
+        } else if (body_len >= sizeof(openflow13_multipart_header) && ntohs(*(uint16_t *)body) == OFPMP_GROUP){
+            mock_send_group_stats(sw, xid);
+        }
+        break;
+    case OFPT13_GROUP_MOD:
+        mock_apply_group_mod(sw, body, body_len);
+        break;
+    case OFP_FLOW_MOD:
+        mock_apply_flow_mod13(sw, body, body_len);
+        break;
+    case OFPT13_METER_MOD:
+        pthread_mutex_lock(&sw->lock);
+        sw->meter_mods++;
+        pthread_mutex_unlock(&sw->lock);
+        break;
+    case OFPT14_BUNDLE_CONTROL:
+    case OFPT14_BUNDLE_ADD_MESSAGE:
+        if (sw->version >= OFP14_VERSION){
+            mock_handle_bundle(sw, xid, header->type == OFPT14_BUNDLE_ADD_MESSAGE, body, body_len);
+        }
+        break;
+    case OFPT13_EXPERIMENTER:
+        if (body_len >= sizeof(openflow13_experimenter)){
+            openflow13_experimenter *experimenter = (openflow13_experimenter *)body;
+            uint32_t exp_type = ntohl(experimenter->exp_type);
+            if (ntohl(experimenter->experimenter) == ONF_EXPERIMENTER_ID &&
+                (exp_type == ONF_ET_BUNDLE_CONTROL || exp_type == ONF_ET_BUNDLE_ADD_MESSAGE)){
+                mock_handle_bundle(sw, xid, exp_type == ONF_ET_BUNDLE_ADD_MESSAGE, body + sizeof(*experimenter),
+                    body_len - sizeof(*experimenter));
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void mock_apply_flow_mod(struct MockSwitch *sw, uint8_t *body, uint16_t body_len){
+    if (body_len < sizeof(openflow_flow_mod)){
+        return;
+    }
+    openflow_flow_mod *flow_mod = (openflow_flow_mod *)body;
+    struct FiveTuple key = {0};
+    key.src_ip = ntohl(flow_mod->match.nw_src);
+    key.dst_ip = ntohl(flow_mod->match.nw_dst);
+    key.src_port = ntohs(flow_mod->match.tp_src);
+    key.dst_port = ntohs(flow_mod->match.tp_dst);
+    key.proto = flow_mod->match.nw_proto;
+    // Look for the new VLAN in the actions
+    int32_t vlan = -1;
+    uint8_t *action = body + sizeof(openflow_flow_mod);
+    while (action + sizeof(openflow_action_output) <= body + body_len){
+        uint16_t type = ntohs(*(uint16_t *)action);
+        uint16_t len = ntohs(*(uint16_t *)(action + 2));
+        if (type == OFPAT_SET_VLAN_VID){
+            vlan = ntohs(((openflow_action_vlan_vid *)action)->vlan_vid);
+        }
+        if (len == 0){
+            break;
+        }
+        action += len;
+    }
+    if (ntohs(flow_mod->command) == OFPFC_ADD && mock_setup_event(sw, &key, vlan, ntohl(flow_mod->buffer_id), 1)){
+        return;
+    }
+    // OpenFlow 1.0 MODIFYs replace the cookie
+    uint64_t cookie = ntohll(flow_mod->cookie);
+    mock_apply_vlan(sw, &key, vlan, &cookie);
+}
+
+/**
+ * @brief Connects to the controller, waiting for it to listen
+ */
+int mock_connect(){
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(OF_PORT);
+    while (1){
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0){
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0){
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+}
+
+void *mock_switch_run(void *arg){
+    struct MockSwitch *sw = arg;
+    sw->fd = mock_connect();
+    if (sw->fd < 0){
+        printf("Mock switch: could not connect to the controller\n");
+        return NULL;
+    }
+    mock_send_hello(sw);
+    uint32_t xid = 0;
+    uint32_t last_echo_tick = 0;
+    while (1){
+        openflow_header header;
+        if (mock_read_full(sw->fd, &header, OFP_HEADER_LEN)){
+            break;
+        }
+        uint16_t body_len = ntohs(header.length) - OFP_HEADER_LEN;
+        uint8_t *body = malloc(body_len + 1);
+        if (body_len > 0 && mock_read_full(sw->fd, body, body_len)){
+            free(body);
+            break;
+        }
+        switch (header.type){
+        case OFP_HELLO:
+            mock_negotiate_version(sw, &header, body, body_len);
+            break;
+        case OFP_FEATURES_REQUEST:
+            mock_send_features_reply(sw, ntohl(header.xid));
+            break;
+        case OFP_STATS_REQUEST:
+            if (sw->version >= OFP13_VERSION){
+                mock_handle_message13(sw, &header, body, body_len);
+            } else if (body_len >= sizeof(openflow_flow_stats_request_header) && ntohs(*(uint16_t *)body) == OFPST_FLOW){
+                mock_send_flow_stats(sw, ntohl(header.xid), 0, 0);
+            }
+            break;
+        case OFP_FLOW_MOD:
+            if (sw->version >= OFP13_VERSION){
+                mock_handle_message13(sw, &header, body, body_len);
+            } else {
+                mock_apply_flow_mod(sw, body, body_len);
+            }
+            break;
+        case OFP_PACKET_OUT:
+            mock_handle_packet_out(sw, body, body_len);
+            break;
+        case OFP_ECHO_REQUEST:
+            mock_send(sw, OFP_ECHO_REPLY, ntohl(header.xid), body, body_len);
+            break;
+        case OFP_ECHO_REPLY:
+            sw->echo_replies++;
+            break;
+        default:
+            if (sw->version >= OFP13_VERSION){
+                mock_handle_message13(sw, &header, body, body_len);
+            }
+            break;
+        }
+        free(body);
+        // Keep-alive, answered by openflow_control()
+        if (sw->config.echo_interval > 0 && sw->tick - last_echo_tick >= (uint32_t)sw->config.echo_interval){
+            mock_send(sw, OFP_ECHO_REQUEST, xid++, NULL, 0);
+            last_echo_tick = sw->tick;
+        }
+    }
+    close(sw->fd);
+    return NULL;
+}
+
+int mock_switch_start(struct MockSwitch *sw){
+    if (pthread_create(&sw->thread, NULL, mock_switch_run, sw)){
+        printf("Could not start the mock switch\n");
+        return -1;
+    }
+    return 0;
+}
+
+double mock_switch_core_load(struct MockSwitch *sw, uint64_t *core_load){
+    memset(core_load, 0, NB_CORES * sizeof(uint64_t));
+    pthread_mutex_lock(&sw->lock);
+    for (int i = 0; i < sw->config.nb_flows; i++){
+        core_load[mock_flow_vlan(sw, &sw->flows[i]) % NB_CORES] += sw->flows[i].rate;
+    }
+    pthread_mutex_unlock(&sw->lock);
+    uint64_t max_load = 0;
+    uint64_t total_load = 0;
+    for (int core = 0; core < NB_CORES; core++){
+        total_load += core_load[core];
+        if (core_load[core] > max_load){
+            max_load = core_load[core];
+        }
+    }
+    if (total_load == 0){
+        return 1;
+    }
+    return (double)max_load * NB_CORES / total_load;
+}
+
+void mock_switch_wait(struct MockSwitch *sw){
+    pthread_join(sw->thread, NULL);
+}
+
+void mock_switch_destroy(struct MockSwitch *sw){
+    pthread_mutex_destroy(&sw->lock);
+    free(sw->flows);
+    free(sw->setups);
+    for (uint32_t i = 0; i < sw->bundle_len; i++){
+        free(sw->bundle[i]);
+    }
+    free(sw->bundle);
+}
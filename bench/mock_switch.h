@@ -0,0 +1,198 @@
+/**
+ * @file mock_switch.h
+ * @brief Local OpenFlow switch emulator used by the benchmarks
+ *
+ * The emulator connects to the controller socket opened by `openflow_create_connection()` and
+ * speaks HELLO, FEATURES, flow STATS, FLOW_MOD and ECHO. With `of_version` set to OpenFlow 1.3 or
+ * 1.4, it negotiates the version from the HELLO bitmaps and speaks OFPMP_FLOW multipart, OXM
+ * FLOW_MODs, METER_MOD, bundles (applied on commit) and a SELECT group instead: once the rule sending the
+ * traffic to the group is added, the flows follow the VLAN of the bucket their 5-tuple hashes to, unless an
+ * exact-match rule pins them, and only the pinned flows are listed in the flow stats. Flow stats carry the cookies of the
+ * rules and OpenFlow 1.3 requests list the flows matching their cookie mask. mock_switch_packet_in
+ * sends the PACKET_IN of new connections and records when their FLOW_MOD and their packet come back, to measure the
+ * flow setup of the controller. It holds a synthetic set of flows whose
+ * rates follow a configurable distribution. Every flow STATS_REQUEST advances the emulated time
+ * by one tick: counters grow by the flow rates and a share of the flows is replaced (churn).
+ * FLOW_MODs change the VLAN, i.e. the core, of the matching flow, so the real per-core load can be
+ * compared to the balancer decisions.
+ *
+ */
+
+#ifndef MOCK_SWITCH_H
+#define MOCK_SWITCH_H
+
+#include <pthread.h>
+#include <arpa/inet.h>
+#include "openflow13.h"
+
+enum MockRateDistribution {
+    MOCK_RATES_UNIFORM = 0,
+    MOCK_RATES_ZIPF = 1, /** Rate of the i-th flow proportional to 1/i^zipf_exponent */
+    MOCK_RATES_ELEPHANTS = 2, /** A share of elephants, elephant_ratio times bigger than the mice */
+};
+
+struct MockSwitchConfig {
+    int nb_flows; /** Active flows at any time, at most MAX_HANDLED_FLOWS */
+    enum MockRateDistribution distribution;
+    double zipf_exponent;
+    double elephant_share; /** Share of the flows that are elephants */
+    double elephant_ratio; /** Rate of an elephant divided by the rate of a mouse */
+    uint64_t total_rate; /** Packets per tick over all flows */
+    double churn; /** Share of the flows replaced by new ones each tick */
+    int echo_interval; /** Ticks between two ECHO_REQUESTs sent to the controller, 0 to disable */
+    uint8_t of_version; /** Highest OpenFlow version offered: OFP_VERSION, OFP13_VERSION or OFP14_VERSION */
+    unsigned int seed;
+};
+
+struct MockFlow {
+    struct FiveTuple key; /** Host byte order, like the flow table */
+    uint64_t rate; /** Packets per tick */
+    uint64_t packet_count;
+    uint32_t created_tick;
+    uint16_t vlan;
+    uint8_t pinned; /** Added by an exact-match FLOW_MOD, bypasses the group */
+    uint64_t cookie; /** Set by the FLOW_MOD adding the rule, or modifying it in OpenFlow 1.0 */
+};
+
+/**
+ * @brief Decoded FLOW_MOD, the ones added to a bundle are applied on commit
+ *
+ */
+struct MockFlowMod {
+    struct FiveTuple key;
+    int32_t vlan;
+    uint64_t cookie;
+    uint8_t command;
+    uint16_t priority;
+    uint32_t buffer_id;
+};
+
+/**
+ * @brief Connection whose first packet missed the flow table, see mock_switch_packet_in
+ *
+ */
+struct MockSetup {
+    uint64_t sent_ns; /** When its PACKET_IN was written */
+    uint64_t installed_ns; /** When the FLOW_MOD installing it was received, 0 before */
+    uint64_t released_ns; /** When its packet left the switch, through the buffer_id of the FLOW_MOD or a PACKET_OUT, 0 before */
+    uint16_t vlan;
+};
+
+struct MockSwitch {
+    struct MockSwitchConfig config;
+    int fd;
+    uint8_t version; /** Negotiated with the controller */
+    pthread_t thread;
+    pthread_mutex_t lock; /** Protects the flows and the counters */
+    struct MockFlow *flows;
+    uint32_t tick;
+    uint32_t next_port; /** Source port of the next created flow */
+    double churn_carry; /** Fraction of flow left to replace from the previous ticks */
+    uint8_t **bundle; /** Messages of the open bundle, header included */
+    uint32_t bundle_len;
+    uint32_t bundle_capacity;
+    uint16_t group_vlans[OPENFLOW13_MAX_BUCKETS]; /** VLAN of each bucket of the group */
+    int nb_buckets;
+    uint8_t group_rule; /** The traffic goes through the group */
+    uint64_t bucket_packets[OPENFLOW13_MAX_BUCKETS];
+    uint8_t table_miss; /** OpenFlow 1.3 rule sending the missed packets to the controller */
+    struct MockSetup *setups; /** Indexed by the order of the PACKET_INs */
+    uint32_t nb_setups;
+    uint32_t setups_capacity;
+    // Counters
+    uint64_t stats_requests;
+    uint64_t flow_mods;
+    uint64_t unknown_flow_mods; /** FLOW_MODs matching no flow, e.g. a flow that churned */
+    uint64_t echo_replies;
+    uint64_t churned_flows;
+    uint64_t meter_mods;
+    uint64_t bundles; /** Bundles committed */
+    uint64_t group_mods;
+    uint64_t pinned_flows;
+    uint64_t packet_outs;
+    uint32_t setups_installed;
+    uint32_t setups_completed; /** Installed and released */
+};
+
+/**
+ * @brief Fills a configuration with default values: 1000 flows with Zipf(1.1) rates and no churn
+ *
+ * @param config : the configuration to fill
+ */
+void mock_switch_default_config(struct MockSwitchConfig *config);
+
+/**
+ * @brief Creates the synthetic flows of the switch
+ *
+ * @param sw : the switch to initialize
+ * @param config : the configuration to use, copied
+ * @return int : 0 on success, -1 if the configuration is invalid
+ */
+int mock_switch_init(struct MockSwitch *sw, struct MockSwitchConfig *config);
+
+/**
+ * @brief Starts the switch thread. It connects to the controller on `OF_PORT`, retrying until
+ * `openflow_create_connection()` listens, and serves requests until the controller closes the connection.
+ *
+ * @param sw
+ * @return int : 0 on success, -1 if the thread couldn't be created
+ */
+int mock_switch_start(struct MockSwitch *sw);
+
+/**
+ * @brief Encodes the flow stats of the switch as a sequence of STATS_REPLY messages (MULTIPART_REPLY once
+ * OpenFlow 1.3 or later is negotiated), without advancing the time
+ *
+ * @param sw
+ * @param xid : transaction ID of the request
+ * @param cookie
+ * @param cookie_mask : from OpenFlow 1.3, only the flows whose cookie matches `cookie` under the mask are listed
+ * @param len : filled with the length of the sequence
+ * @return uint8_t* : the messages, to be freed by the caller
+ */
+uint8_t *mock_switch_flow_stats_reply(struct MockSwitch *sw, uint32_t xid, uint64_t cookie, uint64_t cookie_mask, size_t *len);
+
+/**
+ * @brief Sends the PACKET_IN of the first packet of `nb_packets` new TCP connections in a single write. Buffered
+ * packets are sent truncated with their buffer_id, the others whole.
+ *
+ * @param sw
+ * @param nb_packets
+ * @param buffered : let the FLOW_MOD release the buffered packet, a PACKET_OUT must return it otherwise
+ * @return int : 0 on success, -1 if the PACKET_INs couldn't be sent
+ */
+int mock_switch_packet_in(struct MockSwitch *sw, int nb_packets, uint8_t buffered);
+
+/**
+ * @brief Gives the number of connections sent by mock_switch_packet_in that were installed and whose packet was released
+ *
+ * @param sw
+ * @return uint32_t
+ */
+uint32_t mock_switch_setups_completed(struct MockSwitch *sw);
+
+/**
+ * @brief Computes the real load of each core from the flow rates and their current VLAN, the one of their
+ * bucket for the flows going through the group
+ *
+ * @param sw
+ * @param core_load : array of NB_CORES loads to fill
+ * @return double : the imbalance, i.e. the load of the most loaded core divided by the average load
+ */
+double mock_switch_core_load(struct MockSwitch *sw, uint64_t *core_load);
+
+/**
+ * @brief Waits for the switch thread to exit, once it applied all messages. The controller must have closed the connection.
+ *
+ * @param sw
+ */
+void mock_switch_wait(struct MockSwitch *sw);
+
+/**
+ * @brief Frees the flows of a stopped switch
+ *
+ * @param sw
+ */
+void mock_switch_destroy(struct MockSwitch *sw);
+
+#endif
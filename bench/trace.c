@@ -0,0 +1,281 @@
+#include "trace.h"
+
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define PCAP_LINKTYPE_ETHERNET 1
+
+struct PcapHeader {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct PcapRecord {
+    uint32_t ts_sec;
+    uint32_t ts_frac; /** Micro or nanoseconds, depending on the magic */
+    uint32_t caplen;
+    uint32_t len;
+};
+
+void trace_init(struct TraceSet *trace, uint64_t cycle_ns){
+    memset(trace, 0, sizeof(*trace));
+    trace->cycle_ns = cycle_ns;
+    trace->index_size = 1024;
+    trace->index = calloc(trace->index_size, sizeof(uint32_t));
+}
+
+uint32_t trace_hash(struct FiveTuple *key){
+    uint32_t hash = key->src_ip * 0x9e3779b1;
+    hash ^= key->dst_ip * 0x85ebca6b;
+    hash ^= ((uint32_t)key->src_port << 16 | key->dst_port) * 0xc2b2ae35;
+    hash ^= key->proto;
+    return hash ^ (hash >> 15);
+}
+
+/**
+ * @brief Doubles the size of the index and inserts the flows again
+ */
+void trace_grow_index(struct TraceSet *trace){
+    free(trace->index);
+    trace->index_size *= 2;
+    trace->index = calloc(trace->index_size, sizeof(uint32_t));
+    for (int i = 0; i < trace->nb_flows; i++){
+        uint32_t slot = trace_hash(&trace->flows[i].key) & (trace->index_size - 1);
+        while (trace->index[slot]){
+            slot = (slot + 1) & (trace->index_size - 1);
+        }
+        trace->index[slot] = i + 1;
+    }
+}
+
+uint32_t trace_flow(struct TraceSet *trace, struct FiveTuple *key){
+    uint32_t slot = trace_hash(key) & (trace->index_size - 1);
+    while (trace->index[slot]){
+        uint32_t idx = trace->index[slot] - 1;
+        if (five_tuple_equals(&trace->flows[idx].key, key)){
+            return idx;
+        }
+        slot = (slot + 1) & (trace->index_size - 1);
+    }
+    if (trace->nb_flows == trace->flows_capacity){
+        trace->flows_capacity = trace->flows_capacity ? 2 * trace->flows_capacity : 1024;
+        trace->flows = realloc(trace->flows, trace->flows_capacity * sizeof(struct TraceFlow));
+    }
+    uint32_t idx = trace->nb_flows++;
+    trace->flows[idx].key = *key;
+    trace->flows[idx].last_cycle = -1;
+    trace->flows[idx].last_sample = 0;
+    trace->index[slot] = idx + 1;
+    // Keep the index at most half full
+    if (2 * (uint32_t)trace->nb_flows > trace->index_size){
+        trace_grow_index(trace);
+    }
+    return idx;
+}
+
+void trace_add(struct TraceSet *trace, uint64_t time_ns, struct FiveTuple *key, uint64_t packets){
+    int cycle_idx = time_ns / trace->cycle_ns;
+    if (cycle_idx >= trace->cycles_capacity){
+        int capacity = trace->cycles_capacity ? trace->cycles_capacity : 64;
+        while (capacity <= cycle_idx){
+            capacity *= 2;
+        }
+        trace->cycles = realloc(trace->cycles, capacity * sizeof(struct TraceCycle));
+        memset(&trace->cycles[trace->cycles_capacity], 0, (capacity - trace->cycles_capacity) * sizeof(struct TraceCycle));
+        trace->cycles_capacity = capacity;
+    }
+    if (cycle_idx >= trace->nb_cycles){
+        trace->nb_cycles = cycle_idx + 1;
+    }
+    uint32_t flow_idx = trace_flow(trace, key);
+    struct TraceFlow *flow = &trace->flows[flow_idx];
+    struct TraceCycle *cycle = &trace->cycles[cycle_idx];
+    if (flow->last_cycle == cycle_idx){
+        cycle->samples[flow->last_sample].packets += packets;
+        return;
+    }
+    if (cycle->nb_samples == cycle->capacity){
+        cycle->capacity = cycle->capacity ? 2 * cycle->capacity : 64;
+        cycle->samples = realloc(cycle->samples, cycle->capacity * sizeof(struct TraceSample));
+    }
+    cycle->samples[cycle->nb_samples].flow = flow_idx;
+    cycle->samples[cycle->nb_samples].packets = packets;
+    // Samples are added in time order, a flow only needs to remember its last one
+    if (cycle_idx > flow->last_cycle){
+        flow->last_cycle = cycle_idx;
+        flow->last_sample = cycle->nb_samples;
+    }
+    cycle->nb_samples++;
+}
+
+int trace_load_csv(struct TraceSet *trace, const char *path){
+    FILE *file = fopen(path, "r");
+    if (!file){
+        printf("Could not open %s\n", path);
+        return -1;
+    }
+    char line[256];
+    int line_nb = 0;
+    uint8_t first_line = 1;
+    while (fgets(line, sizeof(line), file)){
+        line_nb++;
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r'){
+            continue;
+        }
+        double start, end, pps;
+        char src_ip[16], dst_ip[16];
+        unsigned int src_port, dst_port, proto;
+        struct in_addr addr;
+        if (sscanf(line, "%lf,%lf,%15[^,],%15[^,],%u,%u,%u,%lf", &start, &end, src_ip, dst_ip, &src_port, &dst_port, &proto, &pps) != 8){
+            // Tolerate a header line
+            if (first_line){
+                first_line = 0;
+                continue;
+            }
+            printf("%s:%d: expected start,end,src_ip,dst_ip,src_port,dst_port,proto,pps\n", path, line_nb);
+            fclose(file);
+            return -1;
+        }
+        first_line = 0;
+        struct FiveTuple key = {0};
+        if (!inet_aton(src_ip, &addr)){
+            printf("%s:%d: invalid address %s\n", path, line_nb, src_ip);
+            fclose(file);
+            return -1;
+        }
+        key.src_ip = ntohl(addr.s_addr);
+        if (!inet_aton(dst_ip, &addr)){
+            printf("%s:%d: invalid address %s\n", path, line_nb, dst_ip);
+            fclose(file);
+            return -1;
+        }
+        key.dst_ip = ntohl(addr.s_addr);
+        key.src_port = src_port;
+        key.dst_port = dst_port;
+        key.proto = proto;
+        // Spread the packets of the range over the cycles it overlaps
+        uint64_t start_ns = start * 1e9;
+        uint64_t end_ns = end * 1e9;
+        while (start_ns < end_ns){
+            uint64_t cycle_end = (start_ns / trace->cycle_ns + 1) * trace->cycle_ns;
+            if (cycle_end > end_ns){
+                cycle_end = end_ns;
+            }
+            trace_add(trace, start_ns, &key, (uint64_t)(pps * (cycle_end - start_ns) / 1e9));
+            start_ns = cycle_end;
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+/**
+ * @brief Extracts the five-tuple of an Ethernet frame
+ *
+ * @return int : 0 if the frame is an IPv4 TCP or UDP packet, -1 otherwise
+ */
+int trace_parse_frame(uint8_t *frame, uint32_t len, struct FiveTuple *key){
+    uint32_t offset = 12;
+    if (len < offset + 2){
+        return -1;
+    }
+    uint16_t eth_type = ntohs(*(uint16_t *)(frame + offset));
+    offset += 2;
+    while (eth_type == 0x8100 || eth_type == 0x88a8){
+        if (len < offset + 4){
+            return -1;
+        }
+        eth_type = ntohs(*(uint16_t *)(frame + offset + 2));
+        offset += 4;
+    }
+    if (eth_type != 0x0800 || len < offset + 20){
+        return -1;
+    }
+    uint8_t *ip = frame + offset;
+    uint32_t ihl = (ip[0] & 0x0F) * 4;
+    uint8_t proto = ip[9];
+    if ((proto != 6 && proto != 17) || len < offset + ihl + 4){
+        return -1;
+    }
+    key->proto = proto;
+    key->src_ip = ntohl(*(uint32_t *)(ip + 12));
+    key->dst_ip = ntohl(*(uint32_t *)(ip + 16));
+    key->src_port = ntohs(*(uint16_t *)(ip + ihl));
+    key->dst_port = ntohs(*(uint16_t *)(ip + ihl + 2));
+    return 0;
+}
+
+int trace_load_pcap(struct TraceSet *trace, const char *path){
+    FILE *file = fopen(path, "rb");
+    if (!file){
+        printf("Could not open %s\n", path);
+        return -1;
+    }
+    struct PcapHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1){
+        printf("%s is not a pcap file\n", path);
+        fclose(file);
+        return -1;
+    }
+    uint8_t swapped = header.magic == __builtin_bswap32(PCAP_MAGIC_US) || header.magic == __builtin_bswap32(PCAP_MAGIC_NS);
+    uint32_t magic = swapped ? __builtin_bswap32(header.magic) : header.magic;
+    uint32_t linktype = swapped ? __builtin_bswap32(header.linktype) : header.linktype;
+    if (magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS){
+        printf("%s is not a pcap file (pcapng is not supported)\n", path);
+        fclose(file);
+        return -1;
+    }
+    if (linktype != PCAP_LINKTYPE_ETHERNET){
+        printf("%s: only Ethernet captures are supported\n", path);
+        fclose(file);
+        return -1;
+    }
+    uint64_t frac_ns = magic == PCAP_MAGIC_NS ? 1 : 1000;
+    uint8_t frame[65536];
+    uint64_t first_ns = 0;
+    uint8_t first = 1;
+    struct PcapRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1){
+        if (swapped){
+            record.ts_sec = __builtin_bswap32(record.ts_sec);
+            record.ts_frac = __builtin_bswap32(record.ts_frac);
+            record.caplen = __builtin_bswap32(record.caplen);
+        }
+        if (record.caplen > sizeof(frame) || fread(frame, 1, record.caplen, file) != record.caplen){
+            printf("%s: truncated capture\n", path);
+            break;
+        }
+        uint64_t time_ns = (uint64_t)record.ts_sec * 1000000000ULL + record.ts_frac * frac_ns;
+        if (first){
+            first_ns = time_ns;
+            first = 0;
+        }
+        struct FiveTuple key = {0};
+        if (time_ns >= first_ns && trace_parse_frame(frame, record.caplen, &key) == 0){
+            trace_add(trace, time_ns - first_ns, &key, 1);
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+int trace_load(struct TraceSet *trace, const char *path){
+    size_t len = strlen(path);
+    if (len > 5 && !strcmp(path + len - 5, ".pcap")){
+        return trace_load_pcap(trace, path);
+    }
+    return trace_load_csv(trace, path);
+}
+
+void trace_destroy(struct TraceSet *trace){
+    for (int i = 0; i < trace->nb_cycles; i++){
+        free(trace->cycles[i].samples);
+    }
+    free(trace->cycles);
+    free(trace->flows);
+    free(trace->index);
+}
@@ -0,0 +1,119 @@
+/**
+ * @file trace.h
+ * @brief Per-flow rate traces replayed by the balancer simulator
+ *
+ * A trace is cut in cycles of a fixed duration. For each cycle, it holds the packets received by
+ * each flow during the cycle. It is loaded either from a CSV of flow rates or from a pcap capture.
+ *
+ * CSV lines describe the constant rate of a flow during a time range, in seconds:
+ *
+ *     start,end,src_ip,dst_ip,src_port,dst_port,proto,pps
+ *     0,30,10.0.0.1,10.1.0.1,1024,80,6,150000
+ *
+ * Empty lines and lines starting with `#` are ignored. Captures must be classic pcap files
+ * (micro or nanosecond timestamps) of Ethernet frames; VLAN tags are skipped and non IPv4
+ * TCP/UDP packets ignored.
+ *
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "hashmap.h"
+
+struct TraceFlow {
+    struct FiveTuple key; /** Host byte order, like the flow table */
+    int last_cycle; /** Last cycle with a sample of the flow, -1 if none */
+    int last_sample; /** Index of that sample in its cycle */
+};
+
+struct TraceSample {
+    uint32_t flow; /** Index in TraceSet::flows */
+    uint64_t packets;
+};
+
+struct TraceCycle {
+    int nb_samples;
+    int capacity;
+    struct TraceSample *samples;
+};
+
+struct TraceSet {
+    uint64_t cycle_ns;
+    int nb_flows;
+    int flows_capacity;
+    struct TraceFlow *flows;
+    uint32_t *index; /** Open addressing index of the flows, flow index + 1, 0 if empty */
+    uint32_t index_size;
+    int nb_cycles;
+    int cycles_capacity;
+    struct TraceCycle *cycles;
+};
+
+/**
+ * @brief Initializes an empty trace
+ *
+ * @param trace : the trace to initialize
+ * @param cycle_ns : duration of a cycle
+ */
+void trace_init(struct TraceSet *trace, uint64_t cycle_ns);
+
+/**
+ * @brief Accounts packets of a flow at a given time
+ *
+ * @param trace
+ * @param time_ns : time since the start of the trace
+ * @param key : the flow
+ * @param packets
+ */
+void trace_add(struct TraceSet *trace, uint64_t time_ns, struct FiveTuple *key, uint64_t packets);
+
+/**
+ * @brief Returns the index of a flow in `trace->flows`, the flow is added if needed
+ *
+ * @param trace
+ * @param key
+ * @return uint32_t : the index of the flow
+ */
+uint32_t trace_flow(struct TraceSet *trace, struct FiveTuple *key);
+
+/**
+ * @brief Loads a CSV of flow rates
+ *
+ * @param trace : an initialized trace
+ * @param path
+ * @return int : 0 on success, -1 otherwise
+ */
+int trace_load_csv(struct TraceSet *trace, const char *path);
+
+/**
+ * @brief Loads a pcap capture
+ *
+ * @param trace : an initialized trace
+ * @param path
+ * @return int : 0 on success, -1 otherwise
+ */
+int trace_load_pcap(struct TraceSet *trace, const char *path);
+
+/**
+ * @brief Loads a trace, the format is guessed from the extension (.pcap or .csv)
+ *
+ * @param trace : an initialized trace
+ * @param path
+ * @return int : 0 on success, -1 otherwise
+ */
+int trace_load(struct TraceSet *trace, const char *path);
+
+/**
+ * @brief Frees the trace
+ *
+ * @param trace
+ */
+void trace_destroy(struct TraceSet *trace);
+
+#endif
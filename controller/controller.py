@@ -35,6 +35,8 @@ IP_UDP = 17
 IP_ICMP = 1
 
 DEFAULT_VLAN = 0x0000
+# orss sets the new flows up itself (FLOW_SETUP_NATIVE in src/env.h), PACKET_INs are left to it
+NATIVE_FLOW_SETUP = True
 
 class SimpleSwitch(app_manager.RyuApp):
     OFP_VERSIONS = [ofproto_v1_0.OFP_VERSION]
@@ -156,6 +158,8 @@ class SimpleSwitch(app_manager.RyuApp):
 
     @set_ev_cls(ofp_event.EventOFPPacketIn, MAIN_DISPATCHER)
     def _packet_in_handler(self, ev):
+        if NATIVE_FLOW_SETUP:
+            return
         msg = ev.msg
         datapath = msg.datapath
         flow_spec = {
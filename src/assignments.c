@@ -0,0 +1,395 @@
+#include "assignments.h"
+#include "flowhash.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Regions of the file start on a cache line
+#define ASSIGNMENTS_ALIGN(offset) (((offset) + 63) & ~(size_t)63)
+
+/*
+    Offsets of the regions of a table of `capacity` entries, returns the length of the file
+*/
+static size_t assignments_layout(uint32_t capacity, uint32_t *index_size, size_t *index_offset, size_t *pending_offset){
+    *index_size = 2;
+    while (*index_size < 2 * capacity){
+        *index_size *= 2;
+    }
+    size_t entries_offset = ASSIGNMENTS_ALIGN(sizeof(struct AssignmentHeader));
+    *index_offset = ASSIGNMENTS_ALIGN(entries_offset + (size_t)capacity * sizeof(struct AssignmentEntry));
+    *pending_offset = ASSIGNMENTS_ALIGN(*index_offset + (size_t)*index_size * sizeof(int32_t));
+    return *pending_offset + (size_t)capacity * sizeof(int32_t);
+}
+
+static inline uint8_t assignments_key_equals(const struct FiveTuple *a, const struct FiveTuple *b){
+    return a->src_ip == b->src_ip && a->dst_ip == b->dst_ip && a->src_port == b->src_port && a->dst_port == b->dst_port && a->proto == b->proto;
+}
+
+/*
+    Sequence lock. The writer makes the sequence odd before writing and even after, the release fence keeps
+    the writes after the odd sequence. Readers read the sequence, the data, an acquire fence keeps the reads
+    before the second read of the sequence.
+*/
+static inline void assignments_write_begin(struct AssignmentHeader *header, uint64_t sequence){
+    __atomic_store_n(&header->sequence, sequence | 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void assignments_write_end(struct AssignmentHeader *header){
+    __atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t assignments_read_begin(const struct AssignmentHeader *header){
+    return __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+}
+
+/*
+    The daemon holds the lock, e.g. it was preempted while writing: the CPU is given back now and then
+*/
+static inline void assignments_read_wait(int attempt){
+    if ((attempt & 1023) == 1023){
+        sched_yield();
+    }
+}
+
+static inline uint8_t assignments_read_retry(const struct AssignmentHeader *header, uint64_t sequence){
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&header->sequence, __ATOMIC_RELAXED) != sequence;
+}
+
+int assignments_open(struct AssignmentTable *table, const char *path, int capacity, int nb_cores){
+    memset(table, 0, sizeof(*table));
+    table->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (table->fd < 0){
+        printf("Could not open the assignment table %s\n", path);
+        return -1;
+    }
+    struct stat file_stat;
+    if (fstat(table->fd, &file_stat)){
+        printf("Could not read the size of the assignment table %s\n", path);
+        assignments_close(table);
+        return -1;
+    }
+    uint32_t index_size;
+    size_t index_offset, pending_offset;
+    size_t length = assignments_layout(capacity, &index_size, &index_offset, &pending_offset);
+    // Never shrink the file, readers of a previous table may still map all of it
+    if ((size_t)file_stat.st_size > length){
+        length = file_stat.st_size;
+    } else if (ftruncate(table->fd, length)){
+        printf("Could not size the assignment table %s\n", path);
+        assignments_close(table);
+        return -1;
+    }
+    table->data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, table->fd, 0);
+    if (table->data == MAP_FAILED){
+        printf("Could not map the assignment table %s\n", path);
+        table->data = NULL;
+        assignments_close(table);
+        return -1;
+    }
+    table->changes = malloc(capacity * sizeof(int32_t));
+    table->length = length;
+    table->capacity = capacity;
+    table->header = (struct AssignmentHeader *)table->data;
+    table->entries = (struct AssignmentEntry *)(table->data + ASSIGNMENTS_ALIGN(sizeof(struct AssignmentHeader)));
+    table->index = (int32_t *)(table->data + index_offset);
+    table->pending = (int32_t *)(table->data + pending_offset);
+    // Readers of a previous table wait until it is written again, then see a new epoch
+    struct AssignmentHeader *header = table->header;
+    uint8_t taken_over = header->magic == ASSIGNMENTS_MAGIC;
+    assignments_write_begin(header, taken_over ? header->sequence : 0);
+    memset(table->data + sizeof(*header), 0, length - sizeof(*header));
+    header->version = ASSIGNMENTS_VERSION;
+    header->nb_cores = nb_cores;
+    header->capacity = capacity;
+    header->index_mask = index_size - 1;
+    header->epoch = taken_over ? header->epoch + 1 : 1;
+    header->cycle = 0;
+    header->time_ns = 0;
+    header->nb_flows = 0;
+    header->nb_pending = 0;
+    memset(header->target_load, 0, sizeof(header->target_load));
+    memset(header->core_active, 0, sizeof(header->core_active));
+    memset(header->core_active, 1, nb_cores);
+    header->magic = ASSIGNMENTS_MAGIC;
+    assignments_write_end(header);
+    return 0;
+}
+
+static void assignments_index_add(struct AssignmentTable *table, int slot){
+    uint32_t mask = table->header->index_mask;
+    uint32_t i = table->entries[slot].hash & mask;
+    while (table->index[i]){
+        i = (i + 1) & mask;
+    }
+    table->index[i] = slot + 1;
+}
+
+static void assignments_index_remove(struct AssignmentTable *table, int slot){
+    uint32_t mask = table->header->index_mask;
+    uint32_t hole = table->entries[slot].hash & mask;
+    while (table->index[hole] != slot + 1){
+        hole = (hole + 1) & mask;
+    }
+    // Backward shift, like the index of the flow table
+    for (uint32_t i = (hole + 1) & mask; table->index[i]; i = (i + 1) & mask){
+        uint32_t home = table->entries[table->index[i] - 1].hash & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)){
+            table->index[hole] = table->index[i];
+            hole = i;
+        }
+    }
+    table->index[hole] = 0;
+}
+
+void assignments_publish(struct AssignmentTable *table, struct HashMap *map, const uint64_t *target_load, const uint8_t *active, uint64_t time_ns){
+    struct AssignmentHeader *header = table->header;
+    int capacity = map->capacity < table->capacity ? map->capacity : table->capacity;
+    // Only the writer modifies the table, the changes are found before readers are locked out
+    int nb_changes = 0;
+    for (int slot = 0; slot < capacity; slot++){
+        struct key_value_pair *pair = &map->map[slot];
+        struct AssignmentEntry *entry = &table->entries[slot];
+        if (!pair->valid && !entry->valid){
+            continue;
+        }
+        if (!pair->valid || !entry->valid || entry->generation != pair->generation || entry->pending ||
+            entry->core != pair->value->assigned_core || !assignments_key_equals(&entry->key, &pair->key)){
+            table->changes[nb_changes++] = slot;
+        }
+    }
+    uint64_t cycle = header->cycle + 1;
+    uint32_t nb_pending = 0;
+    assignments_write_begin(header, header->sequence);
+    for (int i = 0; i < nb_changes; i++){
+        int slot = table->changes[i];
+        struct key_value_pair *pair = &map->map[slot];
+        struct AssignmentEntry *entry = &table->entries[slot];
+        uint8_t same_flow = pair->valid && entry->valid && entry->generation == pair->generation &&
+            assignments_key_equals(&entry->key, &pair->key);
+        if (entry->valid && !same_flow){
+            assignments_index_remove(table, slot);
+            entry->valid = 0;
+            header->nb_flows--;
+        }
+        if (!pair->valid){
+            continue;
+        }
+        uint8_t core = pair->value->assigned_core;
+        if (!same_flow){
+            entry->key = pair->key;
+            entry->hash = pair->hash;
+            entry->generation = pair->generation;
+            entry->core = core;
+            entry->previous_core = core;
+            entry->pending = 0;
+            entry->migration_cycle = 0;
+            entry->valid = 1;
+            assignments_index_add(table, slot);
+            header->nb_flows++;
+        } else if (entry->core != core){
+            entry->previous_core = entry->core;
+            entry->core = core;
+            entry->pending = 1;
+            entry->migration_cycle = cycle;
+            table->pending[nb_pending++] = slot;
+        } else {
+            // Migrated by the previous publication, its FLOW_MOD has been sent since
+            entry->pending = 0;
+        }
+    }
+    header->nb_pending = nb_pending;
+    memcpy(header->target_load, target_load, header->nb_cores * sizeof(uint64_t));
+    memcpy(header->core_active, active, header->nb_cores);
+    header->cycle = cycle;
+    header->time_ns = time_ns;
+    assignments_write_end(header);
+}
+
+void assignments_close(struct AssignmentTable *table){
+    if (table->data){
+        munmap(table->data, table->length);
+        table->data = NULL;
+    }
+    if (table->fd >= 0){
+        close(table->fd);
+    }
+    table->fd = -1;
+    free(table->changes);
+    table->changes = NULL;
+}
+
+int assignments_attach(struct AssignmentReader *reader, const char *path){
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = open(path, O_RDONLY);
+    if (reader->fd < 0){
+        printf("Could not open the assignment table %s\n", path);
+        return -1;
+    }
+    struct stat file_stat;
+    if (fstat(reader->fd, &file_stat) || (size_t)file_stat.st_size < sizeof(struct AssignmentHeader)){
+        printf("No assignment table in %s\n", path);
+        assignments_detach(reader);
+        return -1;
+    }
+    reader->data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, reader->fd, 0);
+    if (reader->data == MAP_FAILED){
+        printf("Could not map the assignment table %s\n", path);
+        reader->data = NULL;
+        assignments_detach(reader);
+        return -1;
+    }
+    reader->length = file_stat.st_size;
+    reader->header = (const struct AssignmentHeader *)reader->data;
+    struct AssignmentHeader header;
+    int attempt = 0;
+    for (; attempt < ASSIGNMENTS_READ_ATTEMPTS; attempt++){
+        uint64_t sequence = assignments_read_begin(reader->header);
+        if (sequence & 1){
+            assignments_read_wait(attempt);
+            continue;
+        }
+        memcpy(&header, reader->header, sizeof(header));
+        if (!assignments_read_retry(reader->header, sequence)){
+            break;
+        }
+    }
+    uint32_t index_size;
+    size_t index_offset, pending_offset;
+    if (attempt == ASSIGNMENTS_READ_ATTEMPTS || header.magic != ASSIGNMENTS_MAGIC || header.version != ASSIGNMENTS_VERSION ||
+        assignments_layout(header.capacity, &index_size, &index_offset, &pending_offset) > reader->length ||
+        header.index_mask != index_size - 1){
+        printf("No assignment table in %s\n", path);
+        assignments_detach(reader);
+        return -1;
+    }
+    reader->capacity = header.capacity;
+    reader->index_mask = header.index_mask;
+    reader->epoch = header.epoch;
+    reader->entries = (const struct AssignmentEntry *)(reader->data + ASSIGNMENTS_ALIGN(sizeof(struct AssignmentHeader)));
+    reader->index = (const int32_t *)(reader->data + index_offset);
+    reader->pending = (const int32_t *)(reader->data + pending_offset);
+    return 0;
+}
+
+int assignments_lookup(struct AssignmentReader *reader, struct FiveTuple *key, struct Assignment *assignment){
+    uint32_t hash = flowhash_crc32c(key, 0);
+    for (int attempt = 0; attempt < ASSIGNMENTS_READ_ATTEMPTS; attempt++){
+        uint64_t sequence = assignments_read_begin(reader->header);
+        if (sequence & 1){
+            assignments_read_wait(attempt);
+            continue;
+        }
+        // Values read during a publication may be torn: they are bounded here and dropped by the retry
+        const struct AssignmentEntry *found = NULL;
+        uint32_t i = hash & reader->index_mask;
+        for (uint32_t probes = 0; probes <= reader->index_mask; probes++, i = (i + 1) & reader->index_mask){
+            uint32_t slot = (uint32_t)reader->index[i] - 1;
+            if (slot >= reader->capacity){
+                break;
+            }
+            if (reader->entries[slot].hash == hash && assignments_key_equals(&reader->entries[slot].key, key)){
+                found = &reader->entries[slot];
+                break;
+            }
+        }
+        struct Assignment read = {.cycle = reader->header->cycle};
+        if (found){
+            read.core = found->core;
+            read.previous_core = found->previous_core;
+            read.pending = found->pending;
+            read.migration_cycle = found->migration_cycle;
+        }
+        uint64_t epoch = reader->header->epoch;
+        if (assignments_read_retry(reader->header, sequence)){
+            reader->retries++;
+            continue;
+        }
+        if (epoch != reader->epoch){
+            return ASSIGNMENTS_RESTARTED;
+        }
+        if (found){
+            *assignment = read;
+        } else {
+            assignment->cycle = read.cycle;
+        }
+        return found != NULL;
+    }
+    return ASSIGNMENTS_BUSY;
+}
+
+int assignments_pending(struct AssignmentReader *reader, struct AssignmentMigration *migrations, int max, uint64_t *cycle){
+    for (int attempt = 0; attempt < ASSIGNMENTS_READ_ATTEMPTS; attempt++){
+        uint64_t sequence = assignments_read_begin(reader->header);
+        if (sequence & 1){
+            assignments_read_wait(attempt);
+            continue;
+        }
+        uint32_t nb_pending = reader->header->nb_pending;
+        for (uint32_t i = 0; i < nb_pending && i < (uint32_t)max && i < reader->capacity; i++){
+            uint32_t slot = reader->pending[i];
+            if (slot >= reader->capacity){
+                break;
+            }
+            migrations[i].key = reader->entries[slot].key;
+            migrations[i].source_core = reader->entries[slot].previous_core;
+            migrations[i].destination_core = reader->entries[slot].core;
+        }
+        uint64_t read_cycle = reader->header->cycle;
+        uint64_t epoch = reader->header->epoch;
+        if (assignments_read_retry(reader->header, sequence)){
+            reader->retries++;
+            continue;
+        }
+        if (epoch != reader->epoch){
+            return ASSIGNMENTS_RESTARTED;
+        }
+        *cycle = read_cycle;
+        return nb_pending;
+    }
+    return ASSIGNMENTS_BUSY;
+}
+
+int assignments_cores(struct AssignmentReader *reader, struct AssignmentCores *cores){
+    for (int attempt = 0; attempt < ASSIGNMENTS_READ_ATTEMPTS; attempt++){
+        uint64_t sequence = assignments_read_begin(reader->header);
+        if (sequence & 1){
+            assignments_read_wait(attempt);
+            continue;
+        }
+        int nb_cores = reader->header->nb_cores;
+        if (nb_cores > MAX_CORES){
+            nb_cores = MAX_CORES;
+        }
+        cores->cycle = reader->header->cycle;
+        cores->time_ns = reader->header->time_ns;
+        cores->nb_cores = nb_cores;
+        cores->nb_flows = reader->header->nb_flows;
+        memcpy(cores->target_load, reader->header->target_load, nb_cores * sizeof(uint64_t));
+        memcpy(cores->active, reader->header->core_active, nb_cores);
+        uint64_t epoch = reader->header->epoch;
+        if (assignments_read_retry(reader->header, sequence)){
+            reader->retries++;
+            continue;
+        }
+        return epoch == reader->epoch ? 0 : ASSIGNMENTS_RESTARTED;
+    }
+    return ASSIGNMENTS_BUSY;
+}
+
+void assignments_detach(struct AssignmentReader *reader){
+    if (reader->data){
+        munmap((void *)reader->data, reader->length);
+        reader->data = NULL;
+    }
+    if (reader->fd >= 0){
+        close(reader->fd);
+    }
+    reader->fd = -1;
+}
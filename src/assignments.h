@@ -0,0 +1,201 @@
+/**
+ * @file assignments.h
+ * @brief Flow to core assignments published in shared memory, for the host dispatcher and other local readers
+ *
+ * The daemon steers flows with VLAN rewrites on the switch (or the XDP maps): a process on the host only
+ * learns the core of a flow, or that it is migrating, from its packets. Every cycle, the daemon copies its
+ * decisions into a file mapped in memory (on tmpfs by default): the core of each flow of the flow table, the
+ * flows migrated by the cycle with the core they leave, and the load targeted on each core after balancing.
+ * A reader maps the same file and looks a flow up without any system call.
+ *
+ * The table is guarded by a sequence lock: the daemon makes the sequence odd, writes the changes of the cycle
+ * and makes it even again. A reader reads the sequence, the data, then the sequence again, and retries if it
+ * changed or was odd. The daemon never waits for the readers, and only the changes are written under the lock.
+ * Migrations are published before their FLOW_MODs are sent and stay pending until the next publication.
+ *
+ * The file is a `struct AssignmentHeader`, `capacity` entries mirroring the slots of the flow table, an
+ * index of the entries by flowhash_crc32c of their key (linear probing, slot + 1, 0 when empty) and the
+ * slots of the pending migrations. The reader functions only need this file and flowhash.c.
+ *
+ */
+
+#ifndef ASSIGNMENTS_H
+#define ASSIGNMENTS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hashmap.h"
+
+#define ASSIGNMENTS_MAGIC 0x4f524153 // "ORAS"
+#define ASSIGNMENTS_VERSION 1
+
+// Returned by the readers
+#define ASSIGNMENTS_BUSY -1 /** The daemon kept the table locked, e.g. it died while writing it */
+#define ASSIGNMENTS_RESTARTED -2 /** The daemon created the table again, the reader must attach again */
+
+struct AssignmentHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t nb_cores;
+    uint32_t capacity; /** Entries, the size of the flow table */
+    uint32_t index_mask; /** Entries of the index - 1 */
+    uint64_t epoch; /** Incremented each time a daemon takes the table over, i.e. when it restarts */
+    uint64_t sequence; /** Odd while the daemon writes */
+    uint64_t cycle; /** Publications so far */
+    uint64_t time_ns; /** CLOCK_MONOTONIC time of the last publication */
+    uint32_t nb_flows;
+    uint32_t nb_pending; /** Migrations of the last publication */
+    uint64_t target_load[MAX_CORES]; /** Load of each core after balancing, in packets per second */
+    uint8_t core_active[MAX_CORES]; /** 0 for the cores parked by consolidation */
+};
+
+struct AssignmentEntry {
+    struct FiveTuple key;
+    uint32_t hash; /** flowhash_crc32c of the key */
+    uint16_t generation; /** Generation of the slot of the flow table */
+    uint8_t valid;
+    uint8_t core;
+    uint8_t previous_core; /** Core the flow leaves when pending */
+    uint8_t pending; /** Migrated by the last publication */
+    uint64_t migration_cycle; /** Publication of the last migration */
+};
+
+/**
+ * @brief What a reader gets for a flow
+ *
+ */
+struct Assignment {
+    uint8_t core;
+    uint8_t previous_core;
+    uint8_t pending;
+    uint64_t migration_cycle;
+    uint64_t cycle; /** Publication read */
+};
+
+struct AssignmentMigration {
+    struct FiveTuple key;
+    uint8_t source_core;
+    uint8_t destination_core;
+};
+
+struct AssignmentCores {
+    uint64_t cycle; /** Publication read */
+    uint64_t time_ns;
+    int nb_cores;
+    uint32_t nb_flows;
+    uint64_t target_load[MAX_CORES];
+    uint8_t active[MAX_CORES];
+};
+
+/**
+ * @brief Table written by the daemon
+ *
+ */
+struct AssignmentTable {
+    int fd;
+    uint8_t *data; /** The mapped file */
+    size_t length;
+    struct AssignmentHeader *header;
+    struct AssignmentEntry *entries;
+    int32_t *index;
+    int32_t *pending;
+    int capacity;
+    int32_t *changes; /** Slots changed by the cycle, found before locking */
+};
+
+/**
+ * @brief Mapping of a reader
+ *
+ */
+struct AssignmentReader {
+    int fd;
+    const uint8_t *data;
+    size_t length;
+    const struct AssignmentHeader *header;
+    const struct AssignmentEntry *entries;
+    const int32_t *index;
+    const int32_t *pending;
+    uint32_t capacity;
+    uint32_t index_mask;
+    uint64_t epoch; /** Of the table attached to */
+    uint64_t retries; /** Reads overlapped by a publication */
+};
+
+/**
+ * @brief Creates (or takes over) the file and maps it, empty, for a flow table of `capacity` flows. Readers
+ * of a previous run see ASSIGNMENTS_RESTARTED.
+ *
+ * @param table : the structure to fill
+ * @param path : the file, on tmpfs (/dev/shm) to keep it off the disk
+ * @param capacity : flows of the flow table
+ * @param nb_cores : cores balanced, at most MAX_CORES
+ * @return int : 0 on success, -1 otherwise
+ */
+int assignments_open(struct AssignmentTable *table, const char *path, int capacity, int nb_cores);
+
+/**
+ * @brief Publishes the flow table: new and expired flows, migrations since the previous publication, and
+ * the load and state of each core
+ *
+ * @param table
+ * @param map : the flow table, at most the capacity given to assignments_open
+ * @param target_load : load of each core after balancing
+ * @param active : 0 for the parked cores
+ * @param time_ns : CLOCK_MONOTONIC time of the publication
+ */
+void assignments_publish(struct AssignmentTable *table, struct HashMap *map, const uint64_t *target_load, const uint8_t *active, uint64_t time_ns);
+
+/**
+ * @brief Unmaps the table, the last publication stays readable
+ *
+ * @param table
+ */
+void assignments_close(struct AssignmentTable *table);
+
+/**
+ * @brief Maps the table published by the daemon, read-only
+ *
+ * @param reader : the structure to fill
+ * @param path : the file given to the daemon
+ * @return int : 0 on success, -1 if the file can't be mapped or holds no table
+ */
+int assignments_attach(struct AssignmentReader *reader, const char *path);
+
+/**
+ * @brief Core of a flow
+ *
+ * @param reader
+ * @param key : the flow
+ * @param assignment : filled when the flow is found, its cycle in any case
+ * @return int : 1 if the flow is found, 0 if not, ASSIGNMENTS_BUSY or ASSIGNMENTS_RESTARTED
+ */
+int assignments_lookup(struct AssignmentReader *reader, struct FiveTuple *key, struct Assignment *assignment);
+
+/**
+ * @brief Migrations of the last publication
+ *
+ * @param reader
+ * @param migrations : filled with at most `max` migrations
+ * @param max
+ * @param cycle : filled with the publication read
+ * @return int : the number of migrations (possibly more than `max`), ASSIGNMENTS_BUSY or ASSIGNMENTS_RESTARTED
+ */
+int assignments_pending(struct AssignmentReader *reader, struct AssignmentMigration *migrations, int max, uint64_t *cycle);
+
+/**
+ * @brief Target load and state of each core
+ *
+ * @param reader
+ * @param cores : the structure to fill
+ * @return int : 0 on success, ASSIGNMENTS_BUSY or ASSIGNMENTS_RESTARTED
+ */
+int assignments_cores(struct AssignmentReader *reader, struct AssignmentCores *cores);
+
+/**
+ * @brief Unmaps the table
+ *
+ * @param reader
+ */
+void assignments_detach(struct AssignmentReader *reader);
+
+#endif
@@ -1,110 +1,454 @@
 #include "balancer.h"
 
+// Runtime settings, see balancer_configure
+double imbalance_threshold = IMBALANCE_THRESHOLD;
+int max_migrations = MAX_REBALANCE_ITERATIONS;
+double feedback_weight = FEEDBACK_WEIGHT;
+// Relative capacity of each core, 0 when the core is drained or parked
+double core_capacity[MAX_CORES] = {[0 ... MAX_CORES - 1] = 1};
+// Capacity of each core given by balancer_set_capacity, whether it is parked or not
+double configured_capacity[MAX_CORES] = {[0 ... MAX_CORES - 1] = 1};
+// Consolidation, see balancer_set_consolidation
+double consolidation_ceiling = CONSOLIDATION_CEILING;
+uint8_t core_parked[MAX_CORES] = {0};
+// Cycles since a core was last parked or brought back
+uint32_t consolidation_hold = 0;
+// Load of each core that doesn't belong to any tracked flow
+uint64_t background_load[MAX_CORES] = {0};
+// Background load of each core corrected by the host utilization
+uint64_t background_scaled[MAX_CORES] = {0};
+// Utilization of each core reported by the host, negative when unknown
+double host_utilization[MAX_CORES] = {[0 ... MAX_CORES - 1] = -1};
+// Load of each core after the last balancing
+uint64_t balanced_load[MAX_CORES] = {0};
+// Number of calls to balancer_balance
+uint32_t balance_cycles = 0;
+// Policy of balancer_place
+int placement_policy = PLACEMENT_POLICY;
+// Load expected on each core from the flows placed since the last balancing
+uint64_t placed_load[MAX_CORES] = {0};
+// Mean load of a tracked flow at the last balancing
+uint64_t mean_flow_load = 1;
 
-void balancer_print_migrations(struct Migrations *migrations, struct Repartition *repartition, int nbCores, struct HashMap *hashmap){
+void balancer_set_background_load(int core, uint64_t load){
+    if (core >= 0 && core < MAX_CORES){
+        background_load[core] = load;
+    }
+}
+
+void balancer_set_capacity(int core, double capacity){
+    if (core >= 0 && core < MAX_CORES && capacity >= 0){
+        configured_capacity[core] = capacity;
+        core_capacity[core] = core_parked[core] ? 0 : capacity;
+    }
+}
+
+/*
+    Parks a core or brings it back, with its configured capacity
+*/
+void balancer_park(int core, uint8_t parked){
+    core_parked[core] = parked;
+    core_capacity[core] = parked ? 0 : configured_capacity[core];
+    consolidation_hold = 0;
+}
+
+void balancer_set_consolidation(double ceiling){
+    consolidation_ceiling = ceiling > 0 ? ceiling : 0;
+    if (consolidation_ceiling == 0){
+        for (int core = 0; core < MAX_CORES; core++){
+            if (core_parked[core]){
+                balancer_park(core, 0);
+            }
+        }
+    }
+}
+
+uint8_t balancer_core_active(int core){
+    return core >= 0 && core < MAX_CORES && core_capacity[core] > 0;
+}
+
+/*
+    Adjusts the active cores to the load of the cycle before balancing it. Cores are brought back at once, from
+    the first parked one, until the load fits under the ceiling of the active cores; then the last active core
+    is parked when the load fits the others with the hysteresis margin, once per CONSOLIDATION_HOLD_CYCLES.
+*/
+void balancer_consolidate(uint64_t total_load, int nbCores){
+    if (consolidation_ceiling == 0){
+        return;
+    }
+    consolidation_hold++;
+    double active_capacity = 0;
+    int last_active = 0;
+    for (int i = 0; i < nbCores && i < MAX_CORES; i++){
+        if (core_capacity[i] > 0){
+            active_capacity += core_capacity[i];
+            last_active = i;
+        }
+    }
+    uint8_t unparked = 0;
+    for (int i = 0; i < nbCores && i < MAX_CORES && total_load > consolidation_ceiling * active_capacity; i++){
+        if (core_parked[i] && configured_capacity[i] > 0){
+            balancer_park(i, 0);
+            active_capacity += configured_capacity[i];
+            unparked = 1;
+        }
+    }
+    if (unparked || last_active == 0 || consolidation_hold < CONSOLIDATION_HOLD_CYCLES){
+        return;
+    }
+    double remaining_capacity = active_capacity - core_capacity[last_active];
+    if (total_load < consolidation_ceiling * remaining_capacity * (1 - CONSOLIDATION_HYSTERESIS)){
+        balancer_park(last_active, 1);
+    }
+}
+
+void balancer_set_utilization(int core, double utilization){
+    if (core >= 0 && core < MAX_CORES){
+        host_utilization[core] = utilization;
+    }
+}
+
+double balancer_get_imbalance(int nbCores){
+    // Drained cores are left out, their remaining load can't be migrated
+    uint64_t totalLoad = 0;
+    double totalCapacity = 0;
+    for (int i = 0; i < nbCores && i < MAX_CORES; i++){
+        if (core_capacity[i] > 0){
+            totalLoad += balanced_load[i];
+            totalCapacity += core_capacity[i];
+        }
+    }
+    if (totalLoad == 0 || totalCapacity == 0){
+        return 0;
+    }
+    double largest_imbalance = 0;
+    for (int i = 0; i < nbCores && i < MAX_CORES; i++){
+        if (core_capacity[i] == 0){
+            continue;
+        }
+        double imbalance = balanced_load[i] / (totalLoad * core_capacity[i] / totalCapacity);
+        if (imbalance > largest_imbalance){
+            largest_imbalance = imbalance;
+        }
+    }
+    return largest_imbalance;
+}
+
+void balancer_configure(double threshold, int migrations_per_cycle, double weight){
+    imbalance_threshold = threshold;
+    feedback_weight = weight;
+    max_migrations = migrations_per_cycle < MAX_MIGRATIONS ? migrations_per_cycle : MAX_MIGRATIONS;
+}
+
+void balancer_set_placement(int policy){
+    placement_policy = policy;
+}
+
+/*
+    Load of a core relative to its capacity, flows placed since the last balancing included
+*/
+double balancer_placement_load(int core){
+    return (balanced_load[core] + placed_load[core]) / core_capacity[core];
+}
+
+/*
+    Mixes the 5-tuple of a flow with a seed (murmur3 finalizer)
+*/
+uint32_t balancer_hash(struct FiveTuple *key, uint32_t seed){
+    uint32_t words[4] = {key->src_ip, key->dst_ip, ((uint32_t)key->src_port << 16) | key->dst_port, key->proto};
+    uint32_t hash = seed;
+    for (int i = 0; i < 4; i++){
+        hash ^= words[i];
+        hash ^= hash >> 16;
+        hash *= 0x85ebca6b;
+        hash ^= hash >> 13;
+        hash *= 0xc2b2ae35;
+        hash ^= hash >> 16;
+    }
+    return hash;
+}
+
+int balancer_place(struct FiveTuple *key, int nbCores){
+    int active[nbCores];
+    int nb_active = 0;
+    double total_load = 0;
+    double total_capacity = 0;
+    for (int i = 0; i < nbCores && i < MAX_CORES; i++){
+        if (core_capacity[i] > 0){
+            active[nb_active++] = i;
+            total_load += balanced_load[i] + placed_load[i];
+            total_capacity += core_capacity[i];
+        }
+    }
+    int core = 0;
+    if (placement_policy == PLACEMENT_DEFAULT || nb_active == 0){
+        return core;
+    } else if (placement_policy == PLACEMENT_TWO_CHOICES){
+        int first = active[rand() % nb_active];
+        int second = active[rand() % nb_active];
+        core = balancer_placement_load(second) < balancer_placement_load(first) ? second : first;
+    } else if (placement_policy == PLACEMENT_WEIGHTED_HASH){
+        // Rendezvous hashing: a flow keeps its core while the loads don't change, a loaded core gets fewer flows
+        double mean_load = total_load / total_capacity;
+        double best_score = -1;
+        for (int i = 0; i < nb_active; i++){
+            double weight = core_capacity[active[i]];
+            if (mean_load > 0){
+                weight /= balancer_placement_load(active[i]) / mean_load + 0.1;
+            }
+            double uniform = (balancer_hash(key, active[i]) + 0.5) / 4294967296.0;
+            double score = -weight / log(uniform);
+            if (score > best_score){
+                best_score = score;
+                core = active[i];
+            }
+        }
+    } else {
+        core = active[0];
+        for (int i = 1; i < nb_active; i++){
+            if (balancer_placement_load(active[i]) < balancer_placement_load(core)){
+                core = active[i];
+            }
+        }
+    }
+    placed_load[core] += mean_flow_load;
+    return core;
+}
+
+void balancer_get_core_load(uint64_t *core_load, int nbCores){
+    for (int i = 0; i < nbCores && i < MAX_CORES; i++){
+        core_load[i] = balanced_load[i];
+    }
+}
+
+void balancer_log_cycle(struct Migrations *migrations, struct Repartition *repartition, int nbCores, struct HashMap *hashmap){
     // Describe migrations
     for (int i = 0; i < migrations->nb_migrations; i++){
-        struct RingBuffer *ring_buffer = hashmap_get(hashmap, &migrations->migrations[i].key);
-        printf("Migrate flow %d.%d.%d.%d:%d -> %d.%d.%d.%d:%d (%lu) to core %d\n",
-        migrations->migrations[i].key.src_ip & 0xFF,
-        (migrations->migrations[i].key.src_ip >> 8) & 0xFF,
-        (migrations->migrations[i].key.src_ip >> 16) & 0xFF,
-        (migrations->migrations[i].key.src_ip >> 24) & 0xFF,
-        migrations->migrations[i].key.src_port,
-        migrations->migrations[i].key.dst_ip & 0xFF,
-        (migrations->migrations[i].key.dst_ip >> 8) & 0xFF,
-        (migrations->migrations[i].key.dst_ip >> 16) & 0xFF,
-        (migrations->migrations[i].key.dst_ip >> 24) & 0xFF,
-        migrations->migrations[i].key.dst_port,
-        ringbuffer_get_last(ring_buffer),
+        struct FiveTuple *key = &migrations->migrations[i].key;
+        log_info("balancer", "Migrate flow %d.%d.%d.%d:%d -> %d.%d.%d.%d:%d (%lu) to core %d",
+        key->src_ip & 0xFF, (key->src_ip >> 8) & 0xFF, (key->src_ip >> 16) & 0xFF, (key->src_ip >> 24) & 0xFF,
+        key->src_port,
+        key->dst_ip & 0xFF, (key->dst_ip >> 8) & 0xFF, (key->dst_ip >> 16) & 0xFF, (key->dst_ip >> 24) & 0xFF,
+        key->dst_port,
+        ringbuffer_get_last(hashmap_get(hashmap, key)),
         migrations->migrations[i].destination_core);
     }
-    printf("--------------------\n");
     // Describe core load
-    for (int i = 0; i < nbCores; i++)
-        printf("Core %d: %u flows, %lu load\n", i, repartition->core_load[i].nb_flows, repartition->core_load[i].load);
-    printf("\n");
-    // Describe flows
     for (int i = 0; i < nbCores; i++){
-        printf("Core %d:\n", i);
+        log_debug("balancer", "Core %d: %u flows, %lu load", i, repartition->core_load[i].nb_flows, repartition->core_load[i].load);
+    }
+    // Describe flows, in the binary trace and only every LOG_FLOW_DUMP_INTERVAL cycles
+    if (!log_tracing() || balance_cycles % LOG_FLOW_DUMP_INTERVAL){
+        return;
+    }
+    for (int i = 0; i < nbCores; i++){
         for (int j = 0; j < repartition->core_load[i].nb_flows; j++){
-            printf("[%u]%d.%d.%d.%d:%d -> %d.%d.%d.%d:%d to core %d\n",
-            repartition->core_load[i].flowKeys[j].proto,
-            repartition->core_load[i].flowKeys[j].src_ip & 0xFF,
-            (repartition->core_load[i].flowKeys[j].src_ip >> 8) & 0xFF,
-            (repartition->core_load[i].flowKeys[j].src_ip >> 16) & 0xFF,
-            (repartition->core_load[i].flowKeys[j].src_ip >> 24) & 0xFF,
-            repartition->core_load[i].flowKeys[j].src_port,
-            repartition->core_load[i].flowKeys[j].dst_ip & 0xFF,
-            (repartition->core_load[i].flowKeys[j].dst_ip >> 8) & 0xFF,
-            (repartition->core_load[i].flowKeys[j].dst_ip >> 16) & 0xFF,
-            (repartition->core_load[i].flowKeys[j].dst_ip >> 24) & 0xFF,
-            repartition->core_load[i].flowKeys[j].dst_port,
-            repartition->core_load[i].core_idx);
+            log_flow(balance_cycles, &repartition->core_load[i].flowKeys[j], repartition->core_load[i].core_idx,
+                ringbuffer_get_last(repartition->core_load[i].flows[j]));
         }
-        printf("\n");
     }
 }
 
 
+void balancer_swap_flows(struct CoreLoad *core, int i, int j){
+    struct RingBuffer *flow = core->flows[i];
+    struct FiveTuple key = core->flowKeys[i];
+    uint64_t load = core->flowLoads[i];
+    core->flows[i] = core->flows[j];
+    core->flowKeys[i] = core->flowKeys[j];
+    core->flowLoads[i] = core->flowLoads[j];
+    core->flows[j] = flow;
+    core->flowKeys[j] = key;
+    core->flowLoads[j] = load;
+}
+
+/*
+    Moves the flow at index i of the heap of a core up, until its parent is bigger
+*/
+void balancer_sift_flow_up(struct CoreLoad *core, int i){
+    while (i > 0 && core->flowLoads[(i - 1) / 2] < core->flowLoads[i]){
+        balancer_swap_flows(core, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+/*
+    Moves the flow at index i of the heap of a core down, until its children are smaller
+*/
+void balancer_sift_flow_down(struct CoreLoad *core, int i){
+    while (1){
+        int biggest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < core->nb_flows && core->flowLoads[left] > core->flowLoads[biggest]){
+            biggest = left;
+        }
+        if (right < core->nb_flows && core->flowLoads[right] > core->flowLoads[biggest]){
+            biggest = right;
+        }
+        if (biggest == i){
+            return;
+        }
+        balancer_swap_flows(core, i, biggest);
+        i = biggest;
+    }
+}
+
+/*
+    Sums the load of a core and orders its flows as a max-heap of their load
+*/
 void balancer_update_core_info(struct CoreLoad *core){
-    core->load = 0;
-    core->biggestLoad_idx = 0;
-    uint64_t biggestLoad = 0;
+    core->load = background_scaled[core->core_idx];
     for (int j = 0; j < core->nb_flows; j++){
-        uint64_t currentLoad = ringbuffer_get_last(core->flows[j]);
-        if (currentLoad > biggestLoad){
-            biggestLoad = currentLoad;
-            core->biggestLoad_idx = j;
+        core->load += core->flowLoads[j];
+    }
+    for (int j = core->nb_flows / 2 - 1; j >= 0; j--){
+        balancer_sift_flow_down(core, j);
+    }
+}
+
+/*
+    Cost of a packet on each core relative to the others, from the host utilization: the share of the
+    utilization of a core over its share of the packets, blended with 1 by the feedback weight.
+*/
+void balancer_compute_scale(struct CoreLoad *core_load, int nbCores, double *scale){
+    uint64_t packets[nbCores];
+    uint64_t totalPackets = 0;
+    double totalUtilization = 0;
+    for (int i = 0; i < nbCores; i++){
+        scale[i] = 1;
+        packets[i] = background_load[i];
+        for (int j = 0; j < core_load[i].nb_flows; j++){
+            packets[i] += ringbuffer_get_last(core_load[i].flows[j]);
+        }
+        // Cores the host didn't report on are left out
+        if (host_utilization[i] >= 0){
+            totalPackets += packets[i];
+            totalUtilization += host_utilization[i];
+        }
+    }
+    if (feedback_weight <= 0 || totalPackets == 0 || totalUtilization <= 0){
+        return;
+    }
+    for (int i = 0; i < nbCores; i++){
+        if (host_utilization[i] < 0 || packets[i] == 0){
+            continue;
         }
-        core->load += currentLoad;
+        double cost = (host_utilization[i] / totalUtilization) / ((double)packets[i] / totalPackets);
+        if (cost > FEEDBACK_MAX_SCALE){
+            cost = FEEDBACK_MAX_SCALE;
+        } else if (cost < 1.0 / FEEDBACK_MAX_SCALE){
+            cost = 1.0 / FEEDBACK_MAX_SCALE;
+        }
+        scale[i] = 1 + feedback_weight * (cost - 1);
     }
 }
 
-void balancer_compute_repartition(struct Repartition *repartition, struct HashMap *hashmap, uint8_t nbCores){
+void balancer_compute_repartition(struct Repartition *repartition, struct HashMap *hashmap, int nbCores){
     // Initialize the repartition
     repartition->core_load = calloc(nbCores, sizeof(struct CoreLoad));
-    // Iterate over the hashmap
-    struct FiveTuple previous_key;
-    struct FiveTuple current_key;
-    struct RingBuffer *value;
-    while (hashmap_get_next(hashmap, &previous_key, &current_key, &value)){
-        // Memorized assigned flows
-        if (repartition->core_load[value->assigned_core].nb_flows > HASHMAP_SIZE){
-            printf("ERROR: core %d is full, max number of connection is %d\n", value->assigned_core, HASHMAP_SIZE);
-            exit(1);
-        }
-        repartition->core_load[value->assigned_core].flowKeys[repartition->core_load[value->assigned_core].nb_flows] = current_key;
-        repartition->core_load[value->assigned_core].flows[repartition->core_load[value->assigned_core].nb_flows] = value;
-        repartition->core_load[value->assigned_core].nb_flows++;
-
-        previous_key = current_key;
-    }
-    // Compute the load of each core
+    // Count the flows of each core, reading the slots of the table in order
+    for (int slot = 0; slot < hashmap->capacity; slot++){
+        if (hashmap->map[slot].valid){
+            repartition->core_load[hashmap->map[slot].value->assigned_core % nbCores].capacity++;
+        }
+    }
+    // Size the arrays of each core, a core can receive up to max_migrations more flows
+    for (int i = 0; i < nbCores; i++){
+        repartition->core_load[i].capacity += max_migrations;
+        repartition->core_load[i].flows = malloc(repartition->core_load[i].capacity * sizeof(struct RingBuffer *));
+        repartition->core_load[i].flowKeys = malloc(repartition->core_load[i].capacity * sizeof(struct FiveTuple));
+        repartition->core_load[i].flowLoads = malloc(repartition->core_load[i].capacity * sizeof(uint64_t));
+    }
+    // Memorized assigned flows
+    for (int slot = 0; slot < hashmap->capacity; slot++){
+        if (!hashmap->map[slot].valid){
+            continue;
+        }
+        struct RingBuffer *value = hashmap->map[slot].value;
+        struct CoreLoad *core = &repartition->core_load[value->assigned_core % nbCores];
+        core->flowKeys[core->nb_flows] = hashmap->map[slot].key;
+        core->flows[core->nb_flows] = value;
+        core->nb_flows++;
+    }
+    // Compute the load of each flow: a flow keeps the cost of its packets on the core it is assigned to
+    // when it migrates
+    double scale[nbCores];
+    balancer_compute_scale(repartition->core_load, nbCores, scale);
     for (int i = 0; i < nbCores; i++){
-        repartition->core_load[i].core_idx = i;
-        balancer_update_core_info(&repartition->core_load[i]);
+        struct CoreLoad *core = &repartition->core_load[i];
+        core->core_idx = i;
+        for (int j = 0; j < core->nb_flows; j++){
+            core->flowLoads[j] = ringbuffer_get_last(core->flows[j]) * scale[i];
+        }
+        background_scaled[i] = background_load[i] * scale[i];
+        balancer_update_core_info(core);
+    }
+}
+
+/*
+    Walks the heap of a core from index i: best gets the biggest flow of at most `fit`, fallback the smallest
+    flow above it and below `limit`. The children of a flow are smaller, so only the flows above `fit` and the
+    first ones below it are visited.
+*/
+void balancer_find_flow(struct CoreLoad *core, int i, double fit, double limit, int *best, int *fallback){
+    if (i >= core->nb_flows){
+        return;
+    }
+    uint64_t load = core->flowLoads[i];
+    if (load <= fit){
+        if (load > 0 && (*best < 0 || load > core->flowLoads[*best])){
+            *best = i;
+        }
+        return;
+    }
+    if (load < limit && (*fallback < 0 || load < core->flowLoads[*fallback])){
+        *fallback = i;
     }
+    balancer_find_flow(core, 2 * i + 1, fit, limit, best, fallback);
+    balancer_find_flow(core, 2 * i + 2, fit, limit, best, fallback);
 }
 
-struct Migration balancer_migrate(struct CoreLoad *bigCore, struct CoreLoad *smallCore){
-    // Migrate the biggest flow
-    int biggestLoad_idx = bigCore->biggestLoad_idx;
-    struct RingBuffer *flow = bigCore->flows[biggestLoad_idx];
-    struct FiveTuple key = bigCore->flowKeys[biggestLoad_idx];
-    // Remove the flow from the big core
+/*
+    Index of the flow of the big core to migrate to the small core, -1 if no flow lowers the load of the big
+    core without putting the small core above it. The biggest flow that fits under half the gap between the
+    two cores (weighted by their capacities) is preferred: it can't come back on the next balancing, so flows
+    don't move back and forth between two cores.
+*/
+int balancer_pick_flow(struct CoreLoad *bigCore, struct CoreLoad *smallCore){
+    double big_capacity = core_capacity[bigCore->core_idx];
+    double small_capacity = core_capacity[smallCore->core_idx];
+    // Load that evens both cores out, and load past which the small core ends up above the big one
+    double fit = (bigCore->load * small_capacity - smallCore->load * big_capacity) / (big_capacity + small_capacity);
+    double limit = bigCore->load * small_capacity / big_capacity - smallCore->load;
+    int best = -1;
+    int fallback = -1;
+    balancer_find_flow(bigCore, 0, fit, limit, &best, &fallback);
+    return best >= 0 ? best : fallback;
+}
+
+struct Migration balancer_migrate(struct CoreLoad *bigCore, struct CoreLoad *smallCore, int i){
+    struct RingBuffer *flow = bigCore->flows[i];
+    struct FiveTuple key = bigCore->flowKeys[i];
+    uint64_t load = bigCore->flowLoads[i];
+    // Remove the flow from the big core, the last flow takes its place in the heap
     bigCore->nb_flows--;
-    bigCore->flows[biggestLoad_idx] = bigCore->flows[bigCore->nb_flows];
-    bigCore->flowKeys[biggestLoad_idx] = bigCore->flowKeys[bigCore->nb_flows];
+    balancer_swap_flows(bigCore, i, bigCore->nb_flows);
+    if (i < bigCore->nb_flows){
+        balancer_sift_flow_down(bigCore, i);
+        balancer_sift_flow_up(bigCore, i);
+    }
     // Add the flow to the small core
     smallCore->flows[smallCore->nb_flows] = flow;
     smallCore->flowKeys[smallCore->nb_flows] = key;
+    smallCore->flowLoads[smallCore->nb_flows] = load;
     smallCore->nb_flows++;
+    balancer_sift_flow_up(smallCore, smallCore->nb_flows - 1);
     // Update the assigned core
     flow->assigned_core = smallCore->core_idx;
-    // Update the load of the cores
-    balancer_update_core_info(bigCore);
-    balancer_update_core_info(smallCore);
+    // Update the load of the cores, the flow keeps its load
+    bigCore->load -= load;
+    smallCore->load += load;
     // Return a description of the migration
     struct Migration migration;
     migration.key = key;
@@ -112,48 +456,170 @@ struct Migration balancer_migrate(struct CoreLoad *bigCore, struct CoreLoad *sma
     return migration;
 }
 
-void balancer_free(struct Repartition *repartition){
+void balancer_free(struct Repartition *repartition, int nbCores){
+    for (int i = 0; i < nbCores; i++){
+        free(repartition->core_load[i].flows);
+        free(repartition->core_load[i].flowKeys);
+        free(repartition->core_load[i].flowLoads);
+    }
     free(repartition->core_load);
 }
 
+/*
+    Cores ordered by a key, as a binary heap of core indexes. pos gives the index of each core in the heap so
+    that a core whose load changed is moved in O(log cores).
+*/
+struct CoreHeap {
+    int nb_cores;
+    int8_t order; // 1 for a max-heap, -1 for a min-heap
+    int cores[MAX_CORES];
+    int pos[MAX_CORES];
+    double key[MAX_CORES];
+};
+
+/*
+    Key of a core in the heap of the cores to migrate from: the load over the capacity, infinite for a drained
+    core and -1 for a core without flows
+*/
+double balancer_source_key(struct CoreLoad *core){
+    if (core->nb_flows == 0){
+        return -1;
+    }
+    return core_capacity[core->core_idx] == 0 ? INFINITY : core->load / core_capacity[core->core_idx];
+}
+
+/*
+    Key of a core in the heap of the cores to migrate to: the load over the capacity, infinite for a drained core
+*/
+double balancer_destination_key(struct CoreLoad *core){
+    return core_capacity[core->core_idx] == 0 ? INFINITY : core->load / core_capacity[core->core_idx];
+}
+
+uint8_t balancer_heap_above(struct CoreHeap *heap, int i, int j){
+    double a = heap->key[heap->cores[i]];
+    double b = heap->key[heap->cores[j]];
+    return heap->order > 0 ? a > b : a < b;
+}
+
+void balancer_heap_swap(struct CoreHeap *heap, int i, int j){
+    int core = heap->cores[i];
+    heap->cores[i] = heap->cores[j];
+    heap->cores[j] = core;
+    heap->pos[heap->cores[i]] = i;
+    heap->pos[heap->cores[j]] = j;
+}
+
+/*
+    Moves a core to its place in the heap after its key changed
+*/
+void balancer_heap_update(struct CoreHeap *heap, int core, double key){
+    heap->key[core] = key;
+    int i = heap->pos[core];
+    while (i > 0 && balancer_heap_above(heap, i, (i - 1) / 2)){
+        balancer_heap_swap(heap, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    while (1){
+        int top = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < heap->nb_cores && balancer_heap_above(heap, left, top)){
+            top = left;
+        }
+        if (right < heap->nb_cores && balancer_heap_above(heap, right, top)){
+            top = right;
+        }
+        if (top == i){
+            return;
+        }
+        balancer_heap_swap(heap, i, top);
+        i = top;
+    }
+}
+
+void balancer_heap_init(struct CoreHeap *heap, struct Repartition *repartition, int nbCores, int8_t order){
+    heap->nb_cores = nbCores;
+    heap->order = order;
+    for (int i = 0; i < nbCores; i++){
+        heap->cores[i] = i;
+        heap->pos[i] = i;
+        heap->key[i] = 0;
+    }
+    for (int i = 0; i < nbCores; i++){
+        struct CoreLoad *core = &repartition->core_load[i];
+        balancer_heap_update(heap, i, order > 0 ? balancer_source_key(core) : balancer_destination_key(core));
+    }
+}
+
 void balancer_balance(struct HashMap *hashmap, int nbCores, struct Migrations *migrations){
     // Compute the repartition
     struct Repartition repartition;
     balancer_compute_repartition(&repartition, hashmap, nbCores);
-    while (migrations->nb_migrations < MAX_REBALANCE_ITERATIONS)
+    // Migrated flows keep their load, the total doesn't change during the balancing
+    uint64_t totalLoad = 0;
+    for (int i = 0; i < nbCores; i++){
+        totalLoad += repartition.core_load[i].load;
+    }
+    // Parked cores are drained like cores of capacity 0
+    balancer_consolidate(totalLoad, nbCores);
+    double totalCapacity = 0;
+    for (int i = 0; i < nbCores; i++){
+        totalCapacity += core_capacity[i];
+    }
+    // The core the most above its share of the total load, proportional to its capacity, is the top of
+    // sources and the core the most below the top of destinations
+    struct CoreHeap sources;
+    struct CoreHeap destinations;
+    balancer_heap_init(&sources, &repartition, nbCores, 1);
+    balancer_heap_init(&destinations, &repartition, nbCores, -1);
+    while (migrations->nb_migrations < max_migrations && totalCapacity > 0)
     {
-        // Compute the average load and find the core with the biggest load
-        // & the core with the smallest load
-        uint64_t averageLoad = 0;
-        uint64_t biggestLoad = 0;
-        uint64_t smallestLoad = UINT64_MAX;
-        int biggestLoad_idx = 0;
-        int smallestLoad_idx = 0;
-        for (int i = 0; i < nbCores; i++){
-            averageLoad += repartition.core_load[i].load;
-            if (repartition.core_load[i].load > biggestLoad){
-                biggestLoad = repartition.core_load[i].load;
-                biggestLoad_idx = i;
-            }
-            if (repartition.core_load[i].load < smallestLoad){
-                smallestLoad = repartition.core_load[i].load;
-                smallestLoad_idx = i;
-            }
+        int biggestLoad_idx = sources.cores[0];
+        int smallestLoad_idx = destinations.cores[0];
+        double largest_key = sources.key[biggestLoad_idx];
+        double smallest_key = destinations.key[smallestLoad_idx];
+        if (largest_key < 0 || smallest_key == INFINITY){
+            // No core has flows, or every core is drained
+            break;
         }
-        averageLoad /= nbCores;
+        // Draining: every flow must leave, whatever its load
+        uint8_t draining = largest_key == INFINITY;
+        long double largest_imbalance = totalLoad > 0 ? largest_key * totalCapacity / totalLoad : 0;
+        long double smallest_imbalance = totalLoad > 0 ? smallest_key * totalCapacity / totalLoad : 0;
         // Check if the load is balanced enough
-        long double largest_imbalance = (long double) biggestLoad / (long double) averageLoad;
-        long double smallest_imbalance = (long double) smallestLoad / (long double) averageLoad;
-        if (largest_imbalance > 1 + IMBALANCE_THRESHOLD || smallest_imbalance < 1 - IMBALANCE_THRESHOLD && averageLoad > 0) {
-            // printf("Rebalancing: largest_imbalance = %Lf, smallest_imbalance = %Lf, average_load = %lu\n", largest_imbalance, smallest_imbalance, averageLoad);
+        uint8_t imbalanced = totalLoad > 0 && (largest_imbalance > 1 + imbalance_threshold || smallest_imbalance < 1 - imbalance_threshold);
+        if (biggestLoad_idx != smallestLoad_idx && (draining || imbalanced)) {
             // There are too much flows on the core with the biggest load
-            migrations->migrations[migrations->nb_migrations] = balancer_migrate(&repartition.core_load[biggestLoad_idx], &repartition.core_load[smallestLoad_idx]);
+            struct CoreLoad *bigCore = &repartition.core_load[biggestLoad_idx];
+            struct CoreLoad *smallCore = &repartition.core_load[smallestLoad_idx];
+            // A drained core gives away its biggest flow first
+            int flow = draining ? 0 : balancer_pick_flow(bigCore, smallCore);
+            if (flow < 0){
+                // No migration lowers the most loaded core
+                break;
+            }
+            migrations->migrations[migrations->nb_migrations] = balancer_migrate(bigCore, smallCore, flow);
             migrations->nb_migrations++;
+            balancer_heap_update(&sources, biggestLoad_idx, balancer_source_key(bigCore));
+            balancer_heap_update(&sources, smallestLoad_idx, balancer_source_key(smallCore));
+            balancer_heap_update(&destinations, biggestLoad_idx, balancer_destination_key(bigCore));
+            balancer_heap_update(&destinations, smallestLoad_idx, balancer_destination_key(smallCore));
         } else {
             // The load is balanced enough
             break;
         }
     }
-    balancer_print_migrations(migrations, &repartition, nbCores, hashmap);
-    balancer_free(&repartition);
+    // The flows placed since the previous balancing are in the repartition now
+    uint64_t flows_load = 0;
+    int nb_flows = 0;
+    for (int i = 0; i < nbCores && i < MAX_CORES; i++){
+        balanced_load[i] = repartition.core_load[i].load;
+        placed_load[i] = 0;
+        flows_load += repartition.core_load[i].load - background_scaled[i];
+        nb_flows += repartition.core_load[i].nb_flows;
+    }
+    mean_flow_load = nb_flows && flows_load ? flows_load / nb_flows : 1;
+    balancer_log_cycle(migrations, &repartition, nbCores, hashmap);
+    balancer_free(&repartition, nbCores);
+    balance_cycles++;
 }
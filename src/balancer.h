@@ -3,17 +3,20 @@
 
 #include "env.h"
 #include "hashmap.h"
+#include "log.h"
 #include <math.h>
 #include <stdlib.h>
 
 
 struct CoreLoad {
     uint8_t core_idx;
-    uint64_t load;
-    int biggestLoad_idx;
+    uint64_t load; // Background load plus the load of the flows, kept up to date by the migrations
     int nb_flows;
-    struct RingBuffer* flows[HASHMAP_SIZE];
-    struct FiveTuple flowKeys[HASHMAP_SIZE];
+    int capacity;
+    // The flows of the core, a max-heap of their load: the biggest flow is the first one
+    struct RingBuffer** flows;
+    struct FiveTuple* flowKeys;
+    uint64_t* flowLoads; // Load of each flow, its packet rate scaled by the cost of a packet on its core
 };
 
 struct Repartition {
@@ -27,7 +30,7 @@ struct Migration {
 
 struct Migrations {
     int nb_migrations;
-    struct Migration migrations[MAX_REBALANCE_ITERATIONS];
+    struct Migration migrations[MAX_MIGRATIONS];
 };
 
 /*
@@ -37,7 +40,7 @@ struct Migrations {
         hashmap: hashmap containing the flows
         nbCores: number of cores
 */
-void balancer_compute_repartition(struct Repartition *repartition, struct HashMap *hashmap, uint8_t nbCores);
+void balancer_compute_repartition(struct Repartition *repartition, struct HashMap *hashmap, int nbCores);
 
 /*
     Balance the flows between the cores
@@ -46,9 +49,95 @@ void balancer_compute_repartition(struct Repartition *repartition, struct HashMa
 */
 void balancer_balance(struct HashMap *hashmap, int nbCores, struct Migrations *migrations);
 
+/*
+    Set the load of a core that is not attributed to any tracked flow (e.g. the aggregated load of mice flows).
+    This load is accounted in the load of the core but can't be migrated.
+    Parameters:
+        core: the core index
+        load: the background load of the core for the current cycle
+*/
+void balancer_set_background_load(int core, uint64_t load);
+
+/*
+    Set the relative capacity of a core, cores get a share of the total load proportional to their capacity.
+    A core with a capacity of 0 is drained: its flows are migrated to the other cores, at most
+    max_migrations per cycle, and it receives no new migrations.
+    Parameters:
+        core: the core index
+        capacity: the relative capacity of the core, 1 by default
+*/
+void balancer_set_capacity(int core, double capacity);
+
+/*
+    Set the load ceiling of consolidation: cores are parked, i.e. drained, while the load fits the remaining
+    ones, and brought back when it rises (see CONSOLIDATION_CEILING). Core 0 is never parked.
+    Parameters:
+        ceiling: load a core of capacity 1 should stay under, 0 to keep every core active
+*/
+void balancer_set_consolidation(double ceiling);
+
+/*
+    Tell whether a core is active, i.e. neither parked by consolidation nor drained by its capacity
+    Parameters:
+        core: the core index
+*/
+uint8_t balancer_core_active(int core);
+
+/*
+    Set the utilization of a core measured by the host for the current cycle (see feedback.h).
+    The packet load of each core is corrected by the cost of its packets: a core with twice the utilization
+    of the others for the same packet count counts its flows twice, in the proportion of the feedback weight.
+    Parameters:
+        core: the core index
+        utilization: busy fraction of the core, queue backlog included, negative when unknown
+*/
+void balancer_set_utilization(int core, double utilization);
+
+/*
+    Get the imbalance after the last balancing: the largest ratio between the load of a core and its share of the total load.
+    Drained cores are left out. Returns 0 when there is no load.
+    Parameters:
+        nbCores: number of cores
+*/
+double balancer_get_imbalance(int nbCores);
+
+/*
+    Change the balancing settings, they apply from the next call to balancer_balance
+    Parameters:
+        threshold: relative distance to the average load above which a core is rebalanced (IMBALANCE_THRESHOLD by default)
+        migrations_per_cycle: maximum number of migrations per call, at most MAX_MIGRATIONS (MAX_REBALANCE_ITERATIONS by default)
+        feedback_weight: 0 to balance packet counts, 1 to balance the host utilization (FEEDBACK_WEIGHT by default)
+*/
+void balancer_configure(double threshold, int migrations_per_cycle, double feedback_weight);
+
+/*
+    Change the policy placing new flows, it applies from the next call to balancer_place
+    Parameters:
+        policy: PLACEMENT_DEFAULT, PLACEMENT_LEAST_LOADED, PLACEMENT_TWO_CHOICES or PLACEMENT_WEIGHTED_HASH
+*/
+void balancer_set_placement(int policy);
+
+/*
+    Pick the core of a new flow with the placement policy, from the load of the last balancing and the flows
+    placed since. Each placed flow is expected to add the mean load of a flow to its core. Drained cores are
+    never picked, except by PLACEMENT_DEFAULT.
+    Parameters:
+        key: the new flow
+        nbCores: number of cores
+*/
+int balancer_place(struct FiveTuple *key, int nbCores);
+
+/*
+    Get the load of each core as decided by the last balancing, migrations included
+    Parameters:
+        core_load: array of nbCores loads to fill
+        nbCores: number of cores
+*/
+void balancer_get_core_load(uint64_t *core_load, int nbCores);
+
 /*
     Free the memory allocated for the repartition
 */
-void balancer_free(struct Repartition *repartition);
+void balancer_free(struct Repartition *repartition, int nbCores);
 
 #endif
@@ -0,0 +1,19 @@
+#ifndef __CONNECTION_H
+#define __CONNECTION_H
+
+/*
+Value of the per-CPU `connections` map, shared by the XDP programs and the userspace harvester.
+Kept as two 64 bits words (flags, then packets) so that userspace can reduce the per-CPU values
+with plain word operations.
+*/
+struct ConnectionState {
+  uint8_t SYN;
+  uint8_t SYNACK;
+  uint8_t ACK;
+  uint8_t FIN;
+  uint8_t HANDLED;
+  uint8_t pad[3];
+  uint64_t packets; /** Packets seen on this CPU */
+};
+
+#endif
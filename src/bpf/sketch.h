@@ -0,0 +1,49 @@
+#ifndef __SKETCH_H
+#define __SKETCH_H
+
+/*
+Count-Min sketch and top-K table shared by xdp_rx and the userspace reader.
+The includer must define struct FiveTuple (XDP layout, IP addresses in network byte order).
+*/
+
+struct CountMinSketch {
+  uint32_t counters[CMS_DEPTH][CMS_WIDTH];
+};
+
+struct HeavyHitter {
+  struct FiveTuple key;
+  uint32_t count; /** Sketch estimate when the entry was last updated */
+};
+
+struct TopK {
+  struct HeavyHitter entries[TOPK_SIZE];
+};
+
+/*
+Returns the column of `tuple` in the given row of the sketch.
+Each row uses a different seed so that collisions are independent between rows.
+*/
+static inline uint32_t cms_hash(const struct FiveTuple *tuple, uint32_t row){
+  uint32_t hash = 0x9747b28c ^ (row * 0x85ebca6b);
+  uint32_t words[3] = {
+    tuple->src_ip,
+    tuple->dst_ip,
+    ((uint32_t)tuple->src_port << 16 | tuple->dst_port) ^ ((uint32_t)tuple->proto << 8)
+  };
+  for (int i = 0; i < 3; i++){
+    uint32_t k = words[i] * 0xcc9e2d51;
+    k = (k << 15) | (k >> 17);
+    hash ^= k * 0x1b873593;
+    hash = ((hash << 13) | (hash >> 19)) * 5 + 0xe6546b64;
+  }
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6b;
+  hash ^= hash >> 13;
+  return hash & (CMS_WIDTH - 1);
+}
+
+static inline uint8_t five_tuple_same(const struct FiveTuple *a, const struct FiveTuple *b){
+  return a->src_ip == b->src_ip && a->dst_ip == b->dst_ip && a->src_port == b->src_port && a->dst_port == b->dst_port && a->proto == b->proto;
+}
+
+#endif
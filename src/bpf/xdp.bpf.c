@@ -23,15 +23,88 @@ struct {
     __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
     __uint(key_size, sizeof(struct FiveTuple));
     __uint(value_size, sizeof(struct ConnectionState));
-    __uint(max_entries, 4096*64);
+    __uint(max_entries, CONNECTIONS_MAX_ENTRIES);
 } connections SEC(".maps");
 
+// Flow to core assignments written by the balancer in STEERING_XDP mode
+// LRU so that flows the balancer stopped tracking eventually make room for new ones
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(key_size, sizeof(struct FiveTuple));
+    __uint(value_size, sizeof(uint32_t));
+    __uint(max_entries, 4096*64);
+} flow_cores SEC(".maps");
+
+// One entry per core, used by XDP_STEER_CPUMAP
+struct {
+    __uint(type, BPF_MAP_TYPE_CPUMAP);
+    __uint(key_size, sizeof(uint32_t));
+    __uint(value_size, sizeof(struct bpf_cpumap_val));
+    __uint(max_entries, MAX_CORES);
+} cpu_map SEC(".maps");
+
+// Per-CPU Count-Min sketch of packets per flow, reset by userspace every cycle
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(key_size, sizeof(uint32_t));
+    __uint(value_size, sizeof(struct CountMinSketch));
+    __uint(max_entries, 1);
+} sketch SEC(".maps");
+
+// Per-CPU heavy-hitter candidates, reset by userspace every cycle
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(key_size, sizeof(uint32_t));
+    __uint(value_size, sizeof(struct TopK));
+    __uint(max_entries, 1);
+} topk SEC(".maps");
+
 static inline int forward(void* map, u32 key, u64 flags){
     if (XDP_FORWARDING)
         return bpf_redirect_map(map, key, flags);
     return XDP_PASS;
 }
 
+static inline int push_vlan(struct xdp_md_copy *ctx, uint16_t vid){
+    void *data_end = (void *)(long)ctx->data_end;
+    void *data = (void *)(long)ctx->data;
+    struct ethhdr eth_copy;
+    struct ethhdr *eth = data;
+    if (data + sizeof(*eth) > data_end)
+        return -1;
+    __builtin_memcpy(&eth_copy, eth, sizeof(eth_copy));
+    // Make room for the tag in front of the frame
+    if (bpf_xdp_adjust_head((struct xdp_md *)ctx, -(int)sizeof(struct VlanTag)))
+        return -1;
+    data_end = (void *)(long)ctx->data_end;
+    data = (void *)(long)ctx->data;
+    eth = data;
+    struct VlanTag *tag = data + sizeof(struct ethhdr);
+    if (data + sizeof(*eth) + sizeof(*tag) > data_end)
+        return -1;
+    __builtin_memcpy(eth->h_dest, eth_copy.h_dest, sizeof(eth->h_dest));
+    __builtin_memcpy(eth->h_source, eth_copy.h_source, sizeof(eth->h_source));
+    eth->h_proto = bpf_htons(ETH_P_8021Q);
+    tag->tci = bpf_htons(vid & VLAN_VID_MASK);
+    tag->encapsulated_proto = eth_copy.h_proto;
+    return 0;
+}
+
+// Applies the balancer decision for the flow if there is one, forwards the frame otherwise
+static inline int steer(struct xdp_md_copy *ctx, struct FiveTuple *tuple){
+    if (STEERING_MODE != STEERING_XDP)
+        return forward(&map_redir, ctx->ingress_ifindex, 0);
+    uint32_t *assigned_core = bpf_map_lookup_elem(&flow_cores, tuple);
+    if (!assigned_core)
+        return forward(&map_redir, ctx->ingress_ifindex, 0);
+    uint32_t core = *assigned_core;
+    if (XDP_STEER_ACTION == XDP_STEER_CPUMAP)
+        return bpf_redirect_map(&cpu_map, core, XDP_PASS);
+    if (push_vlan(ctx, core) < 0)
+        return XDP_PASS;
+    return bpf_redirect_map(&map_redir, ctx->ingress_ifindex, 0);
+}
+
 static enum TCP_FLAGS parse_headers(struct xdp_md_copy *ctx, struct FiveTuple *tuple){
     void *data_end = (void *)(long)ctx->data_end;
     void *data = (void *)(long)ctx->data;
@@ -91,12 +164,48 @@ static inline void update_connection_state(struct FiveTuple *tuple, struct Conne
             old_state->ACK = 1;
         if (state->FIN)
             old_state->FIN = 1;
+        old_state->packets++;
         bpf_map_update_elem(&connections, tuple, old_state, BPF_ANY);
     } else {
+        state->packets = 1;
         bpf_map_update_elem(&connections, tuple, state, BPF_ANY);
     }
 }
 
+// Counts the packet in the sketch and keeps the flow in the top-K table if it is among the largest ones
+static inline void count_heavy_hitter(struct FiveTuple *tuple){
+    uint32_t zero = 0;
+    struct CountMinSketch *cms = bpf_map_lookup_elem(&sketch, &zero);
+    struct TopK *candidates = bpf_map_lookup_elem(&topk, &zero);
+    if (!cms || !candidates)
+        return;
+    // Maps are per-CPU, no need for atomic operations
+    uint32_t estimate = 0xFFFFFFFF;
+    for (uint32_t row = 0; row < CMS_DEPTH; row++){
+        uint32_t col = cms_hash(tuple, row);
+        uint32_t count = ++cms->counters[row][col];
+        if (count < estimate)
+            estimate = count;
+    }
+    uint32_t smallest = 0xFFFFFFFF;
+    uint32_t smallest_idx = 0;
+    for (uint32_t i = 0; i < TOPK_SIZE; i++){
+        struct HeavyHitter *entry = &candidates->entries[i];
+        if (five_tuple_same(&entry->key, tuple)){
+            entry->count = estimate;
+            return;
+        }
+        if (entry->count < smallest){
+            smallest = entry->count;
+            smallest_idx = i;
+        }
+    }
+    if (estimate > smallest && smallest_idx < TOPK_SIZE){
+        candidates->entries[smallest_idx].key = *tuple;
+        candidates->entries[smallest_idx].count = estimate;
+    }
+}
+
 static inline void swap_tuple(struct FiveTuple *tuple){
     uint32_t tmp_ip = tuple->src_ip;
     uint16_t tmp_port = tuple->src_port;
@@ -112,9 +221,12 @@ int xdp_rx(struct xdp_md_copy *ctx)
     struct FiveTuple tuple = {0};
     enum TCP_FLAGS flags = parse_headers(ctx, &tuple);
     if (flags == ERROR || 
-        flags == NO_FLAGS ||
         (flags == NOT_TCP && tuple.proto != IPPROTO_UDP))
         return forward(&map_redir, ctx->ingress_ifindex,0);
+    if (HEAVY_HITTER_TRACKING)
+        count_heavy_hitter(&tuple);
+    if (flags == NO_FLAGS)
+        return steer(ctx, &tuple);
     struct ConnectionState state = {0};
     if (flags == UDP){
         state.SYN = 1;
@@ -131,7 +243,7 @@ int xdp_rx(struct xdp_md_copy *ctx)
         //     state.FIN = 1;
     }
     update_connection_state(&tuple, &state);
-    return forward(&map_redir, ctx->ingress_ifindex,0);
+    return steer(ctx, &tuple);
 }
 
 SEC("xdp")
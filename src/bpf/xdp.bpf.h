@@ -4,6 +4,8 @@
 #include "../env.h"
 
 #define ETH_P_IP 0x0800
+#define ETH_P_8021Q 0x8100
+#define VLAN_VID_MASK 0x0fff
 
 #define BPF_ANY 0
 
@@ -15,13 +17,13 @@ struct FiveTuple {
   uint8_t proto;  /** 1 byte protocol */
 };
 
-struct ConnectionState {
-  uint8_t SYN;
-  uint8_t SYNACK;
-  uint8_t ACK;
-  uint8_t FIN;
-  uint8_t HANDLED;
-  uint8_t pad[3];
+#include "sketch.h"
+#include "connection.h"
+
+// 802.1Q tag inserted between the MAC addresses and the encapsulated ethertype
+struct VlanTag {
+  uint16_t tci; /** 2 bytes priority, DEI and VLAN ID */
+  uint16_t encapsulated_proto; /** 2 bytes ethertype of the tagged frame */
 };
 
 enum TCP_FLAGS {
@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include "../../vmlinux/vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include "../env.h"
+
+char LICENSE[] SEC("license") = "Dual BSD/GPL";
+
+// One AF_XDP socket per RX queue, i.e. per core
+struct {
+    __uint(type, BPF_MAP_TYPE_XSKMAP);
+    __uint(key_size, sizeof(uint32_t));
+    __uint(value_size, sizeof(uint32_t));
+    __uint(max_entries, MAX_CORES);
+} xsks_map SEC(".maps");
+
+SEC("xdp")
+int xdp_dispatch(struct xdp_md *ctx)
+{
+    // Frames of queues without socket go through the kernel stack
+    return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS);
+}
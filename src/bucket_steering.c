@@ -0,0 +1,60 @@
+#include "bucket_steering.h"
+
+int bucket_steering_init(struct BucketSteering *steering, openflow_connection *connection, int nb_cores){
+    memset(steering, 0, sizeof(*steering));
+    steering->connection = connection;
+    steering->nb_cores = nb_cores;
+    for (int bucket = 0; bucket < NB_BUCKETS; bucket++){
+        steering->bucket_core[bucket] = bucket % nb_cores;
+    }
+    // A group left by a previous run would make the ADD fail
+    if (openflow_mod_group(connection, OFPGC_DELETE, BUCKET_GROUP_ID, NULL, 0)){
+        return -1;
+    }
+    if (openflow_mod_group(connection, OFPGC_ADD, BUCKET_GROUP_ID, steering->bucket_core, NB_BUCKETS)){
+        return -1;
+    }
+    return openflow_add_group_rule(connection, BUCKET_GROUP_ID, BUCKET_RULE_PRIORITY);
+}
+
+struct FiveTuple bucket_steering_key(int bucket){
+    // Never the zero key, hashmap_get_next() starts iterating from it
+    struct FiveTuple key = {0};
+    key.src_port = bucket;
+    key.dst_port = BUCKET_GROUP_ID;
+    return key;
+}
+
+int bucket_steering_bucket(struct FiveTuple *key){
+    if (key->proto || key->src_ip || key->dst_ip || key->dst_port != BUCKET_GROUP_ID || key->src_port >= NB_BUCKETS){
+        return -1;
+    }
+    return key->src_port;
+}
+
+int bucket_steering_collect(struct BucketSteering *steering){
+    int nb_buckets = openflow_get_group_buckets(steering->connection, BUCKET_GROUP_ID, steering->packets, NB_BUCKETS);
+    if (nb_buckets != NB_BUCKETS){
+        printf("Group %d has %d buckets instead of %d\n", BUCKET_GROUP_ID, nb_buckets, NB_BUCKETS);
+        return -1;
+    }
+    return 0;
+}
+
+void bucket_steering_assign(struct BucketSteering *steering, int bucket, uint16_t core){
+    steering->bucket_core[bucket] = core;
+    steering->changed = 1;
+}
+
+int bucket_steering_commit(struct BucketSteering *steering){
+    if (!steering->changed){
+        return 0;
+    }
+    steering->changed = 0;
+    // A SELECT group can only be replaced as a whole
+    return openflow_mod_group(steering->connection, OFPGC_MODIFY, BUCKET_GROUP_ID, steering->bucket_core, NB_BUCKETS);
+}
+
+int bucket_steering_pin(struct BucketSteering *steering, struct FiveTuple *key, uint16_t core, uint64_t cookie){
+    return openflow_pin_flow(steering->connection, key, core, cookie);
+}
@@ -0,0 +1,96 @@
+/**
+ * @file bucket_steering.h
+ * @brief Bucket to core steering through an OpenFlow 1.3 SELECT group (STEERING_BUCKETS mode)
+ *
+ * The switch hashes the flows over the NB_BUCKETS buckets of a single group, each bucket tagging
+ * its packets with the VLAN of a core. The buckets are tracked in the flow table like flows, under
+ * a pseudo key, with their packet counters read from the group stats. Migrating a bucket changes
+ * its VLAN, all the changes of a cycle are sent as one GROUP_MOD. Elephants can be pinned on top of
+ * the group with exact-match rules, they are then balanced as flows.
+ *
+ */
+
+#ifndef BUCKET_STEERING_H
+#define BUCKET_STEERING_H
+
+#include "openflow13.h"
+#include "hashmap.h"
+
+#if NB_BUCKETS > OPENFLOW13_MAX_BUCKETS
+#error "NB_BUCKETS must not exceed OPENFLOW13_MAX_BUCKETS"
+#endif
+
+struct BucketSteering {
+    openflow_connection *connection;
+    int nb_cores;
+    uint16_t bucket_core[NB_BUCKETS];
+    uint64_t packets[NB_BUCKETS]; /** Packet counter of each bucket, from the last group stats */
+    uint8_t changed; /** A bucket was assigned since the last commit */
+};
+
+/**
+ * @brief Replaces the group of the switch by one spreading the buckets over the cores round-robin,
+ * then sends the IPv4 traffic of the network port to it
+ *
+ * @param steering : the structure to fill
+ * @param connection : an OpenFlow 1.3 or later connection, kept to send the GROUP_MODs
+ * @param nb_cores : the number of cores buckets are steered to
+ * @return int : 0 on success, -1 if the switch doesn't speak OpenFlow 1.3
+ */
+int bucket_steering_init(struct BucketSteering *steering, openflow_connection *connection, int nb_cores);
+
+/**
+ * @brief Key of a bucket in the flow table: protocol 0, the bucket index as source port and the group
+ * as destination port
+ *
+ * @param bucket
+ * @return struct FiveTuple
+ */
+struct FiveTuple bucket_steering_key(int bucket);
+
+/**
+ * @brief Tells whether a flow table key is a bucket
+ *
+ * @param key
+ * @return int : the bucket index, -1 for a flow
+ */
+int bucket_steering_bucket(struct FiveTuple *key);
+
+/**
+ * @brief Reads the packet counters of the buckets into `steering->packets`
+ *
+ * @param steering
+ * @return int : 0 on success, -1 if the group stats could not be read
+ */
+int bucket_steering_collect(struct BucketSteering *steering);
+
+/**
+ * @brief Assigns a bucket to a core, sent on the next bucket_steering_commit()
+ *
+ * @param steering
+ * @param bucket
+ * @param core
+ */
+void bucket_steering_assign(struct BucketSteering *steering, int bucket, uint16_t core);
+
+/**
+ * @brief Sends the buckets assigned since the last commit as a single GROUP_MOD, added to the
+ * bundle of the cycle if one was begun
+ *
+ * @param steering
+ * @return int : 0 on success, -1 otherwise
+ */
+int bucket_steering_commit(struct BucketSteering *steering);
+
+/**
+ * @brief Pins a flow to a core with an exact-match rule taking precedence over the group
+ *
+ * @param steering
+ * @param key : the flow, as stored in the flow table
+ * @param core
+ * @param cookie : cookie of the rule, see openflow_flow_cookie
+ * @return int : 0 on success, -1 otherwise
+ */
+int bucket_steering_pin(struct BucketSteering *steering, struct FiveTuple *key, uint16_t core, uint64_t cookie);
+
+#endif
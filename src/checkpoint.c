@@ -0,0 +1,186 @@
+#include "checkpoint.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+    Reads the identifier of the current boot, left empty if the kernel doesn't give it
+*/
+static void checkpoint_boot_id(char *boot_id){
+    memset(boot_id, 0, CHECKPOINT_BOOT_ID_SIZE);
+    FILE *file = fopen("/proc/sys/kernel/random/boot_id", "r");
+    if (!file){
+        return;
+    }
+    if (!fgets(boot_id, CHECKPOINT_BOOT_ID_SIZE, file)){
+        boot_id[0] = '\0';
+    }
+    boot_id[strcspn(boot_id, "\n")] = '\0';
+    fclose(file);
+}
+
+static size_t checkpoint_record_size(int ring_size){
+    // Records stay 8 bytes aligned
+    return sizeof(struct CheckpointFlow) + (size_t)ring_size * sizeof(uint64_t);
+}
+
+/*
+    Header of an area, NULL if the area holds no complete checkpoint readable with this version
+*/
+static struct CheckpointHeader *checkpoint_area(struct Checkpoint *checkpoint, int area){
+    struct CheckpointHeader *header = (struct CheckpointHeader *)(checkpoint->data + area * checkpoint->area_length);
+    if (header->magic != CHECKPOINT_MAGIC || header->version != CHECKPOINT_VERSION ||
+        !__atomic_load_n(&header->complete, __ATOMIC_ACQUIRE) || header->record_size < sizeof(struct CheckpointFlow) ||
+        sizeof(*header) + (size_t)header->nb_flows * header->record_size > checkpoint->area_length){
+        return NULL;
+    }
+    return header;
+}
+
+int checkpoint_open(struct Checkpoint *checkpoint, const char *path, int capacity, int ring_size){
+    memset(checkpoint, 0, sizeof(*checkpoint));
+    checkpoint->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (checkpoint->fd < 0){
+        printf("Could not open the checkpoint file %s\n", path);
+        return -1;
+    }
+    struct stat file_stat;
+    if (fstat(checkpoint->fd, &file_stat)){
+        printf("Could not read the size of the checkpoint file %s\n", path);
+        checkpoint_close(checkpoint);
+        return -1;
+    }
+    // Never shrink the file, a previous checkpoint of a larger table is restored first. Areas stay 8 bytes aligned.
+    size_t area_length = sizeof(struct CheckpointHeader) + (size_t)capacity * checkpoint_record_size(ring_size);
+    size_t previous_area_length = ((size_t)file_stat.st_size / 2) & ~(size_t)7;
+    if (previous_area_length >= area_length){
+        area_length = previous_area_length;
+    } else if (ftruncate(checkpoint->fd, 2 * area_length)){
+        printf("Could not size the checkpoint file %s\n", path);
+        checkpoint_close(checkpoint);
+        return -1;
+    }
+    size_t length = 2 * area_length;
+    checkpoint->data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, checkpoint->fd, 0);
+    if (checkpoint->data == MAP_FAILED){
+        printf("Could not map the checkpoint file %s\n", path);
+        checkpoint->data = NULL;
+        checkpoint_close(checkpoint);
+        return -1;
+    }
+    if (previous_area_length && previous_area_length < area_length){
+        // The second area of a smaller table moves to the middle of the grown file
+        memmove(checkpoint->data + area_length, checkpoint->data + previous_area_length, previous_area_length);
+    }
+    checkpoint->length = length;
+    checkpoint->area_length = area_length;
+    checkpoint->newest = -1;
+    for (int area = 0; area < 2; area++){
+        struct CheckpointHeader *header = checkpoint_area(checkpoint, area);
+        if (header && (checkpoint->newest < 0 || header->sequence > checkpoint->sequence)){
+            checkpoint->newest = area;
+            checkpoint->sequence = header->sequence;
+        }
+    }
+    checkpoint->capacity = capacity;
+    checkpoint->ring_size = ring_size;
+    checkpoint_boot_id(checkpoint->boot_id);
+    return 0;
+}
+
+int checkpoint_restore(struct Checkpoint *checkpoint, struct HashMap *map, int nb_cores){
+    if (checkpoint->newest < 0){
+        return -1;
+    }
+    uint8_t *area = checkpoint->data + checkpoint->newest * checkpoint->area_length;
+    struct CheckpointHeader *header = (struct CheckpointHeader *)area;
+    // Monotonic times of a previous boot are meaningless, the first sample is then a reference
+    uint8_t same_boot = checkpoint->boot_id[0] && !strncmp(header->boot_id, checkpoint->boot_id, CHECKPOINT_BOOT_ID_SIZE);
+    int max_history = (header->record_size - sizeof(struct CheckpointFlow)) / sizeof(uint64_t);
+    int restored = 0;
+    for (uint32_t i = 0; i < header->nb_flows && map->size < map->capacity; i++){
+        struct CheckpointFlow *flow = (struct CheckpointFlow *)(area + sizeof(*header) + (size_t)i * header->record_size);
+        if (flow->history_size < 0 || flow->history_size > max_history){
+            continue;
+        }
+        struct RingBuffer *ring_buffer = hashmap_new_at(map, flow->slot, flow->generation, &flow->key);
+        if (!ring_buffer){
+            // Smaller table, the cookies of the rules of the flow no longer lead to it
+            ring_buffer = hashmap_new(map, &flow->key);
+            if (!ring_buffer){
+                continue;
+            }
+        }
+        ring_buffer->assigned_core = flow->assigned_core % nb_cores;
+        int first = flow->history_size > ring_buffer->capacity ? flow->history_size - ring_buffer->capacity : 0;
+        for (int j = first; j < flow->history_size; j++){
+            ringbuffer_add(ring_buffer, flow->history[j]);
+        }
+        ring_buffer->packets = flow->packets;
+        ring_buffer->bytes = flow->bytes;
+        ring_buffer->sample_ns = same_boot ? flow->sample_ns : 0;
+        ring_buffer->age_ns = flow->age_ns;
+        ring_buffer->byte_rate = flow->byte_rate;
+        // Expires like the other flows if it isn't sampled anymore
+        ring_buffer->is_active = 1;
+        restored++;
+    }
+    return restored;
+}
+
+void checkpoint_write(struct Checkpoint *checkpoint, struct HashMap *map){
+    // The other area than the last complete checkpoint, which stays restorable until this one is complete
+    int target = checkpoint->newest == 0 ? 1 : 0;
+    uint8_t *area = checkpoint->data + target * checkpoint->area_length;
+    struct CheckpointHeader *header = (struct CheckpointHeader *)area;
+    // Incomplete until every flow is written
+    __atomic_store_n(&header->complete, 0, __ATOMIC_RELEASE);
+    header->magic = CHECKPOINT_MAGIC;
+    header->version = CHECKPOINT_VERSION;
+    header->record_size = checkpoint_record_size(checkpoint->ring_size);
+    uint32_t nb_flows = 0;
+    for (int slot = 0; slot < map->capacity && nb_flows < (uint32_t)checkpoint->capacity; slot++){
+        if (!map->map[slot].valid){
+            continue;
+        }
+        struct RingBuffer *ring_buffer = map->map[slot].value;
+        struct CheckpointFlow *flow = (struct CheckpointFlow *)(area + sizeof(*header) + (size_t)nb_flows * header->record_size);
+        flow->key = map->map[slot].key;
+        flow->slot = slot;
+        flow->generation = map->map[slot].generation;
+        flow->assigned_core = ring_buffer->assigned_core;
+        flow->packets = ring_buffer->packets;
+        flow->bytes = ring_buffer->bytes;
+        flow->sample_ns = ring_buffer->sample_ns;
+        flow->age_ns = ring_buffer->age_ns;
+        flow->byte_rate = ring_buffer->byte_rate;
+        // Oldest rate first
+        int size = ring_buffer->size < checkpoint->ring_size ? ring_buffer->size : checkpoint->ring_size;
+        for (int j = 0; j < size; j++){
+            int pos = (ring_buffer->pos - size + 1 + j + ring_buffer->capacity) % ring_buffer->capacity;
+            flow->history[j] = ring_buffer->buffer[pos];
+        }
+        flow->history_size = size;
+        nb_flows++;
+    }
+    header->nb_flows = nb_flows;
+    memcpy(header->boot_id, checkpoint->boot_id, CHECKPOINT_BOOT_ID_SIZE);
+    header->sequence = checkpoint->newest < 0 ? 0 : checkpoint->sequence + 1;
+    __atomic_store_n(&header->complete, 1, __ATOMIC_RELEASE);
+    checkpoint->newest = target;
+    checkpoint->sequence = header->sequence;
+}
+
+void checkpoint_close(struct Checkpoint *checkpoint){
+    if (checkpoint->data){
+        munmap(checkpoint->data, checkpoint->length);
+        checkpoint->data = NULL;
+    }
+    if (checkpoint->fd >= 0){
+        close(checkpoint->fd);
+    }
+    checkpoint->fd = -1;
+}
@@ -0,0 +1,110 @@
+/**
+ * @file checkpoint.h
+ * @brief Checkpoint of the flow table in a memory-mapped file, for warm restarts
+ *
+ * Without it, a restarted daemon starts with an empty flow table: every flow is assigned to core 0
+ * again, the first cycle sees all the load there and migrates flows that the switch already steers
+ * to other cores. At the end of each cycle, the daemon copies its flow table into a file mapped in
+ * memory: the keys, the slot and generation of each flow (so the cookies of its rules still lead to
+ * it), its core, its last counters and its rate history. The copy lands in the page cache, the file
+ * survives a crash or a restart of the daemon and is restored at startup.
+ *
+ * The file holds two areas of the same size, written in turn so the last complete checkpoint is never
+ * overwritten. Each area is a `struct CheckpointHeader` followed by `nb_flows` records of `record_size`
+ * bytes, each a `struct CheckpointFlow` followed by its rate history, oldest first. The header is marked
+ * incomplete while the flows are written, so a checkpoint interrupted midway is not restored: the other
+ * area, of a lower sequence, is restored instead.
+ *
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hashmap.h"
+
+#define CHECKPOINT_MAGIC 0x4f524350 // "ORCP"
+#define CHECKPOINT_VERSION 3
+#define CHECKPOINT_BOOT_ID_SIZE 40
+
+struct CheckpointHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t complete; /** 0 while the flows are written */
+    uint8_t padding;
+    uint32_t record_size; /** Bytes of each flow record, its history included */
+    uint32_t nb_flows;
+    uint64_t sequence; /** Checkpoints written before this one, the complete area of highest sequence is restored */
+    char boot_id[CHECKPOINT_BOOT_ID_SIZE]; /** /proc/sys/kernel/random/boot_id when written, the sample times are CLOCK_MONOTONIC of that boot */
+};
+
+struct CheckpointFlow {
+    struct FiveTuple key;
+    int32_t slot; /** Slot of the flow in the flow table */
+    uint16_t generation; /** Generation of the slot, part of the cookies of the rules of the flow */
+    uint8_t assigned_core;
+    uint8_t padding;
+    int32_t history_size; /** Rates in the history */
+    // Last sample, see struct RingBuffer
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t sample_ns;
+    uint64_t age_ns;
+    uint64_t byte_rate;
+    uint64_t history[]; /** Packets per second, oldest first */
+};
+
+struct Checkpoint {
+    int fd;
+    uint8_t *data; /** The mapped file */
+    size_t length;
+    size_t area_length; /** Bytes of each of the two areas, half of the file */
+    int newest; /** Area of the last complete checkpoint, -1 if none */
+    uint64_t sequence; /** Of that checkpoint */
+    int capacity; /** Flows each area can hold */
+    int ring_size;
+    char boot_id[CHECKPOINT_BOOT_ID_SIZE]; /** Of the running kernel, empty if unknown */
+};
+
+/**
+ * @brief Opens (or creates) the checkpoint file and maps it, with two areas large enough for a flow table of
+ * `capacity` flows. The last complete checkpoint in the file is kept until the second checkpoint_write.
+ *
+ * @param checkpoint : the structure to fill
+ * @param path : the checkpoint file
+ * @param capacity : flows of the flow table
+ * @param ring_size : rates kept per flow
+ * @return int : 0 on success, -1 otherwise
+ */
+int checkpoint_open(struct Checkpoint *checkpoint, const char *path, int capacity, int ring_size);
+
+/**
+ * @brief Fills an empty flow table with the flows of the last complete checkpoint. Flows keep their slot and
+ * generation when the table is large enough, their rate history is truncated to the ring size of the table.
+ * Sample times are dropped unless the checkpoint was written since the last boot. Cores beyond `nb_cores`
+ * (a restart with fewer cores) are folded like the VLANs of the rules, core % nb_cores.
+ *
+ * @param checkpoint
+ * @param map : the flow table
+ * @param nb_cores : cores balanced by this run
+ * @return int : the number of flows restored, -1 if the file holds no complete checkpoint
+ */
+int checkpoint_restore(struct Checkpoint *checkpoint, struct HashMap *map, int nb_cores);
+
+/**
+ * @brief Copies the flow table into the area not holding the last complete checkpoint
+ *
+ * @param checkpoint
+ * @param map : the flow table, at most the capacity given to checkpoint_open
+ */
+void checkpoint_write(struct Checkpoint *checkpoint, struct HashMap *map);
+
+/**
+ * @brief Unmaps the checkpoint file, the last checkpoint stays in it
+ *
+ * @param checkpoint
+ */
+void checkpoint_close(struct Checkpoint *checkpoint);
+
+#endif
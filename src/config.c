@@ -0,0 +1,346 @@
+#include "config.h"
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The command line, applied again on reload
+int config_argc = 0;
+char **config_argv = NULL;
+
+static struct option config_options[] = {
+    {"config", required_argument, 0, 0},
+    {"cores", required_argument, 0, 0},
+    {"table-size", required_argument, 0, 0},
+    {"ring-size", required_argument, 0, 0},
+    {"of-port", required_argument, 0, 0},
+    {"imbalance-threshold", required_argument, 0, 0},
+    {"max-migrations", required_argument, 0, 0},
+    {"period-ms", required_argument, 0, 0},
+    {"log-level", required_argument, 0, 0},
+    {"core-capacity", required_argument, 0, 0},
+    {"drain", required_argument, 0, 0},
+    {"feedback", required_argument, 0, 0},
+    {"feedback-weight", required_argument, 0, 0},
+    {"core-rate-limit", required_argument, 0, 0},
+    {"placement", required_argument, 0, 0},
+    {"consolidation-ceiling", required_argument, 0, 0},
+    {"checkpoint", required_argument, 0, 0},
+    {"assignments", required_argument, 0, 0},
+    {"help", no_argument, 0, 0},
+    {0, 0, 0, 0}
+};
+
+static const char *config_log_levels[] = {"error", "warn", "info", "debug"};
+// Indexed by PLACEMENT_*
+static const char *config_placements[] = {"default", "least-loaded", "two-choices", "weighted-hash"};
+
+void config_usage(const char *prog){
+    printf("Usage: %s [options]\n"
+        "  --config FILE               read the settings below from FILE (key = value), reloaded on SIGHUP\n"
+        "  --cores N                   host cores to balance, at most %d (default %d)\n"
+        "  --table-size N              flows in the flow table (default %d)\n"
+        "  --ring-size N               packet counters kept per flow (default %d)\n"
+        "  --of-port PORT              OpenFlow listening port (default %d)\n"
+        "  --imbalance-threshold F     rebalance cores further than F from the average load (default %g)\n"
+        "  --max-migrations N          migrations per cycle, at most %d (default %d)\n"
+        "  --period-ms MS              time between two balancing cycles (default %d)\n"
+        "  --log-level LEVEL           error, warn, info or debug (default %s)\n"
+        "  --core-capacity C0,C1,...   relative capacity of the first cores, the others have 1 (default 1)\n"
+        "  --drain CORE,...            migrate every flow off these cores (capacity 0)\n"
+        "  --feedback ADDRESS          UDP port on the loopback, addr:port or Unix socket path of the host feedback, off to ignore it (default %s)\n"
+        "  --feedback-weight F         0 balances packet counts, 1 the host utilization (default %g)\n"
+        "  --core-rate-limit PPS       meter the packets steered to each core, OpenFlow 1.3+, 0 for none (default %d)\n"
+        "  --placement POLICY          core of the new flows: default (core 0), least-loaded, two-choices\n"
+        "                              or weighted-hash (default %s)\n"
+        "  --consolidation-ceiling PPS load a core should stay under, the others are parked at low load,\n"
+        "                              0 to use every core (default %g)\n"
+        "  --checkpoint FILE           checkpoint of the flow table, restored at startup, off for none (default %s)\n"
+        "  --assignments FILE          shared memory file the cores of the flows are published in, off for none\n"
+        "                              (default %s)\n",
+        prog, MAX_CORES, NB_CORES, HASHMAP_SIZE, RING_SIZE, OF_PORT, IMBALANCE_THRESHOLD,
+        MAX_MIGRATIONS, MAX_REBALANCE_ITERATIONS, BALANCING_PERIOD_MS, config_log_levels[LOG_LEVEL],
+        FEEDBACK_ADDRESS, FEEDBACK_WEIGHT, CORE_RATE_LIMIT, config_placements[PLACEMENT_POLICY], (double)CONSOLIDATION_CEILING, CHECKPOINT_PATH,
+        ASSIGNMENTS_PATH);
+}
+
+void config_defaults(struct Config *config){
+    config->path = NULL;
+    config->nb_cores = NB_CORES;
+    config->table_size = HASHMAP_SIZE;
+    config->ring_size = RING_SIZE;
+    config->of_port = OF_PORT;
+    config->imbalance_threshold = IMBALANCE_THRESHOLD;
+    config->max_migrations = MAX_REBALANCE_ITERATIONS;
+    config->period_ms = BALANCING_PERIOD_MS;
+    config->log_level = LOG_LEVEL;
+    strncpy(config->feedback, FEEDBACK_ADDRESS, sizeof(config->feedback) - 1);
+    config->feedback[sizeof(config->feedback) - 1] = '\0';
+    config->feedback_weight = FEEDBACK_WEIGHT;
+    config->core_rate_limit = CORE_RATE_LIMIT;
+    config->placement = PLACEMENT_POLICY;
+    config->consolidation_ceiling = CONSOLIDATION_CEILING;
+    strncpy(config->checkpoint, CHECKPOINT_PATH, sizeof(config->checkpoint) - 1);
+    config->checkpoint[sizeof(config->checkpoint) - 1] = '\0';
+    strncpy(config->assignments, ASSIGNMENTS_PATH, sizeof(config->assignments) - 1);
+    config->assignments[sizeof(config->assignments) - 1] = '\0';
+    for (int core = 0; core < MAX_CORES; core++){
+        config->core_capacity[core] = 1;
+    }
+}
+
+/**
+ * @brief Parses an integer setting in [min, max]
+ */
+int config_parse_int(const char *key, const char *value, long min, long max, int *result){
+    char *end;
+    long parsed = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || parsed < min || parsed > max){
+        printf("Invalid %s: %s, expected an integer between %ld and %ld\n", key, value, min, max);
+        return -1;
+    }
+    *result = parsed;
+    return 0;
+}
+
+/**
+ * @brief Sets a setting from its textual value
+ */
+int config_set(struct Config *config, const char *key, const char *value){
+    if (!strcmp(key, "cores")){
+        return config_parse_int(key, value, 1, MAX_CORES, &config->nb_cores);
+    } else if (!strcmp(key, "table-size")){
+        return config_parse_int(key, value, 1, 1 << 30, &config->table_size);
+    } else if (!strcmp(key, "ring-size")){
+        return config_parse_int(key, value, 1, 1 << 16, &config->ring_size);
+    } else if (!strcmp(key, "of-port")){
+        return config_parse_int(key, value, 1, 65535, &config->of_port);
+    } else if (!strcmp(key, "max-migrations")){
+        return config_parse_int(key, value, 0, MAX_MIGRATIONS, &config->max_migrations);
+    } else if (!strcmp(key, "core-rate-limit")){
+        return config_parse_int(key, value, 0, 2147483647, &config->core_rate_limit);
+    } else if (!strcmp(key, "period-ms")){
+        return config_parse_int(key, value, 1, 3600000, &config->period_ms);
+    } else if (!strcmp(key, "imbalance-threshold")){
+        char *end;
+        double threshold = strtod(value, &end);
+        if (end == value || *end != '\0' || threshold <= 0){
+            printf("Invalid %s: %s, expected a positive number\n", key, value);
+            return -1;
+        }
+        config->imbalance_threshold = threshold;
+        return 0;
+    } else if (!strcmp(key, "feedback-weight")){
+        char *end;
+        double weight = strtod(value, &end);
+        if (end == value || *end != '\0' || weight < 0 || weight > 1){
+            printf("Invalid %s: %s, expected a number between 0 and 1\n", key, value);
+            return -1;
+        }
+        config->feedback_weight = weight;
+        return 0;
+    } else if (!strcmp(key, "consolidation-ceiling")){
+        char *end;
+        double ceiling = strtod(value, &end);
+        if (end == value || *end != '\0' || ceiling < 0){
+            printf("Invalid %s: %s, expected a number of packets per second, 0 to disable consolidation\n", key, value);
+            return -1;
+        }
+        config->consolidation_ceiling = ceiling;
+        return 0;
+    } else if (!strcmp(key, "feedback")){
+        if (strlen(value) >= sizeof(config->feedback)){
+            printf("Invalid %s: %s, the address is too long\n", key, value);
+            return -1;
+        }
+        strcpy(config->feedback, value);
+        return 0;
+    } else if (!strcmp(key, "checkpoint")){
+        if (strlen(value) >= sizeof(config->checkpoint)){
+            printf("Invalid %s: %s, the path is too long\n", key, value);
+            return -1;
+        }
+        strcpy(config->checkpoint, value);
+        return 0;
+    } else if (!strcmp(key, "assignments")){
+        if (strlen(value) >= sizeof(config->assignments)){
+            printf("Invalid %s: %s, the path is too long\n", key, value);
+            return -1;
+        }
+        strcpy(config->assignments, value);
+        return 0;
+    } else if (!strcmp(key, "core-capacity") || !strcmp(key, "drain")){
+        // Comma separated list, capacities of cores 0, 1... or indexes of drained cores
+        uint8_t drain = !strcmp(key, "drain");
+        const char *item = value;
+        for (int core = 0; *item; core++){
+            char *end;
+            double parsed = strtod(item, &end);
+            if (end == item || (*end != ',' && *end != '\0') || parsed < 0 ||
+                (drain ? parsed >= MAX_CORES || parsed != (int)parsed : core >= MAX_CORES)){
+                printf("Invalid %s: %s\n", key, value);
+                return -1;
+            }
+            if (drain){
+                config->core_capacity[(int)parsed] = 0;
+            } else {
+                config->core_capacity[core] = parsed;
+            }
+            item = *end ? end + 1 : end;
+        }
+        return 0;
+    } else if (!strcmp(key, "log-level")){
+        for (int level = LOG_LEVEL_ERROR; level <= LOG_LEVEL_DEBUG; level++){
+            if (!strcmp(value, config_log_levels[level])){
+                config->log_level = level;
+                return 0;
+            }
+        }
+        printf("Invalid %s: %s, expected error, warn, info or debug\n", key, value);
+        return -1;
+    } else if (!strcmp(key, "placement")){
+        for (int policy = PLACEMENT_DEFAULT; policy <= PLACEMENT_WEIGHTED_HASH; policy++){
+            if (!strcmp(value, config_placements[policy])){
+                config->placement = policy;
+                return 0;
+            }
+        }
+        printf("Invalid %s: %s, expected default, least-loaded, two-choices or weighted-hash\n", key, value);
+        return -1;
+    }
+    printf("Unknown setting %s\n", key);
+    return -1;
+}
+
+/**
+ * @brief Reads `key = value` lines from a file
+ */
+int config_load_file(struct Config *config, const char *path){
+    FILE *file = fopen(path, "r");
+    if (!file){
+        printf("Could not open the configuration file %s\n", path);
+        return -1;
+    }
+    char line[256];
+    int line_number = 0;
+    int status = 0;
+    while (fgets(line, sizeof(line), file)){
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment){
+            *comment = '\0';
+        }
+        char key[64];
+        char value[128];
+        int nb_fields = sscanf(line, " %63[^= \t] = %127s", key, value);
+        if (nb_fields <= 0){
+            // Empty line
+            continue;
+        }
+        if (nb_fields != 2 || !strcmp(key, "config") || config_set(config, key, value)){
+            printf("%s:%d: invalid setting\n", path, line_number);
+            status = -1;
+        }
+    }
+    fclose(file);
+    return status;
+}
+
+/**
+ * @brief Builds a configuration from scratch: defaults, file, then command line
+ */
+int config_build(struct Config *config){
+    config_defaults(config);
+    // First pass for the configuration file, the command line takes precedence over it
+    optind = 0;
+    opterr = 0;
+    int index = -1;
+    while (getopt_long(config_argc, config_argv, "", config_options, &index) != -1){
+        if (index >= 0 && !strcmp(config_options[index].name, "config")){
+            config->path = optarg;
+        }
+        index = -1;
+    }
+    if (config->path && config_load_file(config, config->path)){
+        return -1;
+    }
+    optind = 0;
+    opterr = 1;
+    int opt;
+    while ((opt = getopt_long(config_argc, config_argv, "", config_options, &index)) != -1){
+        if (opt != 0){
+            config_usage(config_argv[0]);
+            return -1;
+        }
+        const char *name = config_options[index].name;
+        if (!strcmp(name, "help")){
+            config_usage(config_argv[0]);
+            exit(0);
+        }
+        if (strcmp(name, "config") && config_set(config, name, optarg)){
+            return -1;
+        }
+    }
+    if (optind != config_argc){
+        config_usage(config_argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+int config_init(struct Config *config, int argc, char *argv[]){
+    config_argc = argc;
+    config_argv = argv;
+    return config_build(config);
+}
+
+int config_reload(struct Config *config){
+    struct Config reloaded;
+    if (config_build(&reloaded)){
+        printf("Configuration not reloaded\n");
+        return -1;
+    }
+    if (reloaded.nb_cores != config->nb_cores || reloaded.table_size != config->table_size ||
+        reloaded.ring_size != config->ring_size || reloaded.of_port != config->of_port ||
+        strcmp(reloaded.feedback, config->feedback) || reloaded.core_rate_limit != config->core_rate_limit ||
+        strcmp(reloaded.checkpoint, config->checkpoint) || strcmp(reloaded.assignments, config->assignments)){
+        printf("cores, table-size, ring-size, of-port, feedback, core-rate-limit, checkpoint and assignments only change on restart\n");
+    }
+    config->imbalance_threshold = reloaded.imbalance_threshold;
+    config->max_migrations = reloaded.max_migrations;
+    config->period_ms = reloaded.period_ms;
+    config->log_level = reloaded.log_level;
+    config->feedback_weight = reloaded.feedback_weight;
+    config->placement = reloaded.placement;
+    config->consolidation_ceiling = reloaded.consolidation_ceiling;
+    memcpy(config->core_capacity, reloaded.core_capacity, sizeof(config->core_capacity));
+    return 0;
+}
+
+void config_print(struct Config *config){
+    printf("Configuration%s%s: %d cores, %d flows of %d counters, OpenFlow port %d, "
+        "imbalance threshold %g, %d migrations per cycle, period %d ms, log level %s, host feedback %s (weight %g), "
+        "%s placement\n",
+        config->path ? " from " : "", config->path ? config->path : "",
+        config->nb_cores, config->table_size, config->ring_size, config->of_port,
+        config->imbalance_threshold, config->max_migrations, config->period_ms, config_log_levels[config->log_level],
+        config->feedback, config->feedback_weight, config_placements[config->placement]);
+    if (config->consolidation_ceiling){
+        printf("  cores are consolidated under %g packets per second\n", config->consolidation_ceiling);
+    }
+    if (strcmp(config->checkpoint, "off")){
+        printf("  flow table checkpointed to %s\n", config->checkpoint);
+    }
+    if (strcmp(config->assignments, "off")){
+        printf("  assignments published in %s\n", config->assignments);
+    }
+    if (config->core_rate_limit){
+        printf("  cores are metered at %d packets per second\n", config->core_rate_limit);
+    }
+    for (int core = 0; core < config->nb_cores; core++){
+        if (config->core_capacity[core] == 0){
+            printf("  core %d is drained\n", core);
+        } else if (config->core_capacity[core] != 1){
+            printf("  core %d has a capacity of %g\n", core, config->core_capacity[core]);
+        }
+    }
+}
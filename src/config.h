@@ -0,0 +1,71 @@
+/**
+ * @file config.h
+ * @brief Runtime configuration of the daemon
+ *
+ * Settings take their default value from env.h, then from the configuration file given with
+ * `--config`, then from the command line. The file holds one `key = value` per line, keys being the
+ * long options without their dashes (e.g. `imbalance-threshold = 0.2`); `#` starts a comment.
+ *
+ * On SIGHUP, the file is read again and the command line applied again. Only the balancing settings
+ * (threshold, migrations per cycle, period, log level, core capacities, feedback weight, placement,
+ * consolidation) change
+ * at runtime: the others size the data structures at startup and a change is reported as needing a restart.
+ *
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "env.h"
+#include "log.h"
+
+struct Config {
+    const char *path; /** Configuration file, NULL if none */
+    // Sizing, fixed at startup
+    int nb_cores;
+    int table_size;
+    int ring_size;
+    int of_port;
+    char feedback[108]; /** Address the host feedback is received on, "off" to ignore it */
+    int core_rate_limit; /** Packets per second metered per core, 0 for none */
+    char checkpoint[108]; /** File the flow table is checkpointed to, "off" for none */
+    char assignments[108]; /** File the assignments are published in, "off" for none */
+    // Balancing, reloadable
+    double imbalance_threshold;
+    int max_migrations;
+    int period_ms;
+    enum LogLevel log_level;
+    double core_capacity[MAX_CORES]; /** Relative capacity of each core, 0 to drain it */
+    double feedback_weight; /** 0 to balance packet counts, 1 to balance the host utilization */
+    int placement; /** Policy placing the new flows, PLACEMENT_* */
+    double consolidation_ceiling; /** Load a core of capacity 1 should stay under, 0 to spread over every core */
+};
+
+/**
+ * @brief Builds the configuration from the defaults, the configuration file and the command line
+ *
+ * @param config : the configuration to fill
+ * @param argc
+ * @param argv : the command line, kept to be applied again by config_reload
+ * @return int : 0 on success, -1 if an option or a value is invalid
+ */
+int config_init(struct Config *config, int argc, char *argv[]);
+
+/**
+ * @brief Reads the configuration file and the command line again and applies the reloadable settings
+ *
+ * @param config : the configuration to update, left unchanged if the new one is invalid
+ * @return int : 0 on success, -1 otherwise
+ */
+int config_reload(struct Config *config);
+
+/**
+ * @brief Prints the configuration
+ *
+ * @param config
+ */
+void config_print(struct Config *config);
+
+#endif
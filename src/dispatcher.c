@@ -0,0 +1,693 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "dispatcher.h"
+
+#define DISPATCH_NB_FRAMES(dispatcher) ((uint64_t)(dispatcher)->nb_cores * DISPATCH_FRAMES_PER_CORE)
+
+/**
+ * @brief Maps one of the rings of an AF_XDP socket
+ *
+ * @param fd : the socket
+ * @param ring : the ring to fill
+ * @param offsets : offsets of the ring fields, as returned by XDP_MMAP_OFFSETS
+ * @param pgoff : which ring to map
+ * @param desc_size : size of a ring entry
+ * @param producer_side : 1 if userspace produces in this ring (fill and TX)
+ * @return int : 0 on success, -1 otherwise
+ */
+int map_ring(int fd, struct XskRing *ring, struct xdp_ring_offset *offsets, off_t pgoff, size_t desc_size, uint8_t producer_side){
+    ring->map_len = offsets->desc + DISPATCH_RING_SIZE * desc_size;
+    ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (ring->map == MAP_FAILED){
+        ring->map = NULL;
+        return -1;
+    }
+    ring->producer = ring->map + offsets->producer;
+    ring->consumer = ring->map + offsets->consumer;
+    ring->flags = ring->map + offsets->flags;
+    ring->descs = ring->map + offsets->desc;
+    ring->size = DISPATCH_RING_SIZE;
+    ring->mask = DISPATCH_RING_SIZE - 1;
+    ring->cached_prod = 0;
+    ring->cached_cons = producer_side ? DISPATCH_RING_SIZE : 0;
+    return 0;
+}
+
+void unmap_ring(struct XskRing *ring){
+    if (ring->map){
+        munmap(ring->map, ring->map_len);
+    }
+}
+
+/**
+ * @brief Returns the number of entries that can be produced in the ring, up to `count`
+ */
+uint32_t ring_free(struct XskRing *ring, uint32_t count){
+    uint32_t free_entries = ring->cached_cons - ring->cached_prod;
+    if (free_entries < count){
+        ring->cached_cons = __atomic_load_n(ring->consumer, __ATOMIC_ACQUIRE) + ring->size;
+        free_entries = ring->cached_cons - ring->cached_prod;
+    }
+    return free_entries < count ? free_entries : count;
+}
+
+/**
+ * @brief Returns the number of entries that can be consumed from the ring, up to `count`
+ */
+uint32_t ring_available(struct XskRing *ring, uint32_t count){
+    uint32_t entries = ring->cached_prod - ring->cached_cons;
+    if (entries < count){
+        ring->cached_prod = __atomic_load_n(ring->producer, __ATOMIC_ACQUIRE);
+        entries = ring->cached_prod - ring->cached_cons;
+    }
+    return entries < count ? entries : count;
+}
+
+/**
+ * @brief Creates the AF_XDP socket of a core. The first socket registers the UMEM, the others share it.
+ *
+ * @param shared_fd : socket owning the UMEM, -1 for the first socket
+ * @return int : 0 on success, -1 otherwise
+ */
+int create_socket(struct Dispatcher *dispatcher, struct DispatchCore *core, int shared_fd){
+    core->xsk_fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (core->xsk_fd < 0){
+        printf("Could not create AF_XDP socket for core %d\n", core->core_idx);
+        return -1;
+    }
+    if (shared_fd < 0){
+        struct xdp_umem_reg umem_reg = {0};
+        umem_reg.addr = (uint64_t)(uintptr_t)dispatcher->umem_area;
+        umem_reg.len = dispatcher->umem_len;
+        umem_reg.chunk_size = DISPATCH_FRAME_SIZE;
+        umem_reg.headroom = 0;
+        if (setsockopt(core->xsk_fd, SOL_XDP, XDP_UMEM_REG, &umem_reg, sizeof(umem_reg))){
+            printf("Could not register UMEM\n");
+            return -1;
+        }
+    }
+    // Each queue needs its own fill and completion rings, even when sharing the UMEM
+    uint32_t ring_size = DISPATCH_RING_SIZE;
+    if (setsockopt(core->xsk_fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) ||
+        setsockopt(core->xsk_fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) ||
+        setsockopt(core->xsk_fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) ||
+        setsockopt(core->xsk_fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size))){
+        printf("Could not size the rings of core %d\n", core->core_idx);
+        return -1;
+    }
+    struct xdp_mmap_offsets offsets;
+    socklen_t optlen = sizeof(offsets);
+    if (getsockopt(core->xsk_fd, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &optlen)){
+        printf("Could not get ring offsets of core %d\n", core->core_idx);
+        return -1;
+    }
+    if (map_ring(core->xsk_fd, &core->fill, &offsets.fr, XDP_UMEM_PGOFF_FILL_RING, sizeof(uint64_t), 1) ||
+        map_ring(core->xsk_fd, &core->completion, &offsets.cr, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof(uint64_t), 0) ||
+        map_ring(core->xsk_fd, &core->rx, &offsets.rx, XDP_PGOFF_RX_RING, sizeof(struct xdp_desc), 0) ||
+        map_ring(core->xsk_fd, &core->tx, &offsets.tx, XDP_PGOFF_TX_RING, sizeof(struct xdp_desc), 1)){
+        printf("Could not map the rings of core %d\n", core->core_idx);
+        return -1;
+    }
+    struct sockaddr_xdp addr = {0};
+    addr.sxdp_family = AF_XDP;
+    addr.sxdp_ifindex = dispatcher->ifindex;
+    addr.sxdp_queue_id = core->core_idx;
+    if (shared_fd < 0){
+        addr.sxdp_flags = (DISPATCH_ZERO_COPY ? XDP_ZEROCOPY : XDP_COPY) | XDP_USE_NEED_WAKEUP;
+    } else {
+        // Sockets sharing the UMEM inherit its mode
+        addr.sxdp_flags = XDP_SHARED_UMEM;
+        addr.sxdp_shared_umem_fd = shared_fd;
+    }
+    if (bind(core->xsk_fd, (struct sockaddr *)&addr, sizeof(addr))){
+        printf("Could not bind AF_XDP socket to queue %d of %s\n", core->core_idx, DISPATCH_IFNAME);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Loads the redirection program, registers the sockets and attaches it
+ *
+ * @return int : 0 on success, -1 otherwise
+ */
+int attach_dispatch_program(struct Dispatcher *dispatcher){
+    dispatcher->obj = bpf_object__open_file(DISPATCH_XSK_OBJECT_PATH, NULL);
+    if (libbpf_get_error(dispatcher->obj)){
+        printf("Could not open BPF object %s\n", DISPATCH_XSK_OBJECT_PATH);
+        dispatcher->obj = NULL;
+        return -1;
+    }
+    if (bpf_object__load(dispatcher->obj)){
+        printf("Could not load BPF object %s\n", DISPATCH_XSK_OBJECT_PATH);
+        return -1;
+    }
+    struct bpf_map *xsks_map = bpf_object__find_map_by_name(dispatcher->obj, "xsks_map");
+    struct bpf_program *program = bpf_object__find_program_by_name(dispatcher->obj, "xdp_dispatch");
+    if (!xsks_map || !program){
+        printf("Invalid BPF object %s\n", DISPATCH_XSK_OBJECT_PATH);
+        return -1;
+    }
+    dispatcher->xsks_map_fd = bpf_map__fd(xsks_map);
+    for (uint32_t queue = 0; queue < (uint32_t)dispatcher->nb_cores; queue++){
+        if (bpf_map_update_elem(dispatcher->xsks_map_fd, &queue, &dispatcher->cores[queue].xsk_fd, BPF_ANY)){
+            printf("Could not register socket of queue %u\n", queue);
+            return -1;
+        }
+    }
+    uint32_t xdp_flags = DISPATCH_ZERO_COPY ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+    if (bpf_xdp_attach(dispatcher->ifindex, bpf_program__fd(program), xdp_flags, NULL) < 0){
+        printf("Could not attach xdp_dispatch on %s\n", DISPATCH_IFNAME);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Parses the VLAN and the 5-tuple of a frame
+ *
+ * @param frame : start of the frame
+ * @param len : length of the frame
+ * @param key : filled with the 5-tuple, in the flow table representation
+ * @param vlan : filled with the VLAN ID, -1 if the frame isn't tagged
+ * @return int : 0 if the frame is an IPv4 TCP or UDP frame, -1 otherwise
+ */
+int parse_frame(uint8_t *frame, uint32_t len, struct FiveTuple *key, int *vlan){
+    uint32_t offset = sizeof(struct ethhdr);
+    *vlan = -1;
+    if (len < offset){
+        return -1;
+    }
+    uint16_t proto = ((struct ethhdr *)frame)->h_proto;
+    if (proto == htons(ETH_P_8021Q)){
+        if (len < offset + 4){
+            return -1;
+        }
+        *vlan = ntohs(*(uint16_t *)(frame + offset)) & 0x0fff;
+        proto = *(uint16_t *)(frame + offset + 2);
+        offset += 4;
+    }
+    if (proto != htons(ETH_P_IP) || len < offset + sizeof(struct iphdr)){
+        return -1;
+    }
+    struct iphdr *ip = (struct iphdr *)(frame + offset);
+    offset += ip->ihl * 4;
+    memset(key, 0, sizeof(*key));
+    key->src_ip = ntohl(ip->saddr);
+    key->dst_ip = ntohl(ip->daddr);
+    key->proto = ip->protocol;
+    if (ip->protocol == IPPROTO_TCP && len >= offset + sizeof(struct tcphdr)){
+        struct tcphdr *tcp = (struct tcphdr *)(frame + offset);
+        key->src_port = ntohs(tcp->source);
+        key->dst_port = ntohs(tcp->dest);
+        return 0;
+    }
+    if (ip->protocol == IPPROTO_UDP && len >= offset + sizeof(struct udphdr)){
+        struct udphdr *udp = (struct udphdr *)(frame + offset);
+        key->src_port = ntohs(udp->source);
+        key->dst_port = ntohs(udp->dest);
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief Gives a frame back to the free frames of the core
+ */
+void release_frame(struct DispatchCore *core, uint64_t addr){
+    core->free_frames[core->nb_free_frames++] = addr & ~((uint64_t)DISPATCH_FRAME_SIZE - 1);
+}
+
+/**
+ * @brief Gives free frames to the kernel so that it can receive
+ */
+void refill(struct DispatchCore *core){
+    uint32_t count = ring_free(&core->fill, core->nb_free_frames);
+    for (uint32_t i = 0; i < count; i++){
+        uint64_t *slot = (uint64_t *)core->fill.descs + ((core->fill.cached_prod + i) & core->fill.mask);
+        *slot = core->free_frames[--core->nb_free_frames];
+    }
+    if (count > 0){
+        core->fill.cached_prod += count;
+        __atomic_store_n(core->fill.producer, core->fill.cached_prod, __ATOMIC_RELEASE);
+    }
+    if (__atomic_load_n(core->fill.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP){
+        recvfrom(core->xsk_fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+}
+
+/**
+ * @brief Collects the frames the kernel is done transmitting
+ */
+void complete_tx(struct DispatchCore *core){
+    uint32_t count = ring_available(&core->completion, DISPATCH_RING_SIZE);
+    for (uint32_t i = 0; i < count; i++){
+        uint64_t *slot = (uint64_t *)core->completion.descs + ((core->completion.cached_cons + i) & core->completion.mask);
+        release_frame(core, *slot);
+    }
+    if (count > 0){
+        core->completion.cached_cons += count;
+        __atomic_store_n(core->completion.consumer, core->completion.cached_cons, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Queues a processed frame for transmission, it will be sent by `flush_tx`
+ */
+void transmit(struct DispatchCore *core, struct xdp_desc *desc){
+    if (ring_free(&core->tx, 1) < 1){
+        core->dropped_packets++;
+        release_frame(core, desc->addr);
+        return;
+    }
+    struct xdp_desc *slot = (struct xdp_desc *)core->tx.descs + (core->tx.cached_prod & core->tx.mask);
+    *slot = *desc;
+    core->tx.cached_prod++;
+    core->nb_pending_tx++;
+    core->tx_packets++;
+}
+
+void flush_tx(struct DispatchCore *core){
+    if (core->nb_pending_tx == 0){
+        return;
+    }
+    __atomic_store_n(core->tx.producer, core->tx.cached_prod, __ATOMIC_RELEASE);
+    core->nb_pending_tx = 0;
+    if (!DISPATCH_ZERO_COPY || (__atomic_load_n(core->tx.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP)){
+        sendto(core->xsk_fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+    }
+}
+
+/**
+ * @brief Hands a frame to the core it belongs to
+ */
+void hand_frame(struct DispatchCore *core, struct DispatchCore *target, struct xdp_desc *desc){
+    struct DescRing *ring = &target->inbox[core->core_idx];
+    uint32_t consumer = __atomic_load_n(&ring->consumer, __ATOMIC_ACQUIRE);
+    if (ring->producer - consumer >= DISPATCH_RING_SIZE){
+        core->dropped_packets++;
+        release_frame(core, desc->addr);
+        return;
+    }
+    ring->descs[ring->producer & (DISPATCH_RING_SIZE - 1)] = *desc;
+    __atomic_store_n(&ring->producer, ring->producer + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&target->inbox_pushed, 1, __ATOMIC_RELEASE);
+    core->handed_packets++;
+}
+
+/**
+ * @brief Number of packets a core is done with, its queue drained up to a mark once this reaches it
+ */
+uint64_t core_done(struct DispatchCore *core){
+    return __atomic_load_n(&core->rx_done, __ATOMIC_ACQUIRE) + __atomic_load_n(&core->inbox_done, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Number of packets a core will be done with once everything currently queued is processed
+ */
+uint64_t core_queued(struct DispatchCore *core){
+    // receive() counts the descriptors as done before it releases them from the ring: reading the ring
+    // first, a released descriptor is always counted as done, so the mark can only be over-estimated
+    uint32_t rx_consumer = __atomic_load_n(core->rx.consumer, __ATOMIC_ACQUIRE);
+    uint32_t rx_producer = __atomic_load_n(core->rx.producer, __ATOMIC_ACQUIRE);
+    uint64_t inbox_pushed = __atomic_load_n(&core->inbox_pushed, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&core->rx_done, __ATOMIC_ACQUIRE) + (uint32_t)(rx_producer - rx_consumer) + inbox_pushed;
+}
+
+/**
+ * @brief Records that the core owns a flow, a full table leaves the flow to the shared one
+ */
+void own_flow(struct DispatchCore *core, struct FiveTuple *key){
+    if (!hashmap_get(core->owned, key) && core->owned->size < core->owned->capacity){
+        // Active until an expiry passes without packets
+        hashmap_new(core->owned, key)->is_active = 1;
+    }
+}
+
+/**
+ * @brief Tells a core it no longer owns a flow, called under flows_lock
+ */
+void lose_flow(struct DispatchCore *core, struct FiveTuple *key){
+    uint32_t consumer = __atomic_load_n(&core->lost_consumer, __ATOMIC_ACQUIRE);
+    if (core->lost_producer - consumer >= DISPATCH_LOST_RING_SIZE){
+        __atomic_store_n(&core->lost_overflow, 1, __ATOMIC_RELEASE);
+        return;
+    }
+    core->lost[core->lost_producer & (DISPATCH_LOST_RING_SIZE - 1)] = *key;
+    __atomic_store_n(&core->lost_producer, core->lost_producer + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Forgets the flows taken over by other cores since the previous batch
+ */
+void forget_lost_flows(struct DispatchCore *core){
+    if (__atomic_exchange_n(&core->lost_overflow, 0, __ATOMIC_ACQ_REL)){
+        for (int slot = 0; slot < core->owned->capacity; slot++){
+            if (core->owned->map[slot].valid){
+                hashmap_remove(core->owned, &core->owned->map[slot].key);
+            }
+        }
+    }
+    uint32_t producer = __atomic_load_n(&core->lost_producer, __ATOMIC_ACQUIRE);
+    for (; core->lost_consumer != producer; core->lost_consumer++){
+        hashmap_remove(core->owned, &core->lost[core->lost_consumer & (DISPATCH_LOST_RING_SIZE - 1)]);
+    }
+    __atomic_store_n(&core->lost_consumer, producer, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Forgets the owned flows without packets since the previous expiry, in the shared table too
+ */
+void expire_owned_flows(struct DispatchCore *core){
+    struct Dispatcher *dispatcher = core->dispatcher;
+    for (int slot = 0; slot < core->owned->capacity; slot++){
+        struct key_value_pair *entry = &core->owned->map[slot];
+        if (!entry->valid){
+            continue;
+        }
+        if (entry->value->is_active){
+            // Expires at the next expiry unless it gets a packet
+            entry->value->is_active = 0;
+            continue;
+        }
+        // The shared entry lives as long as its owner keeps the flow
+        pthread_spin_lock(&dispatcher->flows_lock);
+        struct RingBuffer *flow = hashmap_get(dispatcher->flows, &entry->key);
+        if (flow && flow->assigned_core == core->core_idx){
+            hashmap_remove(dispatcher->flows, &entry->key);
+        }
+        pthread_spin_unlock(&dispatcher->flows_lock);
+        hashmap_remove(core->owned, &entry->key);
+    }
+}
+
+/**
+ * @brief Decides whether a packet of a flow can be processed now by the core it has been steered to
+ *
+ * @return struct ReorderFlow* : the buffered flow the packet must wait in, NULL if it can be processed
+ */
+struct ReorderFlow *check_order(struct DispatchCore *core, struct FiveTuple *key){
+    struct Dispatcher *dispatcher = core->dispatcher;
+    // Only this thread changes the reordering buffer of the core and its owned flows, no lock to read them
+    struct ReorderFlow *buffered = core->reorder.nb_flows ? reorder_find(&core->reorder, key) : NULL;
+    if (buffered){
+        return buffered;
+    }
+    struct RingBuffer *owned = hashmap_get(core->owned, key);
+    if (owned){
+        owned->is_active = 1;
+        return NULL;
+    }
+    // A flow new to this core
+    pthread_spin_lock(&dispatcher->flows_lock);
+    struct RingBuffer *flow = hashmap_get(dispatcher->flows, key);
+    if (!flow){
+        // Without room left, new flows are dispatched without ordering guarantees
+        if (dispatcher->flows->size < dispatcher->flows->capacity){
+            flow = hashmap_new(dispatcher->flows, key);
+            flow->assigned_core = core->core_idx;
+            own_flow(core, key);
+        }
+        pthread_spin_unlock(&dispatcher->flows_lock);
+        return NULL;
+    }
+    int old_core = flow->assigned_core;
+    if (old_core == core->core_idx){
+        // Owned already, the table of the core was full or forgotten
+        own_flow(core, key);
+        pthread_spin_unlock(&dispatcher->flows_lock);
+        return NULL;
+    }
+    struct ReorderFlow *moving_away = reorder_find(&dispatcher->cores[old_core].reorder, key);
+    if (moving_away && moving_away->old_core == core->core_idx){
+        // Late packet of a flow migrating away from this core, the new core is waiting for it
+        pthread_spin_unlock(&dispatcher->flows_lock);
+        return NULL;
+    }
+    // The flow migrated to this core
+    flow->assigned_core = core->core_idx;
+    lose_flow(&dispatcher->cores[old_core], key);
+    own_flow(core, key);
+    buffered = reorder_begin(&core->reorder, key, old_core, core_queued(&dispatcher->cores[old_core]), reorder_now_ns());
+    pthread_spin_unlock(&dispatcher->flows_lock);
+    return buffered;
+}
+
+void release_packet(struct ReorderPacket *packet, void *ctx){
+    struct xdp_desc desc = {0};
+    desc.addr = packet->addr;
+    desc.len = packet->len;
+    transmit(ctx, &desc);
+}
+
+uint8_t old_core_drained(struct ReorderFlow *flow, void *ctx){
+    struct DispatchCore *core = ctx;
+    return core_done(&core->dispatcher->cores[flow->old_core]) >= flow->drain_mark;
+}
+
+/**
+ * @brief Releases the buffered flows whose old core drained or whose deadline passed
+ */
+void check_reorder(struct DispatchCore *core){
+    if (core->reorder.nb_flows == 0){
+        return;
+    }
+    pthread_spin_lock(&core->dispatcher->flows_lock);
+    reorder_poll(&core->reorder, reorder_now_ns(), old_core_drained, release_packet, core);
+    pthread_spin_unlock(&core->dispatcher->flows_lock);
+}
+
+/**
+ * @brief Processes a frame that belongs to this core
+ */
+void handle_frame(struct DispatchCore *core, struct xdp_desc *desc){
+    struct FiveTuple key;
+    int vlan;
+    uint8_t *frame = (uint8_t *)core->dispatcher->umem_area + desc->addr;
+    if (parse_frame(frame, desc->len, &key, &vlan)){
+        transmit(core, desc);
+        return;
+    }
+    struct ReorderFlow *buffered = check_order(core, &key);
+    if (!buffered){
+        transmit(core, desc);
+        return;
+    }
+    struct ReorderPacket packet = {desc->addr, desc->len};
+    pthread_spin_lock(&core->dispatcher->flows_lock);
+    reorder_hold(&core->reorder, buffered, &packet, release_packet, core);
+    pthread_spin_unlock(&core->dispatcher->flows_lock);
+}
+
+/**
+ * @brief Receives a batch of frames from the queue of the core and dispatches them
+ */
+uint32_t receive(struct DispatchCore *core){
+    struct Dispatcher *dispatcher = core->dispatcher;
+    uint32_t count = ring_available(&core->rx, DISPATCH_BATCH_SIZE);
+    for (uint32_t i = 0; i < count; i++){
+        struct xdp_desc desc = ((struct xdp_desc *)core->rx.descs)[(core->rx.cached_cons + i) & core->rx.mask];
+        struct FiveTuple key;
+        int vlan;
+        uint8_t *frame = (uint8_t *)dispatcher->umem_area + desc.addr;
+        int target = core->core_idx;
+        if (!parse_frame(frame, desc.len, &key, &vlan) && vlan >= 0){
+            target = vlan % dispatcher->nb_cores;
+        }
+        if (target == core->core_idx){
+            handle_frame(core, &desc);
+        } else {
+            hand_frame(core, &dispatcher->cores[target], &desc);
+        }
+    }
+    if (count > 0){
+        core->rx.cached_cons += count;
+        // Done before released, see core_queued
+        __atomic_add_fetch(&core->rx_done, count, __ATOMIC_RELEASE);
+        __atomic_store_n(core->rx.consumer, core->rx.cached_cons, __ATOMIC_RELEASE);
+        core->rx_packets += count;
+    }
+    return count;
+}
+
+/**
+ * @brief Processes a batch of the frames handed by each other core
+ */
+uint32_t receive_handed(struct DispatchCore *core){
+    uint32_t handled = 0;
+    for (int src = 0; src < core->dispatcher->nb_cores; src++){
+        struct DescRing *ring = &core->inbox[src];
+        uint32_t producer = __atomic_load_n(&ring->producer, __ATOMIC_ACQUIRE);
+        uint32_t count = producer - ring->consumer;
+        if (count > DISPATCH_BATCH_SIZE){
+            count = DISPATCH_BATCH_SIZE;
+        }
+        for (uint32_t i = 0; i < count; i++){
+            handle_frame(core, &ring->descs[(ring->consumer + i) & (DISPATCH_RING_SIZE - 1)]);
+        }
+        if (count > 0){
+            __atomic_store_n(&ring->consumer, ring->consumer + count, __ATOMIC_RELEASE);
+            __atomic_add_fetch(&core->inbox_done, count, __ATOMIC_RELEASE);
+        }
+        handled += count;
+    }
+    return handled;
+}
+
+void *dispatch_loop(void *arg){
+    struct DispatchCore *core = arg;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core->core_idx, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    // The loop polls, only the iterations that processed frames count as busy
+    uint64_t previous = reorder_now_ns();
+    while (*core->dispatcher->running){
+        forget_lost_flows(core);
+        uint32_t expiry_epoch = __atomic_load_n(&core->dispatcher->expiry_epoch, __ATOMIC_ACQUIRE);
+        if (expiry_epoch != core->expiry_epoch){
+            core->expiry_epoch = expiry_epoch;
+            expire_owned_flows(core);
+        }
+        complete_tx(core);
+        refill(core);
+        uint32_t processed = receive(core);
+        processed += receive_handed(core);
+        check_reorder(core);
+        flush_tx(core);
+        uint64_t now = reorder_now_ns();
+        if (processed){
+            __atomic_store_n(&core->busy_ns, core->busy_ns + now - previous, __ATOMIC_RELAXED);
+        }
+        previous = now;
+    }
+    return NULL;
+}
+
+int dispatcher_init(struct Dispatcher *dispatcher, int nb_cores, int table_size){
+    memset(dispatcher, 0, sizeof(*dispatcher));
+    dispatcher->nb_cores = nb_cores;
+    dispatcher->ifindex = if_nametoindex(DISPATCH_IFNAME);
+    if (!dispatcher->ifindex){
+        printf("Could not find interface %s\n", DISPATCH_IFNAME);
+        return -1;
+    }
+    dispatcher->umem_len = DISPATCH_NB_FRAMES(dispatcher) * DISPATCH_FRAME_SIZE;
+    dispatcher->umem_area = mmap(NULL, dispatcher->umem_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (dispatcher->umem_area == MAP_FAILED){
+        printf("Could not allocate UMEM\n");
+        dispatcher->umem_area = NULL;
+        return -1;
+    }
+    dispatcher->flows = hashmap_init(table_size, RING_SIZE);
+    pthread_spin_init(&dispatcher->flows_lock, PTHREAD_PROCESS_PRIVATE);
+    dispatcher->cores = calloc(nb_cores, sizeof(struct DispatchCore));
+    for (int i = 0; i < nb_cores; i++){
+        struct DispatchCore *core = &dispatcher->cores[i];
+        core->core_idx = i;
+        core->xsk_fd = -1;
+        core->dispatcher = dispatcher;
+        core->inbox = calloc(nb_cores, sizeof(struct DescRing));
+        core->owned = hashmap_init(table_size, 1);
+        core->lost = calloc(DISPATCH_LOST_RING_SIZE, sizeof(struct FiveTuple));
+        reorder_init(&core->reorder);
+        // Frames move between cores, each pool must be able to hold all of them
+        core->free_frames = calloc(DISPATCH_NB_FRAMES(dispatcher), sizeof(uint64_t));
+        for (uint64_t frame = 0; frame < DISPATCH_FRAMES_PER_CORE; frame++){
+            release_frame(core, ((uint64_t)i * DISPATCH_FRAMES_PER_CORE + frame) * DISPATCH_FRAME_SIZE);
+        }
+    }
+    for (int i = 0; i < nb_cores; i++){
+        if (create_socket(dispatcher, &dispatcher->cores[i], i == 0 ? -1 : dispatcher->cores[0].xsk_fd)){
+            return -1;
+        }
+        refill(&dispatcher->cores[i]);
+    }
+    if (attach_dispatch_program(dispatcher)){
+        return -1;
+    }
+    printf("Dispatching %s on %d cores (%s mode)\n", DISPATCH_IFNAME, nb_cores, DISPATCH_ZERO_COPY ? "zero-copy" : "copy");
+    return 0;
+}
+
+int dispatcher_start(struct Dispatcher *dispatcher, volatile uint8_t *running){
+    dispatcher->running = running;
+    for (int i = 0; i < dispatcher->nb_cores; i++){
+        if (pthread_create(&dispatcher->cores[i].thread, NULL, dispatch_loop, &dispatcher->cores[i])){
+            printf("Could not start thread of core %d\n", i);
+            *running = 0;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int dispatcher_send_feedback(struct Dispatcher *dispatcher, struct FeedbackSender *sender){
+    uint64_t busy_ns[MAX_CORES];
+    uint64_t packets[MAX_CORES];
+    uint32_t queue_depth[MAX_CORES];
+    int nb_cores = dispatcher->nb_cores < MAX_CORES ? dispatcher->nb_cores : MAX_CORES;
+    for (int i = 0; i < nb_cores; i++){
+        struct DispatchCore *core = &dispatcher->cores[i];
+        busy_ns[i] = __atomic_load_n(&core->busy_ns, __ATOMIC_RELAXED);
+        packets[i] = core_done(core);
+        // Frames received or handed to the core that it didn't process yet
+        queue_depth[i] = core_queued(core) - packets[i];
+    }
+    return feedback_send(sender, nb_cores, busy_ns, packets, queue_depth);
+}
+
+void dispatcher_expire_flows(struct Dispatcher *dispatcher){
+    // Each core expires its own flows between two batches
+    __atomic_add_fetch(&dispatcher->expiry_epoch, 1, __ATOMIC_RELEASE);
+}
+
+void dispatcher_print_stats(struct Dispatcher *dispatcher){
+    printf("Flow table: %d of %d flows\n", dispatcher->flows->size, dispatcher->flows->capacity);
+    for (int i = 0; i < dispatcher->nb_cores; i++){
+        struct DispatchCore *core = &dispatcher->cores[i];
+        printf("Core %d: %lu rx, %lu tx, %lu handed, %lu dropped\n", i,
+            core->rx_packets, core->tx_packets, core->handed_packets, core->dropped_packets);
+        printf("        %d flows in migration, %lu packets held, %lu reorders avoided, %lu deadline expirations, %lu overflows, %lu untracked migrations\n",
+            core->reorder.nb_flows, core->reorder.held_packets, core->reorder.reorders_avoided,
+            core->reorder.deadline_expirations, core->reorder.overflows, core->reorder.untracked_migrations);
+    }
+}
+
+void dispatcher_destroy(struct Dispatcher *dispatcher){
+    // The cores aren't allocated yet when the interface or the UMEM is missing
+    for (int i = 0; i < dispatcher->nb_cores && dispatcher->cores; i++){
+        if (dispatcher->cores[i].thread){
+            pthread_join(dispatcher->cores[i].thread, NULL);
+        }
+    }
+    if (dispatcher->obj){
+        bpf_xdp_detach(dispatcher->ifindex, DISPATCH_ZERO_COPY ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE, NULL);
+        bpf_object__close(dispatcher->obj);
+    }
+    for (int i = 0; i < dispatcher->nb_cores && dispatcher->cores; i++){
+        struct DispatchCore *core = &dispatcher->cores[i];
+        unmap_ring(&core->fill);
+        unmap_ring(&core->completion);
+        unmap_ring(&core->rx);
+        unmap_ring(&core->tx);
+        if (core->xsk_fd >= 0){
+            close(core->xsk_fd);
+        }
+        free(core->inbox);
+        if (core->owned){
+            hashmap_destroy(core->owned);
+        }
+        free(core->lost);
+        reorder_destroy(&core->reorder);
+        free(core->free_frames);
+    }
+    free(dispatcher->cores);
+    if (dispatcher->flows){
+        hashmap_destroy(dispatcher->flows);
+    }
+    if (dispatcher->umem_area){
+        munmap(dispatcher->umem_area, dispatcher->umem_len);
+    }
+}
@@ -0,0 +1,188 @@
+/**
+ * @file dispatcher.h
+ * @brief Host-side AF_XDP dispatcher
+ *
+ * Each core owns an AF_XDP socket bound to its RX queue. All the sockets share a single UMEM so that
+ * a frame received on one queue can be handed to another core without any copy. The core a frame
+ * belongs to is the VLAN set by the NIC balancer, frames received on the wrong queue (e.g. on
+ * single-queue veth pairs) are moved to the right core through per core-pair rings.
+ *
+ * When the NIC migrates a flow, packets of the flow may still be waiting in the queue of the old
+ * core. The new core buffers the packets of the flow in its reordering stage until the old core
+ * processed everything that was queued when the migration was detected, which preserves the order
+ * of the flow.
+ *
+ * Each core looks the flows it owns up in its own table, without any lock. Only a flow it doesn't own
+ * yet, new or migrated, takes the lock of the table shared by all the cores: the flow is recorded
+ * there with its new core, and the core that lost it is told to forget it.
+ *
+ */
+
+#ifndef DISPATCHER_H
+#define DISPATCHER_H
+
+#include <linux/if_xdp.h>
+#include <linux/if_link.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <unistd.h>
+#include "env.h"
+#include "hashmap.h"
+#include "feedback.h"
+#include "load_bpf.h"
+#include "reorder.h"
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+
+/**
+ * @brief Userspace view of an AF_XDP ring (fill, completion, RX or TX)
+ *
+ */
+struct XskRing {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *descs;
+    uint32_t mask;
+    uint32_t size;
+    uint32_t cached_prod;
+    uint32_t cached_cons;
+    void *map; /** Start of the mmap'd area */
+    size_t map_len;
+};
+
+/**
+ * @brief Single producer single consumer ring carrying frame descriptors from one core to another
+ *
+ */
+struct DescRing {
+    uint32_t producer;
+    uint32_t consumer;
+    struct xdp_desc descs[DISPATCH_RING_SIZE];
+};
+
+struct Dispatcher;
+
+/**
+ * @brief Everything owned by the thread serving one core
+ *
+ */
+struct DispatchCore {
+    int core_idx;
+    int xsk_fd;
+    struct Dispatcher *dispatcher;
+    pthread_t thread;
+    struct XskRing fill;
+    struct XskRing completion;
+    struct XskRing rx;
+    struct XskRing tx;
+    // Free UMEM frames owned by this core
+    uint64_t *free_frames;
+    uint32_t nb_free_frames;
+    // Frames to transmit once the batch is handled
+    uint32_t nb_pending_tx;
+    // inbox[src] carries the frames handed to this core by core src
+    struct DescRing *inbox;
+    // Progress counters used to detect when the queue of the core drained
+    uint64_t rx_done; /** RX descriptors consumed (handled or handed to another core) */
+    uint64_t inbox_pushed; /** Frames handed to this core by the others */
+    uint64_t inbox_done; /** Handed frames handled by this core */
+    uint64_t busy_ns; /** Time spent in the iterations that processed frames, reported to the NIC */
+    // Flows owned by this core, only used by its thread
+    struct HashMap *owned;
+    // Flows taken over by other cores, pushed under flows_lock and removed from `owned` by this core
+    struct FiveTuple *lost;
+    uint32_t lost_producer;
+    uint32_t lost_consumer;
+    uint8_t lost_overflow; /** More flows were lost than the ring holds, every owned flow is forgotten */
+    uint32_t expiry_epoch; /** Last expiry requested by dispatcher_expire_flows handled by the core */
+    // Flows migrated to this core, buffered until their old core drained
+    struct ReorderBuffer reorder;
+    // Statistics
+    uint64_t rx_packets;
+    uint64_t tx_packets;
+    uint64_t handed_packets;
+    uint64_t dropped_packets;
+};
+
+struct Dispatcher {
+    int ifindex;
+    void *umem_area;
+    size_t umem_len;
+    struct bpf_object *obj;
+    int xsks_map_fd;
+    int nb_cores;
+    struct DispatchCore *cores;
+    // Core owning each flow, shared by all the cores
+    // The lock also protects the flows of the reordering buffers and the lost rings
+    struct HashMap *flows;
+    pthread_spinlock_t flows_lock;
+    uint32_t expiry_epoch; /** Incremented by dispatcher_expire_flows */
+    volatile uint8_t *running;
+};
+
+/**
+ * @brief Creates the UMEM and one AF_XDP socket per core on `DISPATCH_IFNAME`, then attaches the
+ * redirection program. Sockets are bound in zero-copy mode unless `DISPATCH_ZERO_COPY` is 0.
+ *
+ * @param dispatcher : the dispatcher to initialize
+ * @param nb_cores : number of cores (and RX queues) to serve
+ * @param table_size : flows tracked at once, new flows beyond are dispatched without ordering guarantees
+ * @return int : 0 on success, -1 otherwise
+ */
+int dispatcher_init(struct Dispatcher *dispatcher, int nb_cores, int table_size);
+
+/**
+ * @brief Starts one thread per core, each of them serves its queue until `*running` becomes 0
+ *
+ * @param dispatcher
+ * @param running : flag polled by the threads, set it to 0 to stop them
+ * @return int : 0 on success, -1 if a thread couldn't be started
+ */
+int dispatcher_start(struct Dispatcher *dispatcher, volatile uint8_t *running);
+
+/**
+ * @brief Reports the busy time, processed packets and queue depth of each core to the NIC balancer
+ *
+ * @param dispatcher
+ * @param sender : socket connected with feedback_connect
+ * @return int : 0 on success, -1 if the report couldn't be sent
+ */
+int dispatcher_send_feedback(struct Dispatcher *dispatcher, struct FeedbackSender *sender);
+
+/**
+ * @brief Asks each core to forget the flows it owns that received no packet since the previous call,
+ * so the flow tables keep room for the new flows
+ *
+ * @param dispatcher
+ */
+void dispatcher_expire_flows(struct Dispatcher *dispatcher);
+
+/**
+ * @brief Prints the per-core statistics
+ *
+ * @param dispatcher
+ */
+void dispatcher_print_stats(struct Dispatcher *dispatcher);
+
+/**
+ * @brief Waits for the threads to stop, detaches the program, closes the sockets and frees the UMEM
+ *
+ * @param dispatcher
+ */
+void dispatcher_destroy(struct Dispatcher *dispatcher);
+
+#endif
@@ -0,0 +1,50 @@
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "config.h"
+#include "dispatcher.h"
+
+volatile uint8_t running = 1;
+
+void handle_interrupt(int sig) {
+    printf("\nCaught interrupt signal, stopping dispatcher...\n");
+    running = 0;
+}
+
+int main(int argc, char *argv[])
+{
+    signal(SIGINT, handle_interrupt);
+    // Same configuration as the daemon, for the number of cores and the size of the flow table
+    struct Config config;
+    if (config_init(&config, argc, argv)){
+        return 1;
+    }
+    struct Dispatcher dispatcher;
+    if (dispatcher_init(&dispatcher, config.nb_cores, config.table_size) || dispatcher_start(&dispatcher, &running)){
+        running = 0;
+        dispatcher_destroy(&dispatcher);
+        return 1;
+    }
+    // The balancer still works on packet counts without feedback
+    struct FeedbackSender feedback = {.fd = -1};
+    feedback_connect(&feedback, FEEDBACK_DAEMON_ADDRESS);
+    uint32_t reports = 0;
+    uint32_t expiry = 0;
+    while (running) {
+        usleep(FEEDBACK_REPORT_INTERVAL_MS * 1000);
+        if (feedback.fd >= 0){
+            dispatcher_send_feedback(&dispatcher, &feedback);
+        }
+        if (++expiry * FEEDBACK_REPORT_INTERVAL_MS >= DISPATCH_FLOW_EXPIRY_MS){
+            expiry = 0;
+            dispatcher_expire_flows(&dispatcher);
+        }
+        if (++reports * FEEDBACK_REPORT_INTERVAL_MS >= 1000){
+            reports = 0;
+            dispatcher_print_stats(&dispatcher);
+        }
+    }
+    feedback_disconnect(&feedback);
+    dispatcher_destroy(&dispatcher);
+    return 0;
+}
@@ -7,6 +7,14 @@
 #define RING_SIZE 16
 // Size of the hashmap
 #define HASHMAP_SIZE 1024
+// When the hashmap is full, a new flow evicts the flow with the lowest rate among this many slots,
+// scanned round-robin (least recently sampled first among equal rates)
+#define HASHMAP_EVICTION_SAMPLES 32
+// A new flow only evicts a flow whose rate it exceeds by this fraction, so flows of close rates don't take
+// each other's place every cycle
+#define HASHMAP_EVICTION_MARGIN 0.5
+// Cycles a flow stays in the hashmap before it can be evicted
+#define HASHMAP_EVICTION_GRACE_CYCLES 3
 
 // Number of seconds before calling a connection timeout
 #define CONN_TIMEOUT 15
@@ -17,13 +25,104 @@
 #define IMBALANCE_THRESHOLD 0.1
 // The maximum number of iterations to try to rebalance the flows
 #define MAX_REBALANCE_ITERATIONS 10
+// Milliseconds between two balancing cycles
+#define BALANCING_PERIOD_MS 1000
+// Core a new flow is steered to when it is discovered, before its first balancing:
+// - PLACEMENT_DEFAULT: core 0, where the default VLAN already steers it
+// - PLACEMENT_LEAST_LOADED: the core the furthest below its capacity share
+// - PLACEMENT_TWO_CHOICES: the less loaded of two cores drawn at random (power of two choices)
+// - PLACEMENT_WEIGHTED_HASH: rendezvous hash of the 5-tuple, cores weighted by their spare capacity
+#define PLACEMENT_DEFAULT 0
+#define PLACEMENT_LEAST_LOADED 1
+#define PLACEMENT_TWO_CHOICES 2
+#define PLACEMENT_WEIGHTED_HASH 3
+#define PLACEMENT_POLICY PLACEMENT_LEAST_LOADED
+// Consolidation: load (packets per second, corrected by the host feedback) a core of capacity 1 should stay
+// under, 0 to spread the load over every core. Under low load, the flows are packed onto the fewest cores,
+// the others are parked (drained) from the last one down so the host can let them sleep. A parked core is
+// brought back as soon as the active ones go over the ceiling; one is parked once the load fits the others
+// CONSOLIDATION_HYSTERESIS under the ceiling, at least CONSOLIDATION_HOLD_CYCLES after the previous change.
+// The active cores are written to CONSOLIDATION_STATE_PATH (e.g. "0-3"), replaced at each change.
+#define CONSOLIDATION_CEILING 0
+#define CONSOLIDATION_HYSTERESIS 0.2
+#define CONSOLIDATION_HOLD_CYCLES 5
+#define CONSOLIDATION_STATE_PATH "/tmp/orss-active-cores"
+
+// RING_SIZE, HASHMAP_SIZE, the values above and OF_PORT are defaults: orss takes them from its
+// command line and from a configuration file, see config.h. These bound what can be configured.
+#define MAX_CORES 256
+#define MAX_MIGRATIONS 256
+
+// Host feedback: the dispatcher reports the busy time, processed packets and queue depth of each
+// core every FEEDBACK_REPORT_INTERVAL_MS to FEEDBACK_DAEMON_ADDRESS (host:port or a Unix socket path).
+// The daemon listens on FEEDBACK_ADDRESS (a UDP port on the loopback, addr:port, a Unix socket path, or
+// "off") and corrects the packet load of each core by its measured cost: FEEDBACK_WEIGHT 0 balances
+// packet counts only, 1 balances the host utilization. Reports older than FEEDBACK_TIMEOUT_MS are ignored.
+// FEEDBACK_ADDRESS and FEEDBACK_WEIGHT are defaults, like the values above (see config.h).
+#define FEEDBACK_ADDRESS "6667"
+#define FEEDBACK_WEIGHT 0.5
+#define FEEDBACK_TIMEOUT_MS 3000
+// Bound of the correction, a core counts at most FEEDBACK_MAX_SCALE times (or 1/FEEDBACK_MAX_SCALE) its packets
+#define FEEDBACK_MAX_SCALE 4
+#define FEEDBACK_DAEMON_ADDRESS "192.168.100.2:6667"
+#define FEEDBACK_REPORT_INTERVAL_MS 100
+
+// Runtime metrics (cycle timings, loads, migrations, flow table) served in the Prometheus text format
+// on a Unix socket, e.g. `curl --unix-socket /tmp/orss-metrics.sock http://localhost/metrics`
+#define METRICS_EXPORT 1
+#define METRICS_SOCKET_PATH "/tmp/orss-metrics.sock"
+
+// Warm restart: the flow table (flows, cores and rate history) is copied into CHECKPOINT_PATH, a file mapped
+// in memory, at the end of every cycle and restored at startup; "off" to start with an empty table. The
+// first cycle after a restore takes the core of each flow from the VLAN of its rule on the switch.
+// CHECKPOINT_PATH is a default, like the values above (see config.h).
+#define CHECKPOINT_PATH "/tmp/orss-flows.ckpt"
+
+// The core of each flow, the migrations of the cycle and the target load of each core are published every
+// cycle in ASSIGNMENTS_PATH, a file mapped in memory by the daemon and its readers (e.g. the host
+// dispatcher), "off" to disable. Readers retry a read the daemon overlapped at most ASSIGNMENTS_READ_ATTEMPTS
+// times. ASSIGNMENTS_PATH is a default (see config.h).
+#define ASSIGNMENTS_PATH "/dev/shm/orss-assignments"
+#define ASSIGNMENTS_READ_ATTEMPTS 1000000
+
+// Logging: messages under LOG_LEVEL are skipped before being formatted, the others are queued in a
+// lock-free ring of LOG_RING_SIZE entries (a power of 2) and written by a background thread.
+// LOG_PATH is the text log (NULL for stdout). LOG_TRACE_PATH, when set, receives a binary dump of
+// every flow assignment every LOG_FLOW_DUMP_INTERVAL cycles.
+#define LOG_LEVEL LOG_LEVEL_INFO
+#define LOG_PATH NULL
+#define LOG_TRACE_PATH NULL
+#define LOG_FLOW_DUMP_INTERVAL 10
+#define LOG_RING_SIZE 4096
+#define LOG_MESSAGE_SIZE 192
+// How long the writer sleeps when the ring is empty
+#define LOG_FLUSH_INTERVAL_US 10000
 
 // The listening OpenFlow port
 #define OF_PORT 6666
-// The maximum number of handled flows
+// Highest OpenFlow version offered in HELLO: 0x01 (1.0), 0x04 (1.3) or 0x05 (1.4). The switch picks
+// the highest version both sides support, OpenFlow 1.3 and later bring OXM matches, bundles and meters
+#define OPENFLOW_MAX_VERSION 0x05
+// Apply the migrations of a cycle atomically in a bundle (OpenFlow 1.3 and later)
+#define OPENFLOW_BUNDLES 1
+// Packets per second each core may receive, enforced by one OpenFlow 1.3 meter per core. 0 leaves
+// flows unmetered
+#define CORE_RATE_LIMIT 0
+// How the flows missing the flow table of the eSwitch get their rule:
+// - FLOW_SETUP_CONTROLLER: the Ryu controller (controller/controller.py) answers their PACKET_IN and steers
+//   them to the default VLAN, the balancer moves them afterwards
+// - FLOW_SETUP_NATIVE: orss answers the PACKET_INs itself and installs each flow on the core picked by the
+//   placement policy (NATIVE_FLOW_SETUP in controller.py makes Ryu ignore them). Not used by STEERING_BUCKETS,
+//   whose group rule catches the new flows
+#define FLOW_SETUP_CONTROLLER 0
+#define FLOW_SETUP_NATIVE 1
+#define FLOW_SETUP FLOW_SETUP_NATIVE
+// Flows set up before their FLOW_MODs are written at once, 1 writes each of them immediately
+#define FLOW_SETUP_BATCH 32
+// Priority of the rules of the flows set up natively, OFP_DEFAULT_PRIORITY like the controller's
+#define FLOW_SETUP_PRIORITY 0x8000
+// The initial capacity of the flow stats buffers, they grow as needed
 #define MAX_HANDLED_FLOWS 1024
-// The maximum number of consecutive OpenFlow STATS_REPLY messages
-#define MAX_STATS_REPLY 32
 // The maximum number of actions in a flow
 #define MAX_ACTIONS 4
 
@@ -35,3 +134,95 @@
 // XDP loading mode, choose SKB mode if driver does not support native XDP
 #define XDP_LOADING_MODE (1U << 1) // XDP_FLAGS_SKB_MODE
 // #define XDP_LOADING_MODE (1U << 2) // XDP_FLAGS_DRV_MODE
+
+// Compiled XDP object and the interfaces the programs are attached to.
+// xdp_rx is attached to the network-facing interface and xdp_tx to the host-facing one,
+// each redirecting to the other when forwarding or steering.
+#define XDP_OBJECT_PATH "xdp.bpf.o"
+#define XDP_RX_IFNAME "p0"
+#define XDP_TX_IFNAME "pf0hpf"
+
+// How flow-to-core assignments are applied:
+// - STEERING_OPENFLOW: every migration is a FLOW_MOD rewriting the VLAN of the flow on the eSwitch
+// - STEERING_XDP: the balancer writes the assignment into a BPF map and xdp_rx applies it itself,
+//   a migration is then a single map update (useful without hardware offload, works on veth pairs)
+// - STEERING_BUCKETS: a single OpenFlow 1.3 SELECT group hashes the flows over NB_BUCKETS buckets, each
+//   tagging with the VLAN of its core. The balancer moves buckets, a cycle is one GROUP_MOD whatever the
+//   number of flows. With HEAVY_HITTER_TRACKING and FLOW_DISCOVERY_BPF, elephants are pinned on top of it.
+#define STEERING_OPENFLOW 0
+#define STEERING_XDP 1
+#define STEERING_BUCKETS 2
+#define STEERING_MODE STEERING_OPENFLOW
+
+// In STEERING_BUCKETS mode: number of buckets of the group, at most OPENFLOW13_MAX_BUCKETS
+#define NB_BUCKETS 128
+#define BUCKET_GROUP_ID 1
+// Priority of the rule sending the traffic to the group, and of the exact-match rules of the pinned flows
+#define BUCKET_RULE_PRIORITY 1
+#define PINNED_FLOW_PRIORITY 0x8000
+
+// RSS key of the NIC (`ethtool -x`), for flowhash_toeplitz to compute the RSS hash of a flow in software.
+// The default is the key of the RSS specification, whose verification vectors the microbenchmarks check.
+#define FLOWHASH_RSS_KEY {0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2, 0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, \
+    0x8f, 0xb0, 0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4, 0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c, \
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa}
+
+// In STEERING_XDP mode, how xdp_rx steers a frame to its core:
+// - XDP_STEER_VLAN: push an 802.1Q tag whose VID is the core index, then redirect to XDP_TX_IFNAME
+// - XDP_STEER_CPUMAP: redirect the frame to the core through a cpumap (host and NIC are the same machine)
+#define XDP_STEER_VLAN 0
+#define XDP_STEER_CPUMAP 1
+#define XDP_STEER_ACTION XDP_STEER_VLAN
+// Size of the cpumap queues used by XDP_STEER_CPUMAP
+#define XDP_CPUMAP_QSIZE 2048
+
+// Number of connections tracked by the XDP programs
+#define CONNECTIONS_MAX_ENTRIES (4096*64)
+
+// Where the daemon discovers flows and their packet counters:
+// - FLOW_DISCOVERY_OPENFLOW: dump of the OVS flows (OFPST_FLOW)
+// - FLOW_DISCOVERY_BPF: batched harvesting of the XDP `connections` map
+#define FLOW_DISCOVERY_OPENFLOW 0
+#define FLOW_DISCOVERY_BPF 1
+#define FLOW_DISCOVERY FLOW_DISCOVERY_OPENFLOW
+// Number of entries read per batch syscall
+#define HARVEST_BATCH_SIZE 8192
+// When set, entries are deleted as they are read: counters then only cover the last cycle
+#define HARVEST_DELETE_ON_READ 0
+
+// Heavy-hitter detection: xdp_rx maintains a per-CPU Count-Min sketch and a top-K table.
+// When enabled, only elephants are tracked exactly in the flow table, the other flows are
+// accounted as an aggregate background load on the core they are assigned to.
+#define HEAVY_HITTER_TRACKING 0
+// Count-Min sketch dimensions (CMS_WIDTH must be a power of 2)
+#define CMS_DEPTH 4
+#define CMS_WIDTH 1024
+// Number of heavy-hitter candidates kept per CPU
+#define TOPK_SIZE 32
+// Minimal share of the packets of a cycle for a candidate to be considered an elephant
+#define HEAVY_HITTER_MIN_SHARE 0.01
+
+// Host-side AF_XDP dispatcher (orss_dispatcher)
+// Interface receiving the frames tagged by the NIC, queue i must be served by core i
+#define DISPATCH_IFNAME "ens1f0np0"
+#define DISPATCH_XSK_OBJECT_PATH "xsk.bpf.o"
+// Zero-copy needs driver support, set to 0 to run in copy mode (e.g. on veth)
+#define DISPATCH_ZERO_COPY 1
+// UMEM frames, shared by all the sockets
+#define DISPATCH_FRAME_SIZE 2048
+#define DISPATCH_FRAMES_PER_CORE 4096
+// Number of descriptors of each AF_XDP ring and of each inter-core ring
+#define DISPATCH_RING_SIZE 2048
+// Number of descriptors handled at once
+#define DISPATCH_BATCH_SIZE 64
+// Flows without packets for a whole period leave the flow table of the dispatcher
+#define DISPATCH_FLOW_EXPIRY_MS 1000
+// Flows a core can lose to other cores between two of its batches, a power of 2. Past it, the core
+// forgets all of its flows and finds them again in the shared table.
+#define DISPATCH_LOST_RING_SIZE 1024
+
+// Reordering of migrated flows: flows in migration a core can buffer at once, packets buffered per flow
+#define REORDER_MAX_FLOWS 64
+#define REORDER_MAX_PACKETS 256
+// Time after which a migrated flow is released even if its old core didn't drain
+#define REORDER_DEADLINE_US 500
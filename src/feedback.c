@@ -0,0 +1,228 @@
+#include "feedback.h"
+#include <ctype.h>
+#include <endian.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+
+uint64_t feedback_now_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * @brief Tells whether an address is a UDP port rather than a Unix socket path
+ */
+uint8_t feedback_is_port(const char *address){
+    for (const char *c = address; *c; c++){
+        if (!isdigit((unsigned char)*c)){
+            return 0;
+        }
+    }
+    return *address != '\0';
+}
+
+/**
+ * @brief Resolves a `host:port` UDP address, returns -1 if it is invalid
+ */
+int feedback_resolve(const char *address, struct sockaddr_storage *addr, socklen_t *addr_len){
+    char host[256];
+    strncpy(host, address, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    char *port = strrchr(host, ':');
+    if (!port){
+        printf("Invalid feedback address %s, expected host:port or a path\n", address);
+        return -1;
+    }
+    *port++ = '\0';
+    struct addrinfo hints = {0};
+    struct addrinfo *result;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, port, &hints, &result)){
+        printf("Could not resolve feedback address %s\n", address);
+        return -1;
+    }
+    memcpy(addr, result->ai_addr, result->ai_addrlen);
+    *addr_len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return 0;
+}
+
+int feedback_init(struct Feedback *feedback, const char *address, int nb_cores){
+    memset(feedback, 0, sizeof(*feedback));
+    feedback->nb_cores = nb_cores < MAX_CORES ? nb_cores : MAX_CORES;
+    if (feedback_is_port(address) || (strchr(address, ':') && !strchr(address, '/'))){
+        // A port alone is only reachable from this machine, the dispatcher on another host needs addr:port
+        struct sockaddr_storage addr = {0};
+        socklen_t addr_len = sizeof(struct sockaddr_in);
+        if (feedback_is_port(address)){
+            struct sockaddr_in *local = (struct sockaddr_in *)&addr;
+            local->sin_family = AF_INET;
+            local->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            local->sin_port = htons(atoi(address));
+        } else if (feedback_resolve(address, &addr, &addr_len)){
+            feedback->fd = -1;
+            return -1;
+        }
+        feedback->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (feedback->fd < 0 || bind(feedback->fd, (struct sockaddr *)&addr, addr_len) < 0){
+            printf("Could not listen for host feedback on UDP %s\n", address);
+            feedback_close(feedback);
+            return -1;
+        }
+    } else {
+        feedback->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        struct sockaddr_un addr = {0};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address, sizeof(addr.sun_path) - 1);
+        unlink(addr.sun_path);
+        if (feedback->fd < 0 || bind(feedback->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+            printf("Could not listen for host feedback on %s\n", address);
+            feedback_close(feedback);
+            return -1;
+        }
+        strncpy(feedback->path, addr.sun_path, sizeof(feedback->path) - 1);
+    }
+    printf("Listening for host feedback on %s\n", address);
+    return 0;
+}
+
+/**
+ * @brief Accounts a report, returns -1 if it is invalid
+ */
+int feedback_handle(struct Feedback *feedback, uint8_t *report, ssize_t len){
+    struct FeedbackHeader *header = (struct FeedbackHeader *)report;
+    if (len < (ssize_t)sizeof(*header) || ntohl(header->magic) != FEEDBACK_MAGIC || ntohs(header->version) != FEEDBACK_VERSION){
+        return -1;
+    }
+    int nb_cores = ntohs(header->nb_cores);
+    if (nb_cores > MAX_CORES || len < (ssize_t)(sizeof(*header) + nb_cores * sizeof(struct FeedbackCore))){
+        return -1;
+    }
+    uint32_t sequence = ntohl(header->sequence);
+    uint64_t time_ns = be64toh(header->time_ns);
+    if (feedback->has_baseline && sequence != 1 && (int32_t)(sequence - feedback->sequence) <= 0){
+        // Duplicated or overtaken by a later report
+        return -1;
+    }
+    // A sender starting again from the first sequence or going back in time restarted, its counters too:
+    // start over from this report
+    uint8_t restarted = !feedback->has_baseline || sequence == 1 || time_ns <= feedback->time_ns;
+    struct FeedbackCore *cores = (struct FeedbackCore *)(report + sizeof(*header));
+    for (int core = 0; core < nb_cores && core < feedback->nb_cores; core++){
+        uint64_t busy_ns = be64toh(cores[core].busy_ns);
+        uint64_t packets = be64toh(cores[core].packets);
+        if (!restarted && busy_ns >= feedback->busy_ns[core] && packets >= feedback->packets[core]){
+            feedback->cycle_busy_ns[core] += busy_ns - feedback->busy_ns[core];
+            feedback->cycle_packets[core] += packets - feedback->packets[core];
+        }
+        feedback->busy_ns[core] = busy_ns;
+        feedback->packets[core] = packets;
+        feedback->queue_depth[core] = ntohl(cores[core].queue_depth);
+    }
+    if (!restarted){
+        feedback->cycle_elapsed_ns += time_ns - feedback->time_ns;
+    }
+    feedback->has_baseline = 1;
+    feedback->sequence = sequence;
+    feedback->time_ns = time_ns;
+    feedback->last_report_ns = feedback_now_ns();
+    return 0;
+}
+
+int feedback_collect(struct Feedback *feedback){
+    uint8_t report[FEEDBACK_MAX_REPORT_SIZE];
+    int nb_reports = 0;
+    ssize_t len;
+    while (feedback->fd >= 0 && (len = recv(feedback->fd, report, sizeof(report), 0)) >= 0){
+        if (feedback_handle(feedback, report, len)){
+            feedback->nb_invalid++;
+        } else {
+            nb_reports++;
+        }
+    }
+    feedback->nb_reports += nb_reports;
+    return nb_reports;
+}
+
+int feedback_get_utilization(struct Feedback *feedback, double *utilization){
+    uint64_t elapsed_ns = feedback->cycle_elapsed_ns;
+    uint8_t recent = feedback->has_baseline && feedback_now_ns() - feedback->last_report_ns < FEEDBACK_TIMEOUT_MS * 1000000ULL;
+    for (int core = 0; core < feedback->nb_cores; core++){
+        if (recent && elapsed_ns > 0){
+            // Time the queued packets will take, at the cost per packet measured during the cycle
+            double cost_ns = feedback->cycle_packets[core] ? (double)feedback->cycle_busy_ns[core] / feedback->cycle_packets[core] : 0;
+            utilization[core] = (feedback->cycle_busy_ns[core] + feedback->queue_depth[core] * cost_ns) / elapsed_ns;
+        }
+        feedback->cycle_busy_ns[core] = 0;
+        feedback->cycle_packets[core] = 0;
+    }
+    feedback->cycle_elapsed_ns = 0;
+    return recent && elapsed_ns > 0 ? 0 : -1;
+}
+
+void feedback_close(struct Feedback *feedback){
+    if (feedback->fd >= 0){
+        close(feedback->fd);
+    }
+    if (feedback->path[0]){
+        unlink(feedback->path);
+    }
+    feedback->fd = -1;
+}
+
+int feedback_connect(struct FeedbackSender *sender, const char *address){
+    memset(sender, 0, sizeof(*sender));
+    sender->fd = -1;
+    if (strchr(address, '/')){
+        struct sockaddr_un *addr = (struct sockaddr_un *)&sender->addr;
+        addr->sun_family = AF_UNIX;
+        strncpy(addr->sun_path, address, sizeof(addr->sun_path) - 1);
+        sender->addr_len = sizeof(*addr);
+    } else if (feedback_resolve(address, &sender->addr, &sender->addr_len)){
+        return -1;
+    }
+    sender->fd = socket(sender->addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (sender->fd < 0){
+        printf("Could not create the feedback socket\n");
+        return -1;
+    }
+    return 0;
+}
+
+int feedback_send(struct FeedbackSender *sender, int nb_cores, uint64_t *busy_ns, uint64_t *packets, uint32_t *queue_depth){
+    uint8_t report[FEEDBACK_MAX_REPORT_SIZE] = {0};
+    nb_cores = nb_cores < MAX_CORES ? nb_cores : MAX_CORES;
+    struct FeedbackHeader *header = (struct FeedbackHeader *)report;
+    header->magic = htonl(FEEDBACK_MAGIC);
+    header->version = htons(FEEDBACK_VERSION);
+    header->nb_cores = htons(nb_cores);
+    header->sequence = htonl(++sender->sequence);
+    header->time_ns = htobe64(feedback_now_ns());
+    struct FeedbackCore *cores = (struct FeedbackCore *)(report + sizeof(*header));
+    for (int core = 0; core < nb_cores; core++){
+        cores[core].busy_ns = htobe64(busy_ns[core]);
+        cores[core].packets = htobe64(packets[core]);
+        cores[core].queue_depth = htonl(queue_depth[core]);
+    }
+    size_t len = sizeof(*header) + nb_cores * sizeof(struct FeedbackCore);
+    // Nobody may be listening (yet), a lost report is made up for by the next one
+    if (sendto(sender->fd, report, len, 0, (struct sockaddr *)&sender->addr, sender->addr_len) < 0){
+        return -1;
+    }
+    return 0;
+}
+
+void feedback_disconnect(struct FeedbackSender *sender){
+    if (sender->fd >= 0){
+        close(sender->fd);
+    }
+    sender->fd = -1;
+}
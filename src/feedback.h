@@ -0,0 +1,146 @@
+/**
+ * @file feedback.h
+ * @brief Host-to-NIC feedback of per-core utilization
+ *
+ * Packet counts only approximate the work of a core: two flows with the same rate can cost very
+ * different CPU time on the host. The host dispatcher reports, for each core, the time it spent
+ * processing packets, the packets it processed and the depth of its queue. The daemon turns the
+ * reports received during a cycle into a utilization per core which the balancer uses to correct the
+ * packet load of the cores (see balancer_set_utilization).
+ *
+ * Reports are datagrams, sent over UDP (`host:port`) or over a Unix datagram socket when the address
+ * is a path, e.g. when the daemon and the dispatcher run on the same machine. A report is a
+ * `struct FeedbackHeader` followed by `nb_cores` `struct FeedbackCore`, in network byte order.
+ * Counters are cumulative so that a lost report only delays the next one.
+ *
+ */
+
+#ifndef FEEDBACK_H
+#define FEEDBACK_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include "env.h"
+
+#define FEEDBACK_MAGIC 0x4f524642 // "ORFB"
+#define FEEDBACK_VERSION 1
+
+struct FeedbackHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t nb_cores;
+    uint32_t sequence;
+    uint32_t padding;
+    uint64_t time_ns; /** Sender clock, CLOCK_MONOTONIC */
+} __attribute__((packed));
+
+struct FeedbackCore {
+    uint64_t busy_ns; /** Time spent processing packets */
+    uint64_t packets; /** Packets processed */
+    uint32_t queue_depth; /** Packets waiting to be processed when the report was sent */
+    uint32_t padding;
+} __attribute__((packed));
+
+#define FEEDBACK_MAX_REPORT_SIZE (sizeof(struct FeedbackHeader) + MAX_CORES * sizeof(struct FeedbackCore))
+
+/**
+ * @brief Receiving side, in the daemon
+ *
+ */
+struct Feedback {
+    int fd;
+    int nb_cores;
+    char path[108]; /** Unix socket path, removed on close */
+    uint8_t has_baseline; /** A first report was received, the next ones are diffed against it */
+    uint32_t sequence;
+    uint64_t time_ns;
+    uint64_t last_report_ns; /** Local time of the last report */
+    uint64_t nb_reports;
+    uint64_t nb_invalid;
+    // Last cumulative counters of each core
+    uint64_t busy_ns[MAX_CORES];
+    uint64_t packets[MAX_CORES];
+    uint32_t queue_depth[MAX_CORES];
+    // Accumulated since the last feedback_get_utilization
+    uint64_t cycle_elapsed_ns;
+    uint64_t cycle_busy_ns[MAX_CORES];
+    uint64_t cycle_packets[MAX_CORES];
+};
+
+/**
+ * @brief Sending side, in the host dispatcher
+ *
+ */
+struct FeedbackSender {
+    int fd;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    uint32_t sequence;
+};
+
+/**
+ * @brief Listens for reports
+ *
+ * @param feedback : the receiver to initialize
+ * @param address : UDP port (on the loopback), `addr:port` to listen on another interface, or path of a Unix
+ * datagram socket
+ * @param nb_cores : cores the daemon balances, reports about other cores are ignored
+ * @return int : 0 on success, -1 otherwise
+ */
+int feedback_init(struct Feedback *feedback, const char *address, int nb_cores);
+
+/**
+ * @brief Reads the pending reports without blocking
+ *
+ * @param feedback
+ * @return int : number of valid reports read
+ */
+int feedback_collect(struct Feedback *feedback);
+
+/**
+ * @brief Gives the utilization of each core over the reports collected since the previous call:
+ * busy time over elapsed time, plus the time needed to process the queued packets at the measured
+ * cost per packet. A core can then be above 1 when it doesn't keep up.
+ *
+ * @param feedback
+ * @param utilization : array of nb_cores values to fill
+ * @return int : 0 if it was filled, -1 if no recent report was received (older than FEEDBACK_TIMEOUT_MS)
+ */
+int feedback_get_utilization(struct Feedback *feedback, double *utilization);
+
+/**
+ * @brief Closes the socket
+ *
+ * @param feedback
+ */
+void feedback_close(struct Feedback *feedback);
+
+/**
+ * @brief Opens the socket reports are sent from
+ *
+ * @param sender
+ * @param address : `host:port` of the daemon, or path of its Unix datagram socket
+ * @return int : 0 on success, -1 otherwise
+ */
+int feedback_connect(struct FeedbackSender *sender, const char *address);
+
+/**
+ * @brief Sends a report, counters are cumulative
+ *
+ * @param sender
+ * @param nb_cores : number of entries of the arrays, at most MAX_CORES
+ * @param busy_ns : time each core spent processing packets
+ * @param packets : packets each core processed
+ * @param queue_depth : packets waiting in the queue of each core
+ * @return int : 0 on success, -1 otherwise
+ */
+int feedback_send(struct FeedbackSender *sender, int nb_cores, uint64_t *busy_ns, uint64_t *packets, uint32_t *queue_depth);
+
+/**
+ * @brief Closes the socket
+ *
+ * @param sender
+ */
+void feedback_disconnect(struct FeedbackSender *sender);
+
+#endif
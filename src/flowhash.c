@@ -0,0 +1,195 @@
+#include "flowhash.h"
+#include <stdio.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+#if defined(__aarch64__)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+// Reflected CRC32C (Castagnoli) polynomial
+#define FLOWHASH_CRC32C_POLY 0x82f63b78
+
+static uint32_t flowhash_crc32c_first(const struct FiveTuple *key, uint32_t seed);
+
+flowhash_function flowhash_crc32c_selected = flowhash_crc32c_first;
+// CRC32C of each byte value, for the portable backend
+static uint32_t crc32c_table[256];
+static int flowhash_backend = -1;
+
+static const char *flowhash_backend_names[FLOWHASH_NB_BACKENDS] = {"portable", "armv8-crc", "sse4.2"};
+
+/*
+    The 5-tuple is hashed as three words, the same for every backend: both addresses, both ports, the protocol.
+    The CRC instructions take the bytes of a word from the least significant one.
+*/
+static inline uint64_t flowhash_addresses(const struct FiveTuple *key){
+    return (uint64_t)key->dst_ip << 32 | key->src_ip;
+}
+
+static inline uint32_t flowhash_ports(const struct FiveTuple *key){
+    return (uint32_t)key->dst_port << 16 | key->src_port;
+}
+
+static inline uint32_t flowhash_crc32c_bytes(uint32_t crc, uint64_t word, int nb_bytes){
+    for (int i = 0; i < nb_bytes; i++){
+        crc = crc32c_table[(crc ^ word) & 0xff] ^ (crc >> 8);
+        word >>= 8;
+    }
+    return crc;
+}
+
+static uint32_t flowhash_crc32c_portable(const struct FiveTuple *key, uint32_t seed){
+    uint32_t crc = flowhash_crc32c_bytes(seed, flowhash_addresses(key), 8);
+    crc = flowhash_crc32c_bytes(crc, flowhash_ports(key), 4);
+    return flowhash_crc32c_bytes(crc, key->proto, 1);
+}
+
+#if defined(__aarch64__)
+static uint32_t flowhash_crc32c_armv8(const struct FiveTuple *key, uint32_t seed){
+    uint32_t crc = seed;
+    // The CRC extension is optional in ARMv8.0, the assembler is told it is there, flowhash_init checks the CPU
+    __asm__(".arch_extension crc\n\t"
+        "crc32cx %w0, %w0, %x1\n\t"
+        "crc32cw %w0, %w0, %w2\n\t"
+        "crc32cb %w0, %w0, %w3"
+        : "+r"(crc)
+        : "r"(flowhash_addresses(key)), "r"(flowhash_ports(key)), "r"((uint32_t)key->proto));
+    return crc;
+}
+#endif
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t flowhash_crc32c_sse42(const struct FiveTuple *key, uint32_t seed){
+    uint32_t crc = _mm_crc32_u64(seed, flowhash_addresses(key));
+    crc = _mm_crc32_u32(crc, flowhash_ports(key));
+    return _mm_crc32_u8(crc, key->proto);
+}
+#endif
+
+int flowhash_init(){
+    if (flowhash_backend >= 0){
+        return flowhash_backend;
+    }
+    for (uint32_t value = 0; value < 256; value++){
+        uint32_t crc = value;
+        for (int bit = 0; bit < 8; bit++){
+            crc = crc & 1 ? (crc >> 1) ^ FLOWHASH_CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[value] = crc;
+    }
+    flowhash_backend = FLOWHASH_PORTABLE;
+    for (int backend = FLOWHASH_NB_BACKENDS - 1; backend > FLOWHASH_PORTABLE; backend--){
+        if (flowhash_crc32c_backend(backend)){
+            flowhash_backend = backend;
+            break;
+        }
+    }
+    flowhash_crc32c_selected = flowhash_crc32c_backend(flowhash_backend);
+    return flowhash_backend;
+}
+
+static uint32_t flowhash_crc32c_first(const struct FiveTuple *key, uint32_t seed){
+    flowhash_init();
+    return flowhash_crc32c_selected(key, seed);
+}
+
+flowhash_function flowhash_crc32c_backend(int backend){
+    if (backend == FLOWHASH_PORTABLE){
+        // The table is filled by flowhash_init
+        return flowhash_backend >= 0 ? flowhash_crc32c_portable : flowhash_crc32c_first;
+    }
+#if defined(__aarch64__)
+    if (backend == FLOWHASH_ARMV8_CRC && (getauxval(AT_HWCAP) & HWCAP_CRC32)){
+        return flowhash_crc32c_armv8;
+    }
+#endif
+#if defined(__x86_64__)
+    if (backend == FLOWHASH_SSE42 && __builtin_cpu_supports("sse4.2")){
+        return flowhash_crc32c_sse42;
+    }
+#endif
+    return (void *)0;
+}
+
+const char *flowhash_backend_name(int backend){
+    return backend >= 0 && backend < FLOWHASH_NB_BACKENDS ? flowhash_backend_names[backend] : "unknown";
+}
+
+/*
+    Input of the Toeplitz hash, in network order like on the wire
+*/
+static void flowhash_toeplitz_input(const struct FiveTuple *key, uint8_t *input){
+    uint32_t words[2] = {key->src_ip, key->dst_ip};
+    for (int i = 0; i < 2; i++){
+        input[4 * i] = words[i] >> 24;
+        input[4 * i + 1] = words[i] >> 16;
+        input[4 * i + 2] = words[i] >> 8;
+        input[4 * i + 3] = words[i];
+    }
+    input[8] = key->src_port >> 8;
+    input[9] = key->src_port;
+    input[10] = key->dst_port >> 8;
+    input[11] = key->dst_port;
+}
+
+/*
+    32 bits of the RSS key starting at bit `offset`, the most significant bit of the first byte being bit 0
+*/
+static uint32_t flowhash_key_window(const uint8_t *rss_key, int offset){
+    int byte = offset / 8;
+    int shift = offset % 8;
+    uint64_t bits = (uint64_t)rss_key[byte] << 32 | (uint64_t)rss_key[byte + 1] << 24 | rss_key[byte + 2] << 16 |
+        rss_key[byte + 3] << 8 | (shift ? rss_key[byte + 4] : 0);
+    return bits >> (8 - shift);
+}
+
+int flowhash_toeplitz_init(struct ToeplitzTable *table, const uint8_t *rss_key, int key_len){
+    if (key_len < FLOWHASH_TOEPLITZ_KEY_MIN){
+        printf("RSS key of %d bytes, at least %d are needed\n", key_len, FLOWHASH_TOEPLITZ_KEY_MIN);
+        return -1;
+    }
+    for (int byte = 0; byte < FLOWHASH_TOEPLITZ_INPUT; byte++){
+        uint32_t windows[8];
+        for (int bit = 0; bit < 8; bit++){
+            windows[bit] = flowhash_key_window(rss_key, 8 * byte + bit);
+        }
+        for (int value = 0; value < 256; value++){
+            uint32_t hash = 0;
+            for (int bit = 0; bit < 8; bit++){
+                if (value & (0x80 >> bit)){
+                    hash ^= windows[bit];
+                }
+            }
+            table->table[byte][value] = hash;
+        }
+    }
+    return 0;
+}
+
+uint32_t flowhash_toeplitz(const struct ToeplitzTable *table, const struct FiveTuple *key){
+    // Four independent lookups per word, without going through the input bytes in memory
+    uint32_t hash = table->table[0][key->src_ip >> 24] ^ table->table[1][(key->src_ip >> 16) & 0xff] ^
+        table->table[2][(key->src_ip >> 8) & 0xff] ^ table->table[3][key->src_ip & 0xff];
+    hash ^= table->table[4][key->dst_ip >> 24] ^ table->table[5][(key->dst_ip >> 16) & 0xff] ^
+        table->table[6][(key->dst_ip >> 8) & 0xff] ^ table->table[7][key->dst_ip & 0xff];
+    hash ^= table->table[8][key->src_port >> 8] ^ table->table[9][key->src_port & 0xff] ^
+        table->table[10][key->dst_port >> 8] ^ table->table[11][key->dst_port & 0xff];
+    return hash;
+}
+
+uint32_t flowhash_toeplitz_reference(const uint8_t *rss_key, const struct FiveTuple *key){
+    uint8_t input[FLOWHASH_TOEPLITZ_INPUT];
+    flowhash_toeplitz_input(key, input);
+    uint32_t hash = 0;
+    for (int bit = 0; bit < 8 * FLOWHASH_TOEPLITZ_INPUT; bit++){
+        if (input[bit / 8] & (0x80 >> (bit % 8))){
+            hash ^= flowhash_key_window(rss_key, bit);
+        }
+    }
+    return hash;
+}
@@ -0,0 +1,118 @@
+/**
+ * @file flowhash.h
+ * @brief Hashes of the 5-tuple of a flow: CRC32C to index the flow table, Toeplitz to match the RSS of a NIC
+ *
+ * flowhash_crc32c runs the CRC32C instruction of the CPU when it has one: the CRC extension of ARMv8 (the
+ * BlueField cores) or SSE4.2 on x86, checked once at the first hash. Other CPUs use a table-driven CRC32C.
+ * Every backend gives the same hash for the same flow; flowhash_crc32c_backend gives each of them to compare
+ * them (see the microbenchmarks).
+ *
+ * flowhash_toeplitz is the Toeplitz hash of RSS over the IPv4 addresses and ports of the flow, in network
+ * order, bit-compatible with the hash a NIC or the eSwitch computes with the same RSS key: a bucket or queue
+ * picked in software from it is the one the hardware picks. The key is expanded once into a table holding
+ * the hash of each value of each input byte, a hash then takes one lookup per byte.
+ *
+ */
+
+#ifndef FLOWHASH_H
+#define FLOWHASH_H
+
+#include <stdint.h>
+#include "hashmap.h"
+
+#define FLOWHASH_PORTABLE 0
+#define FLOWHASH_ARMV8_CRC 1
+#define FLOWHASH_SSE42 2
+#define FLOWHASH_NB_BACKENDS 3
+
+// Bytes hashed by flowhash_toeplitz: source and destination addresses, then source and destination ports
+#define FLOWHASH_TOEPLITZ_INPUT 12
+// Bytes of the RSS key used: the input and the 32 bits of the hash
+#define FLOWHASH_TOEPLITZ_KEY_MIN (FLOWHASH_TOEPLITZ_INPUT + 4)
+
+typedef uint32_t (*flowhash_function)(const struct FiveTuple *key, uint32_t seed);
+
+// The backend picked at the first hash, see flowhash_init
+extern flowhash_function flowhash_crc32c_selected;
+
+struct ToeplitzTable {
+    uint32_t table[FLOWHASH_TOEPLITZ_INPUT][256]; /** Hash of each value of each input byte */
+};
+
+/**
+ * @brief Picks the fastest CRC32C backend the CPU supports. Called by the first hash, calling it again
+ * does nothing.
+ *
+ * @return int : the backend, FLOWHASH_*
+ */
+int flowhash_init();
+
+/**
+ * @brief CRC32C of the 5-tuple of a flow
+ *
+ * @param key : the flow
+ * @param seed : initial value of the CRC, to draw independent hashes
+ * @return uint32_t : the hash, the same whatever the backend
+ */
+static inline uint32_t flowhash_crc32c(const struct FiveTuple *key, uint32_t seed){
+    return flowhash_crc32c_selected(key, seed);
+}
+
+/**
+ * @brief Gives a CRC32C backend
+ *
+ * @param backend : FLOWHASH_*
+ * @return flowhash_function : the hash function, NULL if the CPU (or the build) doesn't support the backend
+ */
+flowhash_function flowhash_crc32c_backend(int backend);
+
+/**
+ * @brief Name of a backend, e.g. "sse4.2"
+ *
+ * @param backend : FLOWHASH_*
+ * @return const char*
+ */
+const char *flowhash_backend_name(int backend);
+
+/**
+ * @brief Expands an RSS key into the table of flowhash_toeplitz
+ *
+ * @param table : the table to fill
+ * @param rss_key : the RSS key, e.g. FLOWHASH_RSS_KEY
+ * @param key_len : bytes of the key, at least FLOWHASH_TOEPLITZ_KEY_MIN
+ * @return int : 0 on success, -1 if the key is too short
+ */
+int flowhash_toeplitz_init(struct ToeplitzTable *table, const uint8_t *rss_key, int key_len);
+
+/**
+ * @brief Toeplitz hash of the addresses and ports of a flow, as computed by RSS (IPv4 with TCP or UDP)
+ *
+ * @param table : the table of the RSS key
+ * @param key : the flow, in host order like every FiveTuple
+ * @return uint32_t : the RSS hash
+ */
+uint32_t flowhash_toeplitz(const struct ToeplitzTable *table, const struct FiveTuple *key);
+
+/**
+ * @brief Same hash as flowhash_toeplitz, bit by bit as written in the RSS specification. Slow, it checks
+ * the table-driven version.
+ *
+ * @param rss_key : the RSS key, at least FLOWHASH_TOEPLITZ_KEY_MIN bytes
+ * @param key : the flow
+ * @return uint32_t : the RSS hash
+ */
+uint32_t flowhash_toeplitz_reference(const uint8_t *rss_key, const struct FiveTuple *key);
+
+/**
+ * @brief Entry of an RSS indirection table of `nb_buckets` entries (a power of 2) a hash leads to: like the
+ * NIC, the low bits of the hash
+ *
+ * @param hash : the RSS hash of the flow
+ * @param nb_buckets : entries of the indirection table
+ * @return int : the entry
+ */
+static inline int flowhash_rss_bucket(uint32_t hash, int nb_buckets){
+    return hash & (nb_buckets - 1);
+}
+
+#endif
@@ -0,0 +1,99 @@
+#include "harvest.h"
+
+int harvest_init(struct Harvester *harvester, struct XdpProgram *prog){
+    harvester->connections_fd = load_bpf_map_fd(prog, "connections");
+    if (harvester->connections_fd < 0){
+        return -1;
+    }
+    harvester->nb_cpus = libbpf_num_possible_cpus();
+    if (harvester->nb_cpus <= 0){
+        printf("Could not get the number of CPUs\n");
+        return -1;
+    }
+    harvester->keys = calloc(HARVEST_BATCH_SIZE, sizeof(struct FiveTuple));
+    harvester->values = calloc((size_t)HARVEST_BATCH_SIZE * harvester->nb_cpus, sizeof(struct ConnectionState));
+    harvester->flows = calloc(CONNECTIONS_MAX_ENTRIES, sizeof(struct HarvestedFlow));
+    harvester->finished = calloc(CONNECTIONS_MAX_ENTRIES, sizeof(struct FiveTuple));
+    harvester->nb_flows = 0;
+    harvester->nb_finished = 0;
+    return 0;
+}
+
+/**
+ * @brief Reduces the per-CPU values of a batch into harvested flows
+ *
+ * @param count : number of entries of the batch
+ */
+void harvest_reduce(struct Harvester *harvester, uint32_t count){
+    int nb_cpus = harvester->nb_cpus;
+    for (uint32_t i = 0; i < count && harvester->nb_flows < CONNECTIONS_MAX_ENTRIES; i++){
+        // Each per-CPU value is two words: OR-ing the flags and summing the counters is a loop
+        // over contiguous memory without branches, which the compiler vectorizes
+        const uint64_t *words = (const uint64_t *)&harvester->values[(size_t)i * nb_cpus];
+        uint64_t flags = 0;
+        uint64_t packets = 0;
+        for (int cpu = 0; cpu < nb_cpus; cpu++){
+            flags |= words[2 * cpu];
+            packets += words[2 * cpu + 1];
+        }
+        struct ConnectionState reduced;
+        memcpy(&reduced, &flags, sizeof(flags));
+        struct HarvestedFlow *flow = &harvester->flows[harvester->nb_flows++];
+        flow->key = load_bpf_flow_key(&harvester->keys[i]);
+        flow->handshake = reduced.SYN || reduced.SYNACK || reduced.ACK;
+        flow->fin = reduced.FIN;
+        flow->packets = packets;
+        if (flow->fin && !HARVEST_DELETE_ON_READ){
+            harvester->finished[harvester->nb_finished++] = harvester->keys[i];
+        }
+    }
+}
+
+int harvest_collect(struct Harvester *harvester){
+    struct bpf_map_batch_opts opts = {0};
+    opts.sz = sizeof(opts);
+    // Hash maps use a bucket index as batch token
+    uint32_t in_batch = 0;
+    uint32_t out_batch = 0;
+    uint8_t first_batch = 1;
+    harvester->nb_flows = 0;
+    harvester->nb_finished = 0;
+    harvester->nb_syscalls = 0;
+    while (1){
+        uint32_t count = HARVEST_BATCH_SIZE;
+        int err;
+        if (HARVEST_DELETE_ON_READ){
+            err = bpf_map_lookup_and_delete_batch(harvester->connections_fd, first_batch ? NULL : &in_batch, &out_batch,
+                harvester->keys, harvester->values, &count, &opts);
+        } else {
+            err = bpf_map_lookup_batch(harvester->connections_fd, first_batch ? NULL : &in_batch, &out_batch,
+                harvester->keys, harvester->values, &count, &opts);
+        }
+        harvester->nb_syscalls++;
+        if (err && errno != ENOENT){
+            printf("Could not read the connections map: %s\n", strerror(errno));
+            return -1;
+        }
+        harvest_reduce(harvester, count);
+        // ENOENT means the last entries were returned
+        if (err){
+            break;
+        }
+        in_batch = out_batch;
+        first_batch = 0;
+    }
+    // Forget finished connections
+    uint32_t nb_deleted = harvester->nb_finished;
+    if (nb_deleted > 0){
+        bpf_map_delete_batch(harvester->connections_fd, harvester->finished, &nb_deleted, &opts);
+        harvester->nb_syscalls++;
+    }
+    return harvester->nb_flows;
+}
+
+void harvest_destroy(struct Harvester *harvester){
+    free(harvester->keys);
+    free(harvester->values);
+    free(harvester->flows);
+    free(harvester->finished);
+}
@@ -0,0 +1,71 @@
+/**
+ * @file harvest.h
+ * @brief Batched harvesting of the XDP `connections` map
+ *
+ * Reading the map key by key costs a `get_next_key` and a lookup syscall per connection. The
+ * harvester reads it `HARVEST_BATCH_SIZE` entries per syscall with `bpf_map_lookup_batch` (or
+ * `bpf_map_lookup_and_delete_batch` when `HARVEST_DELETE_ON_READ` is set) and reduces the per-CPU
+ * values of each connection in a single pass.
+ *
+ */
+
+#ifndef HARVEST_H
+#define HARVEST_H
+
+#include <errno.h>
+#include "load_bpf.h"
+#include "hashmap.h"
+#include "bpf/connection.h"
+
+/**
+ * @brief A connection and its state reduced over all CPUs
+ *
+ */
+struct HarvestedFlow {
+    struct FiveTuple key; /** Flow table key */
+    uint8_t handshake; /** SYN, SYNACK or ACK seen */
+    uint8_t fin; /** FIN seen */
+    uint64_t packets;
+};
+
+struct Harvester {
+    int connections_fd;
+    int nb_cpus;
+    // Batch buffers
+    struct FiveTuple *keys;
+    struct ConnectionState *values; /** HARVEST_BATCH_SIZE * nb_cpus values */
+    // Result of the last harvest
+    int nb_flows;
+    struct HarvestedFlow *flows;
+    // Finished connections to delete from the map
+    int nb_finished;
+    struct FiveTuple *finished;
+    // Number of batch syscalls done by the last harvest
+    int nb_syscalls;
+};
+
+/**
+ * @brief Retrieves the `connections` map of the loaded program and allocates the batch buffers
+ *
+ * @param harvester : the structure to fill
+ * @param prog : the loaded XDP program
+ * @return int : 0 on success, -1 otherwise
+ */
+int harvest_init(struct Harvester *harvester, struct XdpProgram *prog);
+
+/**
+ * @brief Reads the whole map and fills `harvester->flows`. Finished connections are removed from the map.
+ *
+ * @param harvester
+ * @return int : the number of harvested flows, -1 if the map couldn't be read
+ */
+int harvest_collect(struct Harvester *harvester);
+
+/**
+ * @brief Frees the batch buffers
+ *
+ * @param harvester
+ */
+void harvest_destroy(struct Harvester *harvester);
+
+#endif
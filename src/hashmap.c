@@ -1,17 +1,38 @@
 #include "hashmap.h"
+#include "flowhash.h"
 
-struct HashMap *hashmap_init() {
+struct HashMap *hashmap_init(int capacity, int ring_size) {
     struct HashMap *hashmap = calloc(1, sizeof(struct HashMap));
-    hashmap->map = calloc(HASHMAP_SIZE, sizeof(struct key_value_pair));
+    hashmap->map = calloc(capacity, sizeof(struct key_value_pair));
     hashmap->size = 0;
+    hashmap->capacity = capacity;
+    hashmap->ring_size = ring_size;
+    uint32_t index_size = 2;
+    while (index_size < 2 * (uint32_t)capacity) {
+        index_size *= 2;
+    }
+    hashmap->index = calloc(index_size, sizeof(int32_t));
+    hashmap->index_mask = index_size - 1;
+    hashmap->free_slots = malloc(capacity * sizeof(int32_t));
+    hashmap->free_pos = malloc(capacity * sizeof(int32_t));
+    for (int i = 0; i < capacity; i++) {
+        hashmap->free_slots[i] = capacity - 1 - i;
+        hashmap->free_pos[capacity - 1 - i] = i;
+    }
+    hashmap->nb_free = capacity;
     return hashmap;
 }
 
 void hashmap_destroy(struct HashMap *hashmap) {
-    for (int i = 0; i < hashmap->size; i++) {
-        ringbuffer_destroy(hashmap->map[i].value);
+    for (int i = 0; i < hashmap->capacity; i++) {
+        if (hashmap->map[i].valid) {
+            ringbuffer_destroy(hashmap->map[i].value);
+        }
     }
     free(hashmap->map);
+    free(hashmap->index);
+    free(hashmap->free_slots);
+    free(hashmap->free_pos);
     free(hashmap);
 }
 
@@ -20,52 +41,84 @@ uint8_t five_tuple_equals(struct FiveTuple *a, struct FiveTuple *b) {
 }
 
 int hashmap_contains(struct HashMap *hashmap, struct FiveTuple *key) {
-    int iterator = 0;
-    int item_count = 0;
-    while (item_count < hashmap->size) {
-        if (hashmap->map[iterator].valid) {
-            if (five_tuple_equals(&hashmap->map[iterator].key, key)) {
-                return iterator;
-            }
-            item_count++;
+    uint32_t hash = flowhash_crc32c(key, 0);
+    for (uint32_t i = hash & hashmap->index_mask; hashmap->index[i]; i = (i + 1) & hashmap->index_mask) {
+        struct key_value_pair *pair = &hashmap->map[hashmap->index[i] - 1];
+        if (pair->hash == hash && five_tuple_equals(&pair->key, key)) {
+            return hashmap->index[i] - 1;
         }
-        iterator++;
     }
     return -1;
 }
 
-void hashmap_insert_at_index(struct HashMap *hashmap, int index, struct RingBuffer *value, struct FiveTuple key) {
-    hashmap->map[index].key = key;
-    hashmap->map[index].value = value;
-    hashmap->map[index].valid = 1;
+/*
+    Takes a given slot off the stack of the free slots
+*/
+void hashmap_take_slot(struct HashMap *hashmap, int slot) {
+    int pos = hashmap->free_pos[slot];
+    int last = hashmap->free_slots[--hashmap->nb_free];
+    hashmap->free_slots[pos] = last;
+    hashmap->free_pos[last] = pos;
 }
 
-int hashmap_first_free_slot(struct HashMap *hashmap) {
-    for (int i = 0; i < HASHMAP_SIZE; i++) {
-        if (!hashmap->map[i].valid) {
-            return i;
+/*
+    Fills a free slot with a new flow and indexes it
+*/
+void hashmap_fill_slot(struct HashMap *hashmap, int slot, struct RingBuffer *value, struct FiveTuple key) {
+    hashmap_take_slot(hashmap, slot);
+    hashmap->map[slot].key = key;
+    hashmap->map[slot].value = value;
+    hashmap->map[slot].valid = 1;
+    hashmap->map[slot].hash = flowhash_crc32c(&key, 0);
+    hashmap->map[slot].admitted_cycle = hashmap->cycle;
+    uint32_t i = hashmap->map[slot].hash & hashmap->index_mask;
+    while (hashmap->index[i]) {
+        i = (i + 1) & hashmap->index_mask;
+    }
+    hashmap->index[i] = slot + 1;
+    hashmap->size++;
+}
+
+/*
+    Empties the slot of a flow, its ringbuffer is freed
+*/
+void hashmap_release_slot(struct HashMap *hashmap, int slot) {
+    uint32_t hole = hashmap->map[slot].hash & hashmap->index_mask;
+    while (hashmap->index[hole] != slot + 1) {
+        hole = (hole + 1) & hashmap->index_mask;
+    }
+    // Backward shift: the next entries of the probe sequence move up unless the hole is before their home
+    for (uint32_t i = (hole + 1) & hashmap->index_mask; hashmap->index[i]; i = (i + 1) & hashmap->index_mask) {
+        uint32_t home = hashmap->map[hashmap->index[i] - 1].hash & hashmap->index_mask;
+        if (((i - home) & hashmap->index_mask) >= ((i - hole) & hashmap->index_mask)) {
+            hashmap->index[hole] = hashmap->index[i];
+            hole = i;
         }
     }
-    return -1;
+    hashmap->index[hole] = 0;
+    hashmap->map[slot].valid = 0;
+    ringbuffer_destroy(hashmap->map[slot].value);
+    hashmap->free_pos[slot] = hashmap->nb_free;
+    hashmap->free_slots[hashmap->nb_free++] = slot;
+    hashmap->size--;
 }
 
-void hashmap_insert(struct HashMap *hashmap, struct FiveTuple key, struct RingBuffer *value) {
+int hashmap_insert(struct HashMap *hashmap, struct FiveTuple key, struct RingBuffer *value) {
     int index = hashmap_contains(hashmap, &key);
     // If the key is already in the hashmap, update the value
     if (index >= 0){
-        hashmap_insert_at_index(hashmap, index, value, key);
-        return;
+        hashmap->map[index].value = value;
+        return 0;
     }
-    // If the key is not in the hashmap, insert it at the first free slot
-    index = hashmap_first_free_slot(hashmap);
-    if (index >= 0){
-        hashmap_insert_at_index(hashmap, index, value, key);
-        hashmap->size++;
-        return;
+    // If the key is not in the hashmap, insert it at the free slot on top of the stack
+    if (hashmap->nb_free > 0){
+        index = hashmap->free_slots[hashmap->nb_free - 1];
+        hashmap_fill_slot(hashmap, index, value, key);
+        hashmap->map[index].generation++;
+        return 0;
     }
-    // Raise an error if the hashmap is full
-    printf("Hashmap is full!");
-    exit(1);
+    // The hashmap is full, the caller decides what to evict
+    return -1;
 }
 
 struct RingBuffer *hashmap_get(struct HashMap *hashmap, struct FiveTuple *key) {
@@ -76,41 +129,124 @@ struct RingBuffer *hashmap_get(struct HashMap *hashmap, struct FiveTuple *key) {
     return (void *)0;
 }
 
+int hashmap_slot(struct HashMap *hashmap, struct FiveTuple *key) {
+    return hashmap_contains(hashmap, key);
+}
+
+struct RingBuffer *hashmap_get_slot(struct HashMap *hashmap, int slot, uint16_t generation, struct FiveTuple *key) {
+    if (slot < 0 || slot >= hashmap->capacity || !hashmap->map[slot].valid || hashmap->map[slot].generation != generation ||
+        !five_tuple_equals(&hashmap->map[slot].key, key)){
+        return (void *)0;
+    }
+    return hashmap->map[slot].value;
+}
+
+uint16_t hashmap_generation(struct HashMap *hashmap, int slot) {
+    return hashmap->map[slot].generation;
+}
+
 void hashmap_remove(struct HashMap *hashmap, struct FiveTuple *key) {
     int index = hashmap_contains(hashmap, key);
     if (index >= 0){
-        hashmap->map[index].valid = 0;
-        ringbuffer_destroy(hashmap->map[index].value);
-        hashmap->size--;
+        hashmap_release_slot(hashmap, index);
     }
 }
 
 struct RingBuffer *hashmap_new(struct HashMap *hashmap, struct FiveTuple *key) {
-    struct RingBuffer *value = ringbuffer_init();
-    hashmap_insert(hashmap, *key, value);
+    struct RingBuffer *value = ringbuffer_init(hashmap->ring_size);
+    if (hashmap_insert(hashmap, *key, value)){
+        ringbuffer_destroy(value);
+        return (void *)0;
+    }
+    return value;
+}
+
+struct RingBuffer *hashmap_new_at(struct HashMap *hashmap, int slot, uint16_t generation, struct FiveTuple *key) {
+    if (slot < 0 || slot >= hashmap->capacity || hashmap->map[slot].valid){
+        return (void *)0;
+    }
+    struct RingBuffer *value = ringbuffer_init(hashmap->ring_size);
+    hashmap_fill_slot(hashmap, slot, value, *key);
+    hashmap->map[slot].generation = generation;
     return value;
 }
 
+int hashmap_eviction_candidate(struct HashMap *hashmap) {
+    if (hashmap->size == 0){
+        return -1;
+    }
+    int candidate = -1;
+    int sampled = 0;
+    int slot = hashmap->eviction_hand % hashmap->capacity;
+    for (int i = 0; i < hashmap->capacity && sampled < HASHMAP_EVICTION_SAMPLES; i++) {
+        if (hashmap->map[slot].valid && hashmap->cycle - hashmap->map[slot].admitted_cycle >= HASHMAP_EVICTION_GRACE_CYCLES) {
+            struct RingBuffer *value = hashmap->map[slot].value;
+            if (candidate < 0){
+                candidate = slot;
+            } else {
+                struct RingBuffer *best = hashmap->map[candidate].value;
+                uint64_t rate = ringbuffer_get_last(value);
+                uint64_t best_rate = ringbuffer_get_last(best);
+                if (rate < best_rate || (rate == best_rate && value->sample_ns < best->sample_ns)){
+                    candidate = slot;
+                }
+            }
+            sampled++;
+        }
+        slot = (slot + 1) % hashmap->capacity;
+    }
+    hashmap->eviction_hand = slot;
+    return candidate;
+}
+
+struct RingBuffer *hashmap_admit(struct HashMap *hashmap, struct FiveTuple *key, uint64_t rate, struct Eviction *eviction) {
+    eviction->evicted = 0;
+    if (hashmap->size >= hashmap->capacity){
+        int slot = hashmap_eviction_candidate(hashmap);
+        if (slot < 0){
+            return (void *)0;
+        }
+        struct RingBuffer *victim = hashmap->map[slot].value;
+        if ((double)rate <= ringbuffer_get_last(victim) * (1 + HASHMAP_EVICTION_MARGIN)){
+            return (void *)0;
+        }
+        eviction->evicted = 1;
+        eviction->key = hashmap->map[slot].key;
+        eviction->core = victim->assigned_core;
+        eviction->rate = ringbuffer_get_last(victim);
+        hashmap_release_slot(hashmap, slot);
+    }
+    return hashmap_new(hashmap, key);
+}
+
 uint8_t hashmap_get_next(struct HashMap *hashmap, struct FiveTuple *current_key, struct FiveTuple *next_key, struct RingBuffer **next_value) {
     int index = hashmap_contains(hashmap, current_key);
-    for (int i = index + 1; i < HASHMAP_SIZE; i++) {
+    for (int i = index + 1; i < hashmap->capacity; i++) {
         if (hashmap->map[i].valid) {
             *next_key = hashmap->map[i].key;
             *next_value = hashmap->map[i].value;
             return 1;
+        }
     }
     *next_key = (struct FiveTuple){0};
     *next_value = (void *)0;
     return 0;
-    }
 }
 
-void hashmap_cleanup_inactive_flows(struct HashMap *hashmap){
-    for (int i = 0; i < HASHMAP_SIZE; i++) {
-        if (hashmap->map[i].valid && !hashmap->map[i].value->is_active) {
-            hashmap->map[i].valid = 0;
-            ringbuffer_destroy(hashmap->map[i].value);
-            hashmap->size--;
+int hashmap_cleanup_inactive_flows(struct HashMap *hashmap){
+    int expired = 0;
+    hashmap->cycle++;
+    for (int i = 0; i < hashmap->capacity; i++) {
+        if (!hashmap->map[i].valid) {
+            continue;
+        }
+        if (!hashmap->map[i].value->is_active) {
+            hashmap_release_slot(hashmap, i);
+            expired++;
+        } else {
+            // Expires at the next cleanup unless sampled again
+            hashmap->map[i].value->is_active = 0;
         }
     }
+    return expired;
 }
\ No newline at end of file
@@ -17,6 +17,9 @@ struct FiveTuple {
 
 struct key_value_pair {
     uint8_t valid;
+    uint16_t generation; // Incremented each time the slot takes a new flow
+    uint32_t hash; // flowhash_crc32c of the key
+    uint64_t admitted_cycle; // Cycle of the hashmap the flow entered it
     struct FiveTuple key;
     struct RingBuffer *value;
 };
@@ -24,13 +27,40 @@ struct key_value_pair {
 struct HashMap {
     struct key_value_pair *map;
     int size;
+    int capacity; // The maximum number of entries
+    int ring_size; // The capacity of the ringbuffers of the entries
+    int eviction_hand; // First slot sampled by the next eviction
+    uint64_t cycle; // Calls to hashmap_cleanup_inactive_flows so far
+    // Open addressing on the hash of the keys, linear probing: slot + 1 of each flow, 0 if empty. A power of 2
+    // of entries, at least twice the capacity, so probes stay short and always end on an empty entry.
+    int32_t *index;
+    uint32_t index_mask;
+    // Stack of the free slots, the lowest one on top at first, and the position of each free slot in it
+    int32_t *free_slots;
+    int32_t *free_pos;
+    int nb_free;
 };
 
 /*
-Returns a pointer to a new hashmap.
+Flow evicted from a full hashmap by hashmap_admit, its load is still steered to its core.
+*/
+struct Eviction {
+    uint8_t evicted; // 1 if a flow was evicted
+    struct FiveTuple key;
+    uint8_t core; // Core the flow was assigned to
+    uint64_t rate; // Last packet rate of the flow
+};
+
+/*
+Returns 1 if both keys describe the same flow.
+*/
+uint8_t five_tuple_equals(struct FiveTuple *a, struct FiveTuple *b);
+
+/*
+Returns a pointer to a new hashmap of `capacity` entries, each with a ringbuffer of `ring_size` elements.
 This pointer will need to be freed with hashmap_destroy.
 */
-struct HashMap *hashmap_init();
+struct HashMap *hashmap_init(int capacity, int ring_size);
 
 /* Free the memory allocated to the hashmap and its ringbuffers 
     Parameters:
@@ -43,8 +73,10 @@ void hashmap_destroy(struct HashMap *hashmap);
         hashmap: The hashmap to insert into
         key: The key to insert
         value: The value-pointer to insert
+    Returns:
+        0 on success, -1 if the key is new and the hashmap is full
 */
-void hashmap_insert(struct HashMap *hashmap, struct FiveTuple key, struct RingBuffer *value);
+int hashmap_insert(struct HashMap *hashmap, struct FiveTuple key, struct RingBuffer *value);
 
 /*
     Returns the value-pointer associated with the given key, or NULL if the key is not in the hashmap.
@@ -63,7 +95,7 @@ struct RingBuffer *hashmap_get(struct HashMap *hashmap, struct FiveTuple *key);
 void hashmap_remove(struct HashMap *hashmap, struct FiveTuple *key);
 
 /*
-    Returns a pointer to a new ringbuffer.
+    Returns a pointer to a new ringbuffer, or NULL if the hashmap is full.
     This pointer will be freed either by `hashmap_destroy` or by `hashmap_remove`.
     Parameters:
         hashmap: The hashmap to insert into
@@ -71,6 +103,70 @@ void hashmap_remove(struct HashMap *hashmap, struct FiveTuple *key);
 */
 struct RingBuffer *hashmap_new(struct HashMap *hashmap, struct FiveTuple *key);
 
+/*
+    Returns a pointer to a new ringbuffer for a flow put back in a given slot with a given generation, e.g.
+    restored from a checkpoint, so that the cookies of its rules still lead to it. The key must not be in the
+    hashmap already. Returns NULL if the slot is taken or outside of the hashmap.
+    Parameters:
+        hashmap: The hashmap to insert into
+        slot: The slot of the flow
+        generation: The generation of the slot
+        key: The key to insert
+*/
+struct RingBuffer *hashmap_new_at(struct HashMap *hashmap, int slot, uint16_t generation, struct FiveTuple *key);
+
+/*
+    Returns the slot of the flow to evict first among the next HASHMAP_EVICTION_SAMPLES slots: the lowest
+    packet rate, then the oldest sample. Flows admitted less than HASHMAP_EVICTION_GRACE_CYCLES cycles ago are
+    skipped. Successive calls sample the table round-robin. Returns -1 if no flow can be evicted.
+    Parameters:
+        hashmap: The hashmap to search
+*/
+int hashmap_eviction_candidate(struct HashMap *hashmap);
+
+/*
+    Returns a pointer to a new ringbuffer for a flow entering the hashmap, like hashmap_new. When the hashmap
+    is full, the candidate of hashmap_eviction_candidate is evicted for the new flow if the new flow's rate is
+    above the candidate's by more than HASHMAP_EVICTION_MARGIN. Otherwise the new flow is left out and NULL is
+    returned.
+    Parameters:
+        hashmap: The hashmap to insert into
+        key: The key to insert
+        rate: Packets per second of the new flow, 0 if unknown
+        eviction: Filled with the evicted flow, if any
+*/
+struct RingBuffer *hashmap_admit(struct HashMap *hashmap, struct FiveTuple *key, uint64_t rate, struct Eviction *eviction);
+
+/*
+    Returns the slot holding the given key, or -1 if the key is not in the hashmap.
+    The slot and its generation identify the flow until it is removed, see hashmap_get_slot.
+    Parameters:
+        hashmap: The hashmap to search
+        key: The key to search for
+*/
+int hashmap_slot(struct HashMap *hashmap, struct FiveTuple *key);
+
+/*
+    Returns the value-pointer of the flow held by a slot, without searching the key, or NULL if the slot
+    is empty, holds another flow than the one it had at `generation`, or holds another key. Generations
+    start over with each run: a rule stamped by a previous run may name the slot and generation of a
+    different flow, the key tells them apart.
+    Parameters:
+        hashmap: The hashmap to search
+        slot: The slot returned by hashmap_slot
+        generation: The generation of the slot when hashmap_slot returned it, see hashmap_generation
+        key: The flow expected in the slot
+*/
+struct RingBuffer *hashmap_get_slot(struct HashMap *hashmap, int slot, uint16_t generation, struct FiveTuple *key);
+
+/*
+    Returns the generation of a slot, i.e. the number of flows it held (modulo 2^16).
+    Parameters:
+        hashmap: The hashmap
+        slot: The slot, between 0 and the capacity of the hashmap
+*/
+uint16_t hashmap_generation(struct HashMap *hashmap, int slot);
+
 /*
     For a given key, returns the following one in the hashmap. There is no guarantee on the order of the keys.
     By calling this function repeatedly, you can iterate over all the keys in the hashmap.
@@ -86,10 +182,11 @@ uint8_t hashmap_get_next(struct HashMap *hashmap, struct FiveTuple *current_key,
 
 
 /**
- * @brief Cleans the hashmap from expired entries
+ * @brief Cleans the hashmap from the entries that weren't sampled since the previous cleanup
  *
  * @param hashmap
+ * @return int : the number of expired entries
  */
-void hashmap_cleanup_inactive_flows(struct HashMap *hashmap);
+int hashmap_cleanup_inactive_flows(struct HashMap *hashmap);
 
 #endif
\ No newline at end of file
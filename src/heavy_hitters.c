@@ -0,0 +1,113 @@
+#include "heavy_hitters.h"
+
+int heavy_hitters_init(struct HeavyHitters *hh, struct XdpProgram *prog){
+    hh->sketch_fd = load_bpf_map_fd(prog, "sketch");
+    hh->topk_fd = load_bpf_map_fd(prog, "topk");
+    if (hh->sketch_fd < 0 || hh->topk_fd < 0){
+        return -1;
+    }
+    hh->nb_cpus = libbpf_num_possible_cpus();
+    if (hh->nb_cpus <= 0){
+        printf("Could not get the number of CPUs\n");
+        return -1;
+    }
+    hh->percpu_sketch = calloc(hh->nb_cpus, sizeof(struct CountMinSketch));
+    hh->percpu_topk = calloc(hh->nb_cpus, sizeof(struct TopK));
+    hh->empty_sketch = calloc(hh->nb_cpus, sizeof(struct CountMinSketch));
+    hh->empty_topk = calloc(hh->nb_cpus, sizeof(struct TopK));
+    hh->merged = calloc(CMS_DEPTH, sizeof(*hh->merged));
+    hh->elephants = calloc(hh->nb_cpus * TOPK_SIZE, sizeof(struct FiveTuple));
+    hh->estimates = calloc(hh->nb_cpus * TOPK_SIZE, sizeof(uint64_t));
+    hh->nb_elephants = 0;
+    hh->total_packets = 0;
+    return 0;
+}
+
+/**
+ * @brief Estimates the packets of a flow from the merged sketch
+ *
+ * @param xdp_key : the flow, as seen by xdp_rx
+ */
+uint64_t heavy_hitters_estimate(struct HeavyHitters *hh, struct FiveTuple *xdp_key){
+    uint64_t estimate = UINT64_MAX;
+    for (uint32_t row = 0; row < CMS_DEPTH; row++){
+        uint64_t count = hh->merged[row][cms_hash(xdp_key, row)];
+        if (count < estimate){
+            estimate = count;
+        }
+    }
+    return estimate;
+}
+
+int heavy_hitters_collect(struct HeavyHitters *hh){
+    uint32_t zero = 0;
+    if (bpf_map_lookup_elem(hh->sketch_fd, &zero, hh->percpu_sketch) ||
+        bpf_map_lookup_elem(hh->topk_fd, &zero, hh->percpu_topk)){
+        printf("Could not read heavy-hitter maps\n");
+        return -1;
+    }
+    // Start a new cycle, packets counted between the lookups and the reset are lost
+    bpf_map_update_elem(hh->sketch_fd, &zero, hh->empty_sketch, BPF_ANY);
+    bpf_map_update_elem(hh->topk_fd, &zero, hh->empty_topk, BPF_ANY);
+    // Merge the sketches, each CPU only counted its own packets
+    memset(hh->merged, 0, CMS_DEPTH * sizeof(*hh->merged));
+    for (int cpu = 0; cpu < hh->nb_cpus; cpu++){
+        for (int row = 0; row < CMS_DEPTH; row++){
+            uint32_t *counters = hh->percpu_sketch[cpu].counters[row];
+            uint64_t *merged = hh->merged[row];
+            for (int col = 0; col < CMS_WIDTH; col++){
+                merged[col] += counters[col];
+            }
+        }
+    }
+    hh->total_packets = 0;
+    for (int col = 0; col < CMS_WIDTH; col++){
+        hh->total_packets += hh->merged[0][col];
+    }
+    // A flow spread over several CPUs may be a candidate on each of them
+    uint64_t threshold = (uint64_t)(hh->total_packets * HEAVY_HITTER_MIN_SHARE);
+    hh->nb_elephants = 0;
+    for (int cpu = 0; cpu < hh->nb_cpus; cpu++){
+        for (int i = 0; i < TOPK_SIZE; i++){
+            struct HeavyHitter *candidate = &hh->percpu_topk[cpu].entries[i];
+            if (candidate->count == 0){
+                continue;
+            }
+            struct FiveTuple key = load_bpf_flow_key(&candidate->key);
+            if (heavy_hitters_is_elephant(hh, &key)){
+                continue;
+            }
+            uint64_t estimate = heavy_hitters_estimate(hh, &candidate->key);
+            if (estimate > 0 && estimate >= threshold){
+                hh->elephants[hh->nb_elephants] = key;
+                hh->estimates[hh->nb_elephants] = estimate;
+                hh->nb_elephants++;
+            }
+        }
+    }
+    return hh->nb_elephants;
+}
+
+uint8_t heavy_hitters_is_elephant(struct HeavyHitters *hh, struct FiveTuple *key){
+    for (int i = 0; i < hh->nb_elephants; i++){
+        if (five_tuple_same(&hh->elephants[i], key)){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+uint64_t heavy_hitters_flow_estimate(struct HeavyHitters *hh, struct FiveTuple *key){
+    struct FiveTuple xdp_key = load_bpf_xdp_key(key);
+    return heavy_hitters_estimate(hh, &xdp_key);
+}
+
+void heavy_hitters_destroy(struct HeavyHitters *hh){
+    free(hh->percpu_sketch);
+    free(hh->percpu_topk);
+    free(hh->empty_sketch);
+    free(hh->empty_topk);
+    free(hh->merged);
+    free(hh->elephants);
+    free(hh->estimates);
+}
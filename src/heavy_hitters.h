@@ -0,0 +1,74 @@
+/**
+ * @file heavy_hitters.h
+ * @brief Userspace side of the heavy-hitter detection done by xdp_rx
+ *
+ * xdp_rx counts every packet in a per-CPU Count-Min sketch and keeps a per-CPU top-K table of
+ * the largest flows. Every cycle, both are merged across CPUs and reset, which gives the set
+ * of elephants of the cycle. Only those need to be tracked exactly by the balancer.
+ *
+ */
+
+#ifndef HEAVY_HITTERS_H
+#define HEAVY_HITTERS_H
+
+#include "load_bpf.h"
+#include "hashmap.h"
+#include "bpf/sketch.h"
+
+struct HeavyHitters {
+    int sketch_fd;
+    int topk_fd;
+    int nb_cpus;
+    struct CountMinSketch *percpu_sketch; /** Read buffer, one sketch per CPU */
+    struct TopK *percpu_topk; /** Read buffer, one table per CPU */
+    struct CountMinSketch *empty_sketch; /** Zeroes written to reset the sketches, one per CPU */
+    struct TopK *empty_topk; /** Zeroes written to reset the tables, one per CPU */
+    uint64_t (*merged)[CMS_WIDTH]; /** Sketch summed over all CPUs, CMS_DEPTH rows */
+    uint64_t total_packets; /** Packets counted during the last cycle */
+    int nb_elephants;
+    struct FiveTuple *elephants; /** Flow table keys of the elephants of the last cycle */
+    uint64_t *estimates; /** Packets of each elephant during the last cycle */
+};
+
+/**
+ * @brief Retrieves the sketch maps of the loaded program and allocates the read buffers
+ *
+ * @param hh : the structure to fill
+ * @param prog : the loaded XDP program
+ * @return int : 0 on success, -1 otherwise
+ */
+int heavy_hitters_init(struct HeavyHitters *hh, struct XdpProgram *prog);
+
+/**
+ * @brief Merges the per-CPU sketches and candidates, computes the elephants of the cycle and resets the maps
+ *
+ * @param hh
+ * @return int : the number of elephants, -1 if the maps couldn't be read
+ */
+int heavy_hitters_collect(struct HeavyHitters *hh);
+
+/**
+ * @brief Returns 1 if the flow was an elephant during the last collected cycle
+ *
+ * @param hh
+ * @param key : the flow, as stored in the flow table
+ */
+uint8_t heavy_hitters_is_elephant(struct HeavyHitters *hh, struct FiveTuple *key);
+
+/**
+ * @brief Estimates the packets of a flow during the last collected cycle
+ *
+ * @param hh
+ * @param key : the flow, as stored in the flow table
+ * @return uint64_t : an upper bound of the packets of the flow
+ */
+uint64_t heavy_hitters_flow_estimate(struct HeavyHitters *hh, struct FiveTuple *key);
+
+/**
+ * @brief Frees the read buffers
+ *
+ * @param hh
+ */
+void heavy_hitters_destroy(struct HeavyHitters *hh);
+
+#endif
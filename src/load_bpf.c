@@ -0,0 +1,97 @@
+#include "load_bpf.h"
+
+/**
+ * @brief Attaches the program `prog_name` of the object on `ifindex`
+ *
+ * @return int : 0 on success, -1 otherwise
+ */
+int attach_program(struct XdpProgram *prog, const char *prog_name, int ifindex){
+    struct bpf_program *program = bpf_object__find_program_by_name(prog->obj, prog_name);
+    if (!program){
+        printf("Could not find program %s in %s\n", prog_name, XDP_OBJECT_PATH);
+        return -1;
+    }
+    if (bpf_xdp_attach(ifindex, bpf_program__fd(program), XDP_LOADING_MODE, NULL) < 0){
+        printf("Could not attach %s on interface %d\n", prog_name, ifindex);
+        return -1;
+    }
+    return 0;
+}
+
+int load_bpf_attach(struct XdpProgram *prog){
+    prog->rx_ifindex = if_nametoindex(XDP_RX_IFNAME);
+    prog->tx_ifindex = if_nametoindex(XDP_TX_IFNAME);
+    if (!prog->rx_ifindex || !prog->tx_ifindex){
+        printf("Could not find interfaces %s and %s\n", XDP_RX_IFNAME, XDP_TX_IFNAME);
+        return -1;
+    }
+    prog->obj = bpf_object__open_file(XDP_OBJECT_PATH, NULL);
+    if (libbpf_get_error(prog->obj)){
+        printf("Could not open BPF object %s\n", XDP_OBJECT_PATH);
+        prog->obj = NULL;
+        return -1;
+    }
+    if (bpf_object__load(prog->obj)){
+        printf("Could not load BPF object %s\n", XDP_OBJECT_PATH);
+        bpf_object__close(prog->obj);
+        prog->obj = NULL;
+        return -1;
+    }
+    // Each interface redirects to the opposite one
+    int redir_fd = load_bpf_map_fd(prog, "map_redir");
+    if (redir_fd < 0 ||
+        bpf_map_update_elem(redir_fd, &prog->rx_ifindex, &prog->tx_ifindex, BPF_ANY) ||
+        bpf_map_update_elem(redir_fd, &prog->tx_ifindex, &prog->rx_ifindex, BPF_ANY)){
+        printf("Could not fill the redirection map\n");
+        load_bpf_detach(prog);
+        return -1;
+    }
+    if (attach_program(prog, "xdp_rx", prog->rx_ifindex) ||
+        attach_program(prog, "xdp_tx", prog->tx_ifindex)){
+        load_bpf_detach(prog);
+        return -1;
+    }
+    printf("XDP programs attached on %s and %s\n", XDP_RX_IFNAME, XDP_TX_IFNAME);
+    return 0;
+}
+
+int load_bpf_map_fd(struct XdpProgram *prog, const char *map_name){
+    struct bpf_map *map = bpf_object__find_map_by_name(prog->obj, map_name);
+    if (!map){
+        printf("Could not find map %s in %s\n", map_name, XDP_OBJECT_PATH);
+        return -1;
+    }
+    return bpf_map__fd(map);
+}
+
+struct FiveTuple load_bpf_xdp_key(struct FiveTuple *key){
+    struct FiveTuple xdp_key;
+    // Padding bytes are part of the BPF hash keys
+    memset(&xdp_key, 0, sizeof(xdp_key));
+    xdp_key.src_ip = htonl(key->src_ip);
+    xdp_key.dst_ip = htonl(key->dst_ip);
+    xdp_key.src_port = key->src_port;
+    xdp_key.dst_port = key->dst_port;
+    xdp_key.proto = key->proto;
+    return xdp_key;
+}
+
+struct FiveTuple load_bpf_flow_key(struct FiveTuple *xdp_key){
+    struct FiveTuple key = {0};
+    key.src_ip = ntohl(xdp_key->src_ip);
+    key.dst_ip = ntohl(xdp_key->dst_ip);
+    key.src_port = xdp_key->src_port;
+    key.dst_port = xdp_key->dst_port;
+    key.proto = xdp_key->proto;
+    return key;
+}
+
+void load_bpf_detach(struct XdpProgram *prog){
+    if (prog->rx_ifindex)
+        bpf_xdp_detach(prog->rx_ifindex, XDP_LOADING_MODE, NULL);
+    if (prog->tx_ifindex)
+        bpf_xdp_detach(prog->tx_ifindex, XDP_LOADING_MODE, NULL);
+    if (prog->obj)
+        bpf_object__close(prog->obj);
+    prog->obj = NULL;
+}
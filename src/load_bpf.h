@@ -0,0 +1,70 @@
+/**
+ * @file load_bpf.h
+ * @brief Loading of the XDP programs and access to their maps
+ *
+ */
+
+#ifndef LOAD_BPF_H
+#define LOAD_BPF_H
+
+#include <bpf/libbpf.h>
+#include <bpf/bpf.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <stdio.h>
+#include "env.h"
+#include "hashmap.h"
+
+/**
+ * @brief The loaded XDP object and the interfaces its programs are attached to
+ *
+ */
+struct XdpProgram {
+    struct bpf_object *obj;
+    int rx_ifindex; /** Interface xdp_rx is attached to (network side) */
+    int tx_ifindex; /** Interface xdp_tx is attached to (host side) */
+};
+
+/**
+ * @brief Opens and loads `XDP_OBJECT_PATH`, attaches xdp_rx on `XDP_RX_IFNAME` and xdp_tx on `XDP_TX_IFNAME`
+ * and fills the redirection map so that each interface redirects to the other one.
+ *
+ * @param prog : the structure to fill
+ * @return int : 0 on success, -1 if an error occured (the program is then left detached)
+ */
+int load_bpf_attach(struct XdpProgram *prog);
+
+/**
+ * @brief Returns the file descriptor of a map of the loaded object
+ *
+ * @param prog : the loaded program
+ * @param map_name : name of the map in the BPF object
+ * @return int : the map file descriptor, -1 if the map does not exist
+ */
+int load_bpf_map_fd(struct XdpProgram *prog, const char *map_name);
+
+/**
+ * @brief The flow table stores addresses in host byte order (as parsed from OpenFlow) while
+ * the XDP programs build their keys straight from the IP header. Converts a flow table key to an XDP key.
+ *
+ * @param key : the flow table key
+ * @return struct FiveTuple : the key as seen by the XDP programs, padding included
+ */
+struct FiveTuple load_bpf_xdp_key(struct FiveTuple *key);
+
+/**
+ * @brief Converts a key read from an XDP map to a flow table key
+ *
+ * @param xdp_key : the key as seen by the XDP programs
+ * @return struct FiveTuple : the flow table key
+ */
+struct FiveTuple load_bpf_flow_key(struct FiveTuple *xdp_key);
+
+/**
+ * @brief Detaches the programs and frees the BPF object
+ *
+ * @param prog : the loaded program
+ */
+void load_bpf_detach(struct XdpProgram *prog);
+
+#endif
@@ -0,0 +1,244 @@
+#include "log.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_ENTRY_TEXT 0
+#define LOG_ENTRY_FLOW 1
+
+struct LogEntry {
+    uint64_t sequence; /** Ring position the entry can be written (== position) or read (== position + 1) at */
+    uint64_t time_ns;
+    uint8_t type;
+    uint8_t level;
+    const char *module;
+    union {
+        char message[LOG_MESSAGE_SIZE];
+        struct LogFlowRecord flow;
+    };
+};
+
+// Bounded multi-producer ring, each slot carries its own sequence number
+struct LogEntry log_ring[LOG_RING_SIZE];
+uint64_t log_head = 0;
+uint64_t log_tail = 0;
+uint64_t log_nb_dropped = 0;
+
+enum LogLevel log_level = LOG_LEVEL;
+
+pthread_t log_thread;
+volatile uint8_t log_running = 0;
+FILE *log_file = NULL;
+FILE *log_trace = NULL;
+
+static const char *log_level_names[] = {"error", "warn", "info", "debug"};
+
+uint64_t log_now_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * @brief Reserves a slot, NULL if the ring is full. The slot must be published with log_publish.
+ */
+struct LogEntry *log_reserve(){
+    uint64_t position = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+    while (1){
+        struct LogEntry *entry = &log_ring[position & (LOG_RING_SIZE - 1)];
+        int64_t diff = (int64_t)(__atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE) - position);
+        if (diff == 0){
+            if (__atomic_compare_exchange_n(&log_head, &position, position + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+                return entry;
+            }
+            // position was reloaded by the failed exchange
+        } else if (diff < 0){
+            // The writer didn't release this slot yet
+            __atomic_fetch_add(&log_nb_dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        } else {
+            position = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void log_publish(struct LogEntry *entry){
+    // The slot was reserved at position sequence
+    __atomic_store_n(&entry->sequence, entry->sequence + 1, __ATOMIC_RELEASE);
+}
+
+void log_print(FILE *out, uint64_t time_ns, uint8_t level, const char *module, const char *message){
+    fprintf(out, "ts=%lu.%06lu level=%s module=%s msg=\"%s\"\n", time_ns / 1000000000UL, (time_ns % 1000000000UL) / 1000,
+        log_level_names[level], module, message);
+}
+
+void log_write(enum LogLevel level, const char *module, const char *format, ...){
+    va_list args;
+    va_start(args, format);
+    if (!log_running){
+        char message[LOG_MESSAGE_SIZE];
+        vsnprintf(message, sizeof(message), format, args);
+        va_end(args);
+        log_print(stdout, log_now_ns(), level, module, message);
+        return;
+    }
+    struct LogEntry *entry = log_reserve();
+    if (entry){
+        entry->time_ns = log_now_ns();
+        entry->type = LOG_ENTRY_TEXT;
+        entry->level = level;
+        entry->module = module;
+        vsnprintf(entry->message, LOG_MESSAGE_SIZE, format, args);
+        log_publish(entry);
+    }
+    va_end(args);
+}
+
+uint8_t log_tracing(){
+    return log_running && log_trace;
+}
+
+void log_flow(uint32_t cycle, struct FiveTuple *key, uint8_t core, uint64_t load){
+    if (!log_tracing()){
+        return;
+    }
+    struct LogEntry *entry = log_reserve();
+    if (!entry){
+        return;
+    }
+    entry->type = LOG_ENTRY_FLOW;
+    entry->flow = (struct LogFlowRecord){
+        .time_ns = log_now_ns(),
+        .cycle = cycle,
+        .src_ip = key->src_ip,
+        .dst_ip = key->dst_ip,
+        .src_port = key->src_port,
+        .dst_port = key->dst_port,
+        .proto = key->proto,
+        .core = core,
+        .load = load,
+    };
+    log_publish(entry);
+}
+
+uint8_t log_ratelimit(struct LogRateLimit *limit, uint32_t per_second, const char *module){
+    uint64_t now = log_now_ns();
+    if (now - limit->window_start_ns >= 1000000000ULL){
+        if (limit->suppressed){
+            log_write(LOG_LEVEL_WARN, module, "%u messages suppressed by rate limiting", limit->suppressed);
+        }
+        limit->window_start_ns = now;
+        limit->count = 0;
+        limit->suppressed = 0;
+    }
+    if (limit->count < per_second){
+        limit->count++;
+        return 1;
+    }
+    limit->suppressed++;
+    return 0;
+}
+
+uint64_t log_dropped(){
+    return __atomic_load_n(&log_nb_dropped, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Writes the published entries, returns how many there were
+ */
+int log_drain(){
+    int drained = 0;
+    while (1){
+        struct LogEntry *entry = &log_ring[log_tail & (LOG_RING_SIZE - 1)];
+        if (__atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE) != log_tail + 1){
+            break;
+        }
+        if (entry->type == LOG_ENTRY_FLOW){
+            fwrite(&entry->flow, sizeof(entry->flow), 1, log_trace);
+        } else {
+            log_print(log_file, entry->time_ns, entry->level, entry->module, entry->message);
+        }
+        // Hand the slot back to the producers for the next lap
+        __atomic_store_n(&entry->sequence, log_tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+        log_tail++;
+        drained++;
+    }
+    return drained;
+}
+
+void *log_writer(void *arg){
+    (void)arg;
+    uint64_t reported_drops = 0;
+    while (__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)){
+        if (!log_drain()){
+            fflush(log_file);
+            if (log_trace){
+                fflush(log_trace);
+            }
+            usleep(LOG_FLUSH_INTERVAL_US);
+        }
+        uint64_t dropped = log_dropped();
+        if (dropped != reported_drops){
+            char message[LOG_MESSAGE_SIZE];
+            snprintf(message, sizeof(message), "%lu entries dropped, the ring is full", dropped - reported_drops);
+            log_print(log_file, log_now_ns(), LOG_LEVEL_WARN, "log", message);
+            reported_drops = dropped;
+        }
+    }
+    // Entries published before log_stop
+    log_drain();
+    fflush(log_file);
+    return NULL;
+}
+
+int log_start(const char *path, const char *trace_path){
+    for (uint64_t i = 0; i < LOG_RING_SIZE; i++){
+        log_ring[i].sequence = i;
+    }
+    log_head = 0;
+    log_tail = 0;
+    log_file = stdout;
+    if (path){
+        log_file = fopen(path, "a");
+        if (!log_file){
+            printf("Could not open the log file %s\n", path);
+            return -1;
+        }
+    }
+    if (trace_path){
+        log_trace = fopen(trace_path, "w");
+        if (!log_trace){
+            printf("Could not open the flow trace %s\n", trace_path);
+        } else {
+            struct LogTraceHeader header = {
+                .magic = LOG_TRACE_MAGIC,
+                .version = LOG_TRACE_VERSION,
+                .record_size = sizeof(struct LogFlowRecord),
+            };
+            fwrite(&header, sizeof(header), 1, log_trace);
+        }
+    }
+    __atomic_store_n(&log_running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&log_thread, NULL, log_writer, NULL)){
+        printf("Could not start the log writer\n");
+        log_running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void log_stop(){
+    if (!log_running){
+        return;
+    }
+    __atomic_store_n(&log_running, 0, __ATOMIC_RELEASE);
+    pthread_join(log_thread, NULL);
+    if (log_file != stdout){
+        fclose(log_file);
+    }
+    if (log_trace){
+        fclose(log_trace);
+        log_trace = NULL;
+    }
+}
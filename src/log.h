@@ -0,0 +1,137 @@
+/**
+ * @file log.h
+ * @brief Leveled asynchronous logger, off the control path
+ *
+ * Messages under the current level are skipped before being formatted. The others are formatted
+ * into a slot of a lock-free ring of `LOG_RING_SIZE` entries and written by a background thread, so
+ * the caller never waits for the output: when the ring is full, the message is dropped and counted.
+ * Text lines are structured (`ts=... level=... module=... msg="..."`).
+ *
+ * Per-flow assignments go to a binary trace (`LOG_TRACE_PATH`) instead of the text log: a
+ * `struct LogTraceHeader` followed by `struct LogFlowRecord`s, in host byte order.
+ *
+ * Before log_start (e.g. in the benchmarks), messages are printed synchronously to stdout and flow
+ * records are dropped.
+ *
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include "env.h"
+#include "hashmap.h"
+
+enum LogLevel {
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+};
+
+#define LOG_TRACE_MAGIC 0x31435254535352ULL // "RSSTRC1"
+#define LOG_TRACE_VERSION 1
+
+struct LogTraceHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t record_size;
+};
+
+struct LogFlowRecord {
+    uint64_t time_ns; /** CLOCK_MONOTONIC */
+    uint32_t cycle; /** Balancing cycle the assignment was decided at */
+    uint32_t src_ip;
+    uint32_t dst_ip;
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t proto;
+    uint8_t core;
+    uint16_t padding;
+    uint64_t load; /** Packets of the flow during the cycle */
+};
+
+struct LogRateLimit {
+    uint64_t window_start_ns;
+    uint32_t count;
+    uint32_t suppressed;
+};
+
+// Messages under this level are skipped, LOG_LEVEL by default
+extern enum LogLevel log_level;
+
+#define LOG(level, module, ...) do { \
+    if ((level) <= log_level) \
+        log_write((level), (module), __VA_ARGS__); \
+} while (0)
+
+#define log_error(module, ...) LOG(LOG_LEVEL_ERROR, module, __VA_ARGS__)
+#define log_warn(module, ...) LOG(LOG_LEVEL_WARN, module, __VA_ARGS__)
+#define log_info(module, ...) LOG(LOG_LEVEL_INFO, module, __VA_ARGS__)
+#define log_debug(module, ...) LOG(LOG_LEVEL_DEBUG, module, __VA_ARGS__)
+
+// Logs at most `per_second` messages per second from this call site
+#define LOG_RATELIMITED(level, module, per_second, ...) do { \
+    static struct LogRateLimit log_limit_; \
+    if ((level) <= log_level && log_ratelimit(&log_limit_, (per_second), (module))) \
+        log_write((level), (module), __VA_ARGS__); \
+} while (0)
+
+/**
+ * @brief Starts the writer thread
+ *
+ * @param path : text log file, NULL for stdout
+ * @param trace_path : binary trace of the flow assignments, NULL to disable it
+ * @return int : 0 on success, -1 otherwise
+ */
+int log_start(const char *path, const char *trace_path);
+
+/**
+ * @brief Writes the queued entries and stops the writer thread
+ *
+ */
+void log_stop();
+
+/**
+ * @brief Queues a message, use the LOG macros to skip it before formatting when under the level
+ *
+ * @param level
+ * @param module : name of the emitting module
+ * @param format : printf format, messages are truncated to LOG_MESSAGE_SIZE
+ */
+void log_write(enum LogLevel level, const char *module, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+/**
+ * @brief Queues the assignment of a flow to the binary trace
+ *
+ * @param cycle : the balancing cycle
+ * @param key : the flow
+ * @param core : the core the flow is assigned to
+ * @param load : packets of the flow during the cycle
+ */
+void log_flow(uint32_t cycle, struct FiveTuple *key, uint8_t core, uint64_t load);
+
+/**
+ * @brief Tells whether flow records are currently written
+ *
+ * @return uint8_t : 1 if log_flow records are kept
+ */
+uint8_t log_tracing();
+
+/**
+ * @brief Token check of LOG_RATELIMITED, reports the messages suppressed during the previous second
+ *
+ * @return uint8_t : 1 if the message can be logged
+ */
+uint8_t log_ratelimit(struct LogRateLimit *limit, uint32_t per_second, const char *module);
+
+/**
+ * @brief Number of entries dropped because the ring was full
+ *
+ * @return uint64_t
+ */
+uint64_t log_dropped();
+
+#endif
@@ -9,9 +9,83 @@
 #include "hashmap.h"
 #include "ringbuffer.h"
 #include "openflow.h"
+#include "metrics.h"
+#include "config.h"
+#include "feedback.h"
+#include "checkpoint.h"
+#include "assignments.h"
+
+// The XDP programs only need to be loaded by the features relying on their maps
+#define USE_XDP (STEERING_MODE == STEERING_XDP || HEAVY_HITTER_TRACKING || FLOW_DISCOVERY == FLOW_DISCOVERY_BPF)
+#if USE_XDP
+#ifndef ORSS_WITH_BPF
+#error "STEERING_XDP, HEAVY_HITTER_TRACKING and FLOW_DISCOVERY_BPF require building with -DORSS_WITH_BPF=ON"
+#endif
+#include "load_bpf.h"
+#include "xdp_steering.h"
+#include "heavy_hitters.h"
+#include "harvest.h"
+#endif
+// OVS is only needed to discover flows or to steer them
+#define USE_OPENFLOW (STEERING_MODE == STEERING_OPENFLOW || STEERING_MODE == STEERING_BUCKETS || FLOW_DISCOVERY == FLOW_DISCOVERY_OPENFLOW)
+// orss answers the PACKET_INs of the new flows, the group rule of bucket steering leaves none
+#define NATIVE_FLOW_SETUP (FLOW_SETUP == FLOW_SETUP_NATIVE && USE_OPENFLOW && STEERING_MODE != STEERING_BUCKETS)
+#if STEERING_MODE == STEERING_BUCKETS
+#include "bucket_steering.h"
+#endif
 
 uint8_t looping = 1;
 uint8_t interrupted = 0;
+volatile sig_atomic_t reload_requested = 0;
+struct Config config;
+struct Feedback feedback = {.fd = -1};
+struct Checkpoint checkpoint = {.fd = -1};
+struct AssignmentTable assignments = {.fd = -1};
+// Cores active after the previous balancing, reported to the host when they change
+uint8_t active_cores[MAX_CORES];
+// Set until the first flow stats after a restore, the VLAN of each rule gives the core of its flow
+uint8_t reconciling = 0;
+#if USE_XDP
+struct XdpProgram xdp_program = {0};
+#endif
+#if STEERING_MODE == STEERING_XDP
+struct XdpSteering xdp_steering;
+#endif
+#if STEERING_MODE == STEERING_BUCKETS
+struct BucketSteering bucket_steering;
+#endif
+#if HEAVY_HITTER_TRACKING
+struct HeavyHitters heavy_hitters;
+#endif
+#if FLOW_DISCOVERY == FLOW_DISCOVERY_BPF
+struct Harvester harvester;
+#endif
+
+struct DaemonMetrics {
+    struct Metric *cycles;
+    struct Metric *cycle_time;
+    struct Metric *stats_latency;
+    struct Metric *parse_time;
+    struct Metric *balance_time;
+    struct Metric *flow_mod_time;
+    struct Metric *core_load;
+    struct Metric *imbalance;
+    struct Metric *migrations;
+    struct Metric *migrations_per_cycle;
+    struct Metric *table_size;
+    struct Metric *expired_flows;
+    struct Metric *host_utilization;
+    struct Metric *feedback_reports;
+    struct Metric *placed_flows;
+    struct Metric *flow_setups;
+    struct Metric *key_lookups;
+    struct Metric *counter_resets;
+    struct Metric *evictions;
+    struct Metric *rejected_flows;
+    struct Metric *reconciled_flows;
+    struct Metric *core_active;
+    struct Metric *core_transitions;
+} daemon_metrics;
 
 
 void handle_interrupt(int sig) {
@@ -27,6 +101,11 @@ void handle_interrupt(int sig) {
     looping = 0;
 }
 
+void handle_hangup(int sig) {
+    // Reloaded between two cycles
+    reload_requested = 1;
+}
+
 // uint64_t get_flow_stats(uint32_t src_ip, uint32_t dst_ip, uint16_t src_port, uint16_t dst_port, uint8_t proto){
 //     char config_spec[100];
 //     sprintf(config_spec, "in_port=%d,ip,dl_type=0x0800,nw_proto=%u,nw_src=%d.%d.%d.%d,nw_dst=%d.%d.%d.%d,tp_src=%u,tp_dst=%u", 
@@ -162,60 +241,660 @@ void handle_interrupt(int sig) {
 //     return 0;
 // }
 
-void apply_migration(openflow_connection *ofp_connection, struct Migration *migration){
-    openflow_mod_vlan(ofp_connection, &migration->key, migration->destination_core);
+/*
+    Returns the cookie of the rule of a flow of the flow table, 0 if the flow is not in the table
+*/
+uint64_t flow_cookie(struct HashMap *map, struct FiveTuple *key){
+    int slot = hashmap_slot(map, key);
+    if (slot < 0){
+        return 0;
+    }
+    return openflow_flow_cookie(slot, hashmap_generation(map, slot));
+}
+
+void apply_migration(openflow_connection *ofp_connection, struct HashMap *map, struct Migration *migration){
+#if STEERING_MODE == STEERING_XDP
+    xdp_steering_assign(&xdp_steering, &migration->key, migration->destination_core);
+#else
+#if STEERING_MODE == STEERING_BUCKETS
+    int bucket = bucket_steering_bucket(&migration->key);
+    if (bucket >= 0){
+        bucket_steering_assign(&bucket_steering, bucket, migration->destination_core);
+        return;
+    }
+#endif
+    openflow_mod_vlan(ofp_connection, &migration->key, migration->destination_core, flow_cookie(map, &migration->key));
+#endif
+}
+
+void apply_migrations(openflow_connection *ofp_connection, struct HashMap *map, struct Migrations *migrations){
+    for (int i = 0; i < migrations->nb_migrations; i++){
+        apply_migration(ofp_connection, map, &migrations->migrations[i]);
+    }
+#if STEERING_MODE == STEERING_BUCKETS
+    // All the buckets moved by the cycle in one GROUP_MOD
+    bucket_steering_commit(&bucket_steering);
+#endif
+}
+
+/*
+    Steers a new flow to the core chosen by the placement policy. With OpenFlow steering, the FLOW_MOD is added
+    to the placements sent with the migrations of the cycle; past MAX_MIGRATIONS new flows, the others stay
+    on the core of the default VLAN until a balancing moves them.
+*/
+void place_flow(struct HashMap *map, struct FiveTuple *key, struct RingBuffer *ring_buffer, struct Migrations *placements){
+    // Each steering mode only uses one of them: the cookie of the flow, or the FLOW_MODs to send
+    (void)map;
+    (void)placements;
+#if STEERING_MODE == STEERING_OPENFLOW
+    if (placements->nb_migrations == MAX_MIGRATIONS){
+        return;
+    }
+#endif
+    ring_buffer->assigned_core = balancer_place(key, config.nb_cores);
+#if STEERING_MODE == STEERING_XDP
+    // Let xdp_rx steer the new flow to its initial core
+    xdp_steering_assign(&xdp_steering, key, ring_buffer->assigned_core);
+#elif STEERING_MODE == STEERING_BUCKETS
+    // The elephant leaves its bucket, it is balanced on its own from now on
+    bucket_steering_pin(&bucket_steering, key, ring_buffer->assigned_core, flow_cookie(map, key));
+#else
+    if (ring_buffer->assigned_core == 0){
+        // Already there
+        return;
+    }
+    placements->migrations[placements->nb_migrations].key = *key;
+    placements->migrations[placements->nb_migrations].destination_core = ring_buffer->assigned_core;
+    placements->nb_migrations++;
+#endif
+    metrics_add(daemon_metrics.placed_flows, 1);
+}
+
+/*
+    Adds a new flow to the flow table. A full table evicts the flow of lowest rate among a sample of its slots
+    for it, or leaves the new flow out unless its rate is higher by a margin. The evicted flow is still steered
+    to its core, its rate is added to the background load of the core when given. Returns NULL if the flow is
+    left out.
+*/
+struct RingBuffer *admit_flow(struct HashMap *map, struct FiveTuple *key, uint64_t rate, uint64_t *background_load){
+    struct Eviction eviction;
+    struct RingBuffer *ring_buffer = hashmap_admit(map, key, rate, &eviction);
+    if (eviction.evicted){
+        metrics_add(daemon_metrics.evictions, 1);
+        if (background_load){
+            background_load[eviction.core % config.nb_cores] += eviction.rate;
+        }
+    } else if (!ring_buffer){
+        metrics_add(daemon_metrics.rejected_flows, 1);
+    }
+    if (eviction.evicted || !ring_buffer){
+        LOG_RATELIMITED(LOG_LEVEL_WARN, "flows", 1, "Flow table full (%d flows), only the flows of highest rate are tracked",
+            map->capacity);
+    }
+    return ring_buffer;
+}
+
+/*
+    Picks the core of a flow set up from its PACKET_IN. The flow enters the flow table already placed, its
+    FLOW_MOD installs it on that core and it isn't placed again when it is discovered. When it is left out of
+    a full table, or when only the elephants are tracked, it is placed without entering the table and its rule
+    has no cookie.
+*/
+uint16_t setup_flow(struct FiveTuple *key, void *arg, uint64_t *cookie){
+    metrics_add(daemon_metrics.flow_setups, 1);
+#if HEAVY_HITTER_TRACKING
+    return balancer_place(key, config.nb_cores);
+#else
+    struct HashMap *map = arg;
+    struct RingBuffer *ring_buffer = hashmap_get(map, key);
+    if (!ring_buffer){
+        // The rate of a new connection is unknown, it only replaces flows without packets
+        ring_buffer = admit_flow(map, key, 0, NULL);
+        if (!ring_buffer){
+            return balancer_place(key, config.nb_cores);
+        }
+        ring_buffer->assigned_core = balancer_place(key, config.nb_cores);
+#if STEERING_MODE == STEERING_XDP
+        xdp_steering_assign(&xdp_steering, key, ring_buffer->assigned_core);
+#endif
+        if (ring_buffer->assigned_core != 0){
+            metrics_add(daemon_metrics.placed_flows, 1);
+        }
+    }
+    *cookie = flow_cookie(map, key);
+    return ring_buffer->assigned_core;
+#endif
+}
+
+/*
+    Accounts the rates of a flow from its counters, resets included
+*/
+void add_sample(struct RingBuffer *ring_buffer, struct FlowSample *sample){
+    if (ringbuffer_add_sample(ring_buffer, sample)){
+        metrics_add(daemon_metrics.counter_resets, 1);
+    }
+}
+
+/*
+    Takes the core of a flow from its rule on the switch after a restore: the checkpoint may predate the last
+    migrations, or the switch may have refused them
+*/
+void reconcile_flow(struct RingBuffer *ring_buffer, int current_core){
+    if (reconciling && current_core >= 0 && ring_buffer->assigned_core != current_core){
+        ring_buffer->assigned_core = current_core;
+        metrics_add(daemon_metrics.reconciled_flows, 1);
+    }
+}
+
+/*
+    Accounts the counters of a flow for this cycle, the flow is added to the flow table and placed if needed.
+    current_core is the core its rule steers it to, -1 if unknown: a new flow already steered to a core other
+    than the default one (by a previous run of the daemon) stays there. Returns 0 if the flow is not tracked (a
+    mouse when heavy-hitter tracking is enabled, or a flow left out of the full table).
+*/
+uint8_t track_flow(struct HashMap *map, struct FiveTuple *key, struct FlowSample *sample, uint64_t *background_load,
+    struct Migrations *placements, int current_core){
+    struct RingBuffer *ring_buffer = hashmap_get(map, key);
+#if HEAVY_HITTER_TRACKING
+    if (!ring_buffer && !heavy_hitters_is_elephant(&heavy_hitters, key)){
+        return 0;
+    }
+#elif STEERING_MODE == STEERING_BUCKETS
+    // The flows are accounted by their bucket, only the pinned ones are tracked
+    if (!ring_buffer){
+        return 0;
+    }
+#endif
+    if (!ring_buffer){
+        // If it does not exist, create it. Its average rate so far competes with the flows of a full table.
+        ring_buffer = admit_flow(map, key, sample->age_ns ? sample->packets * 1e9 / sample->age_ns : 0, background_load);
+        if (!ring_buffer){
+            return 0;
+        }
+        if (current_core > 0){
+            ring_buffer->assigned_core = current_core;
+        } else {
+            place_flow(map, key, ring_buffer, placements);
+        }
+    } else {
+        reconcile_flow(ring_buffer, current_core);
+    }
+#if FLOW_DISCOVERY == FLOW_DISCOVERY_BPF && HARVEST_DELETE_ON_READ
+    // The harvest returns the packets since the previous one, accumulated into a counter
+    sample->packets += ring_buffer->packets;
+#endif
+    add_sample(ring_buffer, sample);
+    return 1;
 }
 
-void get_migrations(openflow_flows *flows, struct HashMap *map, struct Migrations *migrations){
-    for (int i=0; i<flows->nb_flows;i++){
-        // Get FiveTuple key
+void discover_openflow_flows(openflow_flows *flows, uint64_t time_ns, struct HashMap *map, uint64_t *background_load,
+    struct Migrations *placements){
+    for (uint32_t i=0; i<flows->nb_flows;i++){
+#if STEERING_MODE == STEERING_BUCKETS
+        if (flows->flow_stats[i].priority == BUCKET_RULE_PRIORITY){
+            // The group rule, its counters are read per bucket
+            continue;
+        }
+#endif
+        // The rule duration measures the interval between two samples on the switch clock
+        struct FlowSample sample = {
+            .packets = openflow_ovsbe64_to_uint64(flows->flow_stats[i].packet_count),
+            .bytes = openflow_ovsbe64_to_uint64(flows->flow_stats[i].byte_count),
+            .time_ns = time_ns,
+            .age_ns = flows->flow_stats[i].duration_sec * 1000000000ULL + flows->flow_stats[i].duration_nsec,
+        };
+#if STEERING_MODE == STEERING_OPENFLOW || STEERING_MODE == STEERING_BUCKETS
+        int current_core = openflow_get_vlan(flows, i) % config.nb_cores;
+#else
+        // The rules don't steer the flows
+        int current_core = -1;
+#endif
         struct FiveTuple key = {0};
         key.src_ip = flows->flow_stats[i].match.nw_src;
         key.dst_ip = flows->flow_stats[i].match.nw_dst;
         key.src_port = flows->flow_stats[i].match.tp_src;
         key.dst_port = flows->flow_stats[i].match.tp_dst;
         key.proto = flows->flow_stats[i].match.nw_proto;
-        // Get RingBuffers
+        // The cookie of the rules installed by orss leads to the slot of their flow, the key is only compared
+        int slot;
+        uint16_t generation;
+        if (!openflow_cookie_slot(openflow_get_cookie(flows, i), &slot, &generation)){
+            struct RingBuffer *ring_buffer = hashmap_get_slot(map, slot, generation, &key);
+            if (ring_buffer){
+                reconcile_flow(ring_buffer, current_core);
+                add_sample(ring_buffer, &sample);
+                continue;
+            }
+        }
+        // Rule of another controller, of a previous run, or whose flow left the flow table since
+        metrics_add(daemon_metrics.key_lookups, 1);
+        if (!track_flow(map, &key, &sample, background_load, placements, current_core)){
+            // Untracked flows are accounted by their average rate on the core their VLAN leads to
+            uint32_t duration = flows->flow_stats[i].duration_sec ? flows->flow_stats[i].duration_sec : 1;
+            background_load[openflow_get_vlan(flows, i) % config.nb_cores] += sample.packets / duration;
+        }
+    }
+}
+
+#if FLOW_DISCOVERY == FLOW_DISCOVERY_BPF
+// Time of the previous harvest, the heavy-hitter estimates count the packets since then
+uint64_t last_harvest_ns = 0;
+
+void discover_bpf_flows(struct HashMap *map, uint64_t *background_load, struct Migrations *placements){
+    if (harvest_collect(&harvester) < 0){
+        return;
+    }
+    uint64_t time_ns = metrics_now_ns();
+#if HEAVY_HITTER_TRACKING && STEERING_MODE != STEERING_BUCKETS
+    uint64_t interval_ns = last_harvest_ns ? time_ns - last_harvest_ns : config.period_ms * 1000000ULL;
+#endif
+    last_harvest_ns = time_ns;
+    for (int i = 0; i < harvester.nb_flows; i++){
+        struct HarvestedFlow *flow = &harvester.flows[i];
+        if (flow->fin){
+            // The connection is over
+#if STEERING_MODE == STEERING_XDP
+            xdp_steering_remove(&xdp_steering, &flow->key);
+#endif
+            hashmap_remove(map, &flow->key);
+            continue;
+        }
+        // The XDP program doesn't count bytes nor knows when a connection started
+        struct FlowSample sample = {.packets = flow->packets, .time_ns = time_ns};
+        if (!track_flow(map, &flow->key, &sample, background_load, placements, -1)){
+#if HEAVY_HITTER_TRACKING && STEERING_MODE != STEERING_BUCKETS
+            // Untracked flows are not steered by xdp_rx, they stay on the default core
+            background_load[0] += heavy_hitters_flow_estimate(&heavy_hitters, &flow->key) * 1e9 / interval_ns;
+#endif
+        }
+    }
+}
+#endif
+
+#if STEERING_MODE == STEERING_BUCKETS
+/*
+    Accounts the packet counter of each bucket, the buckets are tracked in the flow table like flows
+*/
+void discover_buckets(struct HashMap *map, uint64_t *background_load){
+    if (bucket_steering_collect(&bucket_steering)){
+        return;
+    }
+    uint64_t time_ns = metrics_now_ns();
+    for (int bucket = 0; bucket < NB_BUCKETS; bucket++){
+        struct FiveTuple key = bucket_steering_key(bucket);
         struct RingBuffer *ring_buffer = hashmap_get(map, &key);
         if (!ring_buffer){
-            // If it does not exist, create it
-            ring_buffer = hashmap_new(map, &key);
+            // Buckets carry all the untracked flows, they always enter the table
+            ring_buffer = admit_flow(map, &key, UINT64_MAX, background_load);
+            if (!ring_buffer){
+                continue;
+            }
+        }
+        // The group installed at startup decides, a restored bucket may have been moved since its checkpoint
+        ring_buffer->assigned_core = bucket_steering.bucket_core[bucket];
+        // Bucket counters have no age, the first sample is a reference only
+        struct FlowSample sample = {.packets = bucket_steering.packets[bucket], .time_ns = time_ns};
+        add_sample(ring_buffer, &sample);
+    }
+}
+#endif
+
+void register_metrics(){
+    // Durations are recorded in ns and exported in seconds, from 1us to 17s
+    daemon_metrics.cycles = metrics_counter("orss_cycles_total", "Balancing cycles run");
+    daemon_metrics.cycle_time = metrics_histogram("orss_cycle_seconds",
+        "Busy time of a balancing cycle, the sleep excluded", 1e-9, 10, 34);
+    daemon_metrics.stats_latency = metrics_histogram("orss_stats_collection_seconds",
+        "Time to collect the flow counters, from the request to the last reply", 1e-9, 10, 34);
+    daemon_metrics.parse_time = metrics_histogram("orss_stats_parse_seconds",
+        "Time to parse the flow stats replies", 1e-9, 10, 34);
+    daemon_metrics.balance_time = metrics_histogram("orss_balance_seconds",
+        "Time to compute the migrations of a cycle", 1e-9, 10, 34);
+    daemon_metrics.flow_mod_time = metrics_histogram("orss_flow_mod_seconds",
+        "Time to send the FLOW_MODs (or steering map updates) of a cycle", 1e-9, 10, 34);
+    daemon_metrics.core_load = metrics_gauge("orss_core_load_packets",
+        "Load of the last cycle assigned to each core, migrations included, in packets per second corrected by the host feedback",
+        "core", config.nb_cores);
+    daemon_metrics.imbalance = metrics_gauge("orss_imbalance_ratio",
+        "Largest load of a core over its capacity share of the total load, after the last balancing", NULL, 1);
+    daemon_metrics.migrations = metrics_counter("orss_migrations_total", "Flows migrated to another core");
+    daemon_metrics.migrations_per_cycle = metrics_histogram("orss_migrations_per_cycle",
+        "Migrations decided by a balancing cycle", 1, 0, 4);
+    daemon_metrics.table_size = metrics_gauge("orss_flow_table_entries", "Flows in the flow table", NULL, 1);
+    daemon_metrics.expired_flows = metrics_counter("orss_flow_table_expired_total",
+        "Flows removed from the flow table after a cycle without packets");
+    daemon_metrics.host_utilization = metrics_gauge("orss_host_utilization_ratio",
+        "Utilization of each core reported by the host during the last cycle, queue backlog included", "core", config.nb_cores);
+    daemon_metrics.feedback_reports = metrics_counter("orss_feedback_reports_total", "Host feedback reports received");
+    daemon_metrics.placed_flows = metrics_counter("orss_placed_flows_total",
+        "New flows steered by the placement policy to a core other than the default one");
+    daemon_metrics.flow_setups = metrics_counter("orss_flow_setups_total",
+        "New flows installed from their PACKET_IN, on the core picked by the placement policy");
+    daemon_metrics.key_lookups = metrics_counter("orss_stats_key_lookups_total",
+        "Flow stats entries matched to the flow table by their 5-tuple, their rule having no valid orss cookie");
+    daemon_metrics.counter_resets = metrics_counter("orss_flow_counter_resets_total",
+        "Flow counters found lower or younger than at the previous cycle, the switch re-created the flow");
+    daemon_metrics.evictions = metrics_counter("orss_flow_table_evictions_total",
+        "Flows evicted from the full flow table for a new flow, their load counted as background load");
+    daemon_metrics.rejected_flows = metrics_counter("orss_flow_table_rejected_total",
+        "New flows left out of the full flow table, their rate not above the rate of the flows sampled for eviction by the eviction margin");
+    daemon_metrics.reconciled_flows = metrics_counter("orss_flows_reconciled_total",
+        "Flows restored from the checkpoint whose rule on the switch steers them to another core, the rule won");
+    daemon_metrics.core_active = metrics_gauge("orss_core_active",
+        "1 if the core receives flows, 0 if it is parked by consolidation or drained", "core", config.nb_cores);
+    daemon_metrics.core_transitions = metrics_counter("orss_core_transitions_total",
+        "Cores parked or brought back, by consolidation or by a change of their capacity");
+}
+
+/*
+    Passes the utilization reported by the host during the cycle to the balancer
+*/
+void collect_feedback(){
+    double utilization[MAX_CORES];
+    for (int core = 0; core < config.nb_cores; core++){
+        utilization[core] = -1;
+    }
+    if (feedback.fd >= 0){
+        metrics_add(daemon_metrics.feedback_reports, feedback_collect(&feedback));
+        if (feedback_get_utilization(&feedback, utilization)){
+            LOG_RATELIMITED(LOG_LEVEL_WARN, "feedback", 1, "No recent host feedback, balancing packet counts");
+        }
+    }
+    for (int core = 0; core < config.nb_cores; core++){
+        balancer_set_utilization(core, utilization[core]);
+        metrics_set(daemon_metrics.host_utilization, core, utilization[core] < 0 ? 0 : utilization[core]);
+    }
+}
+
+void record_load_metrics(struct HashMap *map){
+    uint64_t core_load[MAX_CORES];
+    balancer_get_core_load(core_load, config.nb_cores);
+    for (int core = 0; core < config.nb_cores; core++){
+        metrics_set(daemon_metrics.core_load, core, core_load[core]);
+    }
+    metrics_set(daemon_metrics.imbalance, 0, balancer_get_imbalance(config.nb_cores));
+    metrics_set(daemon_metrics.table_size, 0, map->size);
+}
+
+void apply_config(){
+    balancer_configure(config.imbalance_threshold, config.max_migrations, config.feedback_weight);
+    for (int core = 0; core < config.nb_cores; core++){
+        balancer_set_capacity(core, config.core_capacity[core]);
+    }
+    balancer_set_placement(config.placement);
+    balancer_set_consolidation(config.consolidation_ceiling);
+    log_level = config.log_level;
+}
+
+/*
+    Fills the flow table from the checkpoint of the previous run, if any. The flows keep their core: with XDP
+    steering, the steering map is filled again; with OpenFlow, the rules of the previous run are still on the
+    switch and the first flow stats reconcile the cores with them.
+*/
+void restore_flows(struct HashMap *map){
+    if (!strcmp(config.checkpoint, "off")){
+        return;
+    }
+    if (checkpoint_open(&checkpoint, config.checkpoint, config.table_size, config.ring_size)){
+        printf("The flow table won't be checkpointed\n");
+        return;
+    }
+    int restored = checkpoint_restore(&checkpoint, map, config.nb_cores);
+    if (restored < 0){
+        // First run, or a checkpoint interrupted by a crash
+        return;
+    }
+    printf("Restored %d flows from %s\n", restored, config.checkpoint);
+#if STEERING_MODE == STEERING_XDP
+    for (int slot = 0; slot < map->capacity; slot++){
+        if (map->map[slot].valid){
+            xdp_steering_assign(&xdp_steering, &map->map[slot].key, ((struct RingBuffer *)map->map[slot].value)->assigned_core);
+        }
+    }
+#endif
+    reconciling = FLOW_DISCOVERY == FLOW_DISCOVERY_OPENFLOW && restored > 0;
+}
+
+/*
+    Reports the cores parked or brought back by the last balancing: log, metrics and CONSOLIDATION_STATE_PATH,
+    which lists the active cores like a cpulist (e.g. "0-3,6") and is replaced at once for the host to watch
+*/
+void report_active_cores(uint8_t initial){
+    char list[4 * MAX_CORES + 2] = "";
+    int length = 0;
+    int changes = 0;
+    for (int core = 0; core < config.nb_cores; core++){
+        uint8_t active = balancer_core_active(core);
+        if (!initial && active != active_cores[core]){
+            log_info("cores", "Core %d %s", core, active ? "is active again" : "is parked");
+            changes++;
+        }
+        active_cores[core] = active;
+        metrics_set(daemon_metrics.core_active, core, active);
+        if (active && (core == 0 || !balancer_core_active(core - 1))){
+            int last = core;
+            while (last + 1 < config.nb_cores && balancer_core_active(last + 1)){
+                last++;
+            }
+            length += sprintf(list + length, length ? ",%d" : "%d", core);
+            if (last > core){
+                length += sprintf(list + length, "-%d", last);
+            }
         }
-        ringbuffer_add(ring_buffer, openflow_ovsbe64_to_uint64(flows->flow_stats[i].packet_count));
+    }
+    if (!initial && !changes){
+        return;
+    }
+    metrics_add(daemon_metrics.core_transitions, changes);
+    char tmp_path[sizeof(CONSOLIDATION_STATE_PATH) + 4];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", CONSOLIDATION_STATE_PATH);
+    FILE *state = fopen(tmp_path, "w");
+    if (!state){
+        log_warn("cores", "Could not write the active cores to %s", CONSOLIDATION_STATE_PATH);
+        return;
+    }
+    fprintf(state, "%s\n", list);
+    fclose(state);
+    rename(tmp_path, CONSOLIDATION_STATE_PATH);
+}
+
+/*
+    Publishes the core of each flow, the migrations of the cycle and the target loads for the host, before the
+    FLOW_MODs of the migrations are sent
+*/
+void publish_assignments(struct HashMap *map){
+    uint64_t core_load[MAX_CORES];
+    balancer_get_core_load(core_load, config.nb_cores);
+    assignments_publish(&assignments, map, core_load, active_cores, metrics_now_ns());
+}
+
+void get_migrations(struct HashMap *map, uint64_t *background_load, struct Migrations *migrations){
+    for (int core = 0; core < config.nb_cores; core++){
+        balancer_set_background_load(core, background_load[core]);
     }
     // Balance flows
-    balancer_balance(map, NB_CORES, migrations);
+    balancer_balance(map, config.nb_cores, migrations);
+    report_active_cores(0);
 }
 
-int main(int argc, char const *argv[])
+int main(int argc, char *argv[])
 {
+    if (config_init(&config, argc, argv)){
+        exit(1);
+    }
+    config_print(&config);
+    apply_config();
     signal(SIGINT, handle_interrupt);
+    signal(SIGHUP, handle_hangup);
     uint32_t loops = 0;
-    struct HashMap *map = hashmap_init();
+    struct HashMap *map = hashmap_init(config.table_size, config.ring_size);
+    log_start(LOG_PATH, LOG_TRACE_PATH);
+    register_metrics();
+#if METRICS_EXPORT
+    // The daemon still balances if the metrics can't be served
+    metrics_serve(METRICS_SOCKET_PATH);
+#endif
+    if (strcmp(config.feedback, "off")){
+        // Without feedback, packet counts are balanced
+        feedback_init(&feedback, config.feedback, config.nb_cores);
+    }
+#if USE_XDP
+    if (load_bpf_attach(&xdp_program)){
+        exit(1);
+    }
+#endif
+#if STEERING_MODE == STEERING_XDP
+    // XDP programs will apply the balancer decisions
+    if (xdp_steering_init(&xdp_steering, &xdp_program, config.nb_cores)){
+        printf("Could not setup XDP steering\n");
+        exit(1);
+    }
+#endif
+#if HEAVY_HITTER_TRACKING
+    if (heavy_hitters_init(&heavy_hitters, &xdp_program)){
+        printf("Could not setup heavy-hitter detection\n");
+        exit(1);
+    }
+#endif
+#if FLOW_DISCOVERY == FLOW_DISCOVERY_BPF
+    if (harvest_init(&harvester, &xdp_program)){
+        printf("Could not setup connection harvesting\n");
+        exit(1);
+    }
+#endif
     // Create OpenFlow connection
-    openflow_connection ofp_connection;
-    openflow_create_connection(&ofp_connection);
+    openflow_connection ofp_connection = {0};
+#if USE_OPENFLOW
+    openflow_create_connection(&ofp_connection, config.of_port);
+#if STEERING_MODE == STEERING_OPENFLOW || STEERING_MODE == STEERING_BUCKETS
+    if (config.core_rate_limit && openflow_add_core_meters(&ofp_connection, config.nb_cores, config.core_rate_limit)){
+        printf("Cores are not metered\n");
+    }
+#endif
+#if STEERING_MODE == STEERING_BUCKETS
+    if (bucket_steering_init(&bucket_steering, &ofp_connection, config.nb_cores)){
+        printf("Could not setup bucket steering\n");
+        exit(1);
+    }
+#endif
+#if NATIVE_FLOW_SETUP
+    if (openflow_enable_flow_setup(&ofp_connection, setup_flow, map, FLOW_SETUP_BATCH)){
+        exit(1);
+    }
+#endif
+#endif
+    restore_flows(map);
+    report_active_cores(1);
+    if (strcmp(config.assignments, "off") &&
+        assignments_open(&assignments, config.assignments, config.table_size, config.nb_cores)){
+        printf("The assignments won't be published\n");
+    }
     while (looping) {
+        if (reload_requested){
+            // Thresholds and period only, the flow table is kept
+            reload_requested = 0;
+            if (!config_reload(&config)){
+                config_print(&config);
+                apply_config();
+            }
+        }
+        uint64_t cycle_start = metrics_now_ns();
+        uint64_t start;
+        uint64_t background_load[MAX_CORES] = {0};
+        // FLOW_MODs of the new flows, sent with the migrations
+        struct Migrations placements = {0};
+#if HEAVY_HITTER_TRACKING
+        heavy_hitters_collect(&heavy_hitters);
+#endif
+#if FLOW_DISCOVERY == FLOW_DISCOVERY_BPF
+        start = metrics_now_ns();
+        discover_bpf_flows(map, background_load, &placements);
+        metrics_observe(daemon_metrics.stats_latency, metrics_now_ns() - start);
+#endif
+#if USE_OPENFLOW
         openflow_control(&ofp_connection);
+#endif
+#if FLOW_DISCOVERY == FLOW_DISCOVERY_OPENFLOW
         // Query flows
         openflow_flows flows = {0};
+        start = metrics_now_ns();
         openflow_get_flows(&ofp_connection, &flows);
+        uint64_t stats_ns = metrics_now_ns();
+        metrics_observe(daemon_metrics.stats_latency, stats_ns - start - flows.parse_ns);
+        metrics_observe(daemon_metrics.parse_time, flows.parse_ns);
+        discover_openflow_flows(&flows, stats_ns, map, background_load, &placements);
+        if (flows.nb_flows){
+            reconciling = 0;
+        }
+        // Free flows
+        openflow_free_flows(&flows);
+#endif
+#if STEERING_MODE == STEERING_BUCKETS
+        discover_buckets(map, background_load);
+#endif
+        collect_feedback();
         // Get migrations
-        openflow_get_flows(&ofp_connection, &flows);
         struct Migrations migrations = {0};
-        get_migrations(&flows, map, &migrations);
+        start = metrics_now_ns();
+        get_migrations(map, background_load, &migrations);
+        metrics_observe(daemon_metrics.balance_time, metrics_now_ns() - start);
+        if (assignments.data){
+            publish_assignments(map);
+        }
         // Apply migrations
-        for (int i = 0; i < migrations.nb_migrations; i++){
-            apply_migration(&ofp_connection, &migrations.migrations[i]);
+        start = metrics_now_ns();
+#if STEERING_MODE == STEERING_OPENFLOW || STEERING_MODE == STEERING_BUCKETS
+        // All the placements and migrations of the cycle or none
+        openflow_bundle_begin(&ofp_connection);
+#endif
+        // Placements first, a migration of a new flow must win
+        apply_migrations(&ofp_connection, map, &placements);
+        apply_migrations(&ofp_connection, map, &migrations);
+#if STEERING_MODE == STEERING_OPENFLOW || STEERING_MODE == STEERING_BUCKETS
+        if (openflow_bundle_commit(&ofp_connection)){
+            // The flow table already assigns the flows to their new core, apply them one by one instead
+            log_warn("openflow", "Migration bundle rejected, sending the %d placements and %d migrations one by one",
+                placements.nb_migrations, migrations.nb_migrations);
+            apply_migrations(&ofp_connection, map, &placements);
+            apply_migrations(&ofp_connection, map, &migrations);
         }
-        // Free flows
-        openflow_free_flows(&flows);
+#endif
+        metrics_observe(daemon_metrics.flow_mod_time, metrics_now_ns() - start);
+        metrics_add(daemon_metrics.migrations, migrations.nb_migrations);
+        metrics_observe(daemon_metrics.migrations_per_cycle, migrations.nb_migrations);
+        record_load_metrics(map);
         // Cleanup connections that haven't been filled
-        hashmap_cleanup_inactive_flows(map);
-        sleep(1);
+        metrics_add(daemon_metrics.expired_flows, hashmap_cleanup_inactive_flows(map));
+        if (checkpoint.data){
+            checkpoint_write(&checkpoint, map);
+        }
+        metrics_add(daemon_metrics.cycles, 1);
+        metrics_observe(daemon_metrics.cycle_time, metrics_now_ns() - cycle_start);
+#if NATIVE_FLOW_SETUP
+        // Set the new flows up as their PACKET_IN arrive until the next cycle
+        openflow_serve(&ofp_connection, config.period_ms);
+#else
+        usleep(config.period_ms * 1000);
+#endif
     }
+    metrics_stop();
+    feedback_close(&feedback);
+#if USE_OPENFLOW
     // closing the listening socket
     openflow_terminate_connection(&ofp_connection);
+#endif
+#if FLOW_DISCOVERY == FLOW_DISCOVERY_BPF
+    harvest_destroy(&harvester);
+#endif
+#if HEAVY_HITTER_TRACKING
+    heavy_hitters_destroy(&heavy_hitters);
+#endif
+#if USE_XDP
+    load_bpf_detach(&xdp_program);
+#endif
+    checkpoint_close(&checkpoint);
+    assignments_close(&assignments);
     hashmap_destroy(map);
+    log_stop();
     return 0;
 }
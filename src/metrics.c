@@ -0,0 +1,248 @@
+#include "metrics.h"
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define METRICS_MAX 64
+
+struct Metric registry[METRICS_MAX];
+int nb_metrics = 0;
+
+// Exporter
+pthread_t exporter_thread;
+int exporter_fd = -1;
+volatile uint8_t exporter_running = 0;
+struct sockaddr_un exporter_addr;
+
+struct Metric *metrics_register(enum MetricType type, const char *name, const char *help, const char *label, int nb_series){
+    if (nb_metrics == METRICS_MAX){
+        printf("Metrics registry is full, %s is not exported\n", name);
+        return NULL;
+    }
+    struct Metric *metric = &registry[nb_metrics++];
+    memset(metric, 0, sizeof(*metric));
+    metric->type = type;
+    metric->name = name;
+    metric->help = help;
+    metric->label = label;
+    metric->nb_series = nb_series;
+    metric->values = calloc(nb_series, sizeof(uint64_t));
+    return metric;
+}
+
+struct Metric *metrics_counter(const char *name, const char *help){
+    return metrics_register(METRIC_COUNTER, name, help, NULL, 1);
+}
+
+struct Metric *metrics_gauge(const char *name, const char *help, const char *label, int nb_series){
+    return metrics_register(METRIC_GAUGE, name, help, label, nb_series);
+}
+
+struct Metric *metrics_histogram(const char *name, const char *help, double unit, int min_exp, int max_exp){
+    struct Metric *metric = metrics_register(METRIC_HISTOGRAM, name, help, NULL, 1);
+    if (metric){
+        metric->histogram = calloc(1, sizeof(struct MetricHistogram));
+        metric->unit = unit;
+        metric->min_exp = min_exp;
+        metric->max_exp = max_exp;
+    }
+    return metric;
+}
+
+/**
+ * @brief Index of the bucket holding `value`: values below 2^SUB_BITS have their own bucket,
+ * larger ones share a bucket with the values having the same exponent and top SUB_BITS bits
+ */
+int metrics_bucket(uint64_t value){
+    if (value < (1 << METRICS_HISTOGRAM_SUB_BITS)){
+        return value;
+    }
+    int exp = 63 - __builtin_clzll(value);
+    int sub = (value >> (exp - METRICS_HISTOGRAM_SUB_BITS)) & ((1 << METRICS_HISTOGRAM_SUB_BITS) - 1);
+    return ((exp - METRICS_HISTOGRAM_SUB_BITS + 1) << METRICS_HISTOGRAM_SUB_BITS) + sub;
+}
+
+/**
+ * @brief Largest value recorded in a bucket
+ */
+uint64_t metrics_bucket_upper(int bucket){
+    if (bucket < (1 << METRICS_HISTOGRAM_SUB_BITS)){
+        return bucket;
+    }
+    int exp = (bucket >> METRICS_HISTOGRAM_SUB_BITS) + METRICS_HISTOGRAM_SUB_BITS - 1;
+    uint64_t sub = bucket & ((1 << METRICS_HISTOGRAM_SUB_BITS) - 1);
+    uint64_t lower = ((1ULL << METRICS_HISTOGRAM_SUB_BITS) | sub) << (exp - METRICS_HISTOGRAM_SUB_BITS);
+    return lower + (1ULL << (exp - METRICS_HISTOGRAM_SUB_BITS)) - 1;
+}
+
+void metrics_observe(struct Metric *metric, uint64_t value){
+    struct MetricHistogram *histogram = metric->histogram;
+    __atomic_fetch_add(&histogram->buckets[metrics_bucket(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+}
+
+uint64_t metrics_quantile(struct Metric *metric, double quantile){
+    struct MetricHistogram *histogram = metric->histogram;
+    uint64_t count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+    uint64_t rank = (uint64_t)(quantile * count);
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < METRICS_HISTOGRAM_BUCKETS; bucket++){
+        seen += __atomic_load_n(&histogram->buckets[bucket], __ATOMIC_RELAXED);
+        if (seen > rank){
+            return metrics_bucket_upper(bucket);
+        }
+    }
+    return 0;
+}
+
+void metrics_write_histogram(FILE *out, struct Metric *metric){
+    struct MetricHistogram *histogram = metric->histogram;
+    // Exported buckets are cumulative, at powers of two of the recorded unit. Internal buckets start at
+    // powers of two: a value equal to a bound is only counted under it if its bucket is a single value.
+    uint64_t cumulative = 0;
+    int bucket = 0;
+    for (int exp = metric->min_exp; exp <= metric->max_exp; exp++){
+        uint64_t bound = 1ULL << exp;
+        while (bucket < METRICS_HISTOGRAM_BUCKETS && metrics_bucket_upper(bucket) <= bound){
+            cumulative += __atomic_load_n(&histogram->buckets[bucket], __ATOMIC_RELAXED);
+            bucket++;
+        }
+        fprintf(out, "%s_bucket{le=\"%g\"} %lu\n", metric->name, bound * metric->unit, cumulative);
+    }
+    uint64_t count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %lu\n", metric->name, count);
+    fprintf(out, "%s_sum %g\n", metric->name, __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED) * metric->unit);
+    fprintf(out, "%s_count %lu\n", metric->name, count);
+}
+
+void metrics_write(FILE *out){
+    static const char *types[] = {"counter", "gauge", "histogram"};
+    for (int i = 0; i < nb_metrics; i++){
+        struct Metric *metric = &registry[i];
+        fprintf(out, "# HELP %s %s\n", metric->name, metric->help);
+        fprintf(out, "# TYPE %s %s\n", metric->name, types[metric->type]);
+        switch (metric->type){
+        case METRIC_COUNTER:
+            fprintf(out, "%s %lu\n", metric->name, __atomic_load_n(&metric->values[0], __ATOMIC_RELAXED));
+            break;
+        case METRIC_GAUGE:
+            for (int series = 0; series < metric->nb_series; series++){
+                uint64_t bits = __atomic_load_n(&metric->values[series], __ATOMIC_RELAXED);
+                double value;
+                memcpy(&value, &bits, sizeof(value));
+                if (metric->label){
+                    fprintf(out, "%s{%s=\"%d\"} %g\n", metric->name, metric->label, series, value);
+                } else {
+                    fprintf(out, "%s %g\n", metric->name, value);
+                }
+            }
+            break;
+        case METRIC_HISTOGRAM:
+            metrics_write_histogram(out, metric);
+            break;
+        }
+    }
+}
+
+uint64_t metrics_now_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * @brief Answers a scraper, with HTTP headers if it sent an HTTP request
+ */
+void metrics_answer(int client_fd){
+    char request[1024];
+    ssize_t request_len = 0;
+    struct pollfd pfd = {.fd = client_fd, .events = POLLIN};
+    // Raw clients don't send anything, don't wait for them for long
+    if (poll(&pfd, 1, 100) > 0){
+        request_len = read(client_fd, request, sizeof(request) - 1);
+    }
+    char *body;
+    size_t body_len;
+    FILE *out = open_memstream(&body, &body_len);
+    metrics_write(out);
+    fclose(out);
+    if (request_len >= 4 && !strncmp(request, "GET ", 4)){
+        char header[128];
+        int header_len = snprintf(header, sizeof(header),
+            "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", body_len);
+        // MSG_NOSIGNAL: a scraper closing early must not raise SIGPIPE, which would kill the daemon
+        if (send(client_fd, header, header_len, MSG_NOSIGNAL) < 0){
+            free(body);
+            return;
+        }
+    }
+    size_t written = 0;
+    while (written < body_len){
+        ssize_t valwrite = send(client_fd, body + written, body_len - written, MSG_NOSIGNAL);
+        if (valwrite <= 0){
+            break;
+        }
+        written += valwrite;
+    }
+    free(body);
+}
+
+void *metrics_exporter(void *arg){
+    (void)arg;
+    struct pollfd pfd = {.fd = exporter_fd, .events = POLLIN};
+    while (exporter_running){
+        // Wake up regularly to notice metrics_stop
+        if (poll(&pfd, 1, 200) <= 0){
+            continue;
+        }
+        int client_fd = accept(exporter_fd, NULL, NULL);
+        if (client_fd < 0){
+            continue;
+        }
+        metrics_answer(client_fd);
+        close(client_fd);
+    }
+    return NULL;
+}
+
+int metrics_serve(const char *path){
+    exporter_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (exporter_fd < 0){
+        printf("Could not create the metrics socket\n");
+        return -1;
+    }
+    memset(&exporter_addr, 0, sizeof(exporter_addr));
+    exporter_addr.sun_family = AF_UNIX;
+    strncpy(exporter_addr.sun_path, path, sizeof(exporter_addr.sun_path) - 1);
+    unlink(path);
+    if (bind(exporter_fd, (struct sockaddr *)&exporter_addr, sizeof(exporter_addr)) < 0 || listen(exporter_fd, 4) < 0){
+        printf("Could not listen on %s\n", path);
+        close(exporter_fd);
+        exporter_fd = -1;
+        return -1;
+    }
+    exporter_running = 1;
+    if (pthread_create(&exporter_thread, NULL, metrics_exporter, NULL)){
+        printf("Could not start the metrics exporter\n");
+        exporter_running = 0;
+        close(exporter_fd);
+        exporter_fd = -1;
+        return -1;
+    }
+    printf("Metrics exported on %s\n", path);
+    return 0;
+}
+
+void metrics_stop(){
+    if (!exporter_running){
+        return;
+    }
+    exporter_running = 0;
+    pthread_join(exporter_thread, NULL);
+    close(exporter_fd);
+    unlink(exporter_addr.sun_path);
+    exporter_fd = -1;
+}
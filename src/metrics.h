@@ -0,0 +1,147 @@
+/**
+ * @file metrics.h
+ * @brief In-process metrics registry exported in the Prometheus text format
+ *
+ * Counters, gauges and histograms are registered once at startup, then updated from the control
+ * loop with relaxed atomic operations: no lock and no allocation on the update path. Histograms
+ * are HDR-like: each power of two is split in `1 << METRICS_HISTOGRAM_SUB_BITS` linear buckets, so
+ * any value is recorded with a bounded relative error.
+ *
+ * A background thread serves the registry on the Unix socket `METRICS_SOCKET_PATH`, either as a
+ * plain HTTP response (`curl --unix-socket METRICS_SOCKET_PATH http://localhost/metrics`) or as
+ * raw text when the client sends nothing (`socat - UNIX-CONNECT:METRICS_SOCKET_PATH`).
+ *
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "env.h"
+
+#define METRICS_HISTOGRAM_SUB_BITS 3
+#define METRICS_HISTOGRAM_BUCKETS ((64 - METRICS_HISTOGRAM_SUB_BITS + 1) << METRICS_HISTOGRAM_SUB_BITS)
+
+enum MetricType {
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM,
+};
+
+struct MetricHistogram {
+    uint64_t buckets[METRICS_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+};
+
+struct Metric {
+    enum MetricType type;
+    const char *name;
+    const char *help;
+    const char *label; /** Name of the label telling the series apart, NULL if there is a single series */
+    int nb_series;
+    uint64_t *values; /** Counter values, or gauge values stored as double bits, one per series */
+    struct MetricHistogram *histogram;
+    double unit; /** Histograms: exported value of a recorded unit, e.g. 1e-9 for ns exported in seconds */
+    int min_exp; /** Histograms: exported buckets are the powers of two from 2^min_exp to 2^max_exp units */
+    int max_exp;
+};
+
+/**
+ * @brief Registers a monotonic counter
+ *
+ * @param name : Prometheus name of the metric, ending with `_total`
+ * @param help : one-line description
+ * @return struct Metric* : the counter, NULL if the registry is full
+ */
+struct Metric *metrics_counter(const char *name, const char *help);
+
+/**
+ * @brief Registers a gauge, possibly made of several series (e.g. one per core)
+ *
+ * @param name : Prometheus name of the metric
+ * @param help : one-line description
+ * @param label : name of the label telling the series apart, NULL for a single series
+ * @param nb_series : number of series, the label value of a series is its index
+ * @return struct Metric* : the gauge, NULL if the registry is full
+ */
+struct Metric *metrics_gauge(const char *name, const char *help, const char *label, int nb_series);
+
+/**
+ * @brief Registers a histogram
+ *
+ * @param name : Prometheus name of the metric
+ * @param help : one-line description
+ * @param unit : exported value of a recorded unit
+ * @param min_exp : the first exported bucket is `le=2^min_exp` units
+ * @param max_exp : the last exported bucket before `+Inf` is `le=2^max_exp` units
+ * @return struct Metric* : the histogram, NULL if the registry is full
+ */
+struct Metric *metrics_histogram(const char *name, const char *help, double unit, int min_exp, int max_exp);
+
+/**
+ * @brief Adds to a counter
+ */
+static inline void metrics_add(struct Metric *metric, uint64_t value){
+    __atomic_fetch_add(&metric->values[0], value, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Sets a series of a gauge
+ */
+static inline void metrics_set(struct Metric *metric, int series, double value){
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    __atomic_store_n(&metric->values[series], bits, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Records a value in a histogram
+ *
+ * @param metric : the histogram
+ * @param value : in recorded units
+ */
+void metrics_observe(struct Metric *metric, uint64_t value);
+
+/**
+ * @brief Estimates a quantile of a histogram from its buckets
+ *
+ * @param metric : the histogram
+ * @param quantile : between 0 and 1
+ * @return uint64_t : the upper bound of the bucket holding the quantile, in recorded units
+ */
+uint64_t metrics_quantile(struct Metric *metric, double quantile);
+
+/**
+ * @brief Writes every registered metric in the Prometheus text format
+ *
+ * @param out : the stream to write to
+ */
+void metrics_write(FILE *out);
+
+/**
+ * @brief Monotonic time, for the durations recorded in histograms
+ *
+ * @return uint64_t : time in nanoseconds
+ */
+uint64_t metrics_now_ns();
+
+/**
+ * @brief Starts serving the registry on a Unix socket from a background thread
+ *
+ * @param path : path of the socket, replaced if it exists
+ * @return int : 0 on success, -1 otherwise
+ */
+int metrics_serve(const char *path);
+
+/**
+ * @brief Stops the exporter thread and removes its socket
+ *
+ */
+void metrics_stop();
+
+#endif
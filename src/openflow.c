@@ -1,15 +1,54 @@
-#include "openflow.h"
+#include "openflow13.h"
+
+// The migrations of a bundle are applied in order, all or none
+#define OPENFLOW_BUNDLE_FLAGS (OFPBF_ATOMIC | OFPBF_ORDERED)
 
 uint32_t transaction_id = 0;
 
+void control_logic(openflow_connection *connection, openflow_message *message);
+void flush_openflow_setups(openflow_connection *connection);
+
+/**
+ * @brief Tells whether oRSS speaks an OpenFlow version
+ */
+uint8_t openflow_supported_version(uint8_t version){
+    return version == OFP_VERSION || version == OFP13_VERSION || version == OFP14_VERSION;
+}
+
+const char *openflow_version_name(uint8_t version){
+    switch (version){
+    case OFP13_VERSION:
+        return "1.3";
+    case OFP14_VERSION:
+        return "1.4";
+    default:
+        return "1.0";
+    }
+}
+
+uint8_t openflow_version(openflow_connection *conn){
+    return conn->version ? conn->version : OFP_VERSION;
+}
+
+/**
+ * @brief Writes a whole message to the switch
+ */
+void send_openflow_buffer(openflow_socket_fd socket_fd, uint8_t *buf, uint16_t len, const char *name){
+    int valwrite = write(socket_fd, buf, len);
+    if (valwrite < 0) {
+        printf("Error writing %s message to socket: %s\n", name, strerror(errno));
+    }
+}
+
 /**
  * @brief Waits for a connection to be established, then returns the socket file descriptor
  * and the address of the client.
  * 
  * @param conn : the connection to initialize
+ * @param port : the TCP port to listen on
  * @return void : Information about the connection are stored in the conn structure, and the program exits if an error occurs
  */
-void get_socket(openflow_connection *conn) {
+void get_socket(openflow_connection *conn, uint16_t port) {
     int valread;
     int opt = 1;
     int addrlen = sizeof(conn->addr);
@@ -30,7 +69,7 @@ void get_socket(openflow_connection *conn) {
     }
     conn->addr.sin_family = AF_INET;
     conn->addr.sin_addr.s_addr = INADDR_ANY;
-    conn->addr.sin_port = htons( OF_PORT );
+    conn->addr.sin_port = htons( port );
 
     // Attach socket to port
     if (bind(conn->server_fd, (struct sockaddr*)&conn->addr,
@@ -51,6 +90,8 @@ void get_socket(openflow_connection *conn) {
         printf("Error accepting connection: %s\n", strerror(conn->fd));
         exit(EXIT_FAILURE);
     }
+    // FLOW_MODs are small writes, don't let Nagle hold the next request until they are acked
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
     printf("Client connected!\n");
 }
 
@@ -99,7 +140,7 @@ int read_openflow_message(openflow_socket_fd socket_fd,struct openflow_message *
         // Prints message header
         // printf("Message header: version=%u, type=%u, length=%u, xid=%u\n", message->header.version, message->header.type, message->header.length, message->header.xid);
         // Check that openflow version is correct
-        if (message->header.version != OFP_VERSION && message->header.type != OFP_HELLO) {
+        if (!openflow_supported_version(message->header.version) && message->header.type != OFP_HELLO) {
             printf("That's weird, OpenFlow version is: %u\n", message->header.version);
         }
         // Read message body if there is one
@@ -114,22 +155,77 @@ int read_openflow_message(openflow_socket_fd socket_fd,struct openflow_message *
 }
 
 /**
- * @brief Sends a message to the connection
+ * @brief Gives the versions oRSS offers, as a HELLO version bitmap
+ */
+uint32_t openflow_version_bitmap(){
+    uint32_t bitmap = 0;
+    for (uint8_t version = OFP_VERSION; version <= OPENFLOW_MAX_VERSION; version++){
+        if (openflow_supported_version(version)){
+            bitmap |= 1U << version;
+        }
+    }
+    return bitmap;
+}
+
+/**
+ * @brief Sends a HELLO offering the versions up to OPENFLOW_MAX_VERSION, OpenFlow 1.0 switches ignore the bitmap
  * 
  * @param socket_fd : the socket file descriptor
- * @param message : the message structure to send
- * @return int : -1 if an error occured, 0 if nothing was sent, 1 if a message was sent
  */
 void send_openflow_hello(openflow_socket_fd socket_fd){
-    struct openflow_header header;
-    header.version = OFP_VERSION;
-    header.type = OFP_HELLO;
-    header.length = htons(OFP_HEADER_LEN);
-    header.xid = htonl(transaction_id++);
-    int valwrite = write(socket_fd, &header, OFP_HEADER_LEN);
-    if (valwrite < 0) {
-        printf("Error writing HELLO message to socket: %s\n", strerror(valwrite));
+    uint8_t hello[OFP_HEADER_LEN + 8];
+    openflow_header *header = (openflow_header *)hello;
+    header->version = OPENFLOW_MAX_VERSION;
+    header->type = OFP_HELLO;
+    header->length = htons(sizeof(hello));
+    header->xid = htonl(transaction_id++);
+    // A single version bitmap element
+    uint16_t element[2] = {htons(OFPHET_VERSIONBITMAP), htons(8)};
+    uint32_t bitmap = htonl(openflow_version_bitmap());
+    memcpy(hello + OFP_HEADER_LEN, element, sizeof(element));
+    memcpy(hello + OFP_HEADER_LEN + sizeof(element), &bitmap, sizeof(bitmap));
+    send_openflow_buffer(socket_fd, hello, sizeof(hello), "HELLO");
+}
+
+/**
+ * @brief Picks the version of the connection from the HELLO of the switch: the highest version in
+ * both bitmaps, or the lowest of both HELLO versions when the switch sends no bitmap
+ * 
+ * @param hello : the HELLO of the switch
+ * @return uint8_t : the negotiated version
+ */
+uint8_t openflow_negotiate_version(openflow_message *hello){
+    uint32_t common = 0;
+    if (hello->header.length > OFP_HEADER_LEN){
+        uint8_t *element = hello->data;
+        uint8_t *end = element + hello->header.length - OFP_HEADER_LEN;
+        while (element + 4 <= end){
+            uint16_t type = ntohs(*(uint16_t *)element);
+            uint16_t len = ntohs(*(uint16_t *)(element + 2));
+            if (len < 4 || element + len > end){
+                break;
+            }
+            if (type == OFPHET_VERSIONBITMAP && len >= 8){
+                uint32_t bitmap;
+                memcpy(&bitmap, element + 4, sizeof(bitmap));
+                common = ntohl(bitmap) & openflow_version_bitmap();
+            }
+            // Elements are padded to 8 bytes
+            element += (len + 7) & ~7;
+        }
+    }
+    if (common){
+        uint8_t version = 31;
+        while (!(common & (1U << version))){
+            version--;
+        }
+        return version;
     }
+    uint8_t version = hello->header.version < OPENFLOW_MAX_VERSION ? hello->header.version : OPENFLOW_MAX_VERSION;
+    while (version > OFP_VERSION && !openflow_supported_version(version)){
+        version--;
+    }
+    return version < OFP_VERSION ? OFP_VERSION : version;
 }
 
 /**
@@ -138,9 +234,9 @@ void send_openflow_hello(openflow_socket_fd socket_fd){
  * @param socket_fd : the socket file descriptor
  * @param message : the message structure to send
  */
-uint32_t send_openflow_features_request(openflow_socket_fd socket_fd){
+uint32_t send_openflow_features_request(openflow_socket_fd socket_fd, uint8_t version){
     struct openflow_header header;
-    header.version = OFP_VERSION;
+    header.version = version;
     header.type = OFP_FEATURES_REQUEST;
     header.length = htons(OFP_HEADER_LEN);
     header.xid = htonl(transaction_id);
@@ -156,10 +252,11 @@ uint32_t send_openflow_features_request(openflow_socket_fd socket_fd){
  * @brief Sends a echo_reply message to the switch
  * 
  * @param socket_fd : the socket file descriptor
+ * @param version : the negotiated version
  */
-void send_openflow_echo_reply(openflow_socket_fd socket_fd){
+void send_openflow_echo_reply(openflow_socket_fd socket_fd, uint8_t version){
     struct openflow_header header;
-    header.version = OFP_VERSION;
+    header.version = version;
     header.type = OFP_ECHO_REPLY;
     header.length = htons(OFP_HEADER_LEN);
     header.xid = 0;
@@ -183,19 +280,30 @@ void free_openflow_message_body(struct openflow_message *message){
  * @param type : the type of message to wait for
  * @param msg : the message structure to fill
  * @param xid : the transaction ID to wait for (0 to ignore)
+ * @return int : 0 once the message is received, -1 if the switch answered the transaction with an ERROR
  */
-void openflow_wait_for_message(openflow_connection *conn, uint8_t type, openflow_message *msg, uint32_t xid) {
-    uint8_t msg_received = 0;
-    while (!msg_received) {
+int openflow_wait_for_message(openflow_connection *conn, uint8_t type, openflow_message *msg, uint32_t xid) {
+    while (1) {
         if (read_openflow_message(conn->fd, msg) > 0) {
             if (msg->header.type == type && (xid == 0 || msg->header.xid == xid)) {
-                msg_received = 1;
-            } else {
-                // We received a message that is not the one we are waiting for
-                // Let's buffer it for the openflow_control function
-                printf("Was waiting for type %u with xid %u, got type %u with xid %u\n", type, xid, msg->header.type, msg->header.xid);
+                return 0;
+            }
+            if (msg->header.type == OFP_ERROR && xid != 0 && msg->header.xid == xid) {
+                control_logic(conn, msg);
+                free_openflow_message_body(msg);
+                return -1;
+            }
+            // We received a message that is not the one we are waiting for
+            // Let's buffer it for the openflow_control function
+            printf("Was waiting for type %u with xid %u, got type %u with xid %u\n", type, xid, msg->header.type, msg->header.xid);
+            if (conn->nb_msg_buffered < sizeof(conn->msg_buffer) / sizeof(conn->msg_buffer[0])) {
                 conn->msg_buffer[conn->nb_msg_buffered] = *msg;
                 conn->nb_msg_buffered++;
+            } else {
+                // The buffer is full (e.g. errors of a rejected bundle, a burst of PACKET_INs), handle it now
+                control_logic(conn, msg);
+                free_openflow_message_body(msg);
+                flush_openflow_setups(conn);
             }
         }
     }
@@ -287,8 +395,8 @@ openflow_match hton_openflow_match(openflow_match *match){
  */
 void ntoh_openflow_flow_stats(openflow_flow_stats *flow_stats){
     flow_stats->length = ntohs(flow_stats->length);
-    flow_stats->duration_sec = ntohs(flow_stats->duration_sec);
-    flow_stats->duration_nsec = ntohs(flow_stats->duration_nsec);
+    flow_stats->duration_sec = ntohl(flow_stats->duration_sec);
+    flow_stats->duration_nsec = ntohl(flow_stats->duration_nsec);
     flow_stats->priority = ntohs(flow_stats->priority);
     flow_stats->idle_timeout = ntohs(flow_stats->idle_timeout);
     flow_stats->hard_timeout = ntohs(flow_stats->hard_timeout);
@@ -324,37 +432,236 @@ void ntoh_openflow_action_vlan_vid(openflow_action_vlan_vid *action_vlan_vid){
     action_vlan_vid->len = ntohs(action_vlan_vid->len);
 }
 
-void openflow_create_connection(openflow_connection *connection){
-    get_socket(connection);
+void openflow_create_connection(openflow_connection *connection, uint16_t port){
+    get_socket(connection, port);
     transaction_id = rand();
     openflow_message message;
     openflow_wait_for_message(connection, OFP_HELLO, &message,0);
+    connection->version = openflow_negotiate_version(&message);
+    free_openflow_message_body(&message);
     send_openflow_hello(connection->fd);
-    uint32_t features_xid = send_openflow_features_request(connection->fd);
+    // OpenFlow 1.3 FEATURES_REPLY have the same layout without ports
+    uint32_t features_xid = send_openflow_features_request(connection->fd, connection->version);
     openflow_wait_for_message(connection, OFP_FEATURES_REPLY, &message, features_xid);
     parse_features_reply(&message, connection);
     free_openflow_message_body(&message);
-    printf("Connected to switch %lx\n", connection->features.datapath_id);
+    printf("Connected to switch %lx with OpenFlow %s\n", connection->features.datapath_id, openflow_version_name(connection->version));
 }
 
-void openflow_mod_vlan(openflow_connection *connection,struct FiveTuple *fiveTuple, uint16_t new_VLAN){
-    openflow_flow_mod_message flow_mod = {0};
+/**
+ * @brief Sends an OpenFlow 1.3 message, added to the bundle of the cycle if one was begun
+ *
+ * @param xid : transaction ID of the message, shared with its BUNDLE_ADD
+ */
+void send_openflow13_message(openflow_connection *connection, uint8_t *msg, uint16_t len, uint32_t xid, const char *name){
+    if (!connection->batching){
+        send_openflow_buffer(connection->fd, msg, len, name);
+        return;
+    }
+    uint8_t message[OPENFLOW13_MAX_MESSAGE_LEN];
+    if (!connection->bundle_open){
+        // Opened with the first migration, its reply is read on commit
+        connection->bundle_id++;
+        connection->bundle_open_xid = transaction_id++;
+        uint16_t open_len = openflow13_bundle_ctrl_message(message, connection->version, connection->bundle_open_xid,
+            connection->bundle_id, OFPBCT_OPEN_REQUEST, OPENFLOW_BUNDLE_FLAGS);
+        send_openflow_buffer(connection->fd, message, open_len, "BUNDLE_OPEN");
+        connection->bundle_open = 1;
+    }
+    // GROUP_MODs don't fit in the stack buffer
+    uint8_t *bundle_add = message;
+    if (len > OPENFLOW13_MAX_MESSAGE_LEN - 32){
+        bundle_add = malloc(len + 32);
+        if (bundle_add == NULL){
+            printf("Could not allocate the BUNDLE_ADD of a %s\n", name);
+            return;
+        }
+    }
+    // The bundled message and the BUNDLE_ADD share their xid
+    len = openflow13_bundle_add_message(bundle_add, connection->version, xid, connection->bundle_id, OPENFLOW_BUNDLE_FLAGS, msg, len);
+    send_openflow_buffer(connection->fd, bundle_add, len, "BUNDLE_ADD");
+    if (bundle_add != message){
+        free(bundle_add);
+    }
+}
+
+/**
+ * @brief Sends the FLOW_MOD of openflow_mod_vlan in OpenFlow 1.3 and later
+ */
+void send_openflow13_flow_mod(openflow_connection *connection, struct FiveTuple *fiveTuple, uint16_t new_VLAN, uint64_t cookie){
+    uint8_t flow_mod[OPENFLOW13_MAX_MESSAGE_LEN];
+    uint32_t meter_id = connection->meter_rate && new_VLAN < connection->nb_meters ? new_VLAN + 1 : 0;
+    uint32_t xid = transaction_id++;
+    uint16_t len = openflow13_flow_mod_vlan_message(flow_mod, connection->version, xid, OFPFC_MODIFY, 0, 0,
+        OVS_NETWORK_IFINDEX, fiveTuple, new_VLAN, OVS_HOST_IFINDEX, meter_id, cookie);
+    send_openflow13_message(connection, flow_mod, len, xid, "FLOW_MOD");
+}
+
+void openflow_bundle_begin(openflow_connection *connection){
+    connection->batching = OPENFLOW_BUNDLES && openflow_version(connection) >= OFP13_VERSION;
+    connection->bundle_open = 0;
+}
+
+int openflow_bundle_commit(openflow_connection *connection){
+    if (!connection->batching){
+        return 0;
+    }
+    connection->batching = 0;
+    if (!connection->bundle_open){
+        // Nothing was migrated
+        return 0;
+    }
+    connection->bundle_open = 0;
+    uint8_t reply_type = connection->version >= OFP14_VERSION ? OFPT14_BUNDLE_CONTROL : OFPT13_EXPERIMENTER;
+    openflow_message reply;
+    if (openflow_wait_for_message(connection, reply_type, &reply, connection->bundle_open_xid)){
+        printf("Bundle %u could not be opened\n", connection->bundle_id);
+        return -1;
+    }
+    free_openflow_message_body(&reply);
+    uint8_t message[OPENFLOW13_MAX_MESSAGE_LEN];
+    uint32_t commit_xid = transaction_id++;
+    uint16_t len = openflow13_bundle_ctrl_message(message, connection->version, commit_xid, connection->bundle_id,
+        OFPBCT_COMMIT_REQUEST, OPENFLOW_BUNDLE_FLAGS);
+    send_openflow_buffer(connection->fd, message, len, "BUNDLE_COMMIT");
+    if (openflow_wait_for_message(connection, reply_type, &reply, commit_xid)){
+        printf("Bundle %u was rejected, none of its FLOW_MODs were applied\n", connection->bundle_id);
+        return -1;
+    }
+    openflow13_bundle_ctrl *ctrl = openflow13_get_bundle_ctrl(&reply);
+    int status = ctrl && ntohs(ctrl->type) == OFPBCT_COMMIT_REPLY ? 0 : -1;
+    free_openflow_message_body(&reply);
+    return status;
+}
+
+int openflow_add_core_meters(openflow_connection *connection, uint16_t nb_cores, uint32_t rate_pps){
+    if (openflow_version(connection) < OFP13_VERSION){
+        printf("Meters need OpenFlow 1.3, the switch negotiated OpenFlow %s\n", openflow_version_name(openflow_version(connection)));
+        return -1;
+    }
+    uint8_t meter_mod[OPENFLOW13_MAX_MESSAGE_LEN];
+    for (uint16_t core = 0; core < nb_cores; core++){
+        uint16_t len = openflow13_meter_mod_message(meter_mod, connection->version, transaction_id++, OFPMC_ADD, core + 1, rate_pps);
+        send_openflow_buffer(connection->fd, meter_mod, len, "METER_MOD");
+    }
+    connection->meter_rate = rate_pps;
+    connection->nb_meters = nb_cores;
+    return 0;
+}
+
+int openflow_mod_group(openflow_connection *connection, uint16_t command, uint32_t group_id, uint16_t *vlans, int nb_buckets){
+    if (openflow_version(connection) < OFP13_VERSION){
+        printf("Groups need OpenFlow 1.3, the switch negotiated OpenFlow %s\n", openflow_version_name(openflow_version(connection)));
+        return -1;
+    }
+    if (nb_buckets > OPENFLOW13_MAX_BUCKETS){
+        printf("A group holds at most %d buckets\n", OPENFLOW13_MAX_BUCKETS);
+        return -1;
+    }
+    uint8_t *group_mod = malloc(OPENFLOW13_GROUP_MOD_LEN(nb_buckets));
+    if (group_mod == NULL){
+        printf("Could not allocate a GROUP_MOD of %d buckets\n", nb_buckets);
+        return -1;
+    }
+    uint32_t xid = transaction_id++;
+    uint16_t len = openflow13_group_mod_message(group_mod, connection->version, xid, command, group_id, vlans, nb_buckets, OVS_HOST_IFINDEX);
+    send_openflow13_message(connection, group_mod, len, xid, "GROUP_MOD");
+    free(group_mod);
+    return 0;
+}
+
+int openflow_add_group_rule(openflow_connection *connection, uint32_t group_id, uint16_t priority){
+    if (openflow_version(connection) < OFP13_VERSION){
+        return -1;
+    }
+    uint8_t flow_mod[OPENFLOW13_MAX_MESSAGE_LEN];
+    uint32_t xid = transaction_id++;
+    uint16_t len = openflow13_flow_mod_group_message(flow_mod, connection->version, xid, OVS_NETWORK_IFINDEX, priority, group_id);
+    send_openflow13_message(connection, flow_mod, len, xid, "FLOW_MOD");
+    return 0;
+}
+
+int openflow_pin_flow(openflow_connection *connection, struct FiveTuple *fiveTuple, uint16_t vlan, uint64_t cookie){
+    if (openflow_version(connection) < OFP13_VERSION){
+        return -1;
+    }
+    uint8_t flow_mod[OPENFLOW13_MAX_MESSAGE_LEN];
+    uint32_t meter_id = connection->meter_rate && vlan < connection->nb_meters ? vlan + 1 : 0;
+    uint32_t xid = transaction_id++;
+    // Expires with the flow, the group takes it back if it comes again
+    uint16_t len = openflow13_flow_mod_vlan_message(flow_mod, connection->version, xid, OFPFC_ADD, PINNED_FLOW_PRIORITY, CONN_TIMEOUT,
+        OVS_NETWORK_IFINDEX, fiveTuple, vlan, OVS_HOST_IFINDEX, meter_id, cookie);
+    send_openflow13_message(connection, flow_mod, len, xid, "FLOW_MOD");
+    return 0;
+}
+
+int openflow_get_group_buckets(openflow_connection *connection, uint32_t group_id, uint64_t *packets, int max_buckets){
+    if (openflow_version(connection) < OFP13_VERSION){
+        return -1;
+    }
+    uint8_t request[OPENFLOW13_MAX_MESSAGE_LEN];
+    uint32_t xid = transaction_id++;
+    uint16_t len = openflow13_group_stats_request_message(request, connection->version, xid, group_id);
+    send_openflow_buffer(connection->fd, request, len, "MULTIPART_REQUEST");
+    int nb_buckets = -1;
+    uint8_t reply_fully_received = 0;
+    while (!reply_fully_received){
+        openflow_message message;
+        if (openflow_wait_for_message(connection, OFPT13_MULTIPART_REPLY, &message, xid)){
+            return -1;
+        }
+        if (message.header.length < OFP_HEADER_LEN + sizeof(openflow13_multipart_header)){
+            free_openflow_message_body(&message);
+            return -1;
+        }
+        openflow13_multipart_header *reply_header = (openflow13_multipart_header *)message.data;
+        if ((ntohs(reply_header->flags) & OFPMPF_REPLY_MORE) == 0){
+            reply_fully_received = 1;
+        }
+        uint8_t *response_end = (uint8_t *)message.data + message.header.length - OFP_HEADER_LEN;
+        uint8_t *response_head = (uint8_t *)message.data + sizeof(openflow13_multipart_header);
+        while (ntohs(reply_header->type) == OFPMP_GROUP && response_head < response_end){
+            uint32_t reply_group_id;
+            int entry_nb_buckets;
+            int entry_len = openflow13_parse_group_stats(response_head, response_end, &reply_group_id, packets, max_buckets, &entry_nb_buckets);
+            if (entry_len < 0){
+                printf("Malformed group stats entry, ignoring the rest of the reply\n");
+                break;
+            }
+            if (reply_group_id == group_id){
+                nb_buckets = entry_nb_buckets;
+            }
+            response_head += entry_len;
+        }
+        free_openflow_message_body(&message);
+    }
+    return nb_buckets;
+}
+
+/**
+ * @brief Fills an OpenFlow 1.0 FLOW_MOD tagging a flow with a VLAN and sending it to the host
+ */
+void fill_openflow_flow_mod(openflow_flow_mod_message *flow_mod, uint16_t command, uint16_t priority, uint16_t idle_timeout,
+    uint16_t in_port, uint32_t buffer_id, struct FiveTuple *fiveTuple, uint16_t new_VLAN, uint64_t cookie){
+    memset(flow_mod, 0, sizeof(*flow_mod));
     // Setup header
-    flow_mod.header.version = OFP_VERSION;
-    flow_mod.header.type = OFP_FLOW_MOD;
-    flow_mod.header.xid = ntohl(transaction_id++);
-    flow_mod.header.length = htons(sizeof(openflow_flow_mod_message));
-    // Setup body
-    flow_mod.body.command = htons(OFPFC_MODIFY);
-    flow_mod.body.idle_timeout = htons(0);
-    flow_mod.body.hard_timeout = htons(0);
-    flow_mod.body.buffer_id = htonl(-1);
-    flow_mod.body.out_port = htons(OFPP_NONE);
-    flow_mod.body.flags = htons(0);
+    flow_mod->header.version = OFP_VERSION;
+    flow_mod->header.type = OFP_FLOW_MOD;
+    flow_mod->header.xid = ntohl(transaction_id++);
+    flow_mod->header.length = htons(sizeof(openflow_flow_mod_message));
+    // Setup body, in OpenFlow 1.0 a MODIFY also replaces the cookie
+    flow_mod->body.cookie = htonll(cookie);
+    flow_mod->body.command = htons(command);
+    flow_mod->body.idle_timeout = htons(idle_timeout);
+    flow_mod->body.hard_timeout = htons(0);
+    flow_mod->body.priority = htons(priority);
+    flow_mod->body.buffer_id = htonl(buffer_id);
+    flow_mod->body.out_port = htons(OFPP_NONE);
+    flow_mod->body.flags = htons(0);
     // flow_mod.body.match = hton_openflow_match(&flow_stats->match);
     openflow_match body_match = {
         .wildcards = htonl(OFPW_MATCH_FIVE_TUPLE),
-        .in_port = htons(OVS_NETWORK_IFINDEX),
+        .in_port = htons(in_port),
         .dl_src = {0x00,0x00,0x00,0x00,0x00,0x00},
         .dl_dst = {0x00,0x00,0x00,0x00,0x00,0x00},
         .dl_vlan = 0,
@@ -367,16 +674,25 @@ void openflow_mod_vlan(openflow_connection *connection,struct FiveTuple *fiveTup
         .tp_src = htons(fiveTuple->src_port),
         .tp_dst = htons(fiveTuple->dst_port)
     };
-    flow_mod.body.match = body_match;
+    flow_mod->body.match = body_match;
     // Setup VLAN actions
-    flow_mod.vlan_vid.type = htons(OFPAT_SET_VLAN_VID);
-    flow_mod.vlan_vid.len = htons(sizeof(openflow_action_vlan_vid));
-    flow_mod.vlan_vid.vlan_vid = htons(new_VLAN);
+    flow_mod->vlan_vid.type = htons(OFPAT_SET_VLAN_VID);
+    flow_mod->vlan_vid.len = htons(sizeof(openflow_action_vlan_vid));
+    flow_mod->vlan_vid.vlan_vid = htons(new_VLAN);
     // Setup output action
-    flow_mod.output.len = htons(sizeof(openflow_action_output));
-    flow_mod.output.type = htons(OFPAT_OUTPUT);
-    flow_mod.output.port = htons(OVS_HOST_IFINDEX);
-    flow_mod.output.max_len = htons(OVS_OUTPUT_ACTION_MAX_LEN);
+    flow_mod->output.len = htons(sizeof(openflow_action_output));
+    flow_mod->output.type = htons(OFPAT_OUTPUT);
+    flow_mod->output.port = htons(OVS_HOST_IFINDEX);
+    flow_mod->output.max_len = htons(OVS_OUTPUT_ACTION_MAX_LEN);
+}
+
+void openflow_mod_vlan(openflow_connection *connection,struct FiveTuple *fiveTuple, uint16_t new_VLAN, uint64_t cookie){
+    if (openflow_version(connection) >= OFP13_VERSION){
+        send_openflow13_flow_mod(connection, fiveTuple, new_VLAN, cookie);
+        return;
+    }
+    openflow_flow_mod_message flow_mod;
+    fill_openflow_flow_mod(&flow_mod, OFPFC_MODIFY, 0, 0, OVS_NETWORK_IFINDEX, OPENFLOW_NO_BUFFER, fiveTuple, new_VLAN, cookie);
     // Send flow mod
     int valwrite = write(connection->fd, &flow_mod, sizeof(openflow_flow_mod_message));
     if (valwrite < 0){
@@ -384,7 +700,230 @@ void openflow_mod_vlan(openflow_connection *connection,struct FiveTuple *fiveTup
     }
 }
 
+/**
+ * @brief Writes the FLOW_MODs and PACKET_OUTs of the flows set up since the last call at once
+ */
+void flush_openflow_setups(openflow_connection *connection){
+    uint32_t written = 0;
+    while (written < connection->setup_len){
+        int valwrite = write(connection->fd, connection->setup_buffer + written, connection->setup_len - written);
+        if (valwrite < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            // The socket is non-blocking, wait for the switch to read the previous setups
+            struct pollfd pfd = {.fd = connection->fd, .events = POLLOUT};
+            poll(&pfd, 1, 100);
+            continue;
+        }
+        if (valwrite < 0){
+            printf("Error writing flow setups to socket: %s\n", strerror(errno));
+            break;
+        }
+        written += valwrite;
+    }
+    connection->setup_len = 0;
+    connection->nb_setups_queued = 0;
+}
+
+/**
+ * @brief Appends a message to the setup buffer, writing the buffer first if the message doesn't fit
+ */
+void queue_openflow_setup(openflow_connection *connection, void *msg, uint16_t len){
+    if (connection->setup_len + len > OPENFLOW_SETUP_BUFFER_LEN){
+        flush_openflow_setups(connection);
+    }
+    memcpy(connection->setup_buffer + connection->setup_len, msg, len);
+    connection->setup_len += len;
+}
+
+int openflow_parse_packet(uint8_t *packet, uint16_t len, struct FiveTuple *key){
+    uint16_t offset = 12;
+    if (len < offset + 2){
+        return -1;
+    }
+    uint16_t eth_type = packet[offset] << 8 | packet[offset + 1];
+    offset += 2;
+    if (eth_type == ETH_TYPE_VLAN){
+        if (len < offset + 4){
+            return -1;
+        }
+        eth_type = packet[offset + 2] << 8 | packet[offset + 3];
+        offset += 4;
+    }
+    if (eth_type != IPV4_ETH_TYPE || len < offset + 20){
+        return -1;
+    }
+    uint8_t *ip = packet + offset;
+    uint8_t ihl = (ip[0] & 0x0f) * 4;
+    uint8_t proto = ip[9];
+    // The fragments after the first one have no ports
+    uint16_t fragment_offset = (ip[6] & 0x1f) << 8 | ip[7];
+    if (ip[0] >> 4 != 4 || ihl < 20 || len < offset + ihl + 4 || fragment_offset != 0 ||
+        (proto != TCP_PROTO && proto != UDP_PROTO)){
+        return -1;
+    }
+    uint8_t *l4 = ip + ihl;
+    memset(key, 0, sizeof(*key));
+    key->src_ip = (uint32_t)ip[12] << 24 | ip[13] << 16 | ip[14] << 8 | ip[15];
+    key->dst_ip = (uint32_t)ip[16] << 24 | ip[17] << 16 | ip[18] << 8 | ip[19];
+    key->src_port = l4[0] << 8 | l4[1];
+    key->dst_port = l4[2] << 8 | l4[3];
+    key->proto = proto;
+    return 0;
+}
+
+/**
+ * @brief Installs the flow of a PACKET_IN on the VLAN picked by the setup function and releases its packet
+ */
+void handle_openflow_packet_in(openflow_connection *connection, openflow_message *message){
+    if (!connection->flow_setup || message->header.length <= OFP_HEADER_LEN){
+        return;
+    }
+    uint16_t body_len = message->header.length - OFP_HEADER_LEN;
+    uint32_t buffer_id;
+    uint32_t in_port;
+    uint8_t *packet;
+    uint16_t packet_len;
+    if (openflow_version(connection) >= OFP13_VERSION){
+        if (openflow13_parse_packet_in(message->data, body_len, &buffer_id, &in_port, &packet, &packet_len)){
+            return;
+        }
+    } else {
+        if (body_len < sizeof(openflow_packet_in)){
+            return;
+        }
+        openflow_packet_in *packet_in = (openflow_packet_in *)message->data;
+        buffer_id = ntohl(packet_in->buffer_id);
+        in_port = ntohs(packet_in->in_port);
+        packet = (uint8_t *)message->data + sizeof(openflow_packet_in);
+        packet_len = body_len - sizeof(openflow_packet_in);
+    }
+    struct FiveTuple key;
+    if (openflow_parse_packet(packet, packet_len, &key)){
+        // ARP, IPv6... are not balanced
+        return;
+    }
+    uint64_t cookie = 0;
+    uint16_t vlan = connection->flow_setup(&key, connection->flow_setup_arg, &cookie);
+    // The FLOW_MOD applies its actions to the buffered packet, a PACKET_OUT is only needed without buffer
+    if (openflow_version(connection) >= OFP13_VERSION){
+        uint8_t flow_mod[OPENFLOW13_MAX_MESSAGE_LEN];
+        uint32_t meter_id = connection->meter_rate && vlan < connection->nb_meters ? vlan + 1 : 0;
+        uint16_t len = openflow13_flow_mod_vlan_message(flow_mod, connection->version, transaction_id++, OFPFC_ADD,
+            FLOW_SETUP_PRIORITY, CONN_TIMEOUT, in_port, &key, vlan, OVS_HOST_IFINDEX, meter_id, cookie);
+        ((openflow13_flow_mod *)(flow_mod + OFP_HEADER_LEN))->buffer_id = htonl(buffer_id);
+        queue_openflow_setup(connection, flow_mod, len);
+        if (buffer_id == OFP13_NO_BUFFER){
+            uint8_t *packet_out = malloc(OPENFLOW13_MAX_MESSAGE_LEN + packet_len);
+            if (packet_out){
+                len = openflow13_packet_out_message(packet_out, connection->version, transaction_id++, buffer_id, in_port,
+                    vlan, OVS_HOST_IFINDEX, packet, packet_len);
+                queue_openflow_setup(connection, packet_out, len);
+                free(packet_out);
+            }
+        }
+    } else {
+        openflow_flow_mod_message flow_mod;
+        fill_openflow_flow_mod(&flow_mod, OFPFC_ADD, FLOW_SETUP_PRIORITY, CONN_TIMEOUT, in_port, buffer_id, &key, vlan, cookie);
+        queue_openflow_setup(connection, &flow_mod, sizeof(flow_mod));
+        if (buffer_id == OPENFLOW_NO_BUFFER && sizeof(openflow_packet_out_message) + packet_len <= OPENFLOW_SETUP_BUFFER_LEN){
+            uint16_t len = sizeof(openflow_packet_out_message) + packet_len;
+            openflow_packet_out_message *packet_out = malloc(len);
+            if (packet_out){
+                packet_out->header.version = OFP_VERSION;
+                packet_out->header.type = OFP_PACKET_OUT;
+                packet_out->header.length = htons(len);
+                packet_out->header.xid = htonl(transaction_id++);
+                packet_out->body.buffer_id = htonl(buffer_id);
+                packet_out->body.in_port = htons(in_port);
+                packet_out->body.actions_len = htons(sizeof(openflow_action_vlan_vid) + sizeof(openflow_action_output));
+                packet_out->vlan_vid = flow_mod.vlan_vid;
+                packet_out->output = flow_mod.output;
+                memcpy(packet_out + 1, packet, packet_len);
+                queue_openflow_setup(connection, packet_out, len);
+                free(packet_out);
+            }
+        }
+    }
+    connection->nb_setups++;
+    if (++connection->nb_setups_queued >= connection->setup_batch){
+        flush_openflow_setups(connection);
+    }
+}
+
+int openflow_enable_flow_setup(openflow_connection *connection, openflow_flow_setup_fn setup, void *arg, uint16_t batch){
+    connection->setup_buffer = malloc(OPENFLOW_SETUP_BUFFER_LEN);
+    if (connection->setup_buffer == NULL){
+        printf("Could not allocate the flow setup buffer\n");
+        return -1;
+    }
+    connection->setup_len = 0;
+    connection->nb_setups_queued = 0;
+    connection->setup_batch = batch ? batch : 1;
+    connection->flow_setup = setup;
+    connection->flow_setup_arg = arg;
+    if (openflow_version(connection) >= OFP13_VERSION){
+        // OpenFlow 1.3 drops the missed packets by default
+        uint8_t flow_mod[OPENFLOW13_MAX_MESSAGE_LEN];
+        uint16_t len = openflow13_flow_mod_table_miss_message(flow_mod, connection->version, transaction_id++);
+        send_openflow_buffer(connection->fd, flow_mod, len, "FLOW_MOD");
+    }
+    return 0;
+}
+
+/**
+ * @brief openflow_get_flows in OpenFlow 1.3 and later: OFPMP_FLOW multipart request and replies
+ */
+void get_openflow13_flows(openflow_connection *connection, openflow_flows *flows, uint64_t cookie, uint64_t cookie_mask){
+    uint32_t current_xid = transaction_id++;
+    uint8_t flow_request[OPENFLOW13_MAX_MESSAGE_LEN];
+    uint16_t len = openflow13_flow_stats_request_message(flow_request, connection->version, current_xid, OVS_NETWORK_IFINDEX,
+        cookie, cookie_mask);
+    send_openflow_buffer(connection->fd, flow_request, len, "MULTIPART_REQUEST");
+    flows->nb_flows = 0;
+    flows->parse_ns = 0;
+    uint8_t reply_fully_received = 0;
+    while (!reply_fully_received){
+        openflow_message message;
+        if (openflow_wait_for_message(connection, OFPT13_MULTIPART_REPLY, &message, current_xid)){
+            return;
+        }
+        struct timespec parse_start, parse_end;
+        clock_gettime(CLOCK_MONOTONIC, &parse_start);
+        if (message.header.length < OFP_HEADER_LEN + sizeof(openflow13_multipart_header)){
+            free_openflow_message_body(&message);
+            return;
+        }
+        openflow13_multipart_header *reply_header = (openflow13_multipart_header *)message.data;
+        if ((ntohs(reply_header->flags) & OFPMPF_REPLY_MORE) == 0){
+            reply_fully_received = 1;
+        }
+        uint8_t *response_end = (uint8_t *)message.data + message.header.length - OFP_HEADER_LEN;
+        uint8_t *response_head = (uint8_t *)message.data + sizeof(openflow13_multipart_header);
+        while (ntohs(reply_header->type) == OFPMP_FLOW && response_head < response_end){
+            openflow_reserve_flows(flows, flows->nb_flows + 1);
+            int entry_len = openflow13_parse_flow_stats(response_head, response_end, &flows->flow_stats[flows->nb_flows],
+                flows->actions[flows->nb_flows], &flows->nb_actions[flows->nb_flows]);
+            if (entry_len < 0){
+                printf("Malformed flow stats entry, ignoring the rest of the reply\n");
+                break;
+            }
+            response_head += entry_len;
+            flows->nb_flows++;
+        }
+        free_openflow_message_body(&message);
+        clock_gettime(CLOCK_MONOTONIC, &parse_end);
+        flows->parse_ns += (parse_end.tv_sec - parse_start.tv_sec) * 1000000000ULL + parse_end.tv_nsec - parse_start.tv_nsec;
+    }
+}
+
 void openflow_get_flows(openflow_connection *connection, openflow_flows *flows){
+    openflow_get_flows_by_cookie(connection, flows, 0, 0);
+}
+
+void openflow_get_flows_by_cookie(openflow_connection *connection, openflow_flows *flows, uint64_t cookie, uint64_t cookie_mask){
+    if (openflow_version(connection) >= OFP13_VERSION){
+        get_openflow13_flows(connection, flows, cookie, cookie_mask);
+        return;
+    }
     // Create a flow request
     int current_xid = transaction_id;
     transaction_id++;
@@ -407,35 +946,41 @@ void openflow_get_flows(openflow_connection *connection, openflow_flows *flows){
         printf("Error writing FLOW_REQUEST message to socket: %s\n", strerror(valwrite));
         return;
     }
-    // Wait for the reply
-    openflow_message messages[MAX_STATS_REPLY];
-    int nb_messages = 0;
+    // Parse the replies as they arrive
+    flows->nb_flows = 0;
+    flows->parse_ns = 0;
     uint8_t reply_fully_received = 0;
     while (!reply_fully_received){
-        openflow_wait_for_message(connection, OFP_STATS_REPLY, &messages[nb_messages], current_xid);
-        openflow_flow_stats_reply_header *reply_header = (openflow_flow_stats_reply_header *)messages[nb_messages].data;
-        nb_messages++;
+        openflow_message message;
+        if (openflow_wait_for_message(connection, OFP_STATS_REPLY, &message, current_xid)){
+            return;
+        }
+        struct timespec parse_start, parse_end;
+        clock_gettime(CLOCK_MONOTONIC, &parse_start);
+        openflow_flow_stats_reply_header *reply_header = (openflow_flow_stats_reply_header *)message.data;
         if ((ntohs(reply_header->flags) & OFPSF_REPLY_MORE) == 0){
             reply_fully_received = 1;
         }
-    }
-    // Parse the replies
-    flows->nb_flows = 0;
-    for (uint8_t i = 0; i < nb_messages; i++){
-        void *response_end = messages[i].data + messages[i].header.length - OFP_HEADER_LEN;
+        void *response_end = message.data + message.header.length - OFP_HEADER_LEN;
         // Place the pointer at the beginning of the first item
-        void *response_head = messages[i].data + sizeof(openflow_flow_stats_reply_header);
+        void *response_head = message.data + sizeof(openflow_flow_stats_reply_header);
         // While we have not reached the end of the message
         while (response_head < response_end){
+            openflow_reserve_flows(flows, flows->nb_flows + 1);
             // Parse the flow statistics
             flows->flow_stats[flows->nb_flows] = *(openflow_flow_stats *)response_head;
             ntoh_openflow_flow_stats(&flows->flow_stats[flows->nb_flows]);
             // Go to action details
             void *actions_end = response_head + flows->flow_stats[flows->nb_flows].length;
+            if ((openflow_get_cookie(flows, flows->nb_flows) ^ cookie) & cookie_mask){
+                // Not requested, OpenFlow 1.0 switches list all the flows
+                response_head = actions_end;
+                continue;
+            }
             response_head += sizeof(openflow_flow_stats);
             // Parse the actions details
             uint8_t *nb_actions = &flows->nb_actions[flows->nb_flows];
-            while (response_head < actions_end){
+            while (response_head < actions_end && *nb_actions < MAX_ACTIONS){
                 flows->actions[flows->nb_flows][*nb_actions].type = ntohs(*(uint16_t *)response_head);
                 // Read the action
                 switch (flows->actions[flows->nb_flows][*nb_actions].type)
@@ -463,25 +1008,48 @@ void openflow_get_flows(openflow_connection *connection, openflow_flows *flows){
             response_head = actions_end;
             flows->nb_flows++;
         }
-        free_openflow_message_body(&messages[i]);
+        free_openflow_message_body(&message);
+        clock_gettime(CLOCK_MONOTONIC, &parse_end);
+        flows->parse_ns += (parse_end.tv_sec - parse_start.tv_sec) * 1000000000ULL + parse_end.tv_nsec - parse_start.tv_nsec;
     }
 }
 
 
+void openflow_reserve_flows(openflow_flows *flows, uint32_t nb_flows){
+    if (nb_flows <= flows->capacity){
+        return;
+    }
+    uint32_t capacity = flows->capacity ? flows->capacity : MAX_HANDLED_FLOWS;
+    while (capacity < nb_flows){
+        capacity *= 2;
+    }
+    flows->flow_stats = realloc(flows->flow_stats, capacity * sizeof(openflow_flow_stats));
+    flows->nb_actions = realloc(flows->nb_actions, capacity * sizeof(uint8_t));
+    flows->actions = realloc(flows->actions, capacity * sizeof(*flows->actions));
+    memset(flows->nb_actions + flows->capacity, 0, capacity - flows->capacity);
+    flows->capacity = capacity;
+}
+
 void openflow_free_flows(openflow_flows *flows){
-    for (uint16_t i = 0; i < flows->nb_flows; i++){
+    for (uint32_t i = 0; i < flows->nb_flows; i++){
         for (uint8_t j = 0; j < flows->nb_actions[i]; j++){
             free(flows->actions[i][j].data);
         }
-        flows->nb_actions[i] = 0;
     }
+    free(flows->flow_stats);
+    free(flows->nb_actions);
+    free(flows->actions);
+    flows->flow_stats = NULL;
+    flows->nb_actions = NULL;
+    flows->actions = NULL;
+    flows->capacity = 0;
     flows->nb_flows = 0;
 }
 
 void openflow_dump_flows(openflow_flows *flows){
     // Display flows
     printf("--------------------\n");
-    for (int i = 0; i < flows->nb_flows; i++){
+    for (uint32_t i = 0; i < flows->nb_flows; i++){
         printf("Flow %i [%s] %u.%u.%u.%u:%u -> %u.%u.%u.%u:%u => ", i,
             (flows->flow_stats[i].match.nw_proto == 6) ? "TCP" : (flows->flow_stats[i].match.nw_proto == 17) ? "UDP" : "UKN",
             (flows->flow_stats[i].match.nw_src >> 24) & 0xFF,
@@ -528,9 +1096,19 @@ void control_logic(openflow_connection *connection, openflow_message *message){
     switch (message->header.type) {
         case OFP_ECHO_REQUEST:
             printf("Received PING\n");
-            send_openflow_echo_reply(connection->fd);
+            send_openflow_echo_reply(connection->fd, openflow_version(connection));
             printf("Sent PONG\n");
             break;
+        case OFP_ERROR:
+            // Same body in every version: type, code and the start of the failed request
+            if (message->header.length >= OFP_HEADER_LEN + 4) {
+                printf("Switch error type %u code %u for xid %u\n", ntohs(((uint16_t *)message->data)[0]),
+                    ntohs(((uint16_t *)message->data)[1]), message->header.xid);
+            }
+            break;
+        case OFP_PACKET_IN:
+            handle_openflow_packet_in(connection, message);
+            break;
         default:
             break;
     }
@@ -549,6 +1127,27 @@ void openflow_control(openflow_connection *connection){
         control_logic(connection, &message);
         free_openflow_message_body(&message);
     }
+    flush_openflow_setups(connection);
+}
+
+void openflow_serve(openflow_connection *connection, uint32_t timeout_ms){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t deadline_ms = now.tv_sec * 1000ULL + now.tv_nsec / 1000000 + timeout_ms;
+    uint64_t now_ms = deadline_ms - timeout_ms;
+    while (now_ms < deadline_ms){
+        struct pollfd pfd = {.fd = connection->fd, .events = POLLIN};
+        int ready = poll(&pfd, 1, deadline_ms - now_ms);
+        if (ready < 0 || (ready > 0 && (pfd.revents & (POLLERR | POLLHUP)))){
+            // Interrupted by a signal, or the switch is gone
+            return;
+        }
+        if (ready > 0){
+            openflow_control(connection);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        now_ms = now.tv_sec * 1000ULL + now.tv_nsec / 1000000;
+    }
 }
 
 void openflow_terminate_connection(openflow_connection *connection){
@@ -559,6 +1158,33 @@ void openflow_terminate_connection(openflow_connection *connection){
     close(connection->server_fd);
     // Free ports
     free(connection->ports);
+    free(connection->setup_buffer);
+}
+
+uint16_t openflow_get_vlan(openflow_flows *flows, int flow_idx){
+    for (uint8_t j = 0; j < flows->nb_actions[flow_idx]; j++){
+        if (flows->actions[flow_idx][j].type == OFPAT_SET_VLAN_VID){
+            return ((openflow_action_vlan_vid *)flows->actions[flow_idx][j].data)->vlan_vid;
+        }
+    }
+    return 0;
+}
+
+uint64_t openflow_get_cookie(openflow_flows *flows, int flow_idx){
+    return openflow_ovsbe64_to_uint64(flows->flow_stats[flow_idx].cookie);
+}
+
+uint64_t openflow_flow_cookie(int slot, uint16_t generation){
+    return OPENFLOW_COOKIE_TAG << 48 | (uint64_t)generation << 32 | (uint32_t)slot;
+}
+
+int openflow_cookie_slot(uint64_t cookie, int *slot, uint16_t *generation){
+    if ((cookie & OPENFLOW_COOKIE_TAG_MASK) != OPENFLOW_COOKIE_TAG << 48){
+        return -1;
+    }
+    *slot = cookie & OPENFLOW_COOKIE_SLOT_MASK;
+    *generation = cookie >> 32;
+    return 0;
 }
 
 uint64_t openflow_ovsbe64_to_uint64(ovs_32aligned_be64 value){
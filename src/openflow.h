@@ -23,8 +23,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <endian.h>
+#include <errno.h>
 #include <openflow/openflow.h>
 #include <fcntl.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <time.h>
 #include "env.h"
 #include "hashmap.h"
 
@@ -43,10 +47,13 @@
 
 // OpenFlow message types
 #define OFP_HELLO 0x00
+#define OFP_ERROR 0x01
 #define OFP_ECHO_REQUEST 0x02
 #define OFP_ECHO_REPLY 0x03
 #define OFP_FEATURES_REQUEST 0x05
 #define OFP_FEATURES_REPLY 0x06
+#define OFP_PACKET_IN 0x0a
+#define OFP_PACKET_OUT 0x0d
 #define OFP_STATS_REQUEST 0x10
 #define OFP_STATS_REPLY 0x11
 #define OFP_FLOW_MOD 0x0e
@@ -54,6 +61,16 @@
 // OpenFlow stats request types
 #define OFPST_FLOW 0x01
 
+// buffer_id of a packet the switch didn't buffer
+#define OPENFLOW_NO_BUFFER 0xffffffff
+// FLOW_MODs and PACKET_OUTs of the flows set up natively, written at once
+#define OPENFLOW_SETUP_BUFFER_LEN 65536
+// Cookie of the rules installed by orss: OPENFLOW_COOKIE_TAG in the upper 16 bits, then the generation and the
+// slot of the flow in the flow table (see openflow_flow_cookie). Rules of other controllers have other cookies
+#define OPENFLOW_COOKIE_TAG 0x6f72ULL
+#define OPENFLOW_COOKIE_TAG_MASK 0xffff000000000000ULL
+#define OPENFLOW_COOKIE_SLOT_MASK 0x00000000ffffffffULL
+
 // Some network constants
 #define IPV4_ETH_TYPE 0x0800
 #define TCP_PROTO 0x06
@@ -200,10 +217,12 @@ struct openflow_stats_request_message {
 typedef struct openflow_stats_request_message openflow_stats_request_message;
 
 struct openflow_flows {
-    uint16_t nb_flows;
-    openflow_flow_stats flow_stats[MAX_HANDLED_FLOWS];
-    uint8_t nb_actions[MAX_HANDLED_FLOWS];
-    action_descriptor actions[MAX_HANDLED_FLOWS][MAX_ACTIONS];
+    uint32_t nb_flows;
+    uint32_t capacity; /** Allocated entries of the arrays below, grown as needed */
+    uint64_t parse_ns; /** Time spent parsing the STATS_REPLY messages, excluding the wait for them */
+    openflow_flow_stats *flow_stats;
+    uint8_t *nb_actions;
+    action_descriptor (*actions)[MAX_ACTIONS];
 };
 
 typedef struct openflow_flows openflow_flows;
@@ -219,6 +238,51 @@ struct openflow_flow_mod_message {
 
 typedef struct openflow_flow_mod_message openflow_flow_mod_message;
 
+/**
+ * @brief Body of a PACKET_IN, followed by the packet
+ *
+ */
+struct openflow_packet_in {
+    uint32_t buffer_id;
+    uint16_t total_len;
+    uint16_t in_port;
+    uint8_t reason;
+    uint8_t pad;
+} __attribute__((packed));
+
+typedef struct openflow_packet_in openflow_packet_in;
+
+struct openflow_packet_out {
+    uint32_t buffer_id;
+    uint16_t in_port;
+    uint16_t actions_len;
+};
+
+typedef struct openflow_packet_out openflow_packet_out;
+
+/**
+ * @brief PACKET_OUT tagging a packet with a VLAN, followed by the packet when it isn't buffered
+ *
+ */
+struct openflow_packet_out_message {
+    openflow_header header;
+    openflow_packet_out body;
+    openflow_action_vlan_vid vlan_vid;
+    openflow_action_output output;
+};
+
+typedef struct openflow_packet_out_message openflow_packet_out_message;
+
+/**
+ * @brief Chooses the VLAN, i.e. the core, of a flow set up from a PACKET_IN
+ *
+ * @param key : the 5-tuple of the packet, in host byte order
+ * @param arg : the argument given to openflow_enable_flow_setup
+ * @param cookie : set to the cookie of the rule, left to 0 for a flow outside the flow table
+ * @return uint16_t : the VLAN the flow is tagged with
+ */
+typedef uint16_t (*openflow_flow_setup_fn)(struct FiveTuple *key, void *arg, uint64_t *cookie);
+
 /**
  * @brief Abstraction of an OpenFlow connection, users just need to call the right functions to send and receive messages
  * 
@@ -232,14 +296,150 @@ struct openflow_connection {
     uint8_t nb_ports;
     openflow_message msg_buffer[16];
     uint8_t nb_msg_buffered;
+    uint8_t version; /** Negotiated by the HELLO exchange, 0 (OpenFlow 1.0) before it */
+    // Bundle of the current cycle, OpenFlow 1.3 and later
+    uint8_t batching; /** Between openflow_bundle_begin and openflow_bundle_commit */
+    uint8_t bundle_open; /** The OPEN_REQUEST of the bundle was sent */
+    uint32_t bundle_id;
+    uint32_t bundle_open_xid;
+    // Per-core meters, OpenFlow 1.3 and later
+    uint32_t meter_rate; /** Packets per second, 0 when flows aren't metered */
+    uint16_t nb_meters;
+    // Native flow setup from PACKET_INs, see openflow_enable_flow_setup
+    openflow_flow_setup_fn flow_setup; /** NULL when PACKET_INs are left to another controller */
+    void *flow_setup_arg;
+    uint16_t setup_batch; /** Flows set up before their messages are written */
+    uint16_t nb_setups_queued;
+    uint8_t *setup_buffer; /** OPENFLOW_SETUP_BUFFER_LEN bytes of queued FLOW_MODs and PACKET_OUTs */
+    uint32_t setup_len;
+    uint64_t nb_setups; /** Flows set up since the connection was created */
 };
 
 /**
- * @brief Initialize an OpenFlow connection. The connection is established over TCP on the port specified in the env.h file.
+ * @brief Initialize an OpenFlow connection. The connection is established over TCP on the given port.
  * 
  * @param conn : the connection to initialize
+ * @param port : the port to listen on (OF_PORT by default)
+ */
+void openflow_create_connection(openflow_connection *conn, uint16_t port);
+
+/**
+ * @brief Gives the negotiated OpenFlow version of the connection
+ *
+ * @param conn : the connection
+ * @return uint8_t : OFP_VERSION, OFP13_VERSION or OFP14_VERSION
+ */
+uint8_t openflow_version(openflow_connection *conn);
+
+/**
+ * @brief Starts batching the FLOW_MODs of openflow_mod_vlan into a bundle, so that the switch applies
+ * all of them or none. Does nothing in OpenFlow 1.0 or when OPENFLOW_BUNDLES is disabled.
+ *
+ * @param conn : the connection to use
+ */
+void openflow_bundle_begin(openflow_connection *conn);
+
+/**
+ * @brief Commits the bundle started by openflow_bundle_begin and waits for the switch to apply it
+ *
+ * @param conn : the connection to use
+ * @return int : 0 if the bundle was applied (or there was none), -1 if the switch rejected it, none
+ * of its FLOW_MODs were applied then
+ */
+int openflow_bundle_commit(openflow_connection *conn);
+
+/**
+ * @brief Installs a meter per core (meter `core + 1`) dropping packets above `rate_pps`, the FLOW_MODs
+ * of openflow_mod_vlan then send flows through the meter of their core. Needs OpenFlow 1.3.
+ *
+ * @param conn : the connection to use
+ * @param nb_cores : the number of cores
+ * @param rate_pps : packets per second allowed per core
+ * @return int : 0 on success, -1 if the negotiated version has no meters
+ */
+int openflow_add_core_meters(openflow_connection *conn, uint16_t nb_cores, uint32_t rate_pps);
+
+/**
+ * @brief Adds, modifies or deletes a SELECT group whose buckets tag the packets with a VLAN and output them
+ * to the host. Added to the bundle of the cycle if one was begun. Needs OpenFlow 1.3.
+ *
+ * @param conn
+ * @param command : OFPGC_ADD, OFPGC_MODIFY or OFPGC_DELETE
+ * @param group_id
+ * @param vlans : VLAN of each bucket
+ * @param nb_buckets : at most OPENFLOW13_MAX_BUCKETS, ignored by OFPGC_DELETE
+ * @return int : 0 on success, -1 if the switch doesn't speak OpenFlow 1.3
+ */
+int openflow_mod_group(openflow_connection *conn, uint16_t command, uint32_t group_id, uint16_t *vlans, int nb_buckets);
+
+/**
+ * @brief Adds the rule sending the IPv4 traffic of the network port to a group. Needs OpenFlow 1.3.
+ *
+ * @param conn
+ * @param group_id
+ * @param priority : below PINNED_FLOW_PRIORITY so that pinned flows bypass the group
+ * @return int : 0 on success, -1 if the switch doesn't speak OpenFlow 1.3
+ */
+int openflow_add_group_rule(openflow_connection *conn, uint32_t group_id, uint16_t priority);
+
+/**
+ * @brief Adds an exact-match rule at PINNED_FLOW_PRIORITY tagging a flow with a VLAN, so that it bypasses the
+ * group. The rule expires after CONN_TIMEOUT seconds without packets. Needs OpenFlow 1.3.
+ *
+ * @param conn
+ * @param fiveTuple : the flow to pin
+ * @param vlan
+ * @param cookie : cookie of the rule, see openflow_flow_cookie
+ * @return int : 0 on success, -1 if the switch doesn't speak OpenFlow 1.3
+ */
+int openflow_pin_flow(openflow_connection *conn, struct FiveTuple *fiveTuple, uint16_t vlan, uint64_t cookie);
+
+/**
+ * @brief Reads the packet counter of each bucket of a group with an OFPMP_GROUP multipart request
+ *
+ * @param conn
+ * @param group_id
+ * @param packets : filled with the counters of the first max_buckets buckets
+ * @param max_buckets
+ * @return int : the number of buckets of the group, -1 if it was not found or on error
  */
-void openflow_create_connection(openflow_connection *conn);
+int openflow_get_group_buckets(openflow_connection *conn, uint32_t group_id, uint64_t *packets, int max_buckets);
+
+/**
+ * @brief Sets up the new flows from their PACKET_IN instead of an external controller. The 5-tuple of each
+ * IPv4 TCP or UDP packet missing the flow table is read from the packet, `setup` picks its VLAN, then an
+ * exact-match FLOW_MOD at FLOW_SETUP_PRIORITY (expiring after CONN_TIMEOUT seconds without packets) installs
+ * the flow and releases the buffered packet through its buffer_id. A packet the switch didn't buffer is sent
+ * back in a PACKET_OUT. The messages of `batch` setups are written at once, and at the latest when
+ * openflow_control returns. From OpenFlow 1.3, a table-miss rule sending the missed packets to the
+ * controller is added.
+ *
+ * @param conn
+ * @param setup : picks the VLAN of a new flow
+ * @param arg : passed to `setup`
+ * @param batch : setups queued before their messages are written, 1 to write each of them immediately
+ * @return int : 0 on success, -1 if the setup buffer couldn't be allocated
+ */
+int openflow_enable_flow_setup(openflow_connection *conn, openflow_flow_setup_fn setup, void *arg, uint16_t batch);
+
+/**
+ * @brief Reads the 5-tuple of an Ethernet frame, optionally VLAN tagged
+ *
+ * @param packet : the frame, at least its headers
+ * @param len : bytes of the frame available
+ * @param key : filled in host byte order
+ * @return int : 0 for an IPv4 TCP or UDP packet (first fragment), -1 otherwise
+ */
+int openflow_parse_packet(uint8_t *packet, uint16_t len, struct FiveTuple *key);
+
+/**
+ * @brief Handles the messages of the switch, PACKET_INs included, as they arrive for `timeout_ms`. Replaces a
+ * sleep between two cycles, so that new flows don't wait for the next cycle to be set up.
+ *
+ * @param conn
+ * @param timeout_ms : time to serve the connection for, less if a signal interrupts the wait
+ */
+void openflow_serve(openflow_connection *conn, uint32_t timeout_ms);
 
 /**
  * @brief Terminates the connection and frees the resources
@@ -249,7 +449,7 @@ void openflow_create_connection(openflow_connection *conn);
 void openflow_terminate_connection(openflow_connection *conn);
 
 /**
- * @brief Handle OpenFlow controlling such as ECHO_REQUEST, it will empty both connection buffers (Messages buffered in openflow_connection::msg_buffer and the socket buffer). It is user responsibility to call this function periodically to avoid connection timeout.
+ * @brief Handle OpenFlow controlling such as ECHO_REQUEST and PACKET_IN, it will empty both connection buffers (Messages buffered in openflow_connection::msg_buffer and the socket buffer) and write the queued flow setups. It is user responsibility to call this function periodically to avoid connection timeout.
  * 
  * @param conn : the connection to use
  */
@@ -263,6 +463,18 @@ void openflow_control(openflow_connection *conn);
  */
 void openflow_get_flows(openflow_connection *connection, openflow_flows *flows);
 
+/**
+ * @brief Gets the details of the flows whose cookie matches `cookie` under `cookie_mask`, e.g. only the rules of orss
+ * with OPENFLOW_COOKIE_TAG_MASK, or a share of them with low bits of the slot. From OpenFlow 1.3 the switch only
+ * lists these flows, in OpenFlow 1.0 (no cookie in flow stats requests) the others are skipped while parsing.
+ *
+ * @param connection : the connection to use
+ * @param flows : flow structure that will be filled
+ * @param cookie
+ * @param cookie_mask : 0 to get all the flows, like openflow_get_flows
+ */
+void openflow_get_flows_by_cookie(openflow_connection *connection, openflow_flows *flows, uint64_t cookie, uint64_t cookie_mask);
+
 /**
  * @brief Prints a dump of each flow in the flows structure
  *
@@ -276,8 +488,47 @@ void openflow_dump_flows(openflow_flows *flows);
  * @param connection
  * @param fiveTuple
  * @param new_VLAN
+ * @param cookie : new cookie of the rule, see openflow_flow_cookie. Only applied in OpenFlow 1.0, a MODIFY
+ * keeps the cookie of the rule from OpenFlow 1.1
+ */
+void openflow_mod_vlan(openflow_connection *connection, struct FiveTuple *fiveTuple, uint16_t new_VLAN, uint64_t cookie);
+
+/**
+ * @brief Returns the VLAN set by the SET_VLAN_VID action of a flow, i.e. the core the flow is currently steered to
+ *
+ * @param flows : the flows returned by openflow_get_flows
+ * @param flow_idx : the index of the flow
+ * @return uint16_t : the VLAN ID, 0 if the flow has no SET_VLAN_VID action
+ */
+uint16_t openflow_get_vlan(openflow_flows *flows, int flow_idx);
+
+/**
+ * @brief Returns the cookie of a flow
+ *
+ * @param flows : the flows returned by openflow_get_flows
+ * @param flow_idx : the index of the flow
+ * @return uint64_t : the cookie, in host byte order
  */
-void openflow_mod_vlan(openflow_connection *connection, struct FiveTuple *fiveTuple, uint16_t new_VLAN);
+uint64_t openflow_get_cookie(openflow_flows *flows, int flow_idx);
+
+/**
+ * @brief Builds the cookie of the rule of a flow from its place in the flow table
+ *
+ * @param slot : the slot of the flow, see hashmap_slot
+ * @param generation : the generation of the slot, see hashmap_generation
+ * @return uint64_t : the cookie
+ */
+uint64_t openflow_flow_cookie(int slot, uint16_t generation);
+
+/**
+ * @brief Reads the place in the flow table of the flow of a rule from its cookie
+ *
+ * @param cookie : the cookie of the rule
+ * @param slot : filled with the slot of the flow
+ * @param generation : filled with the generation of the slot
+ * @return int : 0 on success, -1 if the rule wasn't installed by orss
+ */
+int openflow_cookie_slot(uint64_t cookie, int *slot, uint16_t *generation);
 
 /**
  * @brief Converts an OVS be64 to uint64_t
@@ -288,7 +539,15 @@ void openflow_mod_vlan(openflow_connection *connection, struct FiveTuple *fiveTu
 uint64_t openflow_ovsbe64_to_uint64(ovs_32aligned_be64 value);
 
 /**
- * @brief Free the flow structure
+ * @brief Grows the arrays of the flow structure to hold at least `nb_flows` flows
+ * 
+ * @param flows : the flow structure
+ * @param nb_flows : the number of flows to hold
+ */
+void openflow_reserve_flows(openflow_flows *flows, uint32_t nb_flows);
+
+/**
+ * @brief Free the flow structure, it can then be reused
  * 
  * @param flows : the flow structure to free
  */
@@ -0,0 +1,529 @@
+#include "openflow13.h"
+
+#define OPENFLOW13_PAD8(len) (((len) + 7) & ~7)
+
+/**
+ * @brief Writes the header of a message, its length is set once the body is written
+ */
+void openflow13_put_header(uint8_t *buf, uint8_t version, uint8_t type, uint32_t xid){
+    openflow_header *header = (openflow_header *)buf;
+    header->version = version;
+    header->type = type;
+    header->length = 0;
+    header->xid = htonl(xid);
+}
+
+uint16_t openflow13_finish(uint8_t *buf, uint8_t *end){
+    uint16_t len = end - buf;
+    ((openflow_header *)buf)->length = htons(len);
+    return len;
+}
+
+/**
+ * @brief Writes an OXM TLV of `size` bytes (1, 2 or 4) and returns the position after it
+ */
+uint8_t *openflow13_put_oxm(uint8_t *oxm, uint8_t field, uint32_t value, uint8_t size){
+    uint32_t header = htonl(OXM_HEADER(field, size));
+    memcpy(oxm, &header, sizeof(header));
+    oxm += sizeof(header);
+    for (int i = size - 1; i >= 0; i--){
+        *oxm++ = value >> (8 * i);
+    }
+    return oxm;
+}
+
+uint16_t openflow13_put_match(uint8_t *buf, uint32_t in_port, struct FiveTuple *key){
+    uint8_t *oxm = buf + sizeof(openflow13_match);
+    oxm = openflow13_put_oxm(oxm, OFPXMT_IN_PORT, in_port, 4);
+    if (key){
+        // Each field needs the ones it depends on: ports need the protocol, which needs IPv4
+        oxm = openflow13_put_oxm(oxm, OFPXMT_ETH_TYPE, IPV4_ETH_TYPE, 2);
+        oxm = openflow13_put_oxm(oxm, OFPXMT_IP_PROTO, key->proto, 1);
+        oxm = openflow13_put_oxm(oxm, OFPXMT_IPV4_SRC, key->src_ip, 4);
+        oxm = openflow13_put_oxm(oxm, OFPXMT_IPV4_DST, key->dst_ip, 4);
+        if (key->proto == TCP_PROTO){
+            oxm = openflow13_put_oxm(oxm, OFPXMT_TCP_SRC, key->src_port, 2);
+            oxm = openflow13_put_oxm(oxm, OFPXMT_TCP_DST, key->dst_port, 2);
+        } else if (key->proto == UDP_PROTO){
+            oxm = openflow13_put_oxm(oxm, OFPXMT_UDP_SRC, key->src_port, 2);
+            oxm = openflow13_put_oxm(oxm, OFPXMT_UDP_DST, key->dst_port, 2);
+        }
+    }
+    uint16_t len = oxm - buf;
+    openflow13_match *match = (openflow13_match *)buf;
+    match->type = htons(OFPMT_OXM);
+    match->length = htons(len);
+    memset(oxm, 0, OPENFLOW13_PAD8(len) - len);
+    return OPENFLOW13_PAD8(len);
+}
+
+uint16_t openflow13_flow_stats_request_message(uint8_t *buf, uint8_t version, uint32_t xid, uint32_t in_port,
+    uint64_t cookie, uint64_t cookie_mask){
+    openflow13_put_header(buf, version, OFPT13_MULTIPART_REQUEST, xid);
+    uint8_t *body = buf + OFP_HEADER_LEN;
+    openflow13_multipart_header *multipart = (openflow13_multipart_header *)body;
+    memset(multipart, 0, sizeof(*multipart));
+    multipart->type = htons(OFPMP_FLOW);
+    body += sizeof(*multipart);
+    openflow13_flow_stats_request *request = (openflow13_flow_stats_request *)body;
+    memset(request, 0, sizeof(*request));
+    request->table_id = 0xff;
+    request->out_port = htonl(OFPP13_ANY);
+    request->out_group = htonl(OFPG13_ANY);
+    request->cookie = htonll(cookie);
+    request->cookie_mask = htonll(cookie_mask);
+    body += sizeof(*request);
+    body += openflow13_put_match(body, in_port, NULL);
+    return openflow13_finish(buf, body);
+}
+
+/**
+ * @brief Writes the header and the body of a FLOW_MOD, the match and the instructions follow
+ */
+uint8_t *openflow13_put_flow_mod(uint8_t *buf, uint8_t version, uint32_t xid, uint8_t command, uint16_t priority, uint16_t idle_timeout){
+    openflow13_put_header(buf, version, OFP_FLOW_MOD, xid);
+    openflow13_flow_mod *flow_mod = (openflow13_flow_mod *)(buf + OFP_HEADER_LEN);
+    memset(flow_mod, 0, sizeof(*flow_mod));
+    flow_mod->command = command;
+    flow_mod->idle_timeout = htons(idle_timeout);
+    flow_mod->priority = htons(priority);
+    flow_mod->buffer_id = htonl(OFP13_NO_BUFFER);
+    flow_mod->out_port = htonl(OFPP13_ANY);
+    flow_mod->out_group = htonl(OFPG13_ANY);
+    return (uint8_t *)(flow_mod + 1);
+}
+
+uint16_t openflow13_flow_mod_vlan_message(uint8_t *buf, uint8_t version, uint32_t xid, uint8_t command, uint16_t priority,
+    uint16_t idle_timeout, uint32_t in_port, struct FiveTuple *key, uint16_t vlan, uint32_t out_port, uint32_t meter_id, uint64_t cookie){
+    uint8_t *body = openflow13_put_flow_mod(buf, version, xid, command, priority, idle_timeout);
+    ((openflow13_flow_mod *)(buf + OFP_HEADER_LEN))->cookie = htonll(cookie);
+    body += openflow13_put_match(body, in_port, key);
+    body += openflow13_put_vlan_instructions(body, vlan, out_port, meter_id);
+    return openflow13_finish(buf, body);
+}
+
+uint16_t openflow13_flow_mod_group_message(uint8_t *buf, uint8_t version, uint32_t xid, uint32_t in_port, uint16_t priority, uint32_t group_id){
+    uint8_t *body = openflow13_put_flow_mod(buf, version, xid, OFPFC_ADD, priority, 0);
+    // IPv4 only, like the exact-match rules: ARP and the rest keep their rules
+    uint8_t *oxm = body + sizeof(openflow13_match);
+    oxm = openflow13_put_oxm(oxm, OFPXMT_IN_PORT, in_port, 4);
+    oxm = openflow13_put_oxm(oxm, OFPXMT_ETH_TYPE, IPV4_ETH_TYPE, 2);
+    uint16_t len = oxm - body;
+    openflow13_match *match = (openflow13_match *)body;
+    match->type = htons(OFPMT_OXM);
+    match->length = htons(len);
+    memset(oxm, 0, OPENFLOW13_PAD8(len) - len);
+    body += OPENFLOW13_PAD8(len);
+    openflow13_instruction *apply = (openflow13_instruction *)body;
+    apply->type = htons(OFPIT_APPLY_ACTIONS);
+    apply->len = htons(sizeof(*apply) + sizeof(openflow13_action_group));
+    apply->meter_id = 0;
+    openflow13_action_group *group = (openflow13_action_group *)(apply + 1);
+    group->type = htons(OFPAT13_GROUP);
+    group->len = htons(sizeof(*group));
+    group->group_id = htonl(group_id);
+    body = (uint8_t *)(group + 1);
+    return openflow13_finish(buf, body);
+}
+
+uint16_t openflow13_flow_mod_table_miss_message(uint8_t *buf, uint8_t version, uint32_t xid){
+    // Lowest priority and an empty match
+    uint8_t *body = openflow13_put_flow_mod(buf, version, xid, OFPFC_ADD, 0, 0);
+    openflow13_match *match = (openflow13_match *)body;
+    match->type = htons(OFPMT_OXM);
+    match->length = htons(sizeof(*match));
+    memset(match + 1, 0, OPENFLOW13_PAD8(sizeof(*match)) - sizeof(*match));
+    body += OPENFLOW13_PAD8(sizeof(*match));
+    openflow13_instruction *apply = (openflow13_instruction *)body;
+    apply->type = htons(OFPIT_APPLY_ACTIONS);
+    apply->len = htons(sizeof(*apply) + sizeof(openflow13_action_output));
+    apply->meter_id = 0;
+    openflow13_action_output *output = (openflow13_action_output *)(apply + 1);
+    memset(output, 0, sizeof(*output));
+    output->type = htons(OFPAT13_OUTPUT);
+    output->len = htons(sizeof(*output));
+    output->port = htonl(OFPP13_CONTROLLER);
+    output->max_len = htons(OPENFLOW13_MISS_SEND_LEN);
+    body = (uint8_t *)(output + 1);
+    return openflow13_finish(buf, body);
+}
+
+uint16_t openflow13_packet_out_message(uint8_t *buf, uint8_t version, uint32_t xid, uint32_t buffer_id, uint32_t in_port,
+    uint16_t vlan, uint32_t out_port, uint8_t *packet, uint16_t packet_len){
+    openflow13_put_header(buf, version, OFP_PACKET_OUT, xid);
+    openflow13_packet_out *packet_out = (openflow13_packet_out *)(buf + OFP_HEADER_LEN);
+    memset(packet_out, 0, sizeof(*packet_out));
+    packet_out->buffer_id = htonl(buffer_id);
+    packet_out->in_port = htonl(in_port);
+    uint8_t *body = (uint8_t *)(packet_out + 1);
+    uint16_t actions_len = openflow13_put_vlan_actions(body, vlan, out_port);
+    packet_out->actions_len = htons(actions_len);
+    body += actions_len;
+    if (packet && buffer_id == OFP13_NO_BUFFER){
+        memcpy(body, packet, packet_len);
+        body += packet_len;
+    }
+    return openflow13_finish(buf, body);
+}
+
+uint16_t openflow13_group_mod_message(uint8_t *buf, uint8_t version, uint32_t xid, uint16_t command, uint32_t group_id,
+    uint16_t *vlans, int nb_buckets, uint32_t out_port){
+    openflow13_put_header(buf, version, OFPT13_GROUP_MOD, xid);
+    openflow13_group_mod *group_mod = (openflow13_group_mod *)(buf + OFP_HEADER_LEN);
+    group_mod->command = htons(command);
+    group_mod->type = OFPGT_SELECT;
+    group_mod->pad = 0;
+    group_mod->group_id = htonl(group_id);
+    uint8_t *body = (uint8_t *)(group_mod + 1);
+    for (int i = 0; i < nb_buckets && command != OFPGC_DELETE; i++){
+        openflow13_bucket *bucket = (openflow13_bucket *)body;
+        memset(bucket, 0, sizeof(*bucket));
+        // Equal weights, the switch hashes the flows over the buckets
+        bucket->weight = htons(1);
+        bucket->watch_port = htonl(OFPP13_ANY);
+        bucket->watch_group = htonl(OFPG13_ANY);
+        body += sizeof(*bucket);
+        body += openflow13_put_vlan_actions(body, vlans[i], out_port);
+        bucket->len = htons(body - (uint8_t *)bucket);
+    }
+    return openflow13_finish(buf, body);
+}
+
+uint16_t openflow13_group_stats_request_message(uint8_t *buf, uint8_t version, uint32_t xid, uint32_t group_id){
+    openflow13_put_header(buf, version, OFPT13_MULTIPART_REQUEST, xid);
+    openflow13_multipart_header *multipart = (openflow13_multipart_header *)(buf + OFP_HEADER_LEN);
+    memset(multipart, 0, sizeof(*multipart));
+    multipart->type = htons(OFPMP_GROUP);
+    openflow13_group_stats_request *request = (openflow13_group_stats_request *)(multipart + 1);
+    memset(request, 0, sizeof(*request));
+    request->group_id = htonl(group_id);
+    return openflow13_finish(buf, (uint8_t *)(request + 1));
+}
+
+uint16_t openflow13_put_vlan_instructions(uint8_t *buf, uint16_t vlan, uint32_t out_port, uint32_t meter_id){
+    uint8_t *body = buf;
+    if (meter_id){
+        openflow13_instruction *meter = (openflow13_instruction *)body;
+        meter->type = htons(OFPIT_METER);
+        meter->len = htons(sizeof(*meter));
+        meter->meter_id = htonl(meter_id);
+        body += sizeof(*meter);
+    }
+    openflow13_instruction *apply = (openflow13_instruction *)body;
+    body += sizeof(*apply);
+    body += openflow13_put_vlan_actions(body, vlan, out_port);
+    apply->type = htons(OFPIT_APPLY_ACTIONS);
+    apply->len = htons(body - (uint8_t *)apply);
+    apply->meter_id = 0;
+    return body - buf;
+}
+
+uint16_t openflow13_put_vlan_actions(uint8_t *buf, uint16_t vlan, uint32_t out_port){
+    // Same actions as SET_VLAN_VID + OUTPUT in OpenFlow 1.0: push a tag, set its VID and output
+    uint8_t *body = buf;
+    openflow13_action_push *push = (openflow13_action_push *)body;
+    memset(push, 0, sizeof(*push));
+    push->type = htons(OFPAT13_PUSH_VLAN);
+    push->len = htons(sizeof(*push));
+    push->ethertype = htons(ETH_TYPE_VLAN);
+    body += sizeof(*push);
+    openflow13_action_set_field16 *set_vlan = (openflow13_action_set_field16 *)body;
+    memset(set_vlan, 0, sizeof(*set_vlan));
+    set_vlan->type = htons(OFPAT13_SET_FIELD);
+    set_vlan->len = htons(sizeof(*set_vlan));
+    set_vlan->oxm_header = htonl(OXM_HEADER(OFPXMT_VLAN_VID, 2));
+    set_vlan->value = htons(OFPVID_PRESENT | (vlan & 0x0fff));
+    body += sizeof(*set_vlan);
+    openflow13_action_output *output = (openflow13_action_output *)body;
+    memset(output, 0, sizeof(*output));
+    output->type = htons(OFPAT13_OUTPUT);
+    output->len = htons(sizeof(*output));
+    output->port = htonl(out_port);
+    output->max_len = htons(0xffff);
+    body += sizeof(*output);
+    return body - buf;
+}
+
+uint16_t openflow13_meter_mod_message(uint8_t *buf, uint8_t version, uint32_t xid, uint16_t command, uint32_t meter_id, uint32_t rate){
+    openflow13_put_header(buf, version, OFPT13_METER_MOD, xid);
+    uint8_t *body = buf + OFP_HEADER_LEN;
+    openflow13_meter_mod *meter_mod = (openflow13_meter_mod *)body;
+    meter_mod->command = htons(command);
+    meter_mod->flags = htons(OFPMF_PKTPS);
+    meter_mod->meter_id = htonl(meter_id);
+    body += sizeof(*meter_mod);
+    openflow13_meter_band_drop *band = (openflow13_meter_band_drop *)body;
+    memset(band, 0, sizeof(*band));
+    band->type = htons(OFPMBT_DROP);
+    band->len = htons(sizeof(*band));
+    band->rate = htonl(rate);
+    body += sizeof(*band);
+    return openflow13_finish(buf, body);
+}
+
+/**
+ * @brief Writes the header of a bundle message and returns where its body starts
+ */
+uint8_t *openflow13_put_bundle_header(uint8_t *buf, uint8_t version, uint32_t xid, uint8_t type14, uint32_t exp_type){
+    if (version >= OFP14_VERSION){
+        openflow13_put_header(buf, version, type14, xid);
+        return buf + OFP_HEADER_LEN;
+    }
+    openflow13_put_header(buf, version, OFPT13_EXPERIMENTER, xid);
+    openflow13_experimenter *experimenter = (openflow13_experimenter *)(buf + OFP_HEADER_LEN);
+    experimenter->experimenter = htonl(ONF_EXPERIMENTER_ID);
+    experimenter->exp_type = htonl(exp_type);
+    return buf + OFP_HEADER_LEN + sizeof(*experimenter);
+}
+
+uint16_t openflow13_bundle_ctrl_message(uint8_t *buf, uint8_t version, uint32_t xid, uint32_t bundle_id, uint16_t type, uint16_t flags){
+    uint8_t *body = openflow13_put_bundle_header(buf, version, xid, OFPT14_BUNDLE_CONTROL, ONF_ET_BUNDLE_CONTROL);
+    openflow13_bundle_ctrl *ctrl = (openflow13_bundle_ctrl *)body;
+    ctrl->bundle_id = htonl(bundle_id);
+    ctrl->type = htons(type);
+    ctrl->flags = htons(flags);
+    body += sizeof(*ctrl);
+    return openflow13_finish(buf, body);
+}
+
+uint16_t openflow13_bundle_add_message(uint8_t *buf, uint8_t version, uint32_t xid, uint32_t bundle_id, uint16_t flags, uint8_t *message, uint16_t len){
+    uint8_t *body = openflow13_put_bundle_header(buf, version, xid, OFPT14_BUNDLE_ADD_MESSAGE, ONF_ET_BUNDLE_ADD_MESSAGE);
+    openflow13_bundle_add *add = (openflow13_bundle_add *)body;
+    add->bundle_id = htonl(bundle_id);
+    add->pad = 0;
+    add->flags = htons(flags);
+    body += sizeof(*add);
+    memcpy(body, message, len);
+    body += len;
+    return openflow13_finish(buf, body);
+}
+
+openflow13_bundle_ctrl *openflow13_get_bundle_ctrl(openflow_message *message){
+    uint16_t body_len = message->header.length - OFP_HEADER_LEN;
+    if (message->header.type == OFPT14_BUNDLE_CONTROL && message->header.version >= OFP14_VERSION &&
+        body_len >= sizeof(openflow13_bundle_ctrl)){
+        return (openflow13_bundle_ctrl *)message->data;
+    }
+    if (message->header.type == OFPT13_EXPERIMENTER &&
+        body_len >= sizeof(openflow13_experimenter) + sizeof(openflow13_bundle_ctrl)){
+        openflow13_experimenter *experimenter = (openflow13_experimenter *)message->data;
+        if (ntohl(experimenter->experimenter) == ONF_EXPERIMENTER_ID && ntohl(experimenter->exp_type) == ONF_ET_BUNDLE_CONTROL){
+            return (openflow13_bundle_ctrl *)(experimenter + 1);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Reads a big endian value of `size` bytes
+ */
+uint32_t openflow13_get_value(uint8_t *value, uint8_t size){
+    uint32_t result = 0;
+    for (int i = 0; i < size && i < 4; i++){
+        result = result << 8 | value[i];
+    }
+    return result;
+}
+
+/**
+ * @brief Fills an OpenFlow 1.0 match from OXM TLVs, masked fields are ignored
+ */
+void openflow13_parse_oxm(uint8_t *oxm, uint8_t *end, openflow_match *match){
+    uint8_t five_tuple = 0;
+    match->wildcards = OFPFW10_ALL;
+    while (oxm + sizeof(uint32_t) <= end){
+        uint32_t header;
+        memcpy(&header, oxm, sizeof(header));
+        header = ntohl(header);
+        uint8_t *value = oxm + sizeof(header);
+        uint8_t size = OXM_LENGTH(header);
+        oxm = value + size;
+        if (oxm > end || OXM_CLASS(header) != OFPXMC_OPENFLOW_BASIC || OXM_HASMASK(header)){
+            continue;
+        }
+        switch (OXM_FIELD(header)){
+        case OFPXMT_IN_PORT:
+            match->in_port = openflow13_get_value(value, size);
+            match->wildcards &= ~OFPFW10_IN_PORT;
+            break;
+        case OFPXMT_ETH_TYPE:
+            match->dl_type = openflow13_get_value(value, size);
+            break;
+        case OFPXMT_VLAN_VID:
+            match->dl_vlan = openflow13_get_value(value, size) & 0x0fff;
+            break;
+        case OFPXMT_IP_PROTO:
+            match->nw_proto = openflow13_get_value(value, size);
+            five_tuple |= 1;
+            break;
+        case OFPXMT_IPV4_SRC:
+            match->nw_src = openflow13_get_value(value, size);
+            five_tuple |= 2;
+            break;
+        case OFPXMT_IPV4_DST:
+            match->nw_dst = openflow13_get_value(value, size);
+            five_tuple |= 4;
+            break;
+        case OFPXMT_TCP_SRC:
+        case OFPXMT_UDP_SRC:
+            match->tp_src = openflow13_get_value(value, size);
+            break;
+        case OFPXMT_TCP_DST:
+        case OFPXMT_UDP_DST:
+            match->tp_dst = openflow13_get_value(value, size);
+            break;
+        default:
+            break;
+        }
+    }
+    if (five_tuple == 7){
+        match->wildcards = OFPW_MATCH_FIVE_TUPLE;
+    }
+}
+
+void openflow13_parse_actions(uint8_t *action, uint8_t *end, action_descriptor *actions, uint8_t *nb_actions){
+    while (action + 4 <= end && *nb_actions < MAX_ACTIONS){
+        uint16_t type = ntohs(*(uint16_t *)action);
+        uint16_t len = ntohs(*(uint16_t *)(action + 2));
+        if (len < 8 || action + len > end){
+            return;
+        }
+        if (type == OFPAT13_OUTPUT && len >= sizeof(openflow13_action_output)){
+            openflow13_action_output output;
+            memcpy(&output, action, sizeof(output));
+            openflow_action_output *converted = malloc(sizeof(openflow_action_output));
+            converted->type = OFPAT_OUTPUT;
+            converted->len = sizeof(openflow_action_output);
+            // Reserved ports keep their low 16 bits, which are their OpenFlow 1.0 values
+            converted->port = ntohl(output.port);
+            converted->max_len = ntohs(output.max_len);
+            actions[*nb_actions].type = OFPAT_OUTPUT;
+            actions[*nb_actions].data = converted;
+            (*nb_actions)++;
+        } else if (type == OFPAT13_SET_FIELD && len >= sizeof(openflow13_action_set_field16)){
+            openflow13_action_set_field16 set_field;
+            memcpy(&set_field, action, sizeof(set_field));
+            uint32_t oxm_header = ntohl(set_field.oxm_header);
+            if (OXM_CLASS(oxm_header) == OFPXMC_OPENFLOW_BASIC && OXM_FIELD(oxm_header) == OFPXMT_VLAN_VID){
+                openflow_action_vlan_vid *converted = malloc(sizeof(openflow_action_vlan_vid));
+                converted->type = OFPAT_SET_VLAN_VID;
+                converted->len = sizeof(openflow_action_vlan_vid);
+                converted->vlan_vid = ntohs(set_field.value) & 0x0fff;
+                converted->pad[0] = converted->pad[1] = 0;
+                actions[*nb_actions].type = OFPAT_SET_VLAN_VID;
+                actions[*nb_actions].data = converted;
+                (*nb_actions)++;
+            }
+        }
+        action += len;
+    }
+}
+
+int openflow13_parse_flow_stats(uint8_t *entry, uint8_t *end, openflow_flow_stats *stats, action_descriptor *actions, uint8_t *nb_actions){
+    openflow13_flow_stats flow_stats;
+    if (end - entry < (long)sizeof(flow_stats)){
+        return -1;
+    }
+    memcpy(&flow_stats, entry, sizeof(flow_stats));
+    uint16_t length = ntohs(flow_stats.length);
+    uint8_t *entry_end = entry + length;
+    if (length < sizeof(flow_stats) || entry_end > end){
+        return -1;
+    }
+    memset(stats, 0, sizeof(*stats));
+    uint8_t *match = entry + sizeof(flow_stats);
+    int match_len = openflow13_parse_match(match, entry_end, &stats->match);
+    if (match_len < 0){
+        return -1;
+    }
+    stats->length = length;
+    stats->table_id = flow_stats.table_id;
+    stats->duration_sec = ntohl(flow_stats.duration_sec);
+    stats->duration_nsec = ntohl(flow_stats.duration_nsec);
+    stats->priority = ntohs(flow_stats.priority);
+    stats->idle_timeout = ntohs(flow_stats.idle_timeout);
+    stats->hard_timeout = ntohs(flow_stats.hard_timeout);
+    uint64_t cookie = ntohll(flow_stats.cookie);
+    uint64_t packet_count = ntohll(flow_stats.packet_count);
+    uint64_t byte_count = ntohll(flow_stats.byte_count);
+    stats->cookie.hi = cookie >> 32;
+    stats->cookie.lo = cookie & 0xFFFFFFFF;
+    stats->packet_count.hi = packet_count >> 32;
+    stats->packet_count.lo = packet_count & 0xFFFFFFFF;
+    stats->byte_count.hi = byte_count >> 32;
+    stats->byte_count.lo = byte_count & 0xFFFFFFFF;
+    openflow13_parse_instructions(match + match_len, entry_end, actions, nb_actions);
+    return length;
+}
+
+int openflow13_parse_packet_in(uint8_t *body, uint16_t body_len, uint32_t *buffer_id, uint32_t *in_port, uint8_t **packet, uint16_t *packet_len){
+    if (body_len < sizeof(openflow13_packet_in)){
+        return -1;
+    }
+    uint8_t *end = body + body_len;
+    openflow13_packet_in packet_in;
+    memcpy(&packet_in, body, sizeof(packet_in));
+    openflow_match match;
+    int match_len = openflow13_parse_match(body + sizeof(packet_in), end, &match);
+    // The packet is aligned by 2 bytes of padding after the match
+    if (match_len < 0 || body + sizeof(packet_in) + match_len + 2 > end){
+        return -1;
+    }
+    uint8_t *data = body + sizeof(packet_in) + match_len + 2;
+    *buffer_id = ntohl(packet_in.buffer_id);
+    *in_port = match.wildcards & OFPFW10_IN_PORT ? 0 : match.in_port;
+    *packet = data;
+    *packet_len = end - data;
+    return 0;
+}
+
+int openflow13_parse_group_stats(uint8_t *entry, uint8_t *end, uint32_t *group_id, uint64_t *bucket_packets, int max_buckets, int *nb_buckets){
+    openflow13_group_stats group_stats;
+    if (end - entry < (long)sizeof(group_stats)){
+        return -1;
+    }
+    memcpy(&group_stats, entry, sizeof(group_stats));
+    uint16_t length = ntohs(group_stats.length);
+    if (length < sizeof(group_stats) || entry + length > end){
+        return -1;
+    }
+    *group_id = ntohl(group_stats.group_id);
+    *nb_buckets = (length - sizeof(group_stats)) / sizeof(openflow13_bucket_counter);
+    uint8_t *counter = entry + sizeof(group_stats);
+    for (int i = 0; i < *nb_buckets && i < max_buckets; i++){
+        openflow13_bucket_counter bucket;
+        memcpy(&bucket, counter + i * sizeof(bucket), sizeof(bucket));
+        bucket_packets[i] = ntohll(bucket.packet_count);
+    }
+    return length;
+}
+
+int openflow13_parse_match(uint8_t *match, uint8_t *end, openflow_match *parsed){
+    openflow13_match match_header;
+    if (end - match < (long)sizeof(match_header)){
+        return -1;
+    }
+    memcpy(&match_header, match, sizeof(match_header));
+    uint16_t match_len = ntohs(match_header.length);
+    if (ntohs(match_header.type) != OFPMT_OXM || match_len < sizeof(match_header) || match + OPENFLOW13_PAD8(match_len) > end){
+        return -1;
+    }
+    memset(parsed, 0, sizeof(*parsed));
+    openflow13_parse_oxm(match + sizeof(match_header), match + match_len, parsed);
+    return OPENFLOW13_PAD8(match_len);
+}
+
+void openflow13_parse_instructions(uint8_t *instruction, uint8_t *end, action_descriptor *actions, uint8_t *nb_actions){
+    *nb_actions = 0;
+    while (instruction + sizeof(openflow13_instruction) <= end){
+        uint16_t type = ntohs(*(uint16_t *)instruction);
+        uint16_t len = ntohs(*(uint16_t *)(instruction + 2));
+        if (len < sizeof(openflow13_instruction) || instruction + len > end){
+            return;
+        }
+        if (type == OFPIT_APPLY_ACTIONS){
+            openflow13_parse_actions(instruction + sizeof(openflow13_instruction), instruction + len, actions, nb_actions);
+        }
+        instruction += len;
+    }
+}
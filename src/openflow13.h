@@ -0,0 +1,640 @@
+/**
+ * @file openflow13.h
+ * @brief OpenFlow 1.3 and 1.4 codec
+ *
+ * Encoders and decoders of the messages oRSS exchanges once the HELLO exchange negotiated OpenFlow
+ * 1.3 or later: OXM matches, OFPMP_FLOW multipart requests and replies, FLOW_MODs with instructions,
+ * PACKET_INs and PACKET_OUTs, METER_MODs and bundles (OFPT_BUNDLE_* in 1.4, the ONF extension in 1.3). Structures are in network
+ * byte order, encoders write whole messages (header included) into a caller buffer of at least
+ * OPENFLOW13_MAX_MESSAGE_LEN bytes (OPENFLOW13_GROUP_MOD_LEN for GROUP_MODs) and return their length.
+ *
+ * Decoded flow stats are converted to the OpenFlow 1.0 representation used by the rest of the
+ * daemon (openflow_flow_stats, OFPAT_SET_VLAN_VID and OFPAT_OUTPUT descriptors), so that callers of
+ * openflow_get_flows don't depend on the negotiated version.
+ *
+ */
+
+#ifndef OPENFLOW13_H
+#define OPENFLOW13_H
+
+#include "openflow.h"
+
+#define OFP13_VERSION 0x04
+#define OFP14_VERSION 0x05
+
+#define OPENFLOW13_MAX_MESSAGE_LEN 512
+// Buckets fitting in a GROUP_MOD
+#define OPENFLOW13_MAX_BUCKETS 1024
+
+// Message types, the ones below FLOW_MOD are the same as in OpenFlow 1.0
+#define OFPT13_ERROR 0x01
+#define OFPT13_EXPERIMENTER 0x04
+#define OFPT13_GROUP_MOD 0x0f
+#define OFPT13_MULTIPART_REQUEST 0x12
+#define OFPT13_MULTIPART_REPLY 0x13
+#define OFPT13_METER_MOD 0x1d
+#define OFPT14_BUNDLE_CONTROL 0x21
+#define OFPT14_BUNDLE_ADD_MESSAGE 0x22
+
+// HELLO elements
+#define OFPHET_VERSIONBITMAP 1
+
+#define OFPMP_FLOW 1
+#define OFPMP_GROUP 6
+#define OFPMPF_REPLY_MORE 1
+
+#define OFPP13_ANY 0xffffffff
+#define OFPG13_ANY 0xffffffff
+#define OFP13_NO_BUFFER 0xffffffff
+#define OFPP13_CONTROLLER 0xfffffffd
+// Bytes of a missed packet sent to the controller, the switch buffers the whole packet
+#define OPENFLOW13_MISS_SEND_LEN 128
+
+// OXM fields of the OpenFlow basic class
+#define OFPXMC_OPENFLOW_BASIC 0x8000
+#define OFPXMT_IN_PORT 0
+#define OFPXMT_ETH_TYPE 5
+#define OFPXMT_VLAN_VID 6
+#define OFPXMT_IP_PROTO 10
+#define OFPXMT_IPV4_SRC 11
+#define OFPXMT_IPV4_DST 12
+#define OFPXMT_TCP_SRC 13
+#define OFPXMT_TCP_DST 14
+#define OFPXMT_UDP_SRC 15
+#define OFPXMT_UDP_DST 16
+#define OXM_HEADER(field, length) ((uint32_t)OFPXMC_OPENFLOW_BASIC << 16 | (field) << 9 | (length))
+#define OXM_CLASS(header) ((header) >> 16)
+#define OXM_FIELD(header) (((header) >> 9) & 0x7f)
+#define OXM_HASMASK(header) (((header) >> 8) & 1)
+#define OXM_LENGTH(header) ((header) & 0xff)
+#define OFPMT_OXM 1
+// VLAN_VID values carry this bit when a tag is present
+#define OFPVID_PRESENT 0x1000
+
+// Instructions and actions
+#define OFPIT_APPLY_ACTIONS 4
+#define OFPIT_METER 6
+#define OFPAT13_OUTPUT 0
+#define OFPAT13_GROUP 22
+#define OFPAT13_PUSH_VLAN 17
+#define OFPAT13_SET_FIELD 25
+#define ETH_TYPE_VLAN 0x8100
+
+// Groups
+#define OFPGC_ADD 0
+#define OFPGC_MODIFY 1
+#define OFPGC_DELETE 2
+#define OFPGT_SELECT 1
+
+// Meters
+#define OFPMC_ADD 0
+#define OFPMC_MODIFY 1
+#define OFPMF_PKTPS 2
+#define OFPMF_BURST 4
+#define OFPMBT_DROP 1
+
+// Bundles
+#define OFPBCT_OPEN_REQUEST 0
+#define OFPBCT_OPEN_REPLY 1
+#define OFPBCT_COMMIT_REQUEST 4
+#define OFPBCT_COMMIT_REPLY 5
+#define OFPBF_ATOMIC 1
+#define OFPBF_ORDERED 2
+// OpenFlow 1.3 carries bundles in experimenter messages of the ONF
+#define ONF_EXPERIMENTER_ID 0x4f4e4600
+#define ONF_ET_BUNDLE_CONTROL 2300
+#define ONF_ET_BUNDLE_ADD_MESSAGE 2301
+
+struct openflow13_multipart_header {
+    uint16_t type;
+    uint16_t flags;
+    uint8_t pad[4];
+};
+
+typedef struct openflow13_multipart_header openflow13_multipart_header;
+
+/**
+ * @brief Body of an OFPMP_FLOW request, followed by a match
+ *
+ */
+struct openflow13_flow_stats_request {
+    uint8_t table_id;
+    uint8_t pad[3];
+    uint32_t out_port;
+    uint32_t out_group;
+    uint8_t pad2[4];
+    uint64_t cookie;
+    uint64_t cookie_mask;
+};
+
+typedef struct openflow13_flow_stats_request openflow13_flow_stats_request;
+
+/**
+ * @brief Entry of an OFPMP_FLOW reply, followed by a match and instructions
+ *
+ */
+struct openflow13_flow_stats {
+    uint16_t length;
+    uint8_t table_id;
+    uint8_t pad;
+    uint32_t duration_sec;
+    uint32_t duration_nsec;
+    uint16_t priority;
+    uint16_t idle_timeout;
+    uint16_t hard_timeout;
+    uint16_t flags;
+    uint16_t importance; /** OpenFlow 1.4, padding in 1.3 */
+    uint8_t pad2[2];
+    uint64_t cookie;
+    uint64_t packet_count;
+    uint64_t byte_count;
+};
+
+typedef struct openflow13_flow_stats openflow13_flow_stats;
+
+/**
+ * @brief Body of a FLOW_MOD, followed by a match and instructions
+ *
+ */
+struct openflow13_flow_mod {
+    uint64_t cookie;
+    uint64_t cookie_mask;
+    uint8_t table_id;
+    uint8_t command;
+    uint16_t idle_timeout;
+    uint16_t hard_timeout;
+    uint16_t priority;
+    uint32_t buffer_id;
+    uint32_t out_port;
+    uint32_t out_group;
+    uint16_t flags;
+    uint16_t importance; /** OpenFlow 1.4, padding in 1.3 */
+};
+
+typedef struct openflow13_flow_mod openflow13_flow_mod;
+
+/**
+ * @brief Body of a PACKET_IN, followed by a match (the ingress port), 2 bytes of padding and the packet
+ *
+ */
+struct openflow13_packet_in {
+    uint32_t buffer_id;
+    uint16_t total_len;
+    uint8_t reason;
+    uint8_t table_id;
+    uint64_t cookie;
+};
+
+typedef struct openflow13_packet_in openflow13_packet_in;
+
+/**
+ * @brief Body of a PACKET_OUT, followed by actions and, when the packet isn't buffered, the packet
+ *
+ */
+struct openflow13_packet_out {
+    uint32_t buffer_id;
+    uint32_t in_port;
+    uint16_t actions_len;
+    uint8_t pad[6];
+};
+
+typedef struct openflow13_packet_out openflow13_packet_out;
+
+/**
+ * @brief Header of a match, followed by OXM TLVs and padded to 8 bytes
+ *
+ */
+struct openflow13_match {
+    uint16_t type;
+    uint16_t length; /** Without the padding */
+};
+
+typedef struct openflow13_match openflow13_match;
+
+/**
+ * @brief Header of an instruction, APPLY_ACTIONS is followed by actions
+ *
+ */
+struct openflow13_instruction {
+    uint16_t type;
+    uint16_t len;
+    uint32_t meter_id; /** OFPIT_METER, padding for APPLY_ACTIONS */
+};
+
+typedef struct openflow13_instruction openflow13_instruction;
+
+struct openflow13_action_output {
+    uint16_t type;
+    uint16_t len;
+    uint32_t port;
+    uint16_t max_len;
+    uint8_t pad[6];
+};
+
+typedef struct openflow13_action_output openflow13_action_output;
+
+struct openflow13_action_push {
+    uint16_t type;
+    uint16_t len;
+    uint16_t ethertype;
+    uint8_t pad[2];
+};
+
+typedef struct openflow13_action_push openflow13_action_push;
+
+/**
+ * @brief SET_FIELD of a 2 bytes OXM (e.g. VLAN_VID), padded to 8 bytes
+ *
+ */
+struct openflow13_action_set_field16 {
+    uint16_t type;
+    uint16_t len;
+    uint32_t oxm_header;
+    uint16_t value;
+    uint8_t pad[6];
+} __attribute__((packed));
+
+typedef struct openflow13_action_set_field16 openflow13_action_set_field16;
+
+struct openflow13_action_group {
+    uint16_t type;
+    uint16_t len;
+    uint32_t group_id;
+};
+
+typedef struct openflow13_action_group openflow13_action_group;
+
+/**
+ * @brief Body of a GROUP_MOD, followed by buckets
+ *
+ */
+struct openflow13_group_mod {
+    uint16_t command;
+    uint8_t type;
+    uint8_t pad;
+    uint32_t group_id;
+};
+
+typedef struct openflow13_group_mod openflow13_group_mod;
+
+/**
+ * @brief Header of a bucket, followed by actions
+ *
+ */
+struct openflow13_bucket {
+    uint16_t len;
+    uint16_t weight;
+    uint32_t watch_port;
+    uint32_t watch_group;
+    uint8_t pad[4];
+};
+
+typedef struct openflow13_bucket openflow13_bucket;
+
+// Length of a bucket of openflow13_group_mod_message: PUSH_VLAN, SET_FIELD and OUTPUT
+#define OPENFLOW13_VLAN_BUCKET_LEN (sizeof(openflow13_bucket) + sizeof(openflow13_action_push) + \
+    sizeof(openflow13_action_set_field16) + sizeof(openflow13_action_output))
+#define OPENFLOW13_GROUP_MOD_LEN(nb_buckets) (OFP_HEADER_LEN + sizeof(openflow13_group_mod) + (nb_buckets) * OPENFLOW13_VLAN_BUCKET_LEN)
+
+/**
+ * @brief Body of an OFPMP_GROUP request
+ *
+ */
+struct openflow13_group_stats_request {
+    uint32_t group_id;
+    uint8_t pad[4];
+};
+
+typedef struct openflow13_group_stats_request openflow13_group_stats_request;
+
+/**
+ * @brief Entry of an OFPMP_GROUP reply, followed by a counter per bucket
+ *
+ */
+struct openflow13_group_stats {
+    uint16_t length;
+    uint8_t pad[2];
+    uint32_t group_id;
+    uint32_t ref_count;
+    uint8_t pad2[4];
+    uint64_t packet_count;
+    uint64_t byte_count;
+    uint32_t duration_sec;
+    uint32_t duration_nsec;
+};
+
+typedef struct openflow13_group_stats openflow13_group_stats;
+
+struct openflow13_bucket_counter {
+    uint64_t packet_count;
+    uint64_t byte_count;
+};
+
+typedef struct openflow13_bucket_counter openflow13_bucket_counter;
+
+struct openflow13_meter_mod {
+    uint16_t command;
+    uint16_t flags;
+    uint32_t meter_id;
+};
+
+typedef struct openflow13_meter_mod openflow13_meter_mod;
+
+struct openflow13_meter_band_drop {
+    uint16_t type;
+    uint16_t len;
+    uint32_t rate;
+    uint32_t burst_size;
+    uint8_t pad[4];
+};
+
+typedef struct openflow13_meter_band_drop openflow13_meter_band_drop;
+
+/**
+ * @brief Body of a bundle control, also the reply
+ *
+ */
+struct openflow13_bundle_ctrl {
+    uint32_t bundle_id;
+    uint16_t type;
+    uint16_t flags;
+};
+
+typedef struct openflow13_bundle_ctrl openflow13_bundle_ctrl;
+
+/**
+ * @brief Body of a bundle add, followed by the bundled message
+ *
+ */
+struct openflow13_bundle_add {
+    uint32_t bundle_id;
+    uint16_t pad;
+    uint16_t flags;
+};
+
+typedef struct openflow13_bundle_add openflow13_bundle_add;
+
+/**
+ * @brief Header of an ONF experimenter message, in OpenFlow 1.3
+ *
+ */
+struct openflow13_experimenter {
+    uint32_t experimenter;
+    uint32_t exp_type;
+};
+
+typedef struct openflow13_experimenter openflow13_experimenter;
+
+/**
+ * @brief Writes a match on the ingress port and, if `key` isn't NULL, on the IPv4 5-tuple
+ *
+ * @param buf : where to write the match
+ * @param in_port : the ingress port
+ * @param key : the 5-tuple in host byte order, NULL to match the port only
+ * @return uint16_t : length written, padding included
+ */
+uint16_t openflow13_put_match(uint8_t *buf, uint32_t in_port, struct FiveTuple *key);
+
+/**
+ * @brief Encodes an OFPMP_FLOW request for the flows coming from `in_port`, in all tables
+ *
+ * @param buf : where to write the message
+ * @param version : the negotiated version
+ * @param xid
+ * @param in_port
+ * @param cookie : only the flows whose cookie has these bits under `cookie_mask` are listed
+ * @param cookie_mask : 0 to list all the flows
+ * @return uint16_t : length of the message
+ */
+uint16_t openflow13_flow_stats_request_message(uint8_t *buf, uint8_t version, uint32_t xid, uint32_t in_port,
+    uint64_t cookie, uint64_t cookie_mask);
+
+/**
+ * @brief Encodes a FLOW_MOD tagging the flow with `vlan` and sending it to `out_port`
+ *
+ * @param buf : where to write the message
+ * @param version : the negotiated version
+ * @param xid
+ * @param command : OFPFC_MODIFY to steer an existing rule, OFPFC_ADD to install one
+ * @param priority : priority of the rule
+ * @param idle_timeout : seconds without packets before the switch removes the rule, 0 to keep it
+ * @param in_port : ingress port of the flow
+ * @param key : the flow, in host byte order
+ * @param vlan : the VLAN ID
+ * @param out_port : the output port
+ * @param meter_id : meter the flow goes through first, 0 for none
+ * @param cookie : cookie of the rule installed by OFPFC_ADD, a MODIFY keeps the cookie of the rule
+ * @return uint16_t : length of the message
+ */
+uint16_t openflow13_flow_mod_vlan_message(uint8_t *buf, uint8_t version, uint32_t xid, uint8_t command, uint16_t priority,
+    uint16_t idle_timeout, uint32_t in_port, struct FiveTuple *key, uint16_t vlan, uint32_t out_port, uint32_t meter_id,
+    uint64_t cookie);
+
+/**
+ * @brief Encodes a FLOW_MOD adding a rule that sends the IPv4 traffic of `in_port` to a group
+ *
+ * @param buf : where to write the message
+ * @param version : the negotiated version
+ * @param xid
+ * @param in_port : the ingress port
+ * @param priority : priority of the rule
+ * @param group_id : the group
+ * @return uint16_t : length of the message
+ */
+uint16_t openflow13_flow_mod_group_message(uint8_t *buf, uint8_t version, uint32_t xid, uint32_t in_port, uint16_t priority, uint32_t group_id);
+
+/**
+ * @brief Encodes a FLOW_MOD adding the table-miss rule: the packets matching no rule are buffered and sent to
+ * the controller in a PACKET_IN
+ *
+ * @param buf : where to write the message
+ * @param version : the negotiated version
+ * @param xid
+ * @return uint16_t : length of the message
+ */
+uint16_t openflow13_flow_mod_table_miss_message(uint8_t *buf, uint8_t version, uint32_t xid);
+
+/**
+ * @brief Encodes a PACKET_OUT tagging a packet with `vlan` and sending it to `out_port`
+ *
+ * @param buf : where to write the message, at least OPENFLOW13_MAX_MESSAGE_LEN + packet_len bytes
+ * @param version : the negotiated version
+ * @param xid
+ * @param buffer_id : the packet buffered by the switch, OFP13_NO_BUFFER to send `packet`
+ * @param in_port : ingress port of the packet
+ * @param vlan : the VLAN ID
+ * @param out_port : the output port
+ * @param packet : the packet when it isn't buffered, NULL otherwise
+ * @param packet_len
+ * @return uint16_t : length of the message
+ */
+uint16_t openflow13_packet_out_message(uint8_t *buf, uint8_t version, uint32_t xid, uint32_t buffer_id, uint32_t in_port,
+    uint16_t vlan, uint32_t out_port, uint8_t *packet, uint16_t packet_len);
+
+/**
+ * @brief Encodes a GROUP_MOD of a select group whose bucket `i` tags with `vlans[i]` and sends to `out_port`
+ *
+ * @param buf : where to write the message, at least OPENFLOW13_GROUP_MOD_LEN(nb_buckets) bytes
+ * @param version : the negotiated version
+ * @param xid
+ * @param command : OFPGC_ADD, OFPGC_MODIFY or OFPGC_DELETE (without buckets)
+ * @param group_id
+ * @param vlans : the VLAN of each bucket
+ * @param nb_buckets : at most OPENFLOW13_MAX_BUCKETS
+ * @param out_port : the output port
+ * @return uint16_t : length of the message
+ */
+uint16_t openflow13_group_mod_message(uint8_t *buf, uint8_t version, uint32_t xid, uint16_t command, uint32_t group_id,
+    uint16_t *vlans, int nb_buckets, uint32_t out_port);
+
+/**
+ * @brief Encodes an OFPMP_GROUP request for a group
+ *
+ * @param buf : where to write the message
+ * @param version : the negotiated version
+ * @param xid
+ * @param group_id
+ * @return uint16_t : length of the message
+ */
+uint16_t openflow13_group_stats_request_message(uint8_t *buf, uint8_t version, uint32_t xid, uint32_t group_id);
+
+/**
+ * @brief Writes the PUSH_VLAN, SET_FIELD(VLAN_VID) and OUTPUT actions of a flow or bucket
+ *
+ * @param buf : where to write the actions
+ * @param vlan : the VLAN ID
+ * @param out_port : the output port
+ * @return uint16_t : length written
+ */
+uint16_t openflow13_put_vlan_actions(uint8_t *buf, uint16_t vlan, uint32_t out_port);
+
+/**
+ * @brief Writes the instructions of openflow13_flow_mod_vlan_message, also used in flow stats entries
+ *
+ * @param buf : where to write the instructions
+ * @param vlan : the VLAN ID
+ * @param out_port : the output port
+ * @param meter_id : meter the flow goes through first, 0 for none
+ * @return uint16_t : length written
+ */
+uint16_t openflow13_put_vlan_instructions(uint8_t *buf, uint16_t vlan, uint32_t out_port, uint32_t meter_id);
+
+/**
+ * @brief Encodes a METER_MOD with a single drop band
+ *
+ * @param buf : where to write the message
+ * @param version : the negotiated version
+ * @param xid
+ * @param command : OFPMC_ADD or OFPMC_MODIFY
+ * @param meter_id
+ * @param rate : packets per second above which packets are dropped
+ * @return uint16_t : length of the message
+ */
+uint16_t openflow13_meter_mod_message(uint8_t *buf, uint8_t version, uint32_t xid, uint16_t command, uint32_t meter_id, uint32_t rate);
+
+/**
+ * @brief Encodes a bundle control, as OFPT_BUNDLE_CONTROL in 1.4 and as an ONF experimenter message in 1.3
+ *
+ * @param buf : where to write the message
+ * @param version : the negotiated version
+ * @param xid
+ * @param bundle_id
+ * @param type : OFPBCT_*
+ * @param flags : OFPBF_*
+ * @return uint16_t : length of the message
+ */
+uint16_t openflow13_bundle_ctrl_message(uint8_t *buf, uint8_t version, uint32_t xid, uint32_t bundle_id, uint16_t type, uint16_t flags);
+
+/**
+ * @brief Encodes a bundle add carrying `message`
+ *
+ * @param buf : where to write the message
+ * @param version : the negotiated version
+ * @param xid
+ * @param bundle_id
+ * @param flags : OFPBF_*, the same as the bundle
+ * @param message : the bundled message, header included, at most OPENFLOW13_MAX_MESSAGE_LEN - 32 bytes
+ * @param len : its length
+ * @return uint16_t : length of the message
+ */
+uint16_t openflow13_bundle_add_message(uint8_t *buf, uint8_t version, uint32_t xid, uint32_t bundle_id, uint16_t flags, uint8_t *message, uint16_t len);
+
+/**
+ * @brief Decodes the bundle control of a reply (OFPT_BUNDLE_CONTROL or ONF experimenter message)
+ *
+ * @param message : the reply
+ * @return openflow13_bundle_ctrl* : the bundle control in network byte order, NULL if the message isn't one
+ */
+openflow13_bundle_ctrl *openflow13_get_bundle_ctrl(openflow_message *message);
+
+/**
+ * @brief Decodes an OXM match into the OpenFlow 1.0 representation, in host byte order. The wildcards
+ * are OFPW_MATCH_FIVE_TUPLE when the match holds an IPv4 5-tuple.
+ *
+ * @param match : start of the match
+ * @param end : end of the enclosing message
+ * @param parsed : the match to fill
+ * @return int : length of the match, padding included, -1 if it is malformed
+ */
+int openflow13_parse_match(uint8_t *match, uint8_t *end, openflow_match *parsed);
+
+/**
+ * @brief Converts the APPLY_ACTIONS instructions to OpenFlow 1.0 descriptors: SET_FIELD of VLAN_VID to
+ * OFPAT_SET_VLAN_VID and OUTPUT to OFPAT_OUTPUT, other actions are skipped. Descriptors are malloc'ed.
+ *
+ * @param instruction : start of the instructions
+ * @param end : end of the instructions
+ * @param actions : filled with up to MAX_ACTIONS descriptors
+ * @param nb_actions : filled with the number of actions
+ */
+void openflow13_parse_instructions(uint8_t *instruction, uint8_t *end, action_descriptor *actions, uint8_t *nb_actions);
+
+/**
+ * @brief Converts actions to OpenFlow 1.0 descriptors, like openflow13_parse_instructions
+ *
+ * @param action : start of the actions
+ * @param end : end of the actions
+ * @param actions : filled with up to MAX_ACTIONS descriptors, after the `*nb_actions` first ones
+ * @param nb_actions : incremented by the number of actions
+ */
+void openflow13_parse_actions(uint8_t *action, uint8_t *end, action_descriptor *actions, uint8_t *nb_actions);
+
+/**
+ * @brief Decodes the body of a PACKET_IN
+ *
+ * @param body : the body, after the header
+ * @param body_len
+ * @param buffer_id : filled with the buffer of the packet on the switch, OFP13_NO_BUFFER if it isn't buffered
+ * @param in_port : filled with the ingress port, 0 if the match has none
+ * @param packet : filled with the start of the packet (at most OPENFLOW13_MISS_SEND_LEN bytes when buffered)
+ * @param packet_len : filled with the bytes of the packet in the message
+ * @return int : 0 on success, -1 if the message is malformed
+ */
+int openflow13_parse_packet_in(uint8_t *body, uint16_t body_len, uint32_t *buffer_id, uint32_t *in_port, uint8_t **packet, uint16_t *packet_len);
+
+/**
+ * @brief Decodes an entry of an OFPMP_GROUP reply
+ *
+ * @param entry : start of the entry
+ * @param end : end of the reply
+ * @param group_id : filled with the group of the entry
+ * @param bucket_packets : filled with the packets of each bucket, in host byte order
+ * @param max_buckets : size of bucket_packets, other buckets are ignored
+ * @param nb_buckets : filled with the number of buckets of the entry
+ * @return int : length of the entry, -1 if it is malformed
+ */
+int openflow13_parse_group_stats(uint8_t *entry, uint8_t *end, uint32_t *group_id, uint64_t *bucket_packets, int max_buckets, int *nb_buckets);
+
+/**
+ * @brief Decodes an entry of an OFPMP_FLOW reply into the OpenFlow 1.0 representation
+ *
+ * @param entry : start of the entry
+ * @param end : end of the reply
+ * @param stats : filled in host byte order, with the IPv4 5-tuple of the match
+ * @param actions : filled with up to MAX_ACTIONS OFPAT_SET_VLAN_VID and OFPAT_OUTPUT descriptors
+ * @param nb_actions : filled with the number of actions
+ * @return int : length of the entry, -1 if it is malformed
+ */
+int openflow13_parse_flow_stats(uint8_t *entry, uint8_t *end, openflow_flow_stats *stats, action_descriptor *actions, uint8_t *nb_actions);
+
+#endif
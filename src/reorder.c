@@ -0,0 +1,85 @@
+#include "reorder.h"
+
+void reorder_init(struct ReorderBuffer *buffer){
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->flows = calloc(REORDER_MAX_FLOWS, sizeof(struct ReorderFlow));
+}
+
+uint64_t reorder_now_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+struct ReorderFlow *reorder_find(struct ReorderBuffer *buffer, struct FiveTuple *key){
+    for (int i = 0; i < buffer->nb_flows; i++){
+        if (five_tuple_equals(&buffer->flows[i].key, key)){
+            return &buffer->flows[i];
+        }
+    }
+    return NULL;
+}
+
+struct ReorderFlow *reorder_begin(struct ReorderBuffer *buffer, struct FiveTuple *key, int old_core, uint64_t drain_mark, uint64_t now_ns){
+    if (buffer->nb_flows == REORDER_MAX_FLOWS){
+        buffer->untracked_migrations++;
+        return NULL;
+    }
+    struct ReorderFlow *flow = &buffer->flows[buffer->nb_flows++];
+    flow->key = *key;
+    flow->old_core = old_core;
+    flow->drain_mark = drain_mark;
+    flow->deadline_ns = now_ns + REORDER_DEADLINE_US * 1000ULL;
+    flow->nb_packets = 0;
+    return flow;
+}
+
+/**
+ * @brief Releases the packets of the flow at `flow_idx` in order and frees its slot
+ */
+void reorder_release(struct ReorderBuffer *buffer, int flow_idx, reorder_release_fn release, void *ctx){
+    struct ReorderFlow *flow = &buffer->flows[flow_idx];
+    for (int i = 0; i < flow->nb_packets; i++){
+        release(&flow->packets[i], ctx);
+    }
+    buffer->nb_flows--;
+    if (flow_idx != buffer->nb_flows){
+        buffer->flows[flow_idx] = buffer->flows[buffer->nb_flows];
+    }
+}
+
+int reorder_hold(struct ReorderBuffer *buffer, struct ReorderFlow *flow, struct ReorderPacket *packet, reorder_release_fn release, void *ctx){
+    if (flow->nb_packets == REORDER_MAX_PACKETS){
+        // Can't wait longer without dropping, give up on ordering for this flow
+        buffer->overflows++;
+        reorder_release(buffer, flow - buffer->flows, release, ctx);
+        release(packet, ctx);
+        return 1;
+    }
+    flow->packets[flow->nb_packets++] = *packet;
+    buffer->held_packets++;
+    return 0;
+}
+
+void reorder_poll(struct ReorderBuffer *buffer, uint64_t now_ns, reorder_drained_fn drained, reorder_release_fn release, void *ctx){
+    int i = 0;
+    while (i < buffer->nb_flows){
+        struct ReorderFlow *flow = &buffer->flows[i];
+        if (drained(flow, ctx)){
+            buffer->reorders_avoided += flow->nb_packets;
+        } else if (now_ns >= flow->deadline_ns){
+            buffer->deadline_expirations++;
+        } else {
+            i++;
+            continue;
+        }
+        // The released flow is replaced by the last one, check the same index again
+        reorder_release(buffer, i, release, ctx);
+    }
+}
+
+void reorder_destroy(struct ReorderBuffer *buffer){
+    free(buffer->flows);
+    buffer->flows = NULL;
+    buffer->nb_flows = 0;
+}
@@ -0,0 +1,127 @@
+/**
+ * @file reorder.h
+ * @brief Reordering stage for migrated flows
+ *
+ * When a flow is migrated, packets already queued on its old core can be overtaken by the packets
+ * reaching the new core. The new core buffers the packets of the flow until the old core signals
+ * it drained everything queued before the migration, or until a short deadline passes.
+ * Memory is bounded: at most `REORDER_MAX_FLOWS` flows and `REORDER_MAX_PACKETS` packets per flow.
+ *
+ */
+
+#ifndef REORDER_H
+#define REORDER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "env.h"
+#include "hashmap.h"
+
+/**
+ * @brief A buffered packet, the buffer only stores its location
+ *
+ */
+struct ReorderPacket {
+    uint64_t addr;
+    uint32_t len;
+};
+
+/**
+ * @brief A flow in migration and its buffered packets
+ *
+ */
+struct ReorderFlow {
+    struct FiveTuple key;
+    int old_core;
+    uint64_t drain_mark; /** Progress the old core has to reach to be drained */
+    uint64_t deadline_ns; /** Monotonic time at which the flow is released anyway */
+    int nb_packets;
+    struct ReorderPacket packets[REORDER_MAX_PACKETS];
+};
+
+struct ReorderBuffer {
+    int nb_flows;
+    struct ReorderFlow *flows;
+    // Counters
+    uint64_t reorders_avoided; /** Packets released in order after the old core drained */
+    uint64_t deadline_expirations; /** Flows released because the old core didn't drain in time */
+    uint64_t overflows; /** Flows released because their buffer was full */
+    uint64_t untracked_migrations; /** Migrations that couldn't be buffered because all flow slots were used */
+    uint64_t held_packets; /** Packets that went through the buffer */
+};
+
+/**
+ * @brief Returns 1 if the old core of the flow processed everything queued before the migration
+ */
+typedef uint8_t (*reorder_drained_fn)(struct ReorderFlow *flow, void *ctx);
+
+/**
+ * @brief Processes a packet leaving the buffer
+ */
+typedef void (*reorder_release_fn)(struct ReorderPacket *packet, void *ctx);
+
+/**
+ * @brief Allocates the flow slots
+ *
+ * @param buffer : the buffer to initialize
+ */
+void reorder_init(struct ReorderBuffer *buffer);
+
+/**
+ * @brief Returns the monotonic time in nanoseconds, the clock used for deadlines
+ */
+uint64_t reorder_now_ns();
+
+/**
+ * @brief Returns the flow if it is currently buffered, NULL otherwise
+ *
+ * @param buffer
+ * @param key : the flow to look for
+ */
+struct ReorderFlow *reorder_find(struct ReorderBuffer *buffer, struct FiveTuple *key);
+
+/**
+ * @brief Starts buffering a migrated flow
+ *
+ * @param buffer
+ * @param key : the migrated flow
+ * @param old_core : the core the flow was migrated from
+ * @param drain_mark : progress the old core has to reach to be drained
+ * @param now_ns : current time, from reorder_now_ns
+ * @return struct ReorderFlow* : the buffered flow, NULL if there is no free slot (the migration is then not ordered)
+ */
+struct ReorderFlow *reorder_begin(struct ReorderBuffer *buffer, struct FiveTuple *key, int old_core, uint64_t drain_mark, uint64_t now_ns);
+
+/**
+ * @brief Buffers a packet of a flow in migration. If the flow buffer is full, the buffered packets
+ * are released first and the packet is released right after them.
+ *
+ * @param buffer
+ * @param flow : the flow, as returned by reorder_begin or reorder_find
+ * @param packet : the packet to buffer
+ * @param release : called for each released packet, in order
+ * @param ctx : passed to release
+ * @return int : 0 if the packet was buffered, 1 if the flow was released
+ */
+int reorder_hold(struct ReorderBuffer *buffer, struct ReorderFlow *flow, struct ReorderPacket *packet, reorder_release_fn release, void *ctx);
+
+/**
+ * @brief Releases the flows whose old core drained or whose deadline passed
+ *
+ * @param buffer
+ * @param now_ns : current time, from reorder_now_ns
+ * @param drained : tells whether the old core of a flow drained
+ * @param release : called for each released packet, in order
+ * @param ctx : passed to drained and release
+ */
+void reorder_poll(struct ReorderBuffer *buffer, uint64_t now_ns, reorder_drained_fn drained, reorder_release_fn release, void *ctx);
+
+/**
+ * @brief Frees the flow slots, buffered packets are dropped
+ *
+ * @param buffer
+ */
+void reorder_destroy(struct ReorderBuffer *buffer);
+
+#endif
@@ -1,7 +1,8 @@
 #include "ringbuffer.h"
 
-struct RingBuffer *ringbuffer_init(){
-    struct RingBuffer* new_buf = calloc(1, sizeof(struct RingBuffer));
+struct RingBuffer *ringbuffer_init(int capacity){
+    struct RingBuffer* new_buf = calloc(1, sizeof(struct RingBuffer) + capacity * sizeof(uint64_t));
+    new_buf->capacity = capacity;
     // new_buf->assigned_core = rand() % NB_CORES; // Assign a random core to the flow
     new_buf->assigned_core = 0;
     return new_buf;
@@ -12,22 +13,44 @@ void ringbuffer_destroy(struct RingBuffer *rb){
 }
 
 void ringbuffer_add(struct RingBuffer *rb, uint64_t value){
-    int last_pos = rb->pos;
-    rb->pos = (rb->pos + 1) % RING_SIZE;
-    int new_pos = rb->pos;
-    // Add value to ring buffer
-    if (rb->size == 0){
-        rb->buffer[new_pos] = value;
-    } else {
-        rb->buffer[new_pos] = value - rb->buffer[last_pos];
-    }
+    rb->pos = (rb->pos + 1) % rb->capacity;
+    rb->buffer[rb->pos] = value;
     // Update size
-    if (rb->size < RING_SIZE){
+    if (rb->size < rb->capacity){
         rb->size++;
     }
     rb->is_active = 1;
 }
 
+uint8_t ringbuffer_add_sample(struct RingBuffer *rb, struct FlowSample *sample){
+    uint8_t first = rb->sample_ns == 0;
+    uint8_t reset = !first && (sample->packets < rb->packets || sample->bytes < rb->bytes ||
+        (sample->age_ns && rb->age_ns && sample->age_ns < rb->age_ns));
+    uint64_t packets = sample->packets;
+    uint64_t bytes = sample->bytes;
+    uint64_t interval_ns;
+    if (first || reset){
+        // Counted since the flow was created, less than an interval ago if its age is unknown
+        interval_ns = sample->age_ns ? sample->age_ns : (first ? 0 : sample->time_ns - rb->sample_ns);
+    } else {
+        packets -= rb->packets;
+        bytes -= rb->bytes;
+        interval_ns = sample->age_ns && rb->age_ns ? sample->age_ns - rb->age_ns : sample->time_ns - rb->sample_ns;
+    }
+    rb->packets = sample->packets;
+    rb->bytes = sample->bytes;
+    rb->sample_ns = sample->time_ns ? sample->time_ns : 1;
+    rb->age_ns = sample->age_ns;
+    rb->is_active = 1;
+    if (interval_ns == 0){
+        // No time elapsed, or nothing to compare the counters to
+        return reset;
+    }
+    rb->byte_rate = bytes * 1e9 / interval_ns;
+    ringbuffer_add(rb, packets * 1e9 / interval_ns);
+    return reset;
+}
+
 uint64_t ringbuffer_get_last(struct RingBuffer *rb){
     if (rb->size == 0){
         return 0;
@@ -44,9 +67,9 @@ uint64_t ringbuffer_get_average(struct RingBuffer *rb, int count) {
     int pos = rb->pos;
     while (i < count && i < rb->size){
         sum += rb->buffer[pos];
-        pos = (pos - 1) % RING_SIZE;
+        pos = (pos - 1) % rb->capacity;
         if (pos < 0){
-            pos = RING_SIZE - 1;
+            pos = rb->capacity - 1;
         }
         i++;
     }
@@ -13,15 +13,30 @@ struct RingBuffer {
     uint8_t assigned_core; // Each ringbuffer corresponds to a flow, and each flow is assigned to a core
     int pos; // The position of the current element
     int size; // The number of elements in the buffer
-    uint64_t buffer[RING_SIZE];
+    int capacity; // The maximum number of elements in the buffer
     uint8_t is_active;
+    // Last sample of the flow counters, the rates are computed against it
+    uint64_t packets; // Raw packet counter
+    uint64_t bytes; // Raw byte counter
+    uint64_t sample_ns; // Monotonic time of the sample, 0 before the first one
+    uint64_t age_ns; // Age of the counters reported with the sample, 0 if unknown
+    uint64_t byte_rate; // Bytes per second between the last two samples
+    uint64_t buffer[]; // Packets per second between consecutive samples
+};
+
+// Counters of a flow, as read from the switch or the XDP program
+struct FlowSample {
+    uint64_t packets; // Raw counters, growing since the flow was created
+    uint64_t bytes;
+    uint64_t time_ns; // Monotonic time the counters were read at
+    uint64_t age_ns; // Time since the counters were created (duration of an OpenFlow rule), 0 if unknown
 };
 
 /* Initialize ringbuffer
 Parameters:
-    ringbuffer* rb: pointer to ringbuffer
+    int capacity: maximum number of elements kept in the buffer
 */
-struct RingBuffer * ringbuffer_init();
+struct RingBuffer * ringbuffer_init(int capacity);
 
 /* Free ringbuffer
 Parameters:
@@ -36,6 +51,18 @@ Parameters:
 */
 void ringbuffer_add(struct RingBuffer *rb, uint64_t value);
 
+/* Account a new sample of the flow counters: the packet rate since the previous sample is added to the
+ringbuffer and the byte rate kept in `byte_rate`. The interval is the difference of the counter ages when
+both samples have one, the difference of their timestamps otherwise. Counters lower than at the previous
+sample, or younger than the previous ones, mean the switch re-created the flow: the rates are then computed
+from the new counters alone. A first sample without age only sets the reference of the next one.
+Parameters:
+    ringbuffer* rb: pointer to ringbuffer
+    struct FlowSample* sample: counters of the flow
+Returns 1 if the counters were reset since the previous sample, 0 otherwise
+*/
+uint8_t ringbuffer_add_sample(struct RingBuffer *rb, struct FlowSample *sample);
+
 /* Get last element from ringbuffer
 Parameters:
     ringbuffer* rb: pointer to ringbuffer
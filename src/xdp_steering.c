@@ -0,0 +1,34 @@
+#include "xdp_steering.h"
+
+int xdp_steering_init(struct XdpSteering *steering, struct XdpProgram *prog, int nb_cores){
+    steering->flow_cores_fd = load_bpf_map_fd(prog, "flow_cores");
+    steering->cpu_map_fd = load_bpf_map_fd(prog, "cpu_map");
+    if (steering->flow_cores_fd < 0 || steering->cpu_map_fd < 0){
+        return -1;
+    }
+    if (XDP_STEER_ACTION == XDP_STEER_CPUMAP){
+        struct bpf_cpumap_val value = {0};
+        value.qsize = XDP_CPUMAP_QSIZE;
+        for (uint32_t core = 0; core < nb_cores; core++){
+            if (bpf_map_update_elem(steering->cpu_map_fd, &core, &value, BPF_ANY)){
+                printf("Could not create cpumap entry for core %u\n", core);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int xdp_steering_assign(struct XdpSteering *steering, struct FiveTuple *key, uint32_t core){
+    struct FiveTuple xdp_key = load_bpf_xdp_key(key);
+    if (bpf_map_update_elem(steering->flow_cores_fd, &xdp_key, &core, BPF_ANY)){
+        printf("Could not assign flow to core %u\n", core);
+        return -1;
+    }
+    return 0;
+}
+
+void xdp_steering_remove(struct XdpSteering *steering, struct FiveTuple *key){
+    struct FiveTuple xdp_key = load_bpf_xdp_key(key);
+    bpf_map_delete_elem(steering->flow_cores_fd, &xdp_key);
+}
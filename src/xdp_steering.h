@@ -0,0 +1,50 @@
+/**
+ * @file xdp_steering.h
+ * @brief Flow to core steering applied by xdp_rx (STEERING_XDP mode)
+ *
+ * Instead of sending a FLOW_MOD to OVS for every migration, assignments are written into the
+ * `flow_cores` BPF map and xdp_rx tags (or redirects) the frames itself.
+ *
+ */
+
+#ifndef XDP_STEERING_H
+#define XDP_STEERING_H
+
+#include "load_bpf.h"
+#include "hashmap.h"
+
+struct XdpSteering {
+    int flow_cores_fd;
+    int cpu_map_fd;
+};
+
+/**
+ * @brief Retrieves the steering maps of the loaded program and, in XDP_STEER_CPUMAP mode,
+ * creates one cpumap entry per core
+ *
+ * @param steering : the structure to fill
+ * @param prog : the loaded XDP program
+ * @param nb_cores : the number of cores flows are steered to, at most MAX_CORES
+ * @return int : 0 on success, -1 otherwise
+ */
+int xdp_steering_init(struct XdpSteering *steering, struct XdpProgram *prog, int nb_cores);
+
+/**
+ * @brief Assigns a flow to a core, this is the whole cost of a migration
+ *
+ * @param steering
+ * @param key : the flow, as stored in the flow table
+ * @param core : the destination core
+ * @return int : 0 on success, -1 otherwise
+ */
+int xdp_steering_assign(struct XdpSteering *steering, struct FiveTuple *key, uint32_t core);
+
+/**
+ * @brief Forgets the assignment of a flow, its frames are forwarded untouched again
+ *
+ * @param steering
+ * @param key : the flow, as stored in the flow table
+ */
+void xdp_steering_remove(struct XdpSteering *steering, struct FiveTuple *key);
+
+#endif